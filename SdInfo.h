@@ -57,6 +57,8 @@ enum {
     SD_CARD_ERROR_INIT_NOT_CALLED,  // "Card has not been initialized"
     SD_CARD_ERROR_INVALID_CARD_CONFIG,  // "Invalid card config"
     SD_CARD_ERROR_FUNCTION_NOT_SUPPORTED,  // "Unsupported SDIO command"
+    SD_CARD_ERROR_PROBE,  // "Sector reads back different at every clock"
+    SD_CARD_ERROR_NO_SECTOR,  // "Sector is past the end of the file"
     SD_CARD_ERROR_UNKNOWN
 };
 
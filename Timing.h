@@ -10,7 +10,6 @@
 #ifndef TIMING_H_
 #define TIMING_H_
 
-#include <msp430.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
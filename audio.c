@@ -0,0 +1,80 @@
+/*
+ * audio.c
+ *
+ *  IMA ADPCM decoder.  The predictor works in 16 bits like any other IMA
+ *  decoder; only the top 6 make it to the DAC.
+ */
+
+#include "audio.h"
+
+const uint16_t audio_steps[AUDIO_MAX_INDEX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t audio_index_adjust[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/*
+ * Apply one code to the decoder state, returning the DAC sample.
+ */
+#pragma CODE_SECTION (decode_sample, ".TI.ramfunc")
+static inline uint8_t decode_sample(uint8_t code, int32_t *predictor, int16_t *index) {
+    uint16_t step = audio_steps[*index];
+    uint16_t diff = step >> 3;
+
+    if (code & 4) {
+        diff += step;
+    }
+    if (code & 2) {
+        diff += step >> 1;
+    }
+    if (code & 1) {
+        diff += step >> 2;
+    }
+    if (code & 8) {
+        *predictor -= diff;
+        if (*predictor < INT16_MIN) {
+            *predictor = INT16_MIN;
+        }
+    } else {
+        *predictor += diff;
+        if (*predictor > INT16_MAX) {
+            *predictor = INT16_MAX;
+        }
+    }
+    *index += audio_index_adjust[code & 7];
+    if (*index < 0) {
+        *index = 0;
+    } else if (*index > AUDIO_MAX_INDEX) {
+        *index = AUDIO_MAX_INDEX;
+    }
+    return (uint16_t)(*predictor - INT16_MIN) >> 10;
+}
+
+/**
+ * Runs once per sample, so it lives in SRAM like the video decoder.
+ */
+#pragma CODE_SECTION (audio_decode, ".TI.ramfunc")
+void audio_decode(const uint8_t *block, uint8_t *samples, uint16_t count) {
+    int32_t predictor = (int16_t)(block[0] | (block[1] << 8));
+    int16_t index = block[2];
+    const uint8_t *codes = block + AUDIO_BLOCK_HEADER;
+    const uint8_t *end = codes + count / 2;
+
+    // A damaged header shouldn't be able to index off the end of the table
+    if (index > AUDIO_MAX_INDEX) {
+        index = AUDIO_MAX_INDEX;
+    }
+    while (codes < end) {
+        uint8_t c = *codes++;
+        *samples++ = decode_sample(c & 0x0F, &predictor, &index);
+        *samples++ = decode_sample(c >> 4, &predictor, &index);
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * audio.h
+ *
+ *  How a frame's audio is stored on the card: 4-bit IMA ADPCM, half the
+ *  size of the raw 6-bit samples the PWM DAC wants.  convert.py (and
+ *  host/encode.c) write it, audio_decode() turns it back into samples.
+ */
+
+#ifndef AUDIO_H_
+#define AUDIO_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The most samples a frame can carry (44.1 kHz / 30 fps).  The header
+// sector (container.h) says how many there really are.
+#define AUDIO_FRAME_SIZE 1470
+
+/*
+ * One frame's audio block:
+ *   [0]     predictor at the start of the frame, signed 16 bits, little endian
+ *   [2]     step index at the start of the frame (0..AUDIO_MAX_INDEX)
+ *   [3]     unused, 0
+ *   [4]     one 4-bit code per sample, first sample in the low nibble
+ * The encoder carries its state on from frame to frame; the header just
+ * means each frame can be decoded on its own, so seeking works.
+ */
+#define AUDIO_BLOCK_HEADER 4
+#define AUDIO_BLOCK_BYTES(samples) (AUDIO_BLOCK_HEADER + (samples) / 2)
+#define AUDIO_BLOCK_SIZE AUDIO_BLOCK_BYTES(AUDIO_FRAME_SIZE)
+#define AUDIO_MAX_INDEX 88
+
+// Shared with the encoder
+extern const uint16_t audio_steps[AUDIO_MAX_INDEX + 1];
+extern const int8_t audio_index_adjust[8];
+
+/**
+ * Decode an audio block of `count` samples (even) into 6-bit samples for
+ * the DAC.
+ */
+void audio_decode(const uint8_t *block, uint8_t *samples, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* AUDIO_H_ */
@@ -0,0 +1,129 @@
+/*
+ * cardtest.c
+ *
+ *  Card tester, see cardtest.h.
+ */
+
+#include "cardtest.h"
+#include "sdcard.h"
+#include "jitter.h"
+#include "hal.h"
+#include <string.h>
+
+// Far too big for SRAM
+struct cardtest_results __attribute__((persistent)) cardtest_results = { 0 };
+
+static void count(struct cardtest_histogram *h, uint32_t us) {
+    if (us < h->min_us) {
+        h->min_us = us;
+    }
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+    h->total_us += us;
+    h->bins[cardtest_bin(us)]++;
+}
+
+/*
+ * Put the sector sd_timing has just timed in the sweep's histograms, and
+ * among its slowest if it's slow enough.
+ */
+static void record(struct cardtest_sweep *sweep, uint32_t sector) {
+    struct cardtest_sector *slot = &sweep->worst[0];
+    uint32_t token = sd_timing.token - sd_timing.asked, transfer = sd_timing.done - sd_timing.token;
+    uint8_t i;
+
+    count(&sweep->token, token);
+    count(&sweep->transfer, transfer);
+    if (sweep->count < CARDTEST_WORST) {
+        slot = &sweep->worst[sweep->count];
+    } else {
+        // Take the place of the quickest of the slowest
+        for (i = 1; i < CARDTEST_WORST; i++) {
+            if (sweep->worst[i].token_us < slot->token_us) {
+                slot = &sweep->worst[i];
+            }
+        }
+        if (token <= slot->token_us) {
+            slot = NULL;
+        }
+    }
+    sweep->count++;
+    if (slot) {
+        slot->sector = sector;
+        slot->token_us = token;
+        slot->transfer_us = transfer;
+    }
+}
+
+static void start(struct cardtest_sweep *sweep, uint32_t first, uint32_t span) {
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->first = first;
+    sweep->span = span;
+    sweep->token.min_us = sweep->transfer.min_us = UINT32_MAX;
+}
+
+/*
+ * A read failed: note why, and whether that's too many in a row.
+ */
+static bool failed(struct cardtest_sweep *sweep, uint8_t *in_a_row) {
+    sweep->errors++;
+    cardtest_results.error = sd_errorCode;
+    if (++*in_a_row < CARDTEST_ERRORS_IN_A_ROW) {
+        return true;
+    }
+    cardtest_results.flags |= CARDTEST_GAVE_UP;
+    return false;
+}
+
+bool cardtest_run(uint32_t span) {
+    struct cardtest_sweep *sweep;
+    // Nothing's playing, so the jitter buffer's free to read into
+    uint8_t *buf = jitter_frame(0);
+    uint32_t n, sector, random = 0x2545F491;
+    uint8_t in_a_row = 0;
+
+    memset(&cardtest_results, 0, sizeof(cardtest_results));
+    cardtest_results.magic = CARDTEST_MAGIC;
+    cardtest_results.card_type = sd_cardType;
+
+    // One long stream, like the player's
+    sweep = &cardtest_results.sweeps[CARDTEST_SWEEP_SEQUENTIAL];
+    start(sweep, 0, MIN(CARDTEST_SEQUENTIAL, span));
+    for (n = 0; n < sweep->span; n++) {
+        if (!sd_stream_read(n, buf)) {
+            if (!failed(sweep, &in_a_row)) {
+                // Don't leave the card streaming (or the bus to it)
+                sd_stream_stop();
+                return false;
+            }
+            continue;
+        }
+        in_a_row = 0;
+        record(sweep, n);
+    }
+    sd_stream_stop();
+
+    // Single sectors all over the place (xorshift32, so every run reads
+    // the same ones)
+    sweep = &cardtest_results.sweeps[CARDTEST_SWEEP_RANDOM];
+    start(sweep, 0, span);
+    in_a_row = 0;
+    for (n = 0; n < CARDTEST_RANDOM; n++) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        sector = random % span;
+        if (!sd_read_block(sector, buf)) {
+            if (!failed(sweep, &in_a_row)) {
+                return false;
+            }
+            continue;
+        }
+        in_a_row = 0;
+        record(sweep, sector);
+    }
+
+    cardtest_results.flags |= CARDTEST_DONE;
+    return true;
+}
@@ -0,0 +1,134 @@
+/*
+ * cardtest.h
+ *
+ *  Card tester, for qualifying SD cards and sizing the jitter buffer
+ *  (jitter.h) from measurements rather than guesses.  Built with CARDTEST
+ *  defined, the firmware doesn't play anything: once the card's up it
+ *  reads a long run of sectors one after the other (CMD18, the way the
+ *  player streams) and then single sectors all over the card (CMD17),
+ *  timing every one with hal_micros():
+ *
+ *      token       from asking for the sector (its command, or the last
+ *                  sector of the stream coming in) to its start token
+ *      transfer    from the start token to the last byte of its CRC
+ *
+ *  Each of those goes into a histogram per sweep, along with the slowest
+ *  sectors, in cardtest_results in FRAM.  It halts with sd_errorCode of
+ *  the last read that failed (0 if none did) for the debugger to dump
+ *  cardtest_results; host/cardview turns a dump into a report.
+ *
+ *  The host backend runs the same code against the emulated card, with
+ *  whatever latencies it's told to inject (cardview -c).
+ */
+
+#ifndef CARDTEST_H_
+#define CARDTEST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sectors read one after the other, from sector 0 (4MB)
+#ifndef CARDTEST_SEQUENTIAL
+#define CARDTEST_SEQUENTIAL 8192UL
+#endif
+// Sectors read one at a time from all over the card
+#ifndef CARDTEST_RANDOM
+#define CARDTEST_RANDOM 1024UL
+#endif
+// How much of the card the random reads cover, in sectors (1GB, the
+// smallest card anyone still sells)
+#ifndef CARDTEST_SPAN
+#define CARDTEST_SPAN 2097152UL
+#endif
+// Reads in a row that can fail before a sweep's given up on
+#define CARDTEST_ERRORS_IN_A_ROW 16
+
+// Histogram bins: four to an octave of microseconds, up to 2^25us
+#define CARDTEST_BINS 96
+// Slowest sectors kept, by token time
+#define CARDTEST_WORST 16
+
+#define CARDTEST_MAGIC 0x4354
+#define CARDTEST_DONE 0x0001
+#define CARDTEST_GAVE_UP 0x0002 // a sweep stopped early on read errors
+
+enum {
+    CARDTEST_SWEEP_SEQUENTIAL,
+    CARDTEST_SWEEP_RANDOM,
+    CARDTEST_SWEEPS
+};
+
+// Every field is on its own alignment, so a dump from the board reads
+// straight into the same struct on the host
+struct cardtest_histogram {
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t total_us;
+    uint32_t bins[CARDTEST_BINS];
+};
+
+struct cardtest_sector {
+    uint32_t sector;
+    uint32_t token_us;
+    uint32_t transfer_us;
+};
+
+struct cardtest_sweep {
+    uint32_t first;         // sector it started at (sequential), or 0
+    uint32_t span;          // sectors it was asked to cover
+    uint32_t count;         // sectors read
+    uint32_t errors;        // reads that failed
+    struct cardtest_histogram token;
+    struct cardtest_histogram transfer;
+    struct cardtest_sector worst[CARDTEST_WORST]; // in no particular order
+};
+
+struct cardtest_results {
+    uint16_t magic;         // CARDTEST_MAGIC once started
+    uint16_t flags;
+    uint16_t error;         // sd_errorCode of the last read that failed
+    uint8_t card_type;      // sd_cardType
+    uint8_t reserved;
+    struct cardtest_sweep sweeps[CARDTEST_SWEEPS];
+};
+
+extern struct cardtest_results cardtest_results;
+
+/**
+ * Run both sweeps on the card (sd_init() done), the random one over the
+ * first `span` sectors.  Returns false if one gave up on read errors.
+ */
+bool cardtest_run(uint32_t span);
+
+/**
+ * The histogram bin `us` falls in.
+ */
+static inline uint8_t cardtest_bin(uint32_t us) {
+    uint8_t top = 0, bin;
+
+    if (us < 4) {
+        return us;
+    }
+    while (us >> (top + 1)) {
+        top++;
+    }
+    // The octave, then the two bits under its top one
+    bin = 4 * (top - 1) + ((us >> (top - 2)) & 3);
+    return bin < CARDTEST_BINS ? bin : CARDTEST_BINS - 1;
+}
+
+/**
+ * The fewest microseconds that go in `bin`.
+ */
+static inline uint32_t cardtest_bin_floor(uint8_t bin) {
+    return bin < 4 ? bin : (uint32_t)(4 + bin % 4) << (bin / 4 - 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CARDTEST_H_ */
@@ -0,0 +1,79 @@
+/*
+ * container.c
+ *
+ *  Header sector, see container.h.
+ */
+
+#include <string.h>
+#include "sdcard.h"
+#include "video.h"
+#include "audio.h"
+#include "container.h"
+
+uint8_t __attribute__((persistent)) container_header[CONTAINER_SIZE] = { 0 };
+struct container_format container;
+
+uint16_t container_get16(uint16_t offset) {
+    return container_header[offset] | (unsigned int)container_header[offset + 1] << 8;
+}
+
+uint32_t container_get32(uint16_t offset) {
+    return container_get16(offset) | (uint32_t)container_get16(offset + 2) << 16;
+}
+
+/*
+ * Whether block 0 of a card without a header starts with a frame: a
+ * length in sectors that fits a frame, the next one's, and an audio block
+ * header.  Raw packed pixels straight off, as the original images start,
+ * next to never pass for that.
+ */
+static bool container_frame_first() {
+    const uint8_t *audio = container_header + FRAME_AUDIO_OFFSET;
+    uint8_t sectors = container_header[FRAME_SECTORS_OFFSET];
+    uint8_t next = container_header[FRAME_NEXT_SECTORS_OFFSET];
+    uint8_t most = (FRAME_MAX_SIZE + CONTAINER_SIZE - 1) / CONTAINER_SIZE;
+
+    return (uint16_t)sectors * CONTAINER_SIZE >= FRAME_VIDEO_OFFSET + VIDEO_LINES && sectors <= most
+            && next <= most && audio[2] <= AUDIO_MAX_INDEX && audio[3] == 0;
+}
+
+bool container_load() {
+    uint8_t i;
+
+    for (i = 0; !sd_stream_read(CONTAINER_BLOCK, container_header); i++) {
+        if (i == SD_READ_RETRIES) {
+            return false;
+        }
+    }
+    if (memcmp(container_header, CONTAINER_MAGIC, 4) == 0) {
+        container.version = container_get16(CONTAINER_VERSION_OFFSET);
+        container.lines = container_get16(CONTAINER_LINES_OFFSET);
+        container.line_pixels = container_get16(CONTAINER_LINE_PIXELS_OFFSET);
+        container.sample_rate = container_get16(CONTAINER_SAMPLE_RATE_OFFSET);
+        container.frame_samples = container_get16(CONTAINER_FRAME_SAMPLES_OFFSET);
+        container.first_block = CONTAINER_BLOCK + 1;
+    } else {
+        // From before there was a header
+        container.version = container_frame_first() ? 0 : CONTAINER_VERSION_RAW;
+        container.lines = VIDEO_LINES;
+        container.line_pixels = VIDEO_LINE_PIXELS;
+        container.sample_rate = CONTAINER_DEFAULT_SAMPLE_RATE;
+        container.frame_samples = AUDIO_FRAME_SIZE;
+        container.first_block = CONTAINER_BLOCK;
+    }
+    container.audio_block_size = AUDIO_BLOCK_HEADER + container.frame_samples / 2;
+    container.video_offset = FRAME_AUDIO_OFFSET + container.audio_block_size;
+    return true;
+}
+
+bool container_playable() {
+    return container.version <= CONTAINER_VERSION
+            && container.lines == VIDEO_LINES
+            && container.line_pixels == VIDEO_LINE_PIXELS
+            && container.sample_rate != 0
+            && container.frame_samples != 0
+            && container.frame_samples <= AUDIO_FRAME_SIZE
+            && container.frame_samples % 2 == 0
+            // The frame timer counts 1us ticks in 16 bits
+            && (uint32_t)container.frame_samples * 1000000 / container.sample_rate < UINT16_MAX;
+}
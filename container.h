@@ -0,0 +1,96 @@
+/*
+ * container.h
+ *
+ *  The header sector at the front of the card, which says what's in the
+ *  frames after it: the format version, the picture's geometry, and the
+ *  audio rate and samples per frame, which set both timers (the frame
+ *  timer runs at one frame of samples).  The seek index (seek.h) fills
+ *  the rest of the sector.  convert.py (and host/encode.c) write it, the
+ *  player reads it once at startup (container_load()).
+ *
+ *  Every frame then starts with its own length, and the next frame's, in
+ *  sectors (video.h), so each read is exactly as long as the frame.
+ */
+
+#ifndef CONTAINER_H_
+#define CONTAINER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The header sector, block 0, numbers little endian:
+ *   [0]     "BAPL"
+ *   [4]     format version (16 bits)
+ *   [6]     display lines per frame (16 bits)
+ *   [8]     pixels per line (16 bits)
+ *   [10]    audio sample rate, Hz (16 bits)
+ *   [12]    audio samples per frame (16 bits, even)
+ *   [14]    0 (16 bits)
+ *   [16]    seek index (seek.h)
+ * The first frame follows, at block 1.
+ *
+ * An image from before there was a header, but with frames as video.h
+ * has them, starts straight off with a frame at block 0: it's version 0,
+ * and the format the player was built for (VIDEO_LINES lines, 44.1 kHz,
+ * AUDIO_FRAME_SIZE samples a frame).  One of the original images, raw
+ * packed frames one after the other, has no frame header at block 0 to
+ * find: it's CONTAINER_VERSION_RAW, and can't be played.
+ */
+#define CONTAINER_BLOCK 0
+#define CONTAINER_SIZE 512
+#define CONTAINER_MAGIC "BAPL"
+#define CONTAINER_VERSION 1
+#define CONTAINER_VERSION_RAW 0xFFFF
+#define CONTAINER_VERSION_OFFSET 4
+#define CONTAINER_LINES_OFFSET 6
+#define CONTAINER_LINE_PIXELS_OFFSET 8
+#define CONTAINER_SAMPLE_RATE_OFFSET 10
+#define CONTAINER_FRAME_SAMPLES_OFFSET 12
+#define CONTAINER_INDEX_OFFSET 16
+
+#define CONTAINER_DEFAULT_SAMPLE_RATE 44100
+
+struct container_format {
+    uint16_t version;
+    uint16_t lines;
+    uint16_t line_pixels;
+    uint16_t sample_rate;
+    uint16_t frame_samples;
+    uint16_t audio_block_size;  // a frame's ADPCM block (audio.h)
+    uint16_t video_offset;      // where a frame's video starts (video.h)
+    uint32_t first_block;
+};
+
+// Straight out of the header sector, in FRAM
+extern uint8_t container_header[CONTAINER_SIZE];
+extern struct container_format container;
+
+/**
+ * Read the header sector off the card into `container`.  Only fails if
+ * the card does.
+ */
+bool container_load();
+
+/**
+ * Whether this build can play what the header describes: a version it
+ * knows, the display's geometry, and no more than AUDIO_FRAME_SIZE
+ * samples a frame, lasting no more than 65ms.
+ */
+bool container_playable();
+
+/**
+ * Little endian numbers out of the header sector, which is only byte
+ * aligned.
+ */
+uint16_t container_get16(uint16_t offset);
+uint32_t container_get32(uint16_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CONTAINER_H_ */
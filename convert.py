@@ -6,21 +6,250 @@ import numpy as np
 import wave
 
 OUTPUT_SIZE = (160, 128)
+# Every frame is padded out to a whole number of SD card sectors, so the
+# player can DMA each sector straight into place without a bounce buffer.
+SECTOR_SIZE = 512
+# Display lines per frame, and packed bytes per line
+LINES = OUTPUT_SIZE[0]
+LINE_BYTES = OUTPUT_SIZE[1] // 8
+FPS = 30
+# Audio rate, and samples per frame: one frame's worth.  Both go in the
+# header, and the player runs its timers off them
+SAMPLE_RATE = 44100
+AUDIO_SIZE = SAMPLE_RATE // FPS
+
+def clean_lines(video, prev):
+    """Bitmap of the lines of `video` that are the same as in `prev`, MSB first.
+
+    The player doesn't send those lines to the display at all.  With no
+    previous frame nothing is clean."""
+    if prev is None:
+        return bytes(LINES // 8)
+    same = np.all(np.frombuffer(video, dtype=np.uint8).reshape(LINES, LINE_BYTES)
+                  == np.frombuffer(prev, dtype=np.uint8).reshape(LINES, LINE_BYTES), axis=1)
+    return np.packbits(same).tobytes()
+
+# Run-length code for the video lines, see video.h
+RLE_RUN = 0x80
+RLE_WHITE = 0x40
+RLE_MAX_RUN = 64
+RLE_MAX_LINE = 1 + LINE_BYTES
+
+def run_at(pixels, p):
+    """Length of the run of same-coloured pixels starting at `p`, up to RLE_MAX_RUN."""
+    r = 1
+    while p + r < len(pixels) and r < RLE_MAX_RUN and pixels[p + r] == pixels[p]:
+        r += 1
+    return r
+
+def encode_line(line):
+    """Run-length code one line of packed pixels.
+
+    Keep this in step with encode_line() in host/encode.c."""
+    pixels = np.unpackbits(np.frombuffer(line, dtype=np.uint8))
+    width = len(pixels)
+    codes = bytearray()
+    p = 0
+    while p < width:
+        r = run_at(pixels, p)
+        if r >= 8 or p + 8 > width:
+            codes.append(RLE_RUN | (RLE_WHITE if pixels[p] else 0) | (r - 1))
+            p += r
+        else:
+            # Pack pixels up until the next run worth coding as one
+            q = p + 8
+            while q + 8 <= width and run_at(pixels, q) < 8:
+                q += 8
+            codes.append((q - p) // 8 - 1)
+            codes += np.packbits(pixels[p:q]).tobytes()
+            p = q
+    if len(codes) > RLE_MAX_LINE:
+        # The whole line as one literal
+        return bytes([LINE_BYTES - 1]) + bytes(line)
+    return bytes(codes)
+
+# 4-bit IMA ADPCM for the audio, see audio.h
+ADPCM_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+ADPCM_INDEX_ADJUST = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+class AudioEncoder:
+    """Codes 8-bit unsigned samples a frame at a time, carrying the
+    predictor on from one frame to the next.
+
+    Keep this in step with encode_audio() in host/encode.c."""
+
+    def __init__(self):
+        self.predictor = 0
+        self.index = 0
+
+    def sample(self, sample):
+        delta = sample - self.predictor
+        step = ADPCM_STEPS[self.index]
+        diff = step >> 3
+        code = 0
+        if delta < 0:
+            code = 8
+            delta = -delta
+        if delta >= step:
+            code |= 4
+            delta -= step
+            diff += step
+        step >>= 1
+        if delta >= step:
+            code |= 2
+            delta -= step
+            diff += step
+        step >>= 1
+        if delta >= step:
+            code |= 1
+            diff += step
+        if code & 8:
+            self.predictor = max(self.predictor - diff, -32768)
+        else:
+            self.predictor = min(self.predictor + diff, 32767)
+        self.index = min(max(self.index + ADPCM_INDEX_ADJUST[code & 7], 0), len(ADPCM_STEPS) - 1)
+        return code
+
+    def encode(self, audio):
+        """One frame's audio block: the decoder state it starts from, then a nibble per sample."""
+        block = bytearray(self.predictor.to_bytes(2, "little", signed=True))
+        block += bytes([self.index, 0])
+        for lo, hi in zip(audio[0::2], audio[1::2]):
+            block.append(self.sample((lo - 128) * 256) | self.sample((hi - 128) * 256) << 4)
+        return bytes(block)
+
+def encode_frame(video, audio, prev, audio_encoder):
+    """Everything in a frame after its sector counts: clean-line map, audio, coded lines.
+
+    `audio` is 8-bit unsigned samples, straight out of the WAV."""
+    # The end of the song can come up short; pad it with silence
+    audio = audio.ljust(AUDIO_SIZE, bytes([0x80]))
+    lines = [encode_line(video[i * LINE_BYTES:(i + 1) * LINE_BYTES]) for i in range(LINES)]
+    return clean_lines(video, prev) + audio_encoder.encode(audio) + b"".join(lines)
+
+def frame_sectors(body):
+    return -(-(2 + len(body)) // SECTOR_SIZE)
+
+# Header in the first sector, see container.h, ending with the seek index,
+# see seek.h
+CONTAINER_MAGIC = b"BAPL"
+CONTAINER_VERSION = 1
+CONTAINER_INDEX_OFFSET = 16
+SEEK_MAX_CHAPTERS = 8
+SEEK_ENTRY_TABLE_OFFSET = CONTAINER_INDEX_OFFSET + 16 + SEEK_MAX_CHAPTERS * 8
+SEEK_MAX_ENTRIES = (SECTOR_SIZE - SEEK_ENTRY_TABLE_OFFSET) // 4
+
+def container_header(blocks, chapters):
+    """The header sector, given the block every frame starts at and the
+    first frame of every chapter.
+
+    Keep this in step with write_header() in host/encode.c."""
+    interval = FPS
+    while -(-len(blocks) // interval) > SEEK_MAX_ENTRIES:
+        interval += FPS
+    entries = blocks[::interval]
+    index = bytearray(CONTAINER_MAGIC)
+    for n in (CONTAINER_VERSION, LINES, OUTPUT_SIZE[1], SAMPLE_RATE, AUDIO_SIZE, 0):
+        index += n.to_bytes(2, "little")
+    index += len(blocks).to_bytes(4, "little")
+    index += interval.to_bytes(2, "little") + len(entries).to_bytes(2, "little")
+    index += bytes([len(chapters)]) + bytes(7)
+    for frame in chapters:
+        index += frame.to_bytes(4, "little") + blocks[frame].to_bytes(4, "little")
+    index += bytes(SEEK_ENTRY_TABLE_OFFSET - len(index))
+    for block in entries:
+        index += block.to_bytes(4, "little")
+    return bytes(index.ljust(SECTOR_SIZE, b"\0"))
+
+class FrameWriter:
+    """Writes frames zero padded to a sector boundary, each one starting
+    with its length in sectors and the length of the one after it.  That
+    means holding on to every frame until the next one turns up.
+
+    The first sector is left for the header, which is filled in once we
+    know where every frame went."""
+
+    def __init__(self, binary_output):
+        self.binary_output = binary_output
+        self.pending = None
+        self.blocks = []
+        self.chapters = []
+        self.next_block = 1
+        binary_output.write(bytes(SECTOR_SIZE))
+
+    def chapter(self):
+        """Start a new chapter with the next frame."""
+        if len(self.chapters) < SEEK_MAX_CHAPTERS:
+            self.chapters.append(len(self.blocks))
+
+    def write(self, body):
+        if self.pending is not None:
+            self.flush(frame_sectors(body))
+        self.pending = body
+        self.blocks.append(self.next_block)
+        self.next_block += frame_sectors(body)
+
+    def flush(self, next_sectors):
+        size = 2 + len(self.pending)
+        self.binary_output.write(bytes([frame_sectors(self.pending), next_sectors]))
+        self.binary_output.write(self.pending)
+        self.binary_output.write(bytes(-size % SECTOR_SIZE))
+        self.pending = None
+
+    def close(self):
+        # The last frame has no next one
+        if self.pending is not None:
+            self.flush(0)
+        self.binary_output.seek(0)
+        self.binary_output.write(container_header(self.blocks, self.chapters))
+        self.binary_output.seek(0, 2)
+
+# Videos to put on the card, one after the other, each its own chapter for
+# the seek buttons: the video, and its sound as PCM 8-bit unsigned mono at SAMPLE_RATE
+VIDEOS = [
+    ("lagtrain.mp4", "lagtrain-encoded.wav"),
+]
 
 ### Bad Apple encoding script ###
 def main():
-    # Open the video file
-    cap = cv2.VideoCapture("lagtrain.mp4")
     # Open the output badapple-encoded.mp4 file, using H.265 compression
     out = cv2.VideoWriter("lagtrain-encoded.mp4", cv2.VideoWriter_fourcc(*"hev1"), 30, OUTPUT_SIZE)
-    # Open the output badapple-encoded.wav file, using PCM 8-bit unsigned mono, 44100 Hz
-    wav = wave.open("lagtrain-encoded.wav", 'rb')
     # open output binary file for writing
-    binary_output = open("lagtrain-encoded.bin", "wb")
+    binary_output = open("lagtrain-encoded.bin", "w+b")
+    writer = FrameWriter(binary_output)
+    audio_encoder = AudioEncoder()
     frame_prev = None
 
     i = 0
+    for video, sound in VIDEOS:
+        writer.chapter()
+        # Open the video and its sound
+        cap = cv2.VideoCapture(video)
+        wav = wave.open(sound, 'rb')
+        frame_prev, i, done = encode_video(cap, wav, writer, audio_encoder, out, frame_prev, i)
+        cap.release()
+        if done:
+            break
+
+    print()
+    # Close the video files
+    out.release()
+    writer.close()
+    binary_output.close()
 
+def encode_video(cap, wav, writer, audio_encoder, out, frame_prev, i):
+    """Encode one video onto the end of the card.  Returns the last frame,
+    the frame count so far, and whether we were told to stop."""
     # Loop through the video
     while cap.isOpened():
         # Read the next frame
@@ -43,24 +272,20 @@ def main():
 
         # Write the frame to the output file, converting back to BGR for compatibility
         out.write(cv2.cvtColor(resized, cv2.COLOR_GRAY2BGR))
-        # Write the compressed frame to the binary file
-        binary_output.write(squished)
-        # Grab 33ms of audio, then bitshift it down to fit w/ our 6-bit dac
-        audio = wav.readframes(44100 // 30)
-        audio = np.frombuffer(audio, dtype=np.uint8) >> 2
-        # Write the audio to the binary file
-        binary_output.write(audio.tobytes())
+        # Grab 33ms of audio.  The player's ADPCM decoder scales it down to
+        # fit our 6-bit dac.
+        audio = wav.readframes(AUDIO_SIZE)
+        # Write the compressed frame and its audio to the binary file
+        body = encode_frame(squished, audio, frame_prev, audio_encoder)
+        writer.write(body)
 
         # This video is 15fps, so grab another audio frame and duplicate the video frame
-        audio = wav.readframes(44100 // 30)
-        audio = np.frombuffer(audio, dtype=np.uint8) >> 2
-        binary_output.write(squished)
-        binary_output.write(audio.tobytes())
-        
-        print(len(squished), len(audio.tobytes()), end=', ')
+        audio = wav.readframes(AUDIO_SIZE)
+        # The second copy of the frame doesn't change a single line
+        writer.write(encode_frame(squished, audio, squished, audio_encoder))
 
         # Print out progress bar and frame size
-        print(f"Frame {i}, frame size: {len(squished)}, audio size {44100 // 30}, total frame size {len(squished) + 44100//30}", end="\r")
+        print(f"Frame {i}, frame size: {len(body)}, {frame_sectors(body)} sectors", end="\r")
         i += 1
 
         # Save the current frame for the next frame
@@ -70,13 +295,9 @@ def main():
         cv2.imshow("frame", cv2.resize(resized, (640, 480), interpolation=cv2.INTER_NEAREST))
         # Wait for 1ms, or until a key is pressed
         if cv2.waitKey(1) & 0xFF == ord('q'):
-            break
+            return frame_prev, i, True
 
-    print()
-    # Close the video files
-    cap.release()
-    out.release()
-    binary_output.close()
+    return frame_prev, i, False
 
 
 if __name__ == "__main__":
@@ -0,0 +1,101 @@
+/*
+ * dac.c
+ *
+ *  Sample ring for the PWM DAC, see dac.h.
+ */
+
+#include <string.h>
+#include "hal.h"
+#include "dac.h"
+
+// In FRAM with the frame buffers: there's no room for it in SRAM
+uint8_t __attribute__((persistent)) dac_ring[DAC_RING_SIZE] = { 0 };
+
+uint16_t dac_underruns = 0;
+uint16_t dac_overruns = 0;
+int16_t dac_lead = 0;
+int16_t dac_min_lead = INT16_MAX;
+
+// Counted in frames since the DMA started at the top of the ring: the
+// next one to queue, and the first one not yet silenced since it played
+static uint32_t next_frame = 0, silenced = 0;
+// Frames queued (or dropped) so far.  next_frame - queued is how far
+// underruns and overruns have moved the sound against the picture.
+static uint32_t queued = 0;
+static bool running = false;
+// Samples in every frame, so in every slot
+static uint16_t frame_samples = AUDIO_FRAME_SIZE;
+
+static inline uint8_t *slot(uint32_t frame) {
+    return dac_ring + (frame % DAC_RING_FRAMES) * frame_samples;
+}
+
+void dac_init(uint16_t samples) {
+    frame_samples = samples;
+    memset(dac_ring, DAC_SILENCE, sizeof(dac_ring));
+    next_frame = silenced = queued = 0;
+    running = false;
+    dac_underruns = dac_overruns = 0;
+    dac_lead = 0;
+    dac_min_lead = INT16_MAX;
+}
+
+void dac_start() {
+    hal_audio_start(dac_ring, DAC_RING_FRAMES * frame_samples);
+    running = true;
+}
+
+void dac_queue(const uint8_t *block) {
+    uint32_t played = hal_audio_position();
+    uint32_t playing = played / frame_samples;
+    int32_t lead = (int32_t)(next_frame * frame_samples - played);
+
+    queued++;
+
+    dac_lead = lead < INT16_MIN ? INT16_MIN : lead;
+    if (running && dac_lead < dac_min_lead) {
+        dac_min_lead = dac_lead;
+    }
+    if (lead < 0) {
+        // The DMA got to this frame's slot first.  Whatever it's playing
+        // now is stale: quieten the rest of it and the gap after it, and
+        // start again far enough behind it.
+        dac_underruns++;
+        for (next_frame = playing; next_frame <= playing + DAC_LATENCY_FRAMES; next_frame++) {
+            memset(slot(next_frame), DAC_SILENCE, frame_samples);
+        }
+    } else if (next_frame >= playing + DAC_RING_FRAMES) {
+        // Every other slot is still waiting to be played
+        dac_overruns++;
+        return;
+    }
+    audio_decode(block, slot(next_frame), frame_samples);
+    next_frame++;
+
+    // Silence whatever's been played since last time, short of the slots
+    // that have been queued into again
+    if (silenced + DAC_RING_FRAMES < next_frame) {
+        silenced = next_frame - DAC_RING_FRAMES;
+    }
+    for (; silenced < playing; silenced++) {
+        memset(slot(silenced), DAC_SILENCE, frame_samples);
+    }
+}
+
+void dac_requeue(const uint8_t *block) {
+    if (next_frame == 0) {
+        return;
+    }
+    if (!running || next_frame - 1 > hal_audio_position() / frame_samples) {
+        audio_decode(block, slot(next_frame - 1), frame_samples);
+    }
+}
+
+int32_t dac_sync_error(uint32_t frame) {
+    int32_t ring_frame = (int32_t)(frame + (next_frame - queued)) - DAC_LATENCY_FRAMES;
+
+    if (!running) {
+        return 0;
+    }
+    return ring_frame * frame_samples - (int32_t)hal_audio_position();
+}
@@ -0,0 +1,87 @@
+/*
+ * dac.h
+ *
+ *  Sample ring for the PWM DAC.  Decoded audio goes into a ring of
+ *  DAC_RING_FRAMES frame-sized slots that DMA0 loops over by itself
+ *  (repeated single transfers, hal_audio_start()), so the DAC never stops
+ *  or restarts when a frame is late.
+ *
+ *  The DMA starts DAC_LATENCY_FRAMES frames after the video, so the
+ *  audio for the frame after next is normally queued a frame and a bit
+ *  ahead of the DMA: one frame can take twice as long as it should
+ *  without the sound noticing.
+ *
+ *  The player queues each frame's audio into the slot after the last one
+ *  (dac_queue()).  If the DMA has already got there, that's an underrun:
+ *  what's left of the slot playing is a gap, and the frame goes in far
+ *  enough after it to get the latency back.  Slots the DMA has finished
+ *  with are silenced, so falling behind sounds like a gap rather than a
+ *  stutter of old audio.  If the ring is full the frame is dropped (an
+ *  overrun).
+ */
+
+#ifndef DAC_H_
+#define DAC_H_
+
+#include <stdint.h>
+#include "audio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames of decoded samples in the ring, room for as many samples as a
+// frame can have
+#define DAC_RING_FRAMES 4
+#define DAC_RING_SIZE (DAC_RING_FRAMES * AUDIO_FRAME_SIZE)
+// Frames the sound starts behind the picture
+#define DAC_LATENCY_FRAMES 1
+// Mid-scale for the 6-bit DAC
+#define DAC_SILENCE 32
+
+extern uint8_t dac_ring[DAC_RING_SIZE];
+
+// How close to the edge we've been, for the debugger (and the host
+// backend's report).  The lead is how many samples ahead of the DMA the
+// last frame was queued; negative if it was late.
+extern uint16_t dac_underruns;
+extern uint16_t dac_overruns;
+extern int16_t dac_lead;
+extern int16_t dac_min_lead;
+
+/**
+ * Silence the ring and start queueing from the top of it, with `samples`
+ * samples a frame (no more than AUDIO_FRAME_SIZE).
+ */
+void dac_init(uint16_t samples);
+
+/**
+ * Start the DMA looping over the ring.  The player calls this on the
+ * DAC_LATENCY_FRAMES'th frame tick.
+ */
+void dac_start();
+
+/**
+ * Decode a frame's audio block (audio.h) into the next slot of the ring.
+ */
+void dac_queue(const uint8_t *block);
+
+/**
+ * Decode `block` over the last frame queued instead, if the DMA hasn't
+ * started on it yet.  For a seek, where the picture that audio went with
+ * is never shown.
+ */
+void dac_requeue(const uint8_t *block);
+
+/**
+ * How far ahead of its sound video frame `frame` would be if it went up
+ * now, in samples; negative if it's behind.  Frames are numbered in the
+ * order their audio was queued, and are meant to go up
+ * DAC_LATENCY_FRAMES before their sound plays.  0 until the DMA starts.
+ */
+int32_t dac_sync_error(uint32_t frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* DAC_H_ */
@@ -5,62 +5,114 @@ import zlib
 import numpy as np
 import wave
 
+# What an image from before there was a header holds (see container.h)
 OUTPUT_SIZE = (160, 128)
+SAMPLE_RATE = 44100
 AUDIO_SIZE = 44100 // 30
-VIDEO_SIZE = 160 * 128 // 8
-FRAME_SIZE = AUDIO_SIZE + VIDEO_SIZE
+# Frame layout, see video.h: two sector counts, the clean-line map (which
+# we don't need - every frame has all of its lines), audio, then video
+SECTOR_SIZE = 512
+CLEAN_MAP_SIZE = 160 // 8
+AUDIO_OFFSET = 2 + CLEAN_MAP_SIZE
+RLE_RUN = 0x80
+RLE_WHITE = 0x40
+
+# 4-bit IMA ADPCM, see audio.h
+ADPCM_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+ADPCM_INDEX_ADJUST = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+def decode_audio(block):
+    """Decode a frame's ADPCM block into the 6-bit samples the player's DAC gets."""
+    predictor = int.from_bytes(block[0:2], "little", signed=True)
+    index = min(block[2], len(ADPCM_STEPS) - 1)
+    samples = bytearray()
+    for byte in block[4:]:
+        for code in (byte & 0x0F, byte >> 4):
+            step = ADPCM_STEPS[index]
+            diff = step >> 3
+            if code & 4:
+                diff += step
+            if code & 2:
+                diff += step >> 1
+            if code & 1:
+                diff += step >> 2
+            predictor = max(predictor - diff, -32768) if code & 8 else min(predictor + diff, 32767)
+            index = min(max(index + ADPCM_INDEX_ADJUST[code & 7], 0), len(ADPCM_STEPS) - 1)
+            samples.append((predictor + 32768) >> 10)
+    return bytes(samples)
+
+def decode_line(data, pos, width):
+    """Decode the run-length coded line at data[pos], returning its pixels and where the next one starts."""
+    pixels = []
+    while len(pixels) < width:
+        code = data[pos]
+        pos += 1
+        if code & RLE_RUN:
+            pixels += [1 if code & RLE_WHITE else 0] * ((code & (RLE_WHITE - 1)) + 1)
+        else:
+            pixels += list(np.unpackbits(np.frombuffer(data[pos:pos + code + 1], dtype=np.uint8)))
+            pos += code + 1
+    return np.array(pixels, dtype=np.uint8), pos
+
+def read_header(f):
+    """The picture size, sample rate and samples per frame out of the header
+    sector (see container.h), leaving `f` at the first frame."""
+    header = f.read(SECTOR_SIZE)
+    if header[0:4] != b"BAPL":
+        f.seek(0)
+        return OUTPUT_SIZE, SAMPLE_RATE, AUDIO_SIZE
+    version, lines, pixels, rate, samples = (int.from_bytes(header[i:i + 2], "little") for i in range(4, 14, 2))
+    if version != 1:
+        raise ValueError(f"container version {version}")
+    return (lines, pixels), rate, samples
 
 ### Verify correct encoding by decoding the file
 def main():
     i = 0
     # Open the encoded file
     with open("lagtrain-encoded.bin", "rb") as f:
+        size, rate, samples = read_header(f)
+        audio_block_size = 4 + samples // 2
+        video_offset = AUDIO_OFFSET + audio_block_size
         while True:
+            # The first sector says how long the rest of the frame is
+            data = f.read(SECTOR_SIZE)
+            if len(data) < SECTOR_SIZE:
+                break
+            sectors, next_sectors = data[0], data[1]
+            data += f.read((sectors - 1) * SECTOR_SIZE)
+
             # Frame container
-            frame = np.zeros(OUTPUT_SIZE, dtype=np.uint8)
-            for r in range(OUTPUT_SIZE[0]):
-                # Read a single row
-                row = f.read(OUTPUT_SIZE[1] // 8)
-                # Convert to np bitarray
-                row = np.unpackbits(np.frombuffer(row, dtype=np.uint8))
-                # Add to frame
-                frame[r] = row
-            # Read audio
-            audio = f.read(AUDIO_SIZE)
-            # Discard.
+            frame = np.zeros(size, dtype=np.uint8)
+            pos = video_offset
+            for r in range(size[0]):
+                # Decode a single row
+                frame[r], pos = decode_line(data, pos, size[1])
+            # Audio is discarded
+            audio = decode_audio(data[AUDIO_OFFSET:AUDIO_OFFSET + audio_block_size])
 
             # Get frame back to full brightness
             frame *= 255
             # Display!
             cv2.imshow("frame", frame)
             # Wait for keypress
-            k = cv2.waitKey(33)
+            k = cv2.waitKey(samples * 1000 // rate)
             # Quit on q
             if k == ord("q"):
                 break
-#             frame = f.read(FRAME_SIZE)
-#             video_portion = frame[:VIDEO_SIZE]
-#             audio_portion = frame[VIDEO_SIZE:]
-# 
-#             # Decompress the video back into pixels
-#             # First, reshape into its packed-by-line form
-#             video = np.frombuffer(video_portion, dtype=np.uint8).reshape(128 // 8, 180)
-#             # Then, unpack the bits
-#             video = np.unpackbits(video, axis=1)
-#             # Stretch back to 255
-#             video = video * 255
-#             # Finally, reshape into the proper format
-#             video = video.reshape(OUTPUT_SIZE)
-# 
-#             # Display the video
-#             cv2.imshow("video", video)
-#             k = cv2.waitKey(33)
-#             if k == ord("q"):
-#                 break
-# 
-#             # Print progress
-#             i += 1
-#             print(f"Frame {i}")
+            # Stop after the last frame
+            if next_sectors == 0:
+                break
 
 
 if __name__ == "__main__":
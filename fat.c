@@ -0,0 +1,315 @@
+/*
+ * fat.c
+ *
+ *  Read-only FAT32, see fat.h.
+ */
+
+#include <string.h>
+#include "sdcard.h"
+#include "fat.h"
+
+#define FAT_SECTOR_SIZE 512
+#define FAT_DIR_ENTRY_SIZE 32
+// Fewer clusters than this and it's FAT12 or FAT16, whatever the boot
+// sector looks like
+#define FAT32_MIN_CLUSTERS 65525UL
+#define FAT32_CLUSTER_MASK 0x0FFFFFFFUL
+#define FAT32_BAD_CLUSTER 0x0FFFFFF7UL
+#define FAT32_END_OF_CHAIN 0x0FFFFFF8UL
+
+// MBR partition types for FAT32 (CHS and LBA addressed)
+#define MBR_PARTITION_TABLE 446
+#define MBR_PARTITIONS 4
+#define MBR_TYPE_FAT32 0x0B
+#define MBR_TYPE_FAT32_LBA 0x0C
+
+// Boot sector (BPB) fields
+#define BPB_BYTES_PER_SECTOR 11
+#define BPB_SECTORS_PER_CLUSTER 13
+#define BPB_RESERVED_SECTORS 14
+#define BPB_FATS 16
+#define BPB_ROOT_ENTRIES 17
+#define BPB_TOTAL_SECTORS_16 19
+#define BPB_FAT_SIZE_16 22
+#define BPB_TOTAL_SECTORS_32 32
+#define BPB_FAT_SIZE_32 36
+#define BPB_ROOT_CLUSTER 44
+
+// Directory entry fields
+#define DIR_ATTR 11
+#define DIR_CLUSTER_HIGH 20
+#define DIR_CLUSTER_LOW 26
+#define DIR_SIZE 28
+#define DIR_END 0x00
+#define DIR_DELETED 0xE5
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_LONG_NAME 0x0F
+
+uint16_t fat_errorCode = FAT_ERROR_NONE;
+
+// The volume
+static uint32_t fat_start;          // first sector of the first FAT
+static uint32_t fat_dataStart;      // sector of cluster 2
+static uint32_t fat_clusters;       // clusters in the data area
+static uint32_t fat_rootCluster;
+static uint8_t fat_clusterSectors;
+// FAT sector in the scratch buffer, so following a chain reads each one once
+static uint32_t fat_cached;
+
+// The open file, and where fat_sector() last found itself in it
+static struct fat_extent __attribute__((persistent)) fat_extent[FAT_MAX_EXTENTS] = { { 0 } };
+static uint8_t fat_extentCount = 0;
+static uint8_t fat_cursor = 0;
+static uint32_t fat_cursorBlock = 0;
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (unsigned int)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static bool read_sector(uint32_t sector, uint8_t *buf) {
+    uint8_t i;
+
+    for (i = 0; !sd_read_block(sector, buf); i++) {
+        if (i == SD_READ_RETRIES) {
+            fat_errorCode = FAT_ERROR_READ;
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t cluster_sector(uint32_t cluster) {
+    return fat_dataStart + (cluster - 2) * fat_clusterSectors;
+}
+
+/**
+ * The cluster after `cluster` in its chain, FAT32_END_OF_CHAIN at the end,
+ * or 0 if the chain's broken (fat_errorCode says why).
+ */
+static uint32_t next_cluster(uint32_t cluster, uint8_t *buf) {
+    uint32_t sector = fat_start + cluster / (FAT_SECTOR_SIZE / 4);
+
+    if (sector != fat_cached) {
+        fat_cached = 0;
+        if (!read_sector(sector, buf)) {
+            return 0;
+        }
+        fat_cached = sector;
+    }
+    cluster = get32(buf + cluster % (FAT_SECTOR_SIZE / 4) * 4) & FAT32_CLUSTER_MASK;
+    if (cluster >= FAT32_END_OF_CHAIN) {
+        return FAT32_END_OF_CHAIN;
+    }
+    if (cluster < 2 || cluster == FAT32_BAD_CLUSTER || cluster - 2 >= fat_clusters) {
+        fat_errorCode = FAT_ERROR_BAD_CHAIN;
+        return 0;
+    }
+    return cluster;
+}
+
+/**
+ * Whether `buf` is a FAT boot sector: a jump, then 512 byte sectors.
+ */
+static bool boot_sector(const uint8_t *buf) {
+    return (buf[0] == 0xEB || buf[0] == 0xE9)
+            && get16(buf + BPB_BYTES_PER_SECTOR) == FAT_SECTOR_SIZE
+            && buf[BPB_SECTORS_PER_CLUSTER] != 0;
+}
+
+bool fat_mount(uint8_t *buf) {
+    uint32_t volume = 0, sectors, fat_size;
+    unsigned int i;
+
+    if (!read_sector(0, buf)) {
+        return false;
+    }
+    if (buf[510] != 0x55 || buf[511] != 0xAA) {
+        fat_errorCode = FAT_ERROR_NO_VOLUME;
+        return false;
+    }
+    if (!boot_sector(buf)) {
+        // A partition table: take the first FAT32 partition
+        for (i = 0; i < MBR_PARTITIONS; i++) {
+            const uint8_t *p = buf + MBR_PARTITION_TABLE + i * 16;
+            if (p[4] == MBR_TYPE_FAT32 || p[4] == MBR_TYPE_FAT32_LBA) {
+                volume = get32(p + 8);
+                break;
+            }
+        }
+        if (!volume) {
+            fat_errorCode = FAT_ERROR_NO_VOLUME;
+            return false;
+        }
+        if (!read_sector(volume, buf)) {
+            return false;
+        }
+        if (!boot_sector(buf)) {
+            fat_errorCode = FAT_ERROR_NO_VOLUME;
+            return false;
+        }
+    }
+
+    // FAT32 has no fixed root directory and only 32-bit sizes
+    fat_size = get32(buf + BPB_FAT_SIZE_32);
+    sectors = get32(buf + BPB_TOTAL_SECTORS_32);
+    if (get16(buf + BPB_ROOT_ENTRIES) != 0 || get16(buf + BPB_FAT_SIZE_16) != 0
+            || get16(buf + BPB_TOTAL_SECTORS_16) != 0 || fat_size == 0) {
+        fat_errorCode = FAT_ERROR_NOT_FAT32;
+        return false;
+    }
+    fat_clusterSectors = buf[BPB_SECTORS_PER_CLUSTER];
+    fat_start = volume + get16(buf + BPB_RESERVED_SECTORS);
+    fat_dataStart = fat_start + buf[BPB_FATS] * fat_size;
+    fat_clusters = (sectors - (fat_dataStart - volume)) / fat_clusterSectors;
+    fat_rootCluster = get32(buf + BPB_ROOT_CLUSTER);
+    fat_cached = 0;
+    if (fat_clusters < FAT32_MIN_CLUSTERS) {
+        fat_errorCode = FAT_ERROR_NOT_FAT32;
+        return false;
+    }
+    fat_errorCode = FAT_ERROR_NONE;
+    return true;
+}
+
+/**
+ * `name` as it's stored in a directory entry: 8 characters of name and 3
+ * of extension, upper case, padded with spaces.
+ */
+static void short_name(const char *name, char *out) {
+    unsigned int i = 0;
+
+    memset(out, ' ', 11);
+    for (; *name && *name != '.'; name++) {
+        if (i < 8) {
+            out[i++] = *name >= 'a' && *name <= 'z' ? *name - 'a' + 'A' : *name;
+        }
+    }
+    if (*name == '.') {
+        name++;
+    }
+    for (i = 8; *name && i < 11; name++) {
+        out[i++] = *name >= 'a' && *name <= 'z' ? *name - 'a' + 'A' : *name;
+    }
+}
+
+/**
+ * Look `name` up in the root directory.  Returns its first cluster and
+ * its size.
+ */
+static bool find(const char *name, uint8_t *buf, uint32_t *cluster, uint32_t *size) {
+    char want[11];
+    uint32_t dir = fat_rootCluster;
+    unsigned int s, i;
+
+    short_name(name, want);
+    while (dir != FAT32_END_OF_CHAIN) {
+        for (s = 0; s < fat_clusterSectors; s++) {
+            fat_cached = 0;
+            if (!read_sector(cluster_sector(dir) + s, buf)) {
+                return false;
+            }
+            for (i = 0; i < FAT_SECTOR_SIZE; i += FAT_DIR_ENTRY_SIZE) {
+                const uint8_t *entry = buf + i;
+                if (entry[0] == DIR_END) {
+                    goto not_found;
+                }
+                if (entry[0] == DIR_DELETED || (entry[DIR_ATTR] & ATTR_LONG_NAME) == ATTR_LONG_NAME
+                        || (entry[DIR_ATTR] & (ATTR_VOLUME_ID | ATTR_DIRECTORY))) {
+                    continue;
+                }
+                if (memcmp(entry, want, 11) == 0) {
+                    *cluster = (uint32_t)get16(entry + DIR_CLUSTER_HIGH) << 16 | get16(entry + DIR_CLUSTER_LOW);
+                    *size = get32(entry + DIR_SIZE);
+                    return true;
+                }
+            }
+        }
+        dir = next_cluster(dir, buf);
+        if (!dir) {
+            return false;
+        }
+    }
+
+not_found:
+    fat_errorCode = FAT_ERROR_NOT_FOUND;
+    return false;
+}
+
+bool fat_open(const char *name, uint8_t *buf) {
+    uint32_t cluster, size, remaining, next;
+    struct fat_extent *e = fat_extent;
+
+    fat_extentCount = 0;
+    fat_cursor = 0;
+    fat_cursorBlock = 0;
+    if (!find(name, buf, &cluster, &size)) {
+        return false;
+    }
+    remaining = (size + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+    if (!remaining) {
+        return true;
+    }
+    if (cluster < 2 || cluster - 2 >= fat_clusters) {
+        fat_errorCode = FAT_ERROR_BAD_CHAIN;
+        return false;
+    }
+
+    // Follow the chain once, merging clusters that follow on from each
+    // other, until it's covered the whole file.  The last cluster's
+    // usually only part used.
+    e->sector = cluster_sector(cluster);
+    e->blocks = 0;
+    fat_extentCount = 1;
+    while (remaining > fat_clusterSectors) {
+        e->blocks += fat_clusterSectors;
+        remaining -= fat_clusterSectors;
+        next = next_cluster(cluster, buf);
+        if (!next) {
+            return false;
+        }
+        if (next == FAT32_END_OF_CHAIN) {
+            // Shorter than its size says
+            fat_errorCode = FAT_ERROR_BAD_CHAIN;
+            return false;
+        }
+        if (next != cluster + 1) {
+            if (fat_extentCount == FAT_MAX_EXTENTS) {
+                fat_errorCode = FAT_ERROR_FRAGMENTED;
+                return false;
+            }
+            e++;
+            fat_extentCount++;
+            e->sector = cluster_sector(next);
+            e->blocks = 0;
+        }
+        cluster = next;
+    }
+    e->blocks += remaining;
+    return true;
+}
+
+uint32_t fat_sector(uint32_t block) {
+    if (block < fat_cursorBlock) {
+        // Backwards (a seek): start from the beginning again
+        fat_cursor = 0;
+        fat_cursorBlock = 0;
+    }
+    while (fat_cursor < fat_extentCount && block - fat_cursorBlock >= fat_extent[fat_cursor].blocks) {
+        fat_cursorBlock += fat_extent[fat_cursor].blocks;
+        fat_cursor++;
+    }
+    if (fat_cursor == fat_extentCount) {
+        return FAT_NO_SECTOR;
+    }
+    return fat_extent[fat_cursor].sector + (block - fat_cursorBlock);
+}
+
+const struct fat_extent *fat_extents(uint8_t *count) {
+    *count = fat_extentCount;
+    return fat_extent;
+}
@@ -0,0 +1,79 @@
+/*
+ * fat.h
+ *
+ *  Just enough FAT32 to find one file on the card and stream it.  Opening
+ *  the file walks its cluster chain once and keeps it as a list of
+ *  extents (runs of consecutive sectors) in FRAM; from then on a sector of
+ *  the file is found by stepping along that list, never by reading the
+ *  FAT.  Reads are read-only and root directory, short (8.3) names only.
+ *
+ *  Installing fat_sector() as sd_map (sdcard.h) makes the player's streamed
+ *  reads come out of the file, so everything above sdcard.c carries on
+ *  counting blocks from the start of the video.
+ */
+
+#ifndef FAT_H_
+#define FAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs of consecutive sectors an open file can be in.  A file copied onto
+// a freshly formatted card is usually in one.
+#define FAT_MAX_EXTENTS 64
+// fat_sector() of a sector past the end of the file (SD_NO_SECTOR, so a
+// read of it through sd_map fails)
+#define FAT_NO_SECTOR 0xFFFFFFFFUL
+
+enum {
+    FAT_ERROR_NONE,
+    FAT_ERROR_READ = 0xFA01,    // the card failed, see sd_errorCode
+    FAT_ERROR_NO_VOLUME,        // no FAT32 partition, or boot sector
+    FAT_ERROR_NOT_FAT32,        // a FAT12/16 volume, or sectors that aren't 512 bytes
+    FAT_ERROR_NOT_FOUND,        // no such file in the root directory
+    FAT_ERROR_BAD_CHAIN,        // a cluster chain that runs off the volume or into a free cluster
+    FAT_ERROR_FRAGMENTED,       // more than FAT_MAX_EXTENTS pieces
+};
+
+// A run of the file's sectors
+struct fat_extent {
+    uint32_t sector;    // on the card
+    uint32_t blocks;
+};
+
+// Most recent FAT_ERROR_* code
+extern uint16_t fat_errorCode;
+
+/**
+ * Find the FAT32 volume: the first FAT32 partition in the MBR, or a card
+ * formatted without a partition table.  `buf` is a sector of scratch
+ * space.  False with FAT_ERROR_NO_VOLUME if there's no FAT at all, which
+ * is a card with the video written straight to it.
+ */
+bool fat_mount(uint8_t *buf);
+
+/**
+ * Open the file called `name` ("BADAPPLE.BIN") in the root directory and
+ * map out its extents.  `buf` is a sector of scratch space.
+ */
+bool fat_open(const char *name, uint8_t *buf);
+
+/**
+ * Where sector `block` of the open file is on the card, or FAT_NO_SECTOR
+ * past its end.  Cheapest going forwards a sector at a time.
+ */
+uint32_t fat_sector(uint32_t block);
+
+/**
+ * The open file's extents, and how many there are.
+ */
+const struct fat_extent *fat_extents(uint8_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* FAT_H_ */
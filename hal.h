@@ -0,0 +1,136 @@
+/*
+ * hal.h
+ *
+ *  Thin hardware abstraction layer under the SPI, DMA, GPIO and timer
+ *  accesses made by the player.  On the MSP430 everything here is a
+ *  one-or-two instruction register poke (see hal_msp430.h), so the hot
+ *  paths cost exactly what they did before.  Building with HAL_HOST
+ *  defined swaps in the Linux backend in host/, which feeds the SPI bus
+ *  from an SD card image and captures TFT pixels into memory.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "defines.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Points in the main loop that the backend may want to timestamp.
+ * On hardware READ_BEGIN/READ_END drive the P3.6 logic analyzer pin,
+ * the host backend uses them to split per-frame read and decode cost.
+ * With HAL_PROFILE (and on the host, with -P) every one of them is
+ * logged for the stage profiler (profile.h).
+ */
+typedef enum {
+    HAL_MARK_READ_BEGIN,
+    HAL_MARK_READ_END,
+    HAL_MARK_DECODE_BEGIN,
+    HAL_MARK_DECODE_END,
+    HAL_MARK_LINE_DECODED,  // one display line expanded, about to be sent
+    HAL_MARK_AUDIO_DECODED, // next frame's audio decoded into its sample buffer
+    HAL_MARK_IDLE_BEGIN,    // done with this frame, going to sleep
+    HAL_MARK_FRAME_BEGIN,   // woken up by the frame timer
+    HAL_MARK_LINE_BEGIN,
+    HAL_MARK_AUDIO_BEGIN,
+    HAL_MARK_SD_COMMAND_BEGIN,
+    HAL_MARK_SD_COMMAND_END,
+    HAL_MARK_SD_TOKEN_BEGIN,    // polling for a sector's start token
+    HAL_MARK_SD_TOKEN_END,
+    HAL_MARK_SD_DMA_BEGIN,      // a sector's receive DMA
+    HAL_MARK_SD_DMA_END,
+    HAL_MARK_DMA_WAIT_BEGIN,    // CPU spinning on a DMA
+    HAL_MARK_DMA_WAIT_END,
+    HAL_MARK_COUNT
+} hal_mark_t;
+
+// SMCLK, which the DAC's sample timer counts, and the frame timer's tick
+#define HAL_SMCLK_HZ 16000000UL
+#define HAL_FRAME_TICK_HZ 1000000UL
+
+/**
+ * The SPI buses: the eUSCI modules the SD card and the TFT hang off.
+ * HAL_SPI_SD and HAL_SPI_TFT say which one each is wired to (the card's
+ * always on UCB0); when they're the same bus the two take turns on it.
+ */
+typedef enum {
+    HAL_SPI_UCB0,
+    HAL_SPI_UCA0,
+    HAL_SPI_BUSES
+} hal_spi_t;
+
+// Unfortunate hack: this flag is set to true / 1 whenever a DMA completes
+// and triggers the DMA_VECTOR ISR.
+extern volatile bool dmaDone;
+
+/**
+ * Bring up clocks, pins, timers and the audio PWM DAC.
+ */
+void hal_init();
+
+/**
+ * Stop for good.  On the board we silence the DAC and spin forever with
+ * whatever is on the LCD still showing; the host backend prints its report and exits.
+ */
+void hal_halt(uint16_t code);
+
+/**
+ * Implemented by the player (main.c), called from the button ISR.
+ * Button 0 is S1 (P1.1), button 1 is S2 (P1.2).
+ */
+void player_button(uint8_t button);
+
+/**
+ * Implemented by the SD engine (sdcard.c), called from the DMA ISR
+ * whenever a receive DMA finishes.
+ */
+void sd_async_dma_done();
+
+#ifdef HAL_HOST
+
+/*
+ * Host backend (host/hal_host.c).  See the MSP430 versions in
+ * hal_msp430.h for what each of these does on the real board.  The
+ * TFT's bus is picked at run time (host_options.split_spi), so one
+ * build can play either wiring.
+ */
+#define HAL_SPI_SD HAL_SPI_UCB0
+#define HAL_SPI_TFT hal_spi_tft
+extern hal_spi_t hal_spi_tft;
+void hal_sd_select(bool selected);
+void hal_tft_select(bool selected);
+void hal_tft_dc(bool data);
+void hal_spi_init(hal_spi_t bus, uint16_t prescaler);
+void hal_spi_set_prescaler(hal_spi_t bus, uint16_t prescaler);
+uint8_t hal_spi_xfer(hal_spi_t bus, uint8_t byte);
+void hal_dma_rx_start(hal_spi_t bus, uint8_t *buf, const uint8_t *fill, size_t size);
+void hal_dma_tx_setup(hal_spi_t bus, const uint8_t *buf, size_t size);
+void hal_dma_tx_start(hal_spi_t bus, const uint8_t *buf);
+void hal_dma_stop();
+void hal_dma_wait();
+size_t hal_dma_rx_count(size_t size);
+void hal_crc_reset();
+void hal_crc_feed(const uint8_t *buf, size_t size);
+uint16_t hal_crc_result();
+void hal_audio_start(const uint8_t *ring, size_t size);
+uint32_t hal_audio_position();
+void hal_set_rates(uint16_t sample_cycles, uint16_t frame_ticks);
+void hal_wait_frame();
+bool hal_frame_due();
+void hal_mark(hal_mark_t mark);
+uint32_t hal_micros();
+
+#else
+#include "hal_msp430.h"
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HAL_H_ */
@@ -0,0 +1,186 @@
+/*
+ * hal_msp430.c
+ *
+ *  MSP430FR6989 board bring-up and interrupt handlers for hal.h.
+ *  The per-byte / per-line accessors are inlined from hal_msp430.h.
+ */
+
+#include <msp430.h>
+#include "hal.h"
+#include "defines.h"
+#include "Timing.h"
+#include "lcd.h"
+
+volatile bool dmaDone = 1; // nothing in flight
+volatile bool nextFrame = 0;
+volatile uint16_t audioLaps = 0;
+#ifdef CARDTEST
+volatile uint16_t microsLaps = 0;
+#endif
+uint16_t audioRingSize = 0;
+
+void hal_init() {
+    WDTCTL = WDTPW | WDTHOLD;   // stop watchdog timer
+    PM5CTL0 &= ~LOCKLPM5;         // Unlock ports from power manager
+    // make the ULP advisor shut up
+    PADIR = PBDIR = PCDIR = PDDIR = PEDIR = 0;
+    PAOUT = PBOUT = PCOUT = PDOUT = PEOUT = 0;
+
+    aclk_init();
+    smclk_init();
+    delay_init();
+    lcd_init();
+
+    // Pins:
+    __disable_interrupt();
+    // Seek buttons: the LaunchPad's S1 and S2 on P1.1 and P1.2, pulled up,
+    // interrupting on the press.  (They used to be P2.1 and P2.2, but P2.2
+    // is the TFT's D/C line, and every command raised a button interrupt.)
+    BIC(P1DIR, BIT1 | BIT2);
+    BIS(P1OUT, BIT1 | BIT2);
+    BIS(P1REN, BIT1 | BIT2);
+    BIS(P1IES, BIT1 | BIT2);
+    BIC(P1IFG, BIT1 | BIT2);
+    BIS(P1IE, BIT1 | BIT2);
+    __enable_interrupt();
+
+    // P2.6, P2.7, P3.6, P3.7 are all LED pins and also our CS/DC lines
+    BIS(P2DIR, BIT2 | BIT6 | BIT7);
+    BIS(P2OUT, BIT2 | BIT6 | BIT7);
+    BIS(P3DIR, BIT6 | BIT7);
+    BIS(P3OUT, BIT6 | BIT7);
+
+    // Timer A1: PWM DAC
+    // Blisteringly fast 16MHz count, 6-bit PWM for a frequency of ~250kHz
+    BIS(P4DIR, BIT7); // P4.7 is TA1.2 output
+    BIS(P4SEL0, BIT7);
+    BIS(P4SEL1, BIT7);
+    TA1EX0 = TAIDEX_0; // divide by 1
+    TA1CTL = TASSEL__SMCLK | MC__UP | TACLR + ID__1; // SMCLK, up mode, clear timer, divide by 1
+    TA1CCR0 = 0x3F; // 6-bit PWM
+    TA1CCR2 = 0x2F; // 0% duty cycle
+    TA1CCTL2 = OUTMOD_3;
+
+    // Timer A0: count when it's time for the next frame
+    TA0EX0 = TAIDEX_1; // divide by 2
+    TA0CTL = TASSEL__SMCLK | MC__UP | TACLR | ID__8; // 1us timer ticks
+    // One frame's worth of DAC samples (1470 x 362 cycles = 33258.75us)
+    // rather than a true 30 Hz: the two timers share SMCLK, so this way
+    // the frames keep pace with the sound instead of drifting away from it.
+    // The player sets both from the card's header (hal_set_rates).
+    TA0CCR0 = 33259 - 1;
+    TA0CCTL0 = CCIE;
+
+#if defined(HAL_PROFILE) || defined(CARDTEST)
+    // Timer A2: free running 1us clock for the profiler's timestamps and
+    // hal_micros()
+    TA2EX0 = TAIDEX_1; // divide by 2
+    TA2CTL = TASSEL__SMCLK | MC__CONTINUOUS | TACLR | ID__8;
+#endif
+#ifdef CARDTEST
+    BIS(TA2CTL, TAIE);
+#endif
+#ifdef HAL_PROFILE
+    profile_reset();
+#endif
+
+    // Timer B1: DMA0 trigger
+    // We need a frequency of 44100 Hz (~22.6 uS per sample)
+    // At 16MHz, this is 363.6 cycles per sample (we'll round up to 364)
+    TB0EX0 = TBIDEX_0; // divide by 1
+    TB0CTL = TBSSEL__SMCLK | MC__UP | TBCLR | ID__1; // SMCLK, up mode, clear timer, divide by 1
+    TB0CCR0 = 361; // *should* be 364 cycles per sample, but trial and error says 361 sounds best
+
+    // DMA0: Audio ring to TA1CCR2, repeated so it goes round and round the ring
+    DMACTL0 |= DMA0TSEL__TB0CCR0;
+    DMA0CTL = DMADT_4 + DMADSTINCR_0 + DMASRCINCR_3 + DMASRCBYTE + DMADSTBYTE + DMALEVEL;
+    __data20_write_long((uint32_t)&DMA0DA, (uint32_t)&TA1CCR2);
+    // DMA0SA / DMA0SZ are unset - hal_audio_start will set them and enable the transfer
+}
+
+void hal_halt(uint16_t code) {
+    // Otherwise the ring plays on forever
+    BIC(DMA0CTL, DMAEN);
+    TA1CCR2 = 0x20; // mid-scale
+    for (;;);
+}
+
+/**
+ * TODO: this is broken :(
+ * Should be much faster than the built-in memcpy() once it works, though
+ */
+void hal_memcpy_dma(void *dst, void *src, size_t size) {
+    DMA1CTL = 0;
+    __data20_write_long(&DMA1SA, src);
+    __data20_write_long(&DMA1DA, dst);
+    DMA1SZ = size / 2;
+    DMACTL0 |= DMA1TSEL__DMAREQ;
+    DMA1CTL = DMADT_1 + DMAEN + DMALEVEL + DMAREQ + DMAIE;
+    // DMA in block transfer mode is blocking, so it's done by now.
+    // Just in case though, wait for the interrupt to set the flag.
+    while (!dmaDone);
+    DMA1CTL = 0; // Disarm it
+    if (size & 1) { // Deal w/ odd numbers of bytes
+        ((uint8_t*)dst)[size - 1] = ((uint8_t*)src)[size - 1];
+    }
+}
+
+
+/*****
+ * Interrupt Handlers
+ *****/
+
+// Called once every 33ms when it's time for a new frame.
+#pragma vector=TIMER0_A0_VECTOR
+__interrupt void frameInterrupt() {
+    nextFrame = true;
+    TA0IV = 0;
+    __low_power_mode_off_on_exit();
+}
+
+#ifdef CARDTEST
+// TA2 wrapped: the top half of hal_micros()
+#pragma vector=TIMER2_A1_VECTOR
+__interrupt void microsInterrupt() {
+    if (TA2IV == TAIV__TAIFG) {
+        microsLaps++;
+    }
+}
+#endif
+
+#pragma vector=DMA_VECTOR
+__interrupt void dmaInterrupt() {
+    switch (__even_in_range(DMAIV, DMAIV_DMA2IFG)) {
+    case DMAIV_DMA0IFG:
+        // Audio DMA wrapped round the ring
+        audioLaps++;
+        break;
+    case DMAIV_DMA1IFG:
+        // SPI receive finished - may be a background SD sector
+        dmaDone = 1;
+        sd_async_dma_done();
+        break;
+    default:
+        dmaDone = 1;
+        break;
+    }
+}
+
+/**
+ * Seek buttons.  player_button() in main.c only notes which one it was;
+ * the main loop does the seek in between frames.  Reading P1IV
+ * acknowledges the interrupt.
+ */
+#pragma vector=PORT1_VECTOR
+__interrupt void buttonInterrupt() {
+    switch (P1IV) {
+    case P1IV_P1IFG1:
+        player_button(0);
+        break;
+    case P1IV_P1IFG2:
+        player_button(1);
+        break;
+    default:
+        break;
+    }
+}
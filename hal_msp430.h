@@ -0,0 +1,401 @@
+/*
+ * hal_msp430.h
+ *
+ *  MSP430FR6989 backend for hal.h.  Everything that gets called per byte
+ *  or per line lives here as a static inline so that the abstraction
+ *  compiles down to the same register writes as before.  Board bring-up
+ *  and the ISRs live in hal_msp430.c.
+ *
+ *  Pin map:
+ *      P1.4 / P1.6 / P1.7  UCB0 CLK / SIMO / SOMI (SD card, and the TFT)
+ *      P1.5 / P2.0         UCA0 CLK / SIMO (TFT, HAL_SPLIT_SPI builds)
+ *      P2.2                TFT data/command
+ *      P2.6                TFT chip select
+ *      P3.6                high while reading (for the logic analyzer)
+ *      P3.7                SD card chip select
+ *      P4.7                TA1.2 audio PWM
+ */
+
+#ifndef HAL_MSP430_H_
+#define HAL_MSP430_H_
+
+#include <msp430.h>
+#ifdef HAL_PROFILE
+#include "profile.h"
+#endif
+
+// Which bus each device is on.  The TFT shares UCB0 with the card, the
+// way the board's wired; build with HAL_SPLIT_SPI for one with the TFT
+// moved to UCA0 of its own.
+#define HAL_SPI_SD HAL_SPI_UCB0
+#ifdef HAL_SPLIT_SPI
+#define HAL_SPI_TFT HAL_SPI_UCA0
+#else
+#define HAL_SPI_TFT HAL_SPI_UCB0
+#endif
+
+// Set by the TIMER0_A0 ISR every 33ms when it's time for a new frame.
+extern volatile bool nextFrame;
+#ifdef CARDTEST
+// Times TA2 has wrapped, counted by its ISR, for hal_micros()
+extern volatile uint16_t microsLaps;
+#endif
+// Times DMA0 has been round the audio ring, counted by the DMA ISR
+extern volatile uint16_t audioLaps;
+extern uint16_t audioRingSize;
+
+static inline void hal_sd_select(bool selected) {
+    if (selected) {
+        BIC(P3OUT, BIT7);
+    } else {
+        BIS(P3OUT, BIT7);
+    }
+}
+
+static inline void hal_tft_select(bool selected) {
+    if (selected) {
+        BIC(P2OUT, BIT6);
+    } else {
+        BIS(P2OUT, BIT6);
+    }
+}
+
+/*
+ * True / HIGH for data, false / LOW for command
+ */
+static inline void hal_tft_dc(bool data) {
+    if (data) {
+        BIS(P2OUT, BIT2);
+    } else {
+        BIC(P2OUT, BIT2);
+    }
+}
+
+/**
+ * Configure `bus` as a mode 0 SPI master clocked from SMCLK / prescaler.
+ * The TFT only listens, so UCA0 gets no SOMI pin.
+ */
+static inline void hal_spi_init(hal_spi_t bus, uint16_t prescaler) {
+    // Configure as SPI.
+    // Don't set UCCPKH/UCCPKL - we're in SPI mode 0 for the SD card.
+    // UCMSB: SD cards transmit MSB first
+    // UCMST: we're an SPI master.
+    // UCSYNC: SPI requires this
+    // UCSSEL__SMCLK: clock source is SMCLK
+    // UCSWRST: keep us held in reset until everything's ready
+    if (bus == HAL_SPI_UCA0) {
+        BIS(UCA0CTLW0, UCSWRST); // hold UCA0 logic in reset state while we're configuring stuff
+
+        BIS(P1SEL0, BIT5);
+        BIC(P1SEL1, BIT5); // Configure P1.5 as SPI CLK
+        BIS(P2SEL0, BIT0);
+        BIC(P2SEL1, BIT0); // Configure P2.0 as SIMO
+
+        UCA0CTLW0 = UCMSB + UCMST + UCSYNC + UCSSEL__SMCLK + UCSWRST;
+        UCA0BRW = prescaler;
+        UCA0MCTLW = 0; // no modulation in SPI mode
+
+        BIC(UCA0CTLW0, UCSWRST);
+        return;
+    }
+
+    BIS(UCB0CTLW0, UCSWRST); // hold UCB0 logic in reset state while we're configuring stuff
+
+    BIS(P1SEL0, BIT4);
+    BIC(P1SEL1, BIT4); // Configure P1.4 as SPI CLK
+    BIS(P1SEL0, BIT6);
+    BIC(P1SEL1, BIT6); // Configure P1.6 as SIMO
+    BIS(P1SEL0, BIT7);
+    BIC(P1SEL1, BIT7); // Configure P1.7 as SOMI
+
+    UCB0CTLW0 = UCMSB + UCMST + UCSYNC + UCSSEL__SMCLK + UCSWRST;
+    UCB0BRW = prescaler;
+
+    BIC(UCB0CTLW0, UCSWRST); // enable SPI - writes to UCB0TXBUF will start a transfer
+}
+
+/**
+ * Change `bus`'s clock to SMCLK / prescaler.  UCxBRW can only be written
+ * with the module held in reset, so nothing can be going on on the bus.
+ */
+static inline void hal_spi_set_prescaler(hal_spi_t bus, uint16_t prescaler) {
+    // A DMA's done once its last byte is in TXBUF, not once it's gone out:
+    // let it finish shifting before the reset cuts it off
+    if (bus == HAL_SPI_UCA0) {
+        while (UCA0STATW & UCBUSY);
+        BIS(UCA0CTLW0, UCSWRST);
+        UCA0BRW = prescaler;
+        BIC(UCA0CTLW0, UCSWRST);
+    } else {
+        while (UCB0STATW & UCBUSY);
+        BIS(UCB0CTLW0, UCSWRST);
+        UCB0BRW = prescaler;
+        BIC(UCB0CTLW0, UCSWRST);
+    }
+}
+
+/**
+ * Send a single byte and return the byte clocked in at the same time.
+ * `bus` is a constant at every call, so this inlines to one module's
+ * registers.
+ */
+static inline uint8_t hal_spi_xfer(hal_spi_t bus, uint8_t byte) {
+    if (bus == HAL_SPI_UCA0) {
+        UCA0TXBUF = byte;
+        while (UCA0STATW & UCBUSY);
+        return UCA0RXBUF;
+    }
+    UCB0TXBUF = byte;
+    while (UCB0STATW & UCBUSY); // wait for SPI transaction to finish
+    return UCB0RXBUF;
+}
+
+/*
+ * Point DMA2 at `bus`'s transmit buffer, triggered whenever it's empty.
+ * DMA2 is the only channel left over for SPI sends (DMA0 is the audio
+ * and DMA1 receives), so it serves whichever bus is sending.
+ */
+static inline void hal_dma_tx_trigger(hal_spi_t bus) {
+    if (bus == HAL_SPI_UCA0) {
+        DMACTL1 = (DMACTL1 & ~DMA2TSEL_31) | DMA2TSEL__UCA0TXIFG;
+        __data20_write_long((unsigned long)&DMA2DA, (unsigned long)&UCA0TXBUF);
+    } else {
+        DMACTL1 = (DMACTL1 & ~DMA2TSEL_31) | DMA2TSEL__UCB0TXIFG0;
+        __data20_write_long((unsigned long)&DMA2DA, (unsigned long)&UCB0TXBUF);
+    }
+}
+
+/**
+ * Start DMA1 receiving `size` bytes from `bus` into `buf`, with DMA2
+ * clocking out `*fill` for every byte.  DMA1 interrupts (and dmaDone gets
+ * set) once the last byte has been received, not just sent.  DMA2 has to
+ * be free: wait out a send on the other bus first.
+ */
+static inline void hal_dma_rx_start(hal_spi_t bus, uint8_t *buf, const uint8_t *fill, size_t size) {
+    // Setup DMA1 to receive
+    if (bus == HAL_SPI_UCA0) {
+        DMACTL0 = (DMACTL0 & ~DMA1TSEL_31) | DMA1TSEL__UCA0RXIFG;
+        __data20_write_long((unsigned long)&DMA1SA, (unsigned long)&UCA0RXBUF);
+    } else {
+        DMACTL0 = (DMACTL0 & ~DMA1TSEL_31) | DMA1TSEL__UCB0RXIFG0;
+        __data20_write_long((unsigned long)&DMA1SA, (unsigned long)&UCB0RXBUF);
+    }
+    DMA1CTL = DMADT_0 + DMADSTINCR_3 + DMASRCINCR_0 + DMASRCBYTE + DMADSTBYTE;
+    DMA1SZ = size;
+    __data20_write_long((unsigned long)&DMA1DA, (unsigned long)buf);
+
+    // Setup DMA2 to just repeat the fill byte
+    hal_dma_tx_trigger(bus);
+    DMA2CTL = DMADT_0 + DMADSTINCR_0 + DMASRCINCR_0 + DMASRCBYTE + DMADSTBYTE;
+    __data20_write_long((unsigned long)&DMA2SA, (unsigned long)fill);
+    DMA2SZ = size - 1;
+
+    // start 'em up
+    DMA1CTL |= DMAEN + DMAIE;
+    DMA2CTL |= DMAEN;
+    if (bus == HAL_SPI_UCA0) {
+        UCA0TXBUF = *fill;
+    } else {
+        UCB0TXBUF = *fill;
+    }
+}
+
+/**
+ * Prepare DMA2 to perform a block -> single address bytewise
+ * transfer to `bus`, but don't start the DMA yet.
+ */
+static inline void hal_dma_tx_setup(hal_spi_t bus, const uint8_t *buf, size_t size) {
+    hal_dma_tx_trigger(bus);
+    DMA2CTL = DMADT_0 + DMADSTINCR_0 + DMASRCINCR_3 + DMASRCBYTE + DMADSTBYTE;
+    __data20_write_long((unsigned long)&DMA2SA, (unsigned long)buf);
+    DMA2SZ = size;
+}
+
+/**
+ * (Re)start the DMA2 transfer set up by hal_dma_tx_setup from `buf`.
+ */
+static inline void hal_dma_tx_start(hal_spi_t bus, const uint8_t *buf) {
+    __data20_write_long((unsigned long)&DMA2SA, (unsigned long)buf);
+    DMA2CTL |= DMAEN + DMAIE;
+    // Poke the TX flag to kick off the first trigger
+    if (bus == HAL_SPI_UCA0) {
+        UCA0IFG &= ~(UCTXIFG | UCRXIFG);
+        UCA0IFG |= UCTXIFG | UCRXIFG;
+    } else {
+        UCB0IFG &= ~(UCTXIFG | UCRXIFG);
+        UCB0IFG |= UCTXIFG | UCRXIFG;
+    }
+}
+
+/**
+ * Disarm both SPI DMA channels.
+ */
+static inline void hal_dma_stop() {
+    BIC(DMA1CTL, DMAEN + DMAIE);
+    DMA2CTL = 0;
+}
+
+/**
+ * Spin until the DMA ISR says the current transfer is done.
+ */
+static inline void hal_dma_wait() {
+    while (!dmaDone);
+}
+
+/**
+ * How many of the `size` bytes hal_dma_rx_start() set DMA1 receiving
+ * have come in so far.  Only while it's running: DMA1SZ goes back to
+ * `size` once it's done, so this goes back to 0.
+ */
+static inline size_t hal_dma_rx_count(size_t size) {
+    return size - DMA1SZ;
+}
+
+/**
+ * Start a CRC16-CCITT (polynomial 0x1021, seed 0: the CRC an SD card
+ * sends after each data block) in the CRC16 module.
+ */
+static inline void hal_crc_reset() {
+    CRCINIRES = 0;
+}
+
+/**
+ * Run `size` bytes through the CRC16 module.  CRCDIRB takes each byte most
+ * significant bit first, the way they came off the card, which makes
+ * CRCINIRES the card's CRC.  One MOV.B a byte, eight to a loop.
+ */
+static inline void hal_crc_feed(const uint8_t *buf, size_t size) {
+    for (; size >= 8; size -= 8) {
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+        CRCDIRB_L = *buf++;
+    }
+    while (size--) {
+        CRCDIRB_L = *buf++;
+    }
+}
+
+/**
+ * The CRC of everything fed in since hal_crc_reset().
+ */
+static inline uint16_t hal_crc_result() {
+    return CRCINIRES;
+}
+
+/**
+ * Start DMA0 feeding 6-bit samples into the PWM DAC at 44.1 kHz, round
+ * and round `ring` until we halt.
+ */
+static inline void hal_audio_start(const uint8_t *ring, size_t size) {
+    BIC(DMA0CTL, DMAEN);
+    __data20_write_long((unsigned long)&DMA0SA, (unsigned long)ring);
+    DMA0SZ = size;
+    audioRingSize = size;
+    audioLaps = 0;
+    DMA0CTL |= DMAEN | DMAIE;
+}
+
+/**
+ * Samples the DAC has been given since hal_audio_start().
+ */
+static inline uint32_t hal_audio_position() {
+    unsigned short gie = __get_interrupt_state();
+    uint16_t laps, left;
+
+    if (!audioRingSize) {
+        return 0;   // not started yet
+    }
+    __disable_interrupt();
+    laps = audioLaps;
+    left = DMA0SZ;
+    if (DMA0CTL & DMAIFG) {
+        // Wrapped, and the ISR hasn't counted it yet: the count we just
+        // read could be from either side of that, so read it again
+        laps++;
+        left = DMA0SZ;
+    }
+    __set_interrupt_state(gie);
+    return (uint32_t)laps * audioRingSize + (audioRingSize - left);
+}
+
+/**
+ * Set the DAC's sample period, in SMCLK cycles, and the frame timer's, in
+ * 1us ticks.  hal_init() starts them off at 362 cycles (44.1 kHz) and one
+ * frame of 1470 of those.
+ */
+static inline void hal_set_rates(uint16_t sample_cycles, uint16_t frame_ticks) {
+    TB0CCR0 = sample_cycles - 1;
+    TA0CCR0 = frame_ticks - 1;
+    BIS(TA0CTL, TACLR);
+}
+
+/**
+ * Sleep until the frame timer says it's time for the next frame.
+ */
+static inline void hal_wait_frame() {
+    while (!nextFrame) __low_power_mode_1();
+    nextFrame = 0;
+}
+
+/**
+ * Whether the frame timer's ticked since the last hal_wait_frame(), so
+ * the next one won't sleep.
+ */
+static inline bool hal_frame_due() {
+    return nextFrame;
+}
+
+#ifdef CARDTEST
+/**
+ * Microseconds since hal_init(), wrapping after 71 minutes: TA2 for the
+ * bottom half, its wraps for the top.  Only in card tester builds
+ * (cardtest.h).
+ */
+static inline uint32_t hal_micros() {
+    unsigned short gie = __get_interrupt_state();
+    uint16_t laps, now;
+
+    __disable_interrupt();
+    now = TA2R;
+    laps = microsLaps;
+    if ((TA2CTL & TAIFG) && now < 0x8000) {
+        laps++; // wrapped, but the ISR hasn't had its turn
+    }
+    __set_interrupt_state(gie);
+    return (uint32_t)laps << 16 | now;
+}
+#endif
+
+static inline void hal_mark(hal_mark_t mark) {
+#ifdef HAL_PROFILE
+    // Marks come from the DMA ISR too
+    unsigned short gie = __get_interrupt_state();
+    __disable_interrupt();
+    if (mark == HAL_MARK_IDLE_BEGIN && nextFrame) {
+        // This frame overran: keep it in the ring
+        profile_trigger();
+    }
+    profile_record(mark, TA2R);
+    __set_interrupt_state(gie);
+#endif
+    // P3.6 high while we're reading from the SD card, for the logic
+    // analyzer.  (It used to be P2.6, but that's the TFT's chip select, and
+    // the card reads ahead in between frames.)
+    switch (mark) {
+    case HAL_MARK_READ_BEGIN:
+        BIS(P3OUT, BIT6);
+        break;
+    case HAL_MARK_READ_END:
+        BIC(P3OUT, BIT6);
+        break;
+    default:
+        break;
+    }
+}
+
+#endif /* HAL_MSP430_H_ */
@@ -0,0 +1,196 @@
+/*
+ * bench_audio.c
+ *
+ *  What does ADPCM do to the audio, and what does decoding it cost?
+ *  Codes a reference track frame by frame exactly like convert.py,
+ *  decodes every frame with the player's audio_decode(), and compares
+ *  the samples that would reach the DAC against the reference - next to
+ *  what the old raw 6-bit samples managed.
+ *
+ *      bench_audio [frames]        synthetic tone
+ *      bench_audio track.wav       8-bit mono PCM, like convert.py reads
+ *
+ *  Decode times are host times (and host TSC cycles on x86), so they only
+ *  say how the decoder compares with the rest of the host benchmarks.
+ *  Exits 1 if the ADPCM track is much worse than raw 6-bit samples.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "synth.h"
+#include "encode.h"
+#include "defines.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+// Decode every frame this many times, to get above the clock's resolution
+#define REPEAT 20
+// How much worse than raw 6-bit samples the ADPCM track may be
+#define MAX_SNR_LOSS_DB 6.0
+
+struct totals {
+    unsigned long frames;
+    double signal;          // reference power about its midpoint
+    double raw_noise;       // squared error of raw 6-bit samples
+    double adpcm_noise;     // squared error of decoded ADPCM samples
+    unsigned int max_error; // worst decoded sample, in DAC steps
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+// Keeps the compiler from optimizing the timed loop away
+static volatile uint8_t sink;
+
+static uint64_t cycles_now() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Code, decode and score one frame of 8-bit samples.
+ */
+static void bench_frame(struct totals *t, struct encode_audio_state *s, const uint8_t *samples) {
+    uint8_t block[AUDIO_BLOCK_SIZE], decoded[AUDIO_FRAME_SIZE];
+    uint64_t start, start_cycles;
+    unsigned int i, r;
+
+    encode_audio(s, samples, AUDIO_FRAME_SIZE, block);
+
+    start = host_now_ns();
+    start_cycles = cycles_now();
+    for (r = 0; r < REPEAT; r++) {
+        audio_decode(block, decoded, AUDIO_FRAME_SIZE);
+        sink ^= decoded[r];
+    }
+    t->cycles += (cycles_now() - start_cycles) / REPEAT;
+    t->ns += (host_now_ns() - start) / REPEAT;
+
+    // Score everything in DAC steps (8-bit samples / 4)
+    for (i = 0; i < AUDIO_FRAME_SIZE; i++) {
+        double want = samples[i] / 4.0;
+        double raw = samples[i] >> 2;
+        unsigned int error = abs((int)decoded[i] - (samples[i] >> 2));
+
+        if (decoded[i] > 63) {
+            fprintf(stderr, "frame %lu sample %u: %u doesn't fit the DAC\n", t->frames, i, decoded[i]);
+            exit(1);
+        }
+        t->signal += (want - 32) * (want - 32);
+        t->raw_noise += (raw - want) * (raw - want);
+        t->adpcm_noise += (decoded[i] - want) * (decoded[i] - want);
+        t->max_error = MAX(t->max_error, error);
+    }
+    t->frames++;
+}
+
+static void bench_synth(struct totals *t, unsigned long frames) {
+    struct encode_audio_state s = { 0 };
+    uint8_t samples[SYNTH_AUDIO_SIZE];
+    unsigned long n;
+
+    for (n = 0; n < frames; n++) {
+        synth_audio(n, samples);
+        bench_frame(t, &s, samples);
+    }
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Just enough of a WAV reader for what convert.py takes: find the fmt and
+ * data chunks, insist on 8-bit mono PCM.
+ */
+static void bench_wav(struct totals *t, const char *path) {
+    struct encode_audio_state s = { 0 };
+    uint8_t samples[AUDIO_FRAME_SIZE], header[12], chunk[8], fmt[16];
+    bool have_fmt = false;
+    uint32_t size;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    if (fread(header, 1, 12, f) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        exit(2);
+    }
+    while (fread(chunk, 1, 8, f) == 8) {
+        size = le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(fmt)) {
+            if (fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt)) {
+                break;
+            }
+            // PCM, 1 channel, 8 bits per sample
+            if (fmt[0] != 1 || fmt[2] != 1 || fmt[14] != 8) {
+                fprintf(stderr, "%s: need 8-bit mono PCM\n", path);
+                exit(2);
+            }
+            have_fmt = true;
+            size -= sizeof(fmt);
+        } else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+            while (size > 0) {
+                size_t n = fread(samples, 1, MIN(size, AUDIO_FRAME_SIZE), f);
+                if (n == 0) {
+                    break;
+                }
+                // convert.py pads the end of the song with silence
+                memset(samples + n, 0x80, AUDIO_FRAME_SIZE - n);
+                bench_frame(t, &s, samples);
+                size -= n;
+            }
+            break;
+        }
+        fseek(f, size + (size & 1), SEEK_CUR);
+    }
+    fclose(f);
+}
+
+static double snr_db(double signal, double noise) {
+    return noise > 0 ? 10 * log10(signal / noise) : INFINITY;
+}
+
+int main(int argc, char **argv) {
+    struct totals t = { 0 };
+    struct stat st;
+    double frames, raw_snr, adpcm_snr;
+
+    if (argc > 1 && stat(argv[1], &st) == 0) {
+        bench_wav(&t, argv[1]);
+    } else {
+        bench_synth(&t, argc > 1 ? strtoul(argv[1], NULL, 0) : 300);
+    }
+    if (t.frames == 0) {
+        fprintf(stderr, "no audio\n");
+        return 1;
+    }
+
+    frames = t.frames;
+    raw_snr = snr_db(t.signal, t.raw_noise);
+    adpcm_snr = snr_db(t.signal, t.adpcm_noise);
+    printf("%lu frames of %d samples\n", t.frames, AUDIO_FRAME_SIZE);
+    printf("%-6s %12s %12s\n", "audio", "bytes", "snr dB");
+    printf("%-6s %12d %12.1f\n", "raw", AUDIO_FRAME_SIZE, raw_snr);
+    printf("%-6s %12d %12.1f\n", "adpcm", AUDIO_BLOCK_SIZE, adpcm_snr);
+    printf("audio %.2fx smaller, worst sample off by %u DAC steps\n",
+           (double)AUDIO_FRAME_SIZE / AUDIO_BLOCK_SIZE, t.max_error);
+#ifdef HAVE_TSC
+    printf("decode: %.1f host us, %.0f host cycles (%.1f per sample) per frame\n",
+           t.ns / 1e3 / frames, t.cycles / frames, t.cycles / frames / AUDIO_FRAME_SIZE);
+#else
+    printf("decode: %.1f host us per frame\n", t.ns / 1e3 / frames);
+#endif
+    return adpcm_snr < raw_snr - MAX_SNR_LOSS_DB ? 1 : 0;
+}
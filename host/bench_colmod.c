@@ -0,0 +1,89 @@
+/*
+ * bench_colmod.c
+ *
+ *  What does sending 12-bit pixels save?  Plays the same synthetic video
+ *  through the player with the TFT set up for 16 bits per pixel (COLMOD
+ *  0x05) and for 12 (0x03).  No clean-line maps, so every line of every
+ *  frame goes out.  The emulated panel keeps RGB565 either way, so every
+ *  frame has to hash the same both ways; the report is what each cost.
+ *
+ *      bench_colmod [frames]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "tft.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The player's side of things, from main.c
+extern uint8_t display_colmod;
+
+static void use_16bit() {
+    display_colmod = TFT_COLMOD_16BIT;
+}
+
+static void use_12bit() {
+    display_colmod = TFT_COLMOD_12BIT;
+}
+
+struct totals {
+    double tft_bytes, bus_us, busy_us, decode_us;
+};
+
+static struct totals average(const struct host_frame *results, unsigned long frames) {
+    struct totals t = { 0 };
+    unsigned long n;
+    for (n = 0; n < frames; n++) {
+        t.tft_bytes += (double)results[n].tft_bytes / frames;
+        t.bus_us += results[n].bus_ns / 1e3 / frames;
+        t.busy_us += results[n].busy_ns / 1e3 / frames;
+        t.decode_us += results[n].decode_ns / 1e3 / frames;
+    }
+    return t;
+}
+
+static void print(const char *name, struct totals t) {
+    printf("%-8s %10.1f %10.1f %10.1f %10.1f\n", name, t.tft_bytes, t.bus_us, t.busy_us, t.decode_us);
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 300;
+    char path[] = "/tmp/bench_colmodXXXXXX";
+    struct host_frame *wide = calloc(frames, sizeof(*wide));
+    struct host_frame *narrow = calloc(frames, sizeof(*narrow));
+    struct totals wide_avg, narrow_avg;
+    unsigned long n, mismatches = 0;
+
+    if (!wide || !narrow || frames == 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    // One extra frame, for the player to read ahead into
+    encode_synth_image(path, frames + 1, ENCODE_NO_CLEAN);
+    host_play(path, frames, wide, use_16bit);
+    host_play(path, frames, narrow, use_12bit);
+    unlink(path);
+
+    for (n = 0; n < frames; n++) {
+        if (wide[n].hash != narrow[n].hash) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "frame %lu: display differs (%08x vs %08x)\n", n, wide[n].hash, narrow[n].hash);
+            }
+        }
+    }
+
+    wide_avg = average(wide, frames);
+    narrow_avg = average(narrow, frames);
+    printf("%lu frames; per frame:\n", frames);
+    printf("%-8s %10s %10s %10s %10s\n", "pixels", "tft bytes", "spi us", "frame us", "host us");
+    print("16-bit", wide_avg);
+    print("12-bit", narrow_avg);
+    printf("TFT traffic: %.2fx less, modelled frame time: %.2fx less, %lu frames differ\n",
+           wide_avg.tft_bytes / narrow_avg.tft_bytes, wide_avg.busy_us / narrow_avg.busy_us, mismatches);
+    free(wide);
+    free(narrow);
+    return mismatches ? 1 : 0;
+}
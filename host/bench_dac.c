@@ -0,0 +1,100 @@
+/*
+ * bench_dac.c
+ *
+ *  Does the audio ring (dac.h) keep the sound going through late frames?
+ *  Plays the same synthetic video twice: once at the usual modelled cost
+ *  per line, and once with lines slow enough that every fully drawn frame
+ *  runs past its 33ms.  For each run it reports how many frames were late,
+ *  how many times the DAC's DMA caught up with the queued audio
+ *  (underruns) and how close it came, next to the silence the old way of
+ *  restarting DMA0 on a frame's own 1470 samples every frame would have
+ *  left: whatever time there was between the samples running out and the
+ *  next frame starting.
+ *
+ *      bench_dac [frames]
+ *
+ *  Exits 1 if either run underran.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "dac.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Modelled cost per line that makes a fully drawn frame late
+#define SLOW_LINE_NS 400000UL
+
+struct totals {
+    unsigned long late, underruns, old_gaps;
+    double min_lead_us, old_silence_us, old_longest_us;
+};
+
+static void slow_lines() {
+    host_options.line_ns = SLOW_LINE_NS;
+}
+
+static struct totals count(const struct host_frame *results, unsigned long frames) {
+    struct totals t = { 0 };
+    unsigned long n;
+
+    t.min_lead_us = 1e9;
+    for (n = 0; n < frames; n++) {
+        if (results[n].busy_ns > HOST_FRAME_NS) {
+            t.late++;
+        }
+        // The last frame played has no next frame's audio to queue
+        if (n + 1 < frames) {
+            double lead_us = results[n].audio_lead * (HOST_SAMPLE_NS / 1e3);
+            double gap_us = (results[n + 1].start_ns - results[n].start_ns) / 1e3
+                    - AUDIO_FRAME_SIZE * (HOST_SAMPLE_NS / 1e3);
+            if (results[n].audio_lead < 0) {
+                t.underruns++;
+            }
+            t.min_lead_us = lead_us < t.min_lead_us ? lead_us : t.min_lead_us;
+            if (gap_us > 0) {
+                t.old_gaps++;
+                t.old_silence_us += gap_us;
+                t.old_longest_us = gap_us > t.old_longest_us ? gap_us : t.old_longest_us;
+            }
+        }
+    }
+    return t;
+}
+
+static void print(const char *name, struct totals t) {
+    printf("%-8s %6lu %10lu %12.1f %10lu %12.1f %12.1f\n", name, t.late, t.underruns, t.min_lead_us,
+           t.old_gaps, t.old_silence_us, t.old_longest_us);
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 300;
+    char path[] = "/tmp/bench_dacXXXXXX";
+    struct host_frame *normal = calloc(frames, sizeof(*normal));
+    struct host_frame *slow = calloc(frames, sizeof(*slow));
+    struct totals normal_t, slow_t;
+
+    if (!normal || !slow || frames < 2) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    // Duplicated frames, so a late frame is followed by one that catches up
+    encode_synth_image(path, frames + 1, ENCODE_DUPLICATE);
+    host_play(path, frames, normal, NULL);
+    host_play(path, frames, slow, slow_lines);
+    unlink(path);
+
+    normal_t = count(normal, frames);
+    slow_t = count(slow, frames);
+    printf("%lu frames; ring of %u frames, sound %u frame(s) behind the picture\n", frames,
+           DAC_RING_FRAMES, DAC_LATENCY_FRAMES);
+    printf("%-8s %6s %10s %12s %10s %12s %12s\n", "lines", "late", "underruns", "min lead us",
+           "old gaps", "old gap us", "longest us");
+    print("normal", normal_t);
+    print("slow", slow_t);
+    free(normal);
+    free(slow);
+    return normal_t.underruns || slow_t.underruns ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * bench_delta.c
+ *
+ *  How much does skipping unchanged lines save?  Plays the same synthetic
+ *  video (duplicated frames and all, like convert.py makes of a 15 fps
+ *  source) through the player twice: once from an image with no clean-line
+ *  maps, so every line of every frame is sent, and once with the maps
+ *  convert.py writes (both made by encode.c).  Every frame has to come out
+ *  on the emulated TFT exactly the same both ways; the report is what it
+ *  cost per frame.
+ *
+ *      bench_delta [frames]
+ *
+ *  Each run is a child process (host_play()), since the player exits when
+ *  it's done.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct totals {
+    double tft_bytes, bus_us, busy_us, decode_us;
+};
+
+static struct totals average(const struct host_frame *results, unsigned long frames) {
+    struct totals t = { 0 };
+    unsigned long n;
+    for (n = 0; n < frames; n++) {
+        t.tft_bytes += (double)results[n].tft_bytes / frames;
+        t.bus_us += results[n].bus_ns / 1e3 / frames;
+        t.busy_us += results[n].busy_ns / 1e3 / frames;
+        t.decode_us += results[n].decode_ns / 1e3 / frames;
+    }
+    return t;
+}
+
+static void print(const char *name, struct totals t) {
+    printf("%-8s %10.1f %10.1f %10.1f %10.1f\n", name, t.tft_bytes, t.bus_us, t.busy_us, t.decode_us);
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 300;
+    char full_path[] = "/tmp/bench_delta_fullXXXXXX";
+    char delta_path[] = "/tmp/bench_delta_deltaXXXXXX";
+    struct host_frame *full = calloc(frames, sizeof(*full));
+    struct host_frame *delta = calloc(frames, sizeof(*delta));
+    struct totals full_avg, delta_avg;
+    unsigned long n, mismatches = 0;
+
+    if (!full || !delta || frames == 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    // One extra frame, for the player to read ahead into
+    encode_synth_image(full_path, frames + 1, ENCODE_DUPLICATE | ENCODE_NO_CLEAN);
+    encode_synth_image(delta_path, frames + 1, ENCODE_DUPLICATE);
+    host_play(full_path, frames, full, NULL);
+    host_play(delta_path, frames, delta, NULL);
+    unlink(full_path);
+    unlink(delta_path);
+
+    for (n = 0; n < frames; n++) {
+        if (full[n].hash != delta[n].hash) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "frame %lu: display differs (%08x vs %08x)\n", n, full[n].hash, delta[n].hash);
+            }
+        }
+    }
+
+    full_avg = average(full, frames);
+    delta_avg = average(delta, frames);
+    printf("%lu frames; per frame:\n", frames);
+    printf("%-8s %10s %10s %10s %10s\n", "image", "tft bytes", "spi us", "frame us", "host us");
+    print("full", full_avg);
+    print("delta", delta_avg);
+    printf("TFT traffic: %.2fx less, modelled frame time: %.2fx less, %lu frames differ\n",
+           full_avg.tft_bytes / delta_avg.tft_bytes, full_avg.busy_us / delta_avg.busy_us, mismatches);
+    free(full);
+    free(delta);
+    return mismatches ? 1 : 0;
+}
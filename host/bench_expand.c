@@ -0,0 +1,143 @@
+/*
+ * bench_expand.c
+ *
+ *  Is the nibble-table video_expand() faster than the loop it replaced,
+ *  and does it give exactly the same pixels?  Checks every byte value and
+ *  a pile of random lines against the old shift-a-bit-at-a-time loop (and
+ *  the 12-bit kernel against a pixel-at-a-time version), then times them
+ *  expanding whole raw frames (2560 bytes each, which is what literal lines
+ *  cost at worst).
+ *
+ *      bench_expand [frames]
+ *
+ *  Times are host times, so only the ratio means anything for the board.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "synth.h"
+#include "video.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Expand every frame this many times, to get above the clock's resolution
+#define REPEAT 20
+#define RANDOM_LINES 100000
+
+// Keeps the compiler from optimizing the timed loops away
+static volatile uint16_t sink;
+
+/*
+ * video_expand() as it was: one bit, one pixel at a time.
+ */
+static void expand_bits(const uint8_t *packed, uint16_t *pixels, uint16_t bytes) {
+    static const uint16_t lookup[2] = {0x0000, 0xFFFF};
+    unsigned int k;
+
+    while (bytes--) {
+        uint8_t p = *packed++;
+        for (k = 0; k < 8; k++) {
+            pixels[7 - k] = lookup[(p & 1)];
+            p >>= 1;
+        }
+        pixels += 8;
+    }
+}
+
+/*
+ * 12-bit pixels the slow way: two pixels to three bytes, one at a time.
+ */
+static void expand12_bits(const uint8_t *packed, uint8_t *out, uint16_t bytes) {
+    unsigned int p;
+
+    memset(out, 0, bytes * 12);
+    for (p = 0; p < bytes * 8u; p++) {
+        if (packed[p / 8] & (0x80 >> (p % 8))) {
+            // Pixel p is nibbles 3p to 3p + 2, high nibble first
+            unsigned int nibble;
+            for (nibble = 3 * p; nibble < 3 * p + 3; nibble++) {
+                out[nibble / 2] |= (nibble & 1) ? 0x0F : 0xF0;
+            }
+        }
+    }
+}
+
+static void check(const uint8_t *packed, uint16_t bytes, const char *what, unsigned long n) {
+    uint16_t got[VIDEO_LINE_PIXELS], want[VIDEO_LINE_PIXELS];
+    uint8_t want12[VIDEO_LINE_BYTES_12BIT];
+
+    video_expand(packed, got, bytes);
+    expand_bits(packed, want, bytes);
+    if (memcmp(got, want, bytes * 8 * sizeof(uint16_t)) != 0) {
+        fprintf(stderr, "%s %lu expands wrong\n", what, n);
+        exit(1);
+    }
+    video_expand12(packed, got, bytes);
+    expand12_bits(packed, want12, bytes);
+    if (memcmp(got, want12, bytes * 12) != 0) {
+        fprintf(stderr, "%s %lu expands wrong at 12 bits\n", what, n);
+        exit(1);
+    }
+}
+
+static void expand12(const uint8_t *packed, uint16_t *pixels, uint16_t bytes) {
+    video_expand12(packed, pixels, bytes);
+}
+
+static uint64_t time_frame(void (*expand)(const uint8_t *, uint16_t *, uint16_t), const uint8_t *video) {
+    uint16_t line[VIDEO_LINE_PIXELS];
+    uint64_t start = host_now_ns();
+    unsigned int i, r;
+
+    for (r = 0; r < REPEAT; r++) {
+        for (i = 0; i < VIDEO_LINES; i++) {
+            expand(video + i * VIDEO_LINE_BYTES, line, VIDEO_LINE_BYTES);
+            sink ^= line[r % VIDEO_LINE_PIXELS];
+        }
+    }
+    return (host_now_ns() - start) / REPEAT;
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 300;
+    uint8_t video[SYNTH_VIDEO_SIZE], packed[VIDEO_LINE_BYTES];
+    uint64_t bits_ns = 0, table_ns = 0, table12_ns = 0;
+    unsigned long n;
+    unsigned int i;
+
+    if (frames == 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    for (n = 0; n < 256; n++) {
+        packed[0] = n;
+        check(packed, 1, "byte", n);
+    }
+    srand(1);
+    for (n = 0; n < RANDOM_LINES; n++) {
+        for (i = 0; i < VIDEO_LINE_BYTES; i++) {
+            packed[i] = rand();
+        }
+        // Literals can be any length up to a whole line
+        check(packed, 1 + n % VIDEO_LINE_BYTES, "random line", n);
+    }
+
+    for (n = 0; n < frames; n++) {
+        synth_video(n, video);
+        for (i = 0; i < VIDEO_LINES; i++) {
+            check(video + i * VIDEO_LINE_BYTES, VIDEO_LINE_BYTES, "frame line", n * VIDEO_LINES + i);
+        }
+        bits_ns += time_frame(expand_bits, video);
+        table_ns += time_frame(video_expand, video);
+        table12_ns += time_frame(expand12, video);
+    }
+
+    printf("all 256 bytes, %d random lines and %lu frames expand identically\n", RANDOM_LINES, frames);
+    printf("%-8s %12s\n", "expand", "host ns");
+    printf("%-8s %12.1f\n", "bits", (double)bits_ns / frames);
+    printf("%-8s %12.1f\n", "nibbles", (double)table_ns / frames);
+    printf("%-8s %12.1f\n", "12-bit", (double)table12_ns / frames);
+    printf("nibble table: %.2fx faster per frame\n", (double)bits_ns / table_ns);
+    return 0;
+}
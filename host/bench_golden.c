@@ -0,0 +1,243 @@
+/*
+ * bench_golden.c
+ *
+ *  Does decode_and_write_frame() still draw what it used to?  Plays every
+ *  frame of an image through the player as it is in main.c and compares
+ *  what went to the TFT each frame (every command and data byte, and the
+ *  panel's contents afterwards) against hashes saved from a player known
+ *  to be right, and reports how long the decode took per frame.  Anything
+ *  that makes the decode faster has to pass this first.
+ *
+ *      bench_golden [-w] [golden.txt [image.bin]]
+ *
+ *  With no image it plays a synthetic one (duplicated frames and clean
+ *  lines and all), which is what the golden.txt in this directory is for.
+ *  -w writes the hashes out instead of checking them, for when the
+ *  difference is meant to be there, or for a new image.
+ *
+ *  Decode times are host times (the fastest of a few runs of each frame),
+ *  so only compare them with each other.  Exits 1 if any frame differs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "seek.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYNTH_FRAMES 600
+// Runs of the whole image; every frame's time is the fastest of them
+#define RUNS 3
+// Differing frames listed before giving up on listing them
+#define SHOW_FRAMES 10
+
+struct golden {
+    uint32_t image;                     // FNV-1a of the image they're for
+    unsigned long frames;
+    uint32_t *stream, *picture;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-w] [golden.txt [image.bin]]\n", argv0);
+    exit(2);
+}
+
+static void *alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        perror("calloc");
+        exit(2);
+    }
+    return p;
+}
+
+/*
+ * Hash the image, so hashes saved from one aren't checked against
+ * another, and read how many frames its header says it has.
+ */
+static uint32_t hash_image(const char *path, unsigned long *frames) {
+    static uint8_t buf[1 << 16];
+    uint32_t hash = 2166136261u;
+    bool first = true;
+    size_t n, i;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    *frames = 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (first && n >= SEEK_FRAMES_OFFSET + 4 && memcmp(buf, CONTAINER_MAGIC, 4) == 0) {
+            *frames = buf[SEEK_FRAMES_OFFSET] | buf[SEEK_FRAMES_OFFSET + 1] << 8
+                    | (unsigned long)buf[SEEK_FRAMES_OFFSET + 2] << 16
+                    | (unsigned long)buf[SEEK_FRAMES_OFFSET + 3] << 24;
+        }
+        first = false;
+        for (i = 0; i < n; i++) {
+            hash = (hash ^ buf[i]) * 16777619u;
+        }
+    }
+    fclose(f);
+    if (*frames == 0) {
+        fprintf(stderr, "%s: no frame count in its header\n", path);
+        exit(2);
+    }
+    return hash;
+}
+
+static bool read_golden(struct golden *g, const char *path) {
+    char line[128];
+    unsigned long n, frame;
+    unsigned int stream, picture;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    if (!fgets(line, sizeof(line), f)
+            || sscanf(line, "# bench_golden: image %x, %lu frames", &stream, &g->frames) != 2) {
+        fprintf(stderr, "%s: not a bench_golden file\n", path);
+        goto fail;
+    }
+    g->image = stream;
+    g->stream = alloc(g->frames * sizeof(*g->stream));
+    g->picture = alloc(g->frames * sizeof(*g->picture));
+    for (n = 0; n < g->frames; n++) {
+        if (!fgets(line, sizeof(line), f) || sscanf(line, "%lu %x %x", &frame, &stream, &picture) != 3
+                || frame != n) {
+            fprintf(stderr, "%s: frame %lu missing\n", path, n);
+            goto fail;
+        }
+        g->stream[n] = stream;
+        g->picture[n] = picture;
+    }
+    fclose(f);
+    return true;
+
+fail:
+    fclose(f);
+    return false;
+}
+
+static bool write_golden(const char *path, uint32_t image, const struct host_frame *results, unsigned long frames) {
+    unsigned long n;
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "# bench_golden: image %08x, %lu frames\n", image, frames);
+    for (n = 0; n < frames; n++) {
+        fprintf(f, "%lu %08x %08x\n", n, results[n].stream_hash, results[n].hash);
+    }
+    return fclose(f) == 0;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    char synth_path[] = "/tmp/bench_goldenXXXXXX";
+    const char *golden_path = "golden.txt", *image_path = NULL;
+    struct host_frame *results, *run;
+    struct golden g = { 0 };
+    bool write = false;
+    unsigned long frames, n, streams = 0, pictures = 0, shown = 0, unsteady = 0;
+    uint64_t *decode_ns, total_ns = 0;
+    uint32_t image;
+    int opt, r;
+
+    while ((opt = getopt(argc, argv, "w")) != -1) {
+        if (opt == 'w') {
+            write = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 2) {
+        usage(argv[0]);
+    }
+    if (optind < argc) {
+        golden_path = argv[optind];
+    }
+    if (optind + 1 < argc) {
+        image_path = argv[optind + 1];
+    } else {
+        encode_synth_image(synth_path, SYNTH_FRAMES, ENCODE_DUPLICATE);
+        image_path = synth_path;
+    }
+
+    image = hash_image(image_path, &frames);
+    results = alloc(frames * sizeof(*results));
+    run = alloc(frames * sizeof(*run));
+    decode_ns = alloc(frames * sizeof(*decode_ns));
+    for (r = 0; r < RUNS; r++) {
+        host_play(image_path, frames, r ? run : results, NULL);
+        for (n = 0; n < frames; n++) {
+            if (r && (run[n].stream_hash != results[n].stream_hash || run[n].hash != results[n].hash)) {
+                unsteady++;
+            }
+            if (!r || run[n].decode_ns < results[n].decode_ns) {
+                results[n].decode_ns = (r ? run : results)[n].decode_ns;
+            }
+        }
+    }
+    if (image_path == synth_path) {
+        unlink(synth_path);
+    }
+    if (unsteady) {
+        fprintf(stderr, "%lu frames came out differently from one run to the next\n", unsteady);
+        return 1;
+    }
+
+    for (n = 0; n < frames; n++) {
+        decode_ns[n] = results[n].decode_ns;
+        total_ns += decode_ns[n];
+    }
+    qsort(decode_ns, frames, sizeof(*decode_ns), compare_ns);
+    printf("%lu frames, image %08x\n", frames, image);
+    printf("decode_and_write_frame(): %.0f ns/frame mean, %.0f median, %.0f slowest (host)\n",
+           (double)total_ns / frames, (double)decode_ns[frames / 2], (double)decode_ns[frames - 1]);
+
+    if (write) {
+        if (!write_golden(golden_path, image, results, frames)) {
+            return 2;
+        }
+        printf("wrote %s\n", golden_path);
+        return 0;
+    }
+    if (!read_golden(&g, golden_path)) {
+        return 2;
+    }
+    if (g.image != image || g.frames != frames) {
+        fprintf(stderr, "%s is for a different image (%08x, %lu frames): make it again with -w\n",
+                golden_path, g.image, g.frames);
+        return 1;
+    }
+    for (n = 0; n < frames; n++) {
+        bool stream = results[n].stream_hash != g.stream[n], picture = results[n].hash != g.picture[n];
+
+        streams += stream;
+        pictures += picture;
+        if ((stream || picture) && shown++ < SHOW_FRAMES) {
+            fprintf(stderr, "frame %lu: sent %08x (want %08x), shows %08x (want %08x)\n", n,
+                    results[n].stream_hash, g.stream[n], results[n].hash, g.picture[n]);
+        }
+    }
+    printf("against %s: %lu frames sent something different, %lu look different%s\n", golden_path, streams,
+           pictures, streams || pictures ? "  FAIL" : "");
+    free(g.stream);
+    free(g.picture);
+    free(results);
+    free(run);
+    free(decode_ns);
+    return streams || pictures ? 1 : 0;
+}
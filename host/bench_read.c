@@ -0,0 +1,263 @@
+/*
+ * bench_read.c
+ *
+ *  How much memory traffic does reading a frame cost?  Runs the old
+ *  bounce-buffer read path (DMA every sector into block_buffer, then
+ *  memcpy into the frame buffer, over a tightly packed stream of raw
+ *  frames) against DMAing sectors straight into the frame buffer, over
+ *  the same raw frames each padded out to whole sectors, both through
+ *  sdcard.c and the emulated card, and reports the bytes written to FRAM
+ *  per frame.  That's the zero-copy read on its own.
+ *
+ *  Then the player's blocking frame read, jitter_start() from jitter.c,
+ *  over the current format (run-length coded video and ADPCM audio), for
+ *  what the two together come to.
+ *
+ *      bench_read [frames]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "synth.h"
+#include "encode.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "seek.h"
+#include "jitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 512
+// The old raw format: video then audio
+#define FRAME_SIZE (SYNTH_VIDEO_SIZE + SYNTH_AUDIO_SIZE)
+
+struct result {
+    uint64_t dma_bytes;
+    uint64_t copy_bytes;
+    uint64_t sd_bytes;
+    uint64_t ns;
+};
+
+static void synth_frame(unsigned long n, uint8_t *frame) {
+    unsigned int i;
+    synth_video(n, frame);
+    synth_audio(n, frame + SYNTH_VIDEO_SIZE);
+    // Raw 6-bit samples for the DAC
+    for (i = 0; i < SYNTH_AUDIO_SIZE; i++) {
+        frame[SYNTH_VIDEO_SIZE + i] >>= 2;
+    }
+}
+
+// What's on the card, and how it's read
+enum layout {
+    PACKED,     // raw frames back to back, through the bounce buffer
+    ALIGNED,    // raw frames starting on sectors, straight into the frame
+    PLAYER,     // the current format, by jitter_start()
+};
+
+// Sectors a raw frame takes up when it starts on one
+#define FRAME_SECTORS ((FRAME_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE)
+
+static void write_image(char *path, unsigned long frames, enum layout layout) {
+    static const uint8_t padding[SECTOR_SIZE];
+    uint8_t frame[FRAME_SIZE];
+    unsigned long n;
+    int fd;
+    FILE *f;
+
+    if (layout == PLAYER) {
+        encode_synth_image(path, frames, 0);
+        return;
+    }
+    fd = mkstemp(path);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    for (n = 0; n < frames; n++) {
+        synth_frame(n, frame);
+        fwrite(frame, 1, FRAME_SIZE, f);
+        if (layout == ALIGNED) {
+            fwrite(padding, 1, FRAME_SECTORS * SECTOR_SIZE - FRAME_SIZE, f);
+        }
+    }
+    fclose(f);
+}
+
+static void open_card(const char *path) {
+    host_options.image = path;
+    hal_init();
+    spi_init();
+    if (!sd_init()) {
+        fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+        exit(1);
+    }
+}
+
+static void check_frame(unsigned long n, const uint8_t *frame, enum layout layout) {
+    // Frames are checked in order, so the audio can be coded again alongside
+    static struct encode_audio_state audio_state;
+    uint8_t expected[FRAME_SIZE], block[AUDIO_BLOCK_SIZE];
+    uint16_t line[VIDEO_LINE_PIXELS], want[VIDEO_LINE_PIXELS];
+    const uint8_t *src = frame + FRAME_VIDEO_OFFSET;
+    unsigned int i;
+    bool ok = true;
+
+    synth_frame(n, expected);
+    if (layout != PLAYER) {
+        ok = memcmp(frame, expected, FRAME_SIZE) == 0;
+    } else {
+        if (n == 0) {
+            memset(&audio_state, 0, sizeof(audio_state));
+        }
+        synth_audio(n, expected + SYNTH_VIDEO_SIZE);
+        encode_audio(&audio_state, expected + SYNTH_VIDEO_SIZE, AUDIO_FRAME_SIZE, block);
+        ok = memcmp(frame + FRAME_AUDIO_OFFSET, block, AUDIO_BLOCK_SIZE) == 0;
+        for (i = 0; i < VIDEO_LINES && ok; i++) {
+            src = video_decode_line(src, line);
+            video_expand(expected + i * VIDEO_LINE_BYTES, want, VIDEO_LINE_BYTES);
+            ok = memcmp(line, want, sizeof(line)) == 0;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "frame %lu read back wrong\n", n);
+        exit(1);
+    }
+}
+
+/*
+ * The old read_frame(): copy out of the current block, refilling it from
+ * the card whenever we run off the end.
+ */
+static uint8_t block_buffer[SECTOR_SIZE];
+static uint32_t legacy_block = 0;
+static uint16_t legacy_offset = 0;
+static uint64_t legacy_copied = 0;
+
+static bool read_frame_legacy(uint8_t *frame_buffer) {
+    uint16_t bytes_remaining = FRAME_SIZE;
+    do {
+        uint16_t bytes_to_copy = MIN(bytes_remaining, SECTOR_SIZE - legacy_offset);
+        memcpy(frame_buffer, block_buffer + legacy_offset, bytes_to_copy);
+        legacy_copied += bytes_to_copy;
+        bytes_remaining -= bytes_to_copy;
+        frame_buffer += bytes_to_copy;
+        legacy_offset += bytes_to_copy;
+
+        if (legacy_offset == SECTOR_SIZE) {
+            legacy_offset = 0;
+            legacy_block++;
+            if (!sd_stream_read(legacy_block, block_buffer)) {
+                return false;
+            }
+        }
+    } while (bytes_remaining > 0);
+    return true;
+}
+
+/*
+ * Sector by sector straight into the frame buffer, the zero-copy read
+ * without anything else changed.
+ */
+static uint32_t aligned_block = 0;
+
+static bool read_frame_aligned(uint8_t *frame_buffer) {
+    unsigned int i;
+    for (i = 0; i < FRAME_SECTORS; i++) {
+        if (!sd_stream_read(aligned_block++, frame_buffer + i * SECTOR_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct result run(const char *path, unsigned long frames, enum layout layout) {
+    static uint8_t frame[FRAME_SECTORS * SECTOR_SIZE];
+    struct host_counters before;
+    struct result r;
+    uint64_t start;
+    unsigned long n;
+
+    open_card(path);
+    if (layout == PACKED) {
+        // Prime the bounce buffer with block 0
+        if (!sd_stream_read(0, block_buffer)) {
+            fprintf(stderr, "priming read failed: %u\n", sd_errorCode);
+            exit(1);
+        }
+    }
+    // The new format has the header sector (container.h) in front
+    jitter_block = layout == PLAYER ? CONTAINER_BLOCK + 1 : 0;
+    aligned_block = 0;
+    legacy_copied = 0;
+    before = host_counters;
+    start = host_now_ns();
+    for (n = 0; n < frames; n++) {
+        uint8_t *dst = layout == PLAYER ? jitter_frame(0) : frame;
+        bool ok;
+
+        switch (layout) {
+        case PACKED:
+            ok = read_frame_legacy(dst);
+            break;
+        case ALIGNED:
+            ok = read_frame_aligned(dst);
+            break;
+        default:
+            ok = jitter_start(jitter_block);
+            break;
+        }
+        // The last frame's read runs off the end of the image (the legacy
+        // path refills its bounce buffer one block early), which is fine.
+        if (!ok && n + 1 < frames) {
+            fprintf(stderr, "read of frame %lu failed: %u\n", n, sd_errorCode);
+            exit(1);
+        }
+        check_frame(n, dst, layout);
+    }
+    r.ns = host_now_ns() - start;
+    r.dma_bytes = host_counters.dma_rx_bytes - before.dma_rx_bytes;
+    r.copy_bytes = legacy_copied;
+    r.sd_bytes = host_counters.sd_bytes - before.sd_bytes;
+    sd_stream_stop();
+    return r;
+}
+
+static void print(const char *name, struct result r, unsigned long frames) {
+    printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.2f\n", name,
+           (double)r.dma_bytes / frames, (double)r.copy_bytes / frames,
+           (double)(r.dma_bytes + r.copy_bytes) / frames,
+           (double)r.sd_bytes / frames, r.ns / 1e3 / frames);
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 300;
+    char packed_path[] = "/tmp/bench_read_packedXXXXXX";
+    char aligned_path[] = "/tmp/bench_read_alignedXXXXXX";
+    char player_path[] = "/tmp/bench_read_playerXXXXXX";
+    struct result packed, aligned, player;
+
+    write_image(packed_path, frames, PACKED);
+    write_image(aligned_path, frames, ALIGNED);
+    write_image(player_path, frames, PLAYER);
+    packed = run(packed_path, frames, PACKED);
+    aligned = run(aligned_path, frames, ALIGNED);
+    player = run(player_path, frames, PLAYER);
+    unlink(packed_path);
+    unlink(aligned_path);
+    unlink(player_path);
+
+    printf("%lu frames of %d bytes raw; bytes per frame:\n", frames, FRAME_SIZE);
+    printf("%-12s %10s %10s %10s %10s %10s\n", "path", "dma", "memcpy", "fram", "spi", "host us");
+    print("bounce", packed, frames);
+    print("zero-copy", aligned, frames);
+    print("player", player, frames);
+    printf("FRAM writes per frame: %.2fx fewer for the same raw frames, %.2fx fewer with the current format too\n",
+           (double)(packed.dma_bytes + packed.copy_bytes) / (aligned.dma_bytes + aligned.copy_bytes),
+           (double)(packed.dma_bytes + packed.copy_bytes) / (player.dma_bytes + player.copy_bytes));
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * bench_rle.c
+ *
+ *  Is run-length coding the video worth it?  Reports how much smaller it
+ *  makes frames (so how much SD time it saves) against how long
+ *  video_decode_line() takes compared to expanding raw packed lines, and
+ *  checks that both give exactly the same pixels, that video_skip_line()
+ *  steps over the same bytes, and that it stays inside a damaged frame.
+ *
+ *      bench_rle [frames]      synthetic content
+ *      bench_rle image.bin     every frame of a converted video
+ *
+ *  Decode times are host times, so only the ratio between the two means
+ *  anything for the board.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "synth.h"
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Decode every frame this many times, to get above the clock's resolution
+#define REPEAT 20
+// SPI bytes per sector: token, data, CRC
+#define SECTOR_BYTES (1 + ENCODE_SECTOR_SIZE + 2)
+
+struct totals {
+    unsigned long frames;
+    uint64_t raw_bytes, rle_bytes;      // video only
+    uint64_t raw_sectors, rle_sectors;  // whole frames
+    uint64_t raw_ns, rle_ns;            // decoding every line
+};
+
+// Keeps the compiler from optimizing the timed loops away
+static volatile uint16_t sink;
+
+/*
+ * Decode one frame's worth of run-length coded lines both ways and time it.
+ * `packed` is the same frame as raw lines.
+ */
+static void bench_frame(struct totals *t, const uint8_t *rle, size_t rle_size, const uint8_t *packed) {
+    uint16_t line[VIDEO_LINE_PIXELS], want[VIDEO_LINE_PIXELS];
+    uint8_t bits[VIDEO_LINE_BYTES];
+    const uint8_t *src = rle, *bits_src = rle, *skip_src = rle;
+    uint64_t start;
+    unsigned int i, r;
+
+    // Same pixels?  Both as pixels, and back to packed bits (the 12-bit path)
+    for (i = 0; i < VIDEO_LINES; i++) {
+        src = video_decode_line(src, line);
+        bits_src = video_decode_packed(bits_src, bits);
+        skip_src = video_skip_line(skip_src, rle + rle_size);
+        video_expand(packed + i * VIDEO_LINE_BYTES, want, VIDEO_LINE_BYTES);
+        if (memcmp(line, want, sizeof(line)) != 0
+                || memcmp(bits, packed + i * VIDEO_LINE_BYTES, VIDEO_LINE_BYTES) != 0
+                || bits_src != src || skip_src != src) {
+            fprintf(stderr, "frame %lu line %u decodes wrong\n", t->frames, i);
+            exit(1);
+        }
+    }
+    if ((size_t)(src - rle) != rle_size) {
+        fprintf(stderr, "frame %lu: decoder used %zu of %zu bytes\n", t->frames, (size_t)(src - rle), rle_size);
+        exit(1);
+    }
+
+    start = host_now_ns();
+    for (r = 0; r < REPEAT; r++) {
+        for (i = 0; i < VIDEO_LINES; i++) {
+            video_expand(packed + i * VIDEO_LINE_BYTES, line, VIDEO_LINE_BYTES);
+            sink ^= line[r % VIDEO_LINE_PIXELS];
+        }
+    }
+    t->raw_ns += (host_now_ns() - start) / REPEAT;
+
+    start = host_now_ns();
+    for (r = 0; r < REPEAT; r++) {
+        src = rle;
+        for (i = 0; i < VIDEO_LINES; i++) {
+            src = video_decode_line(src, line);
+            sink ^= line[r % VIDEO_LINE_PIXELS];
+        }
+    }
+    t->rle_ns += (host_now_ns() - start) / REPEAT;
+
+    t->raw_bytes += ENCODE_VIDEO_SIZE;
+    t->rle_bytes += rle_size;
+    t->raw_sectors += (FRAME_VIDEO_OFFSET + ENCODE_VIDEO_SIZE + ENCODE_SECTOR_SIZE - 1) / ENCODE_SECTOR_SIZE;
+    t->rle_sectors += (FRAME_VIDEO_OFFSET + rle_size + ENCODE_SECTOR_SIZE - 1) / ENCODE_SECTOR_SIZE;
+    t->frames++;
+}
+
+static void bench_synth(struct totals *t, unsigned long frames) {
+    uint8_t packed[ENCODE_VIDEO_SIZE];
+    uint8_t rle[VIDEO_LINES * VIDEO_RLE_MAX_LINE];
+    unsigned long n;
+    unsigned int i;
+
+    for (n = 0; n < frames; n++) {
+        size_t size = 0;
+        synth_video(n, packed);
+        for (i = 0; i < VIDEO_LINES; i++) {
+            size += encode_line(packed + i * VIDEO_LINE_BYTES, rle + size, 0);
+        }
+        bench_frame(t, rle, size, packed);
+    }
+}
+
+static void bench_image(struct totals *t, const char *path) {
+    static uint8_t frame[ENCODE_MAX_SECTORS * ENCODE_SECTOR_SIZE];
+    uint8_t packed[ENCODE_VIDEO_SIZE];
+    uint16_t line[VIDEO_LINE_PIXELS];
+    FILE *f = fopen(path, "rb");
+    unsigned int i, k, video_offset = FRAME_VIDEO_OFFSET;
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    // Frames start after the header sector, if there is one, and their
+    // video after however many samples it says they have
+    if (fread(frame, ENCODE_SECTOR_SIZE, 1, f) == 1 && memcmp(frame, CONTAINER_MAGIC, 4) == 0) {
+        video_offset = FRAME_AUDIO_OFFSET + AUDIO_BLOCK_BYTES(frame[CONTAINER_FRAME_SAMPLES_OFFSET]
+                | frame[CONTAINER_FRAME_SAMPLES_OFFSET + 1] << 8);
+    } else {
+        rewind(f);
+    }
+    while (fread(frame, ENCODE_SECTOR_SIZE, 1, f) == 1) {
+        unsigned int sectors = frame[FRAME_SECTORS_OFFSET];
+        const uint8_t *src = frame + video_offset;
+
+        if (sectors == 0 || sectors > ENCODE_MAX_SECTORS
+                || fread(frame + ENCODE_SECTOR_SIZE, ENCODE_SECTOR_SIZE, sectors - 1, f) != sectors - 1) {
+            fprintf(stderr, "%s: bad frame %lu\n", path, t->frames);
+            exit(1);
+        }
+        // Pack the decoded lines back up to get the raw frame
+        memset(packed, 0, sizeof(packed));
+        for (i = 0; i < VIDEO_LINES; i++) {
+            src = video_decode_line(src, line);
+            for (k = 0; k < VIDEO_LINE_PIXELS; k++) {
+                if (line[k]) {
+                    packed[i * VIDEO_LINE_BYTES + k / 8] |= 0x80 >> (k % 8);
+                }
+            }
+        }
+        bench_frame(t, frame + video_offset, src - (frame + video_offset), packed);
+        if (frame[FRAME_NEXT_SECTORS_OFFSET] == 0) {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Step over every line of frames of random bytes: however the codes come
+ * out, it mustn't get past the end of the frame.
+ */
+static void check_damaged() {
+    uint8_t frame[VIDEO_LINES * VIDEO_RLE_MAX_LINE];
+    const uint8_t *src, *end = frame + sizeof(frame) / 4;
+    uint32_t random = 0x2545F491;
+    unsigned int n, i;
+
+    for (n = 0; n < 100; n++) {
+        for (i = 0; i < sizeof(frame); i++) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            frame[i] = random;
+        }
+        src = frame;
+        for (i = 0; i < VIDEO_LINES; i++) {
+            src = video_skip_line(src, end);
+            if (src > end) {
+                fprintf(stderr, "damaged frame %u: line %u skipped past the end\n", n, i);
+                exit(1);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    struct totals t = { 0 };
+    struct stat st;
+    double frames, saved_us, cost_ratio;
+
+    if (argc > 1 && stat(argv[1], &st) == 0) {
+        bench_image(&t, argv[1]);
+    } else {
+        bench_synth(&t, argc > 1 ? strtoul(argv[1], NULL, 0) : 300);
+    }
+    if (t.frames == 0) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+    check_damaged();
+
+    frames = t.frames;
+    // Bus time at full speed (SMCLK / 1)
+    saved_us = (double)(t.raw_sectors - t.rle_sectors) * SECTOR_BYTES * 8 * 1e6 / HOST_SMCLK_HZ / frames;
+    cost_ratio = (double)t.rle_ns / t.raw_ns;
+    printf("%lu frames, all lines decode identically\n", t.frames);
+    printf("%-6s %12s %12s %12s\n", "video", "bytes", "sectors", "host ns");
+    printf("%-6s %12.1f %12.2f %12.1f\n", "raw", t.raw_bytes / frames, t.raw_sectors / frames, t.raw_ns / frames);
+    printf("%-6s %12.1f %12.2f %12.1f\n", "rle", t.rle_bytes / frames, t.rle_sectors / frames, t.rle_ns / frames);
+    printf("video %.2fx smaller, %.1f us of SD transfer saved per frame; decode takes %.2fx as long\n",
+           (double)t.raw_bytes / t.rle_bytes, saved_us, cost_ratio);
+    return 0;
+}
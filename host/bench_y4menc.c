@@ -0,0 +1,252 @@
+/*
+ * bench_y4menc.c
+ *
+ *  Does y4menc make the same image as convert.py's one-picture-at-a-time
+ *  loop, and how many pictures a second does it get through?  First
+ *  checks pack_frame() against pack_frame_reference() (the whole picture
+ *  thresholded and resized pixel by pixel, the way OpenCV does it) over
+ *  synthetic pictures at a few sizes: down to a third, to exactly half
+ *  (which OpenCV does differently), from HD, not resized at all, blown up,
+ *  and odd sizes in full range.
+ *
+ *  Then encodes the same synthetic 480x360 video (Bad Apple's size) the
+ *  reference way on one thread, and through encpool with the vector kernel
+ *  on no threads and on a few, checks every image comes out byte for byte
+ *  the same, and reports pictures per second for each.  The thread counts
+ *  only say anything about encpool on a machine with that many CPUs; with
+ *  one, the speedup is all the kernel's.
+ *
+ *      bench_y4menc
+ *
+ *  Exits 1 if any picture or image differs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "synth.h"
+#include "encode.h"
+#include "encpool.h"
+#include "pack.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_FRAMES 30
+#define BENCH_WIDTH 480
+#define BENCH_HEIGHT 360
+// Pictures encoded per run, going round this many different ones
+#define BENCH_PICTURES 600
+#define BENCH_DISTINCT 60
+#define REPEATS 2
+
+struct source {
+    unsigned int width, height;
+    bool full_range;
+};
+
+static const struct source sources[] = {
+    { 480, 360, false },
+    { 1920, 1080, false },
+    { 320, 256, false },
+    { 160, 128, true },
+    { 100, 80, false },
+    { 641, 359, true },
+};
+
+static const unsigned int thread_counts[] = { 0, 1, 2, 4, 8 };
+
+static double clamp01(double v) {
+    return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+/*
+ * Picture `n` at any size: a soft-edged ball bouncing over a wavy horizon,
+ * with a fine ripple over the lot so plenty of pixels land either side of
+ * the threshold.
+ */
+static void source_frame(unsigned long n, const struct source *s, uint8_t *luma) {
+    double cx = 0.5 + 0.35 * sin(n * 0.05), cy = 0.45 + 0.3 * cos(n * 0.07);
+    double aspect = (double)s->width / s->height;
+    unsigned int x, y;
+
+    for (y = 0; y < s->height; y++) {
+        for (x = 0; x < s->width; x++) {
+            double u = (x + 0.5) / s->width, v = (y + 0.5) / s->height;
+            double d = hypot((u - cx) * aspect, v - cy);
+            double ball = clamp01((0.25 - d) * 30 + 0.5);
+            double ground = v > 0.75 + 0.05 * sin(u * 12 + n * 0.1) ? 1 : 0;
+            double level = clamp01(fabs(ball - ground) + 0.1 * sin(x * 0.9 + y * 0.4 + n));
+            luma[y * s->width + x] = s->full_range ? lrint(level * 255) : 16 + lrint(level * 219);
+        }
+    }
+}
+
+static bool check_kernel(const struct source *s) {
+    static struct pack_plan plan;
+    uint8_t fast[ENCODE_VIDEO_SIZE], slow[ENCODE_VIDEO_SIZE];
+    uint8_t *luma = malloc((size_t)s->width * s->height);
+    unsigned long n, wrong = 0, white = 0;
+    unsigned int i;
+
+    if (!luma) {
+        perror("malloc");
+        exit(2);
+    }
+    pack_plan_init(&plan, s->width, s->height, s->full_range);
+    for (n = 0; n < CHECK_FRAMES; n++) {
+        source_frame(n, s, luma);
+        pack_frame(&plan, luma, s->width, fast);
+        pack_frame_reference(s->width, s->height, s->full_range, luma, s->width, slow);
+        wrong += memcmp(fast, slow, sizeof(fast)) != 0;
+        for (i = 0; i < sizeof(slow); i++) {
+            white += __builtin_popcount(slow[i]);
+        }
+    }
+    free(luma);
+    printf("%4ux%-4u %-7s %8lu %8lu %7.1f%% %s\n", s->width, s->height, s->full_range ? "full" : "limited",
+           (unsigned long)CHECK_FRAMES, wrong, 100.0 * white / (CHECK_FRAMES * PACK_WIDTH * PACK_HEIGHT),
+           wrong ? "FAIL" : "");
+    return !wrong;
+}
+
+static uint8_t *read_all(FILE *f, size_t *size) {
+    uint8_t *data;
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    data = malloc(*size);
+    if (!data || fread(data, 1, *size, f) != *size) {
+        perror("tmpfile");
+        exit(2);
+    }
+    fclose(f);
+    return data;
+}
+
+static FILE *open_tmp() {
+    FILE *f = tmpfile();
+    if (!f) {
+        perror("tmpfile");
+        exit(2);
+    }
+    return f;
+}
+
+/*
+ * Picture `n`'s sound: the synthetic track, REPEATS frames of it a picture.
+ */
+static void source_audio(unsigned long n, uint8_t *audio) {
+    unsigned int i;
+    for (i = 0; i < REPEATS; i++) {
+        synth_audio(n * REPEATS + i, audio + i * AUDIO_FRAME_SIZE);
+    }
+}
+
+/*
+ * convert.py's loop: each picture thresholded, resized and packed whole,
+ * then written twice.  Returns the image, and how long it took.
+ */
+static uint8_t *encode_reference(uint8_t *const *pictures, const struct source *s, size_t *size, uint64_t *ns) {
+    static struct encoder e;
+    uint8_t video[ENCODE_VIDEO_SIZE], audio[REPEATS * AUDIO_FRAME_SIZE];
+    FILE *f = open_tmp();
+    uint64_t start = host_now_ns();
+    unsigned long n;
+    unsigned int i;
+
+    encode_open(&e, f, 0);
+    encode_chapter(&e);
+    for (n = 0; n < BENCH_PICTURES; n++) {
+        pack_frame_reference(s->width, s->height, s->full_range, pictures[n % BENCH_DISTINCT], s->width, video);
+        source_audio(n, audio);
+        for (i = 0; i < REPEATS; i++) {
+            encode_frame(&e, video, audio + i * AUDIO_FRAME_SIZE);
+        }
+    }
+    encode_close(&e);
+    *ns = host_now_ns() - start;
+    return read_all(f, size);
+}
+
+static uint8_t *encode_pool(uint8_t *const *pictures, const struct source *s, unsigned int threads, size_t *size,
+                            uint64_t *ns) {
+    static struct encoder e;
+    static struct pack_plan plan;
+    struct encpool pool;
+    uint8_t *luma, *audio;
+    FILE *f = open_tmp();
+    uint64_t start = host_now_ns();
+    unsigned long n;
+
+    encode_open(&e, f, 0);
+    pack_plan_init(&plan, s->width, s->height, s->full_range);
+    encpool_start(&pool, &e, &plan, REPEATS, threads);
+    encpool_chapter(&pool);
+    for (n = 0; n < BENCH_PICTURES; n++) {
+        encpool_next(&pool, &luma, &audio);
+        // Stands in for reading the frame
+        memcpy(luma, pictures[n % BENCH_DISTINCT], (size_t)s->width * s->height);
+        source_audio(n, audio);
+        encpool_submit(&pool);
+    }
+    encpool_finish(&pool);
+    encode_close(&e);
+    *ns = host_now_ns() - start;
+    return read_all(f, size);
+}
+
+static double per_second(uint64_t ns) {
+    return BENCH_PICTURES / (ns / 1e9);
+}
+
+int main() {
+    const struct source bench = { BENCH_WIDTH, BENCH_HEIGHT, false };
+    uint8_t *pictures[BENCH_DISTINCT], *want, *got;
+    size_t want_size, got_size;
+    uint64_t want_ns, ns;
+    bool ok = true, same;
+    unsigned int i;
+    long cpus;
+
+    printf("%-9s %-7s %8s %8s %8s\n", "source", "range", "pictures", "wrong", "white");
+    for (i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        ok &= check_kernel(&sources[i]);
+    }
+    printf("\n");
+
+    for (i = 0; i < BENCH_DISTINCT; i++) {
+        pictures[i] = malloc(BENCH_WIDTH * BENCH_HEIGHT);
+        if (!pictures[i]) {
+            perror("malloc");
+            return 2;
+        }
+        source_frame(i, &bench, pictures[i]);
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%u %ux%u pictures, each written %u times, on %ld CPU%s\n", BENCH_PICTURES, BENCH_WIDTH, BENCH_HEIGHT, REPEATS,
+           cpus, cpus == 1 ? "" : "s");
+    printf("%-22s %12s %8s\n", "encoder", "pictures/s", "speedup");
+    want = encode_reference(pictures, &bench, &want_size, &want_ns);
+    printf("%-22s %12.0f %7.1fx\n", "reference, 1 thread", per_second(want_ns), 1.0);
+    for (i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        char name[32];
+
+        got = encode_pool(pictures, &bench, thread_counts[i], &got_size, &ns);
+        same = got_size == want_size && memcmp(got, want, want_size) == 0;
+        snprintf(name, sizeof(name), "encpool, %u thread%s", thread_counts[i], thread_counts[i] == 1 ? "" : "s");
+        printf("%-22s %12.0f %7.1fx %s\n", name, per_second(ns), (double)want_ns / ns, same ? "" : "DIFFERENT");
+        ok &= same;
+        free(got);
+    }
+    printf("image %zu bytes\n", want_size);
+
+    free(want);
+    for (i = 0; i < BENCH_DISTINCT; i++) {
+        free(pictures[i]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+/*
+ * cardview.c
+ *
+ *  Makes sense of what the card tester (cardtest.h) found: a dump of
+ *  cardtest_results off the board, or a run of the same code against the
+ *  emulated card here.  Prints how long the card took to start sending
+ *  each sector (token) and to send it (transfer), for the sequential and
+ *  the random reads, with a histogram of each and the slowest sectors, and
+ *  how deep the jitter buffer would have to be to ride out the slowest
+ *  sector of the stream.
+ *
+ *      cardview [-w sectors] results.bin
+ *      cardview -c image.bin [-L first:next[:tail[:one_in:ms]]] [-S sectors:ms]
+ *               [-o results.bin] [-w sectors]
+ *
+ *  -c tests the emulated card, backed by `image.bin`, with latencies
+ *  injected the way badapple's -L and -S do, and -o saves what it found in
+ *  the board's format.  The random reads only cover as much of the card as
+ *  the image does.  -w is how many of the slowest sectors to list.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "cardtest.h"
+#include "jitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BAR_WIDTH 40
+
+static const char *sweep_names[CARDTEST_SWEEPS] = {
+    [CARDTEST_SWEEP_SEQUENTIAL] = "sequential (CMD18)",
+    [CARDTEST_SWEEP_RANDOM] = "random (CMD17)",
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-w sectors] results.bin\n"
+            "       %s -c image.bin [-L first:next[:tail[:one_in:ms]]] [-S sectors:ms] [-o results.bin] [-w sectors]\n",
+            argv0, argv0);
+    exit(2);
+}
+
+/*
+ * The time at least `fraction` of the sectors took no longer than, to the
+ * top of its bin (or the slowest, if that's less).
+ */
+static uint32_t percentile(const struct cardtest_histogram *h, uint32_t count, double fraction) {
+    uint32_t seen = 0;
+    unsigned int b;
+
+    for (b = 0; b + 1 < CARDTEST_BINS; b++) {
+        seen += h->bins[b];
+        if (seen >= fraction * count) {
+            return MIN(cardtest_bin_floor(b + 1) - 1, h->max_us);
+        }
+    }
+    return h->max_us;
+}
+
+static void print_histogram(const char *name, const struct cardtest_histogram *h, uint32_t count) {
+    uint32_t most = 0;
+    unsigned int b, first = CARDTEST_BINS, last = 0;
+
+    printf("  %-8s min %8u  mean %10.1f  median <= %8u  99%% <= %8u  max %8u us\n", name, h->min_us,
+           (double)h->total_us / count, percentile(h, count, 0.5), percentile(h, count, 0.99), h->max_us);
+    for (b = 0; b < CARDTEST_BINS; b++) {
+        if (h->bins[b]) {
+            first = b < first ? b : first;
+            last = b;
+            most = h->bins[b] > most ? h->bins[b] : most;
+        }
+    }
+    for (b = first; b <= last && first < CARDTEST_BINS; b++) {
+        unsigned int width = (h->bins[b] * BAR_WIDTH + most - 1) / most;
+        if (!h->bins[b]) {
+            // One line for a run of empty bins, so the gap still shows
+            if (h->bins[b - 1]) {
+                printf("    ...\n");
+            }
+            continue;
+        }
+        printf("    < %8u us %8u |%.*s\n", b + 1 < CARDTEST_BINS ? cardtest_bin_floor(b + 1) : UINT32_MAX,
+               h->bins[b], width, "########################################");
+    }
+}
+
+static int by_token(const void *a, const void *b) {
+    const struct cardtest_sector *sa = a, *sb = b;
+    return sa->token_us < sb->token_us ? 1 : sa->token_us > sb->token_us ? -1 : 0;
+}
+
+static void print_sweep(unsigned int s, const struct cardtest_sweep *sweep, unsigned long worst) {
+    struct cardtest_sector sorted[CARDTEST_WORST];
+    unsigned int i, n = MIN(sweep->count, CARDTEST_WORST);
+
+    printf("\n%s: %u sectors", sweep_names[s], sweep->count);
+    if (s == CARDTEST_SWEEP_SEQUENTIAL) {
+        printf(" from %u", sweep->first);
+    } else {
+        printf(" from the first %u", sweep->span);
+    }
+    printf(", %u failed\n", sweep->errors);
+    if (!sweep->count) {
+        return;
+    }
+    print_histogram("token", &sweep->token, sweep->count);
+    print_histogram("transfer", &sweep->transfer, sweep->count);
+
+    memcpy(sorted, sweep->worst, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), by_token);
+    printf("  slowest:\n");
+    for (i = 0; i < n && i < worst; i++) {
+        printf("    sector %10u  token %8u us  transfer %6u us\n", sorted[i].sector, sorted[i].token_us,
+               sorted[i].transfer_us);
+    }
+}
+
+static void report(const struct cardtest_results *r, unsigned long worst) {
+    static const char *types[] = { "unknown", "SD1", "SD2", "SDHC" };
+    const struct cardtest_sweep *stream = &r->sweeps[CARDTEST_SWEEP_SEQUENTIAL];
+    uint32_t frame_us = HOST_FRAME_NS / 1000;
+    unsigned int s, frames;
+
+    printf("%s card%s%s", types[r->card_type < 4 ? r->card_type : 0],
+           (r->flags & CARDTEST_DONE) ? "" : ", didn't finish",
+           (r->flags & CARDTEST_GAVE_UP) ? ", gave up on read errors" : "");
+    if (r->error) {
+        printf(", last error %u", r->error);
+    }
+    printf("\n");
+    for (s = 0; s < CARDTEST_SWEEPS; s++) {
+        print_sweep(s, &r->sweeps[s], worst);
+    }
+    if (!stream->count) {
+        return;
+    }
+    // Frames the player has to have read ahead to keep drawing through the
+    // slowest sector, plus the one being drawn
+    frames = (stream->token.max_us + frame_us - 1) / frame_us;
+    printf("\nslowest sector of the stream held it up %.1f ms, %u frames: the jitter buffer needs %u slots"
+           " to ride that out (it has %u)\n", stream->token.max_us / 1e3, frames, frames + 1, JITTER_SLOTS);
+}
+
+static bool read_results(const char *path, struct cardtest_results *r) {
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    if (fread(r, sizeof(*r), 1, f) != 1 || r->magic != CARDTEST_MAGIC) {
+        fprintf(stderr, "%s: not card tester results\n", path);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    return true;
+}
+
+static bool write_results(const char *path, const struct cardtest_results *r) {
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fwrite(r, sizeof(*r), 1, f);
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *image = NULL, *out = NULL;
+    unsigned long worst = 5;
+    struct cardtest_results r;
+    char *end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:L:S:o:w:")) != -1) {
+        switch (opt) {
+        case 'c':
+            image = optarg;
+            break;
+        case 'L':
+            if (!sd_emu_parse_latency(optarg, &host_options.sd_latency)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            host_options.sd_latency.stall_every = strtoul(optarg, &end, 0);
+            if (*end != ':') {
+                usage(argv[0]);
+            }
+            host_options.sd_latency.stall_ns = strtod(end + 1, NULL) * 1e6;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'w':
+            worst = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (image ? optind != argc : optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    if (image) {
+        host_options.image = image;
+        hal_init();
+        spi_init();
+        if (!sd_init()) {
+            fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+            return 2;
+        }
+        cardtest_run(MIN(CARDTEST_SPAN, sd_emu_sectors()));
+        r = cardtest_results;
+        if (out && !write_results(out, &r)) {
+            return 2;
+        }
+    } else if (!read_results(argv[optind], &r)) {
+        return 2;
+    }
+    report(&r, worst);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * encode.c
+ *
+ *  Keep this in step with convert.py: encode_line() is its encode_line(),
+ *  encode_audio() its AudioEncoder, encode_frame() its encode_frame() +
+ *  FrameWriter.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "encode.h"
+#include "synth.h"
+#include "seek.h"
+#include "defines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int pixel(const uint8_t *packed, unsigned int p) {
+    return (packed[p / 8] >> (7 - p % 8)) & 1;
+}
+
+/*
+ * Length of the run of same-coloured pixels starting at `p`, up to the
+ * longest a run code can hold.
+ */
+static unsigned int run_at(const uint8_t *packed, unsigned int p) {
+    unsigned int colour = pixel(packed, p);
+    unsigned int r = 1;
+    while (p + r < VIDEO_LINE_PIXELS && r < VIDEO_RLE_MAX_RUN && pixel(packed, p + r) == colour) {
+        r++;
+    }
+    return r;
+}
+
+size_t encode_line(const uint8_t *packed, uint8_t *out, unsigned int flags) {
+    uint8_t codes[VIDEO_LINE_PIXELS];
+    unsigned int p = 0, q, i;
+    size_t n = 0;
+
+    while (!(flags & ENCODE_LITERAL) && p < VIDEO_LINE_PIXELS) {
+        unsigned int r = run_at(packed, p);
+        if (r >= 8 || p + 8 > VIDEO_LINE_PIXELS) {
+            codes[n++] = VIDEO_RLE_RUN | (pixel(packed, p) ? VIDEO_RLE_WHITE : 0) | (r - 1);
+            p += r;
+        } else {
+            // Pack pixels up until the next run worth coding as one
+            q = p + 8;
+            while (q + 8 <= VIDEO_LINE_PIXELS && run_at(packed, q) < 8) {
+                q += 8;
+            }
+            codes[n++] = (q - p) / 8 - 1;
+            for (; p < q; p += 8) {
+                uint8_t b = 0;
+                for (i = 0; i < 8; i++) {
+                    b = (b << 1) | pixel(packed, p + i);
+                }
+                codes[n++] = b;
+            }
+        }
+    }
+
+    if ((flags & ENCODE_LITERAL) || n > VIDEO_RLE_MAX_LINE) {
+        // The whole line as one literal
+        out[0] = VIDEO_LINE_BYTES - 1;
+        memcpy(out + 1, packed, VIDEO_LINE_BYTES);
+        return VIDEO_RLE_MAX_LINE;
+    }
+    memcpy(out, codes, n);
+    return n;
+}
+
+/*
+ * Code one sample, updating the state exactly the way audio_decode() will.
+ */
+static uint8_t encode_sample(struct encode_audio_state *s, int32_t sample) {
+    int32_t delta = sample - s->predictor;
+    uint16_t step = audio_steps[s->index];
+    uint16_t diff = step >> 3;
+    uint8_t code = 0;
+
+    if (delta < 0) {
+        code = 8;
+        delta = -delta;
+    }
+    if (delta >= step) {
+        code |= 4;
+        delta -= step;
+        diff += step;
+    }
+    step >>= 1;
+    if (delta >= step) {
+        code |= 2;
+        delta -= step;
+        diff += step;
+    }
+    step >>= 1;
+    if (delta >= step) {
+        code |= 1;
+        diff += step;
+    }
+
+    if (code & 8) {
+        s->predictor = MAX(s->predictor - diff, INT16_MIN);
+    } else {
+        s->predictor = MIN(s->predictor + diff, INT16_MAX);
+    }
+    s->index = MIN(MAX(s->index + audio_index_adjust[code & 7], 0), AUDIO_MAX_INDEX);
+    return code;
+}
+
+void encode_audio(struct encode_audio_state *s, const uint8_t *samples, unsigned int count, uint8_t *block) {
+    unsigned int i;
+
+    block[0] = (uint16_t)s->predictor & 0xFF;
+    block[1] = (uint16_t)s->predictor >> 8;
+    block[2] = s->index;
+    block[3] = 0;
+    for (i = 0; i < count; i += 2) {
+        uint8_t lo = encode_sample(s, (samples[i] - 128) * 256);
+        uint8_t hi = encode_sample(s, (samples[i + 1] - 128) * 256);
+        block[AUDIO_BLOCK_HEADER + i / 2] = lo | hi << 4;
+    }
+}
+
+// Index entries are this many frames apart, or a multiple of it
+#define INDEX_STEP 30
+
+static void put32(uint8_t *p, uint32_t n) {
+    p[0] = n;
+    p[1] = n >> 8;
+    p[2] = n >> 16;
+    p[3] = n >> 24;
+}
+
+void encode_open(struct encoder *e, FILE *f, unsigned int flags) {
+    uint8_t index[CONTAINER_SIZE] = { 0 };
+
+    memset(e, 0, sizeof(*e));
+    e->f = f;
+    e->flags = flags;
+    e->sample_rate = CONTAINER_DEFAULT_SAMPLE_RATE;
+    e->frame_samples = AUDIO_FRAME_SIZE;
+    // Room for the header, filled in once we know where everything went
+    fwrite(index, 1, sizeof(index), f);
+}
+
+void encode_set_audio(struct encoder *e, unsigned int sample_rate, unsigned int frame_samples) {
+    e->sample_rate = sample_rate;
+    e->frame_samples = frame_samples;
+}
+
+void encode_chapter(struct encoder *e) {
+    if (e->chapters < SEEK_MAX_CHAPTERS) {
+        e->chapter[e->chapters++] = e->frames;
+    }
+}
+
+static void put16(uint8_t *p, unsigned int n) {
+    p[0] = n;
+    p[1] = n >> 8;
+}
+
+/*
+ * The header sector for the frames written so far: see container.h and
+ * seek.h.
+ */
+static void write_header(struct encoder *e) {
+    uint8_t index[CONTAINER_SIZE] = { 0 };
+    unsigned long interval = INDEX_STEP, entries, i;
+
+    while ((e->frames + interval - 1) / interval > SEEK_MAX_ENTRIES) {
+        interval += INDEX_STEP;
+    }
+    entries = (e->frames + interval - 1) / interval;
+    memcpy(index, CONTAINER_MAGIC, 4);
+    put16(index + CONTAINER_VERSION_OFFSET, CONTAINER_VERSION);
+    put16(index + CONTAINER_LINES_OFFSET, VIDEO_LINES);
+    put16(index + CONTAINER_LINE_PIXELS_OFFSET, VIDEO_LINE_PIXELS);
+    put16(index + CONTAINER_SAMPLE_RATE_OFFSET, e->sample_rate);
+    put16(index + CONTAINER_FRAME_SAMPLES_OFFSET, e->frame_samples);
+    put32(index + SEEK_FRAMES_OFFSET, e->frames);
+    put16(index + SEEK_INTERVAL_OFFSET, interval);
+    put16(index + SEEK_ENTRIES_OFFSET, entries);
+    index[SEEK_CHAPTERS_OFFSET] = e->chapters;
+    for (i = 0; i < e->chapters; i++) {
+        put32(index + SEEK_CHAPTER_TABLE_OFFSET + i * 8, e->chapter[i]);
+        put32(index + SEEK_CHAPTER_TABLE_OFFSET + i * 8 + 4, e->blocks[e->chapter[i]]);
+    }
+    for (i = 0; i < entries; i++) {
+        put32(index + SEEK_ENTRY_TABLE_OFFSET + i * 4, e->blocks[i * interval]);
+    }
+    fseek(e->f, CONTAINER_BLOCK * ENCODE_SECTOR_SIZE, SEEK_SET);
+    fwrite(index, 1, sizeof(index), e->f);
+    fseek(e->f, 0, SEEK_END);
+}
+
+static void flush(struct encoder *e, unsigned int next_sectors) {
+    if (!e->pending_sectors) {
+        return;
+    }
+    e->pending[FRAME_NEXT_SECTORS_OFFSET] = next_sectors;
+    fwrite(e->pending, ENCODE_SECTOR_SIZE, e->pending_sectors, e->f);
+    e->pending_sectors = 0;
+}
+
+size_t encode_lines(const uint8_t *video, uint8_t *out, unsigned int flags) {
+    size_t size = 0;
+    unsigned int i;
+
+    for (i = 0; i < VIDEO_LINES; i++) {
+        size += encode_line(video + i * VIDEO_LINE_BYTES, out + size, flags);
+    }
+    return size;
+}
+
+void encode_frame(struct encoder *e, const uint8_t *video, const uint8_t *audio) {
+    uint8_t lines[ENCODE_MAX_LINES];
+
+    encode_coded_frame(e, video, lines, encode_lines(video, lines, e->flags), audio);
+}
+
+void encode_coded_frame(struct encoder *e, const uint8_t *video, const uint8_t *lines, size_t lines_size,
+                        const uint8_t *audio) {
+    uint8_t frame[ENCODE_MAX_SECTORS * ENCODE_SECTOR_SIZE] = { 0 };
+    size_t size = FRAME_AUDIO_OFFSET + AUDIO_BLOCK_BYTES(e->frame_samples);
+    unsigned int i, sectors;
+
+    if (e->have_prev && !(e->flags & ENCODE_NO_CLEAN)) {
+        for (i = 0; i < VIDEO_LINES; i++) {
+            if (memcmp(e->prev + i * VIDEO_LINE_BYTES, video + i * VIDEO_LINE_BYTES, VIDEO_LINE_BYTES) == 0) {
+                frame[FRAME_CLEAN_OFFSET + i / 8] |= 0x80 >> (i % 8);
+            }
+        }
+    }
+    encode_audio(&e->audio, audio, e->frame_samples, frame + FRAME_AUDIO_OFFSET);
+    memcpy(frame + size, lines, lines_size);
+    size += lines_size;
+    sectors = (size + ENCODE_SECTOR_SIZE - 1) / ENCODE_SECTOR_SIZE;
+    frame[FRAME_SECTORS_OFFSET] = sectors;
+
+    flush(e, sectors);
+    if (e->frames % 1024 == 0) {
+        e->blocks = realloc(e->blocks, (e->frames + 1024) * sizeof(*e->blocks));
+        if (!e->blocks) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    // After the index and every frame so far
+    e->blocks[e->frames] = 1 + e->sectors;
+    memcpy(e->pending, frame, sizeof(frame));
+    e->pending_sectors = sectors;
+    memcpy(e->prev, video, ENCODE_VIDEO_SIZE);
+    e->have_prev = true;
+    e->frames++;
+    e->bytes += size;
+    e->sectors += sectors;
+}
+
+void encode_close(struct encoder *e) {
+    flush(e, 0);
+    write_header(e);
+    free(e->blocks);
+    e->blocks = NULL;
+}
+
+void encode_synth_image(char *path, unsigned long frames, unsigned int flags) {
+    uint8_t video[SYNTH_VIDEO_SIZE], audio[SYNTH_AUDIO_SIZE];
+    struct encoder *e = malloc(sizeof(*e));
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+    unsigned long n;
+
+    if (!f || !e) {
+        perror(path);
+        exit(2);
+    }
+    encode_open(e, f, flags);
+    encode_chapter(e);
+    for (n = 0; n < frames; n++) {
+        synth_video((flags & ENCODE_DUPLICATE) ? n / 2 : n, video);
+        synth_audio(n, audio);
+        encode_frame(e, video, audio);
+    }
+    encode_close(e);
+    fclose(f);
+    free(e);
+}
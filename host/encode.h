@@ -0,0 +1,127 @@
+/*
+ * encode.h
+ *
+ *  C version of convert.py's frame encoder (see video.h for the format),
+ *  so the host tools can make images out of synthetic content.  Given
+ *  the same frames it writes the same bytes as convert.py.
+ */
+
+#ifndef HOST_ENCODE_H_
+#define HOST_ENCODE_H_
+
+#include "video.h"
+#include "audio.h"
+#include "container.h"
+#include "seek.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ENCODE_SECTOR_SIZE 512
+#define ENCODE_MAX_SECTORS ((FRAME_MAX_SIZE + ENCODE_SECTOR_SIZE - 1) / ENCODE_SECTOR_SIZE)
+#define ENCODE_VIDEO_SIZE (VIDEO_LINES * VIDEO_LINE_BYTES)
+// A frame's worth of run-length coded lines, at their longest
+#define ENCODE_MAX_LINES (VIDEO_LINES * VIDEO_RLE_MAX_LINE)
+
+// Encoder options
+#define ENCODE_NO_CLEAN 0x01    // no clean-line maps: every frame is drawn in full
+#define ENCODE_LITERAL 0x02     // no runs: every line is one 16-byte literal
+#define ENCODE_DUPLICATE 0x04   // (synthetic images) every video frame twice, like a 15 fps source
+
+// ADPCM encoder state, carried on from frame to frame
+struct encode_audio_state {
+    int32_t predictor;
+    int16_t index;
+};
+
+struct encoder {
+    FILE *f;
+    unsigned int flags;
+    struct encode_audio_state audio;
+    uint8_t prev[ENCODE_VIDEO_SIZE];    // last frame's packed video
+    bool have_prev;
+    // Frames are written one behind, once we know how long the next one is
+    uint8_t pending[ENCODE_MAX_SECTORS * ENCODE_SECTOR_SIZE];
+    unsigned int pending_sectors;
+    unsigned long frames;
+    uint64_t bytes;                     // unpadded frame bytes so far
+    uint64_t sectors;
+    // For the header: the audio format, where every frame starts, and
+    // the chapters
+    unsigned int sample_rate;
+    unsigned int frame_samples;
+    uint32_t *blocks;
+    unsigned long chapter[SEEK_MAX_CHAPTERS];
+    unsigned int chapters;
+};
+
+/**
+ * Run-length code one line of 16 packed bytes into `out` (at most
+ * VIDEO_RLE_MAX_LINE bytes), returning its length.
+ */
+size_t encode_line(const uint8_t *packed, uint8_t *out, unsigned int flags);
+
+/**
+ * Run-length code all of a frame's lines, one after the other, into `out`
+ * (at most ENCODE_MAX_LINES bytes), returning their length.  It's the part
+ * of encode_frame() that doesn't depend on the frames before, so it can be
+ * done for several frames at once.
+ */
+size_t encode_lines(const uint8_t *video, uint8_t *out, unsigned int flags);
+
+/**
+ * ADPCM code `count` 8-bit unsigned samples (a frame's worth) into an
+ * AUDIO_BLOCK_BYTES(count) block.  Start `s` out zeroed.
+ */
+void encode_audio(struct encode_audio_state *s, const uint8_t *samples, unsigned int count, uint8_t *block);
+
+/**
+ * Start an image in `f`, which has to be seekable: the header sector
+ * (container.h) goes back in at the front once all the frames are
+ * written.  The audio is 44.1 kHz, AUDIO_FRAME_SIZE samples a frame.
+ */
+void encode_open(struct encoder *e, FILE *f, unsigned int flags);
+
+/**
+ * Change the audio format, before the first frame.  `frame_samples` (even,
+ * no more than AUDIO_FRAME_SIZE) sets the frame rate too.
+ */
+void encode_set_audio(struct encoder *e, unsigned int sample_rate, unsigned int frame_samples);
+
+/**
+ * Start a new chapter with the next frame.  Images usually start with one.
+ */
+void encode_chapter(struct encoder *e);
+
+/**
+ * Add a frame: ENCODE_VIDEO_SIZE bytes of packed lines and a frame's worth
+ * of 8-bit unsigned samples.
+ */
+void encode_frame(struct encoder *e, const uint8_t *video, const uint8_t *audio);
+
+/**
+ * encode_frame() with the lines already coded by encode_lines(), with the
+ * encoder's flags.
+ */
+void encode_coded_frame(struct encoder *e, const uint8_t *video, const uint8_t *lines, size_t lines_size,
+                        const uint8_t *audio);
+
+/**
+ * Write out the last frame and the index.  Doesn't close the file.
+ */
+void encode_close(struct encoder *e);
+
+/**
+ * Write `frames` frames of synth.h content, all one chapter, to a new
+ * temporary file named after the mkstemp() template `path`.
+ */
+void encode_synth_image(char *path, unsigned long frames, unsigned int flags);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_ENCODE_H_ */
@@ -0,0 +1,157 @@
+/*
+ * encpool.c
+ *
+ *  Frames go round a ring of slots: the feeding thread fills one and
+ *  submits it, any worker picks it up, and the feeding thread writes it
+ *  out when it comes round to the same slot again, or at the end.
+ */
+
+#include "encpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        perror("calloc");
+        exit(2);
+    }
+    return p;
+}
+
+static void encode_slot(struct encpool *p, struct encpool_slot *s) {
+    pack_frame(p->plan, s->luma, p->plan->width, s->video);
+    s->lines_size = encode_lines(s->video, s->lines, p->e->flags);
+}
+
+static void *worker(void *arg) {
+    struct encpool *p = arg;
+    struct encpool_slot *s;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->taken == p->submitted && !p->stopping) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->taken == p->submitted) {
+            break;
+        }
+        s = &p->slot[p->taken++ % p->slots];
+        pthread_mutex_unlock(&p->lock);
+
+        encode_slot(p, s);
+
+        pthread_mutex_lock(&p->lock);
+        s->done = true;
+        pthread_cond_broadcast(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+void encpool_start(struct encpool *p, struct encoder *e, const struct pack_plan *plan, unsigned int repeats,
+                   unsigned int threads) {
+    unsigned int i;
+
+    memset(p, 0, sizeof(*p));
+    p->e = e;
+    p->plan = plan;
+    p->repeats = repeats;
+    p->threads = threads;
+    p->slots = threads ? threads * ENCPOOL_SLOTS_PER_THREAD : 1;
+    p->slot = alloc(p->slots * sizeof(*p->slot));
+    for (i = 0; i < p->slots; i++) {
+        p->slot[i].luma = alloc((size_t)plan->width * plan->height);
+        p->slot[i].audio = alloc((size_t)repeats * AUDIO_FRAME_SIZE);
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->thread = alloc((threads ? threads : 1) * sizeof(*p->thread));
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&p->thread[i], NULL, worker, p) != 0) {
+            perror("pthread_create");
+            exit(2);
+        }
+    }
+}
+
+/*
+ * Write out the oldest frame not yet written, once it's been coded.
+ */
+static void write_next(struct encpool *p) {
+    struct encpool_slot *s = &p->slot[p->written % p->slots];
+    unsigned int i;
+
+    pthread_mutex_lock(&p->lock);
+    while (!s->done) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < p->repeats; i++) {
+        if (i == 0 && s->chapter) {
+            encode_chapter(p->e);
+        }
+        // The copies after the first have every line clean
+        encode_coded_frame(p->e, s->video, s->lines, s->lines_size, s->audio + i * p->e->frame_samples);
+    }
+    s->done = false;
+    p->written++;
+}
+
+void encpool_next(struct encpool *p, uint8_t **luma, uint8_t **audio) {
+    struct encpool_slot *s = &p->slot[p->submitted % p->slots];
+
+    if (p->submitted - p->written == p->slots) {
+        write_next(p);
+    }
+    *luma = s->luma;
+    *audio = s->audio;
+}
+
+void encpool_submit(struct encpool *p) {
+    struct encpool_slot *s = &p->slot[p->submitted % p->slots];
+
+    s->chapter = p->chapter;
+    p->chapter = false;
+    if (!p->threads) {
+        encode_slot(p, s);
+        s->done = true;
+        p->submitted++;
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->submitted++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void encpool_chapter(struct encpool *p) {
+    p->chapter = true;
+}
+
+void encpool_finish(struct encpool *p) {
+    unsigned int i;
+
+    while (p->written < p->submitted) {
+        write_next(p);
+    }
+    pthread_mutex_lock(&p->lock);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < p->threads; i++) {
+        pthread_join(p->thread[i], NULL);
+    }
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    pthread_mutex_destroy(&p->lock);
+    for (i = 0; i < p->slots; i++) {
+        free(p->slot[i].luma);
+        free(p->slot[i].audio);
+    }
+    free(p->slot);
+    free(p->thread);
+}
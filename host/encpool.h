@@ -0,0 +1,97 @@
+/*
+ * encpool.h
+ *
+ *  Encodes decoded video frames on a pool of threads: pack.h's threshold,
+ *  resize and packing, and encode_lines(), for as many frames at once as
+ *  there are threads.  Everything that depends on the frame before (the
+ *  clean-line maps, the audio, where each frame goes) is left to the
+ *  thread feeding it, which writes the frames out in order through an
+ *  encoder, so the image is the same whatever the thread count.
+ *
+ *      encpool_start(&pool, &e, &plan, 2, threads);
+ *      while (more) {
+ *          encpool_next(&pool, &luma, &audio);
+ *          ...read a frame into luma and its sound into audio...
+ *          encpool_submit(&pool);
+ *      }
+ *      encpool_finish(&pool);
+ *      encode_close(&e);
+ */
+
+#ifndef HOST_ENCPOOL_H_
+#define HOST_ENCPOOL_H_
+
+#include "encode.h"
+#include "pack.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames queued up per thread, so none of them waits on the reader
+#define ENCPOOL_SLOTS_PER_THREAD 4
+
+struct encpool_slot {
+    uint8_t *luma;                      // the frame, a plan->width byte stride
+    uint8_t *audio;                     // `repeats` frames of sound
+    bool chapter;                       // starts a chapter
+    bool done;                          // packed and coded, ready to write
+    uint8_t video[ENCODE_VIDEO_SIZE];
+    uint8_t lines[ENCODE_MAX_LINES];
+    size_t lines_size;
+};
+
+struct encpool {
+    struct encoder *e;
+    const struct pack_plan *plan;
+    unsigned int repeats;
+    unsigned int threads, slots;
+    struct encpool_slot *slot;
+    // Frames handed in, picked up by a thread, and written, so far
+    unsigned long submitted, taken, written;
+    bool chapter;
+    bool stopping;
+    pthread_t *thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+};
+
+/**
+ * Start `threads` threads (0 does each frame on the spot instead) encoding
+ * frames of `plan`'s size into `e`, each written `repeats` times, like
+ * convert.py writes every frame of its 15 fps source twice.  `plan` has to
+ * stay put until encpool_finish().
+ */
+void encpool_start(struct encpool *p, struct encoder *e, const struct pack_plan *plan, unsigned int repeats,
+                   unsigned int threads);
+
+/**
+ * Where to put the next frame: plan->width x plan->height bytes of luma,
+ * and `repeats` x e->frame_samples samples of 8-bit unsigned sound.  It
+ * might have to write out earlier frames first.
+ */
+void encpool_next(struct encpool *p, uint8_t **luma, uint8_t **audio);
+
+/**
+ * Queue the frame encpool_next() gave out.
+ */
+void encpool_submit(struct encpool *p);
+
+/**
+ * Start a new chapter with the next frame submitted.
+ */
+void encpool_chapter(struct encpool *p);
+
+/**
+ * Write out every frame submitted, and stop the threads.  The encoder
+ * still needs encode_close().
+ */
+void encpool_finish(struct encpool *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_ENCPOOL_H_ */
@@ -0,0 +1,223 @@
+/*
+ * fatgen.c
+ *
+ *  FAT32 card images, see fatgen.h.
+ */
+
+#include "fatgen.h"
+#include <string.h>
+
+#define SECTOR_SIZE 512
+// Where the partition starts on a card that has an MBR (1MB in, like
+// the SD Association's formatter)
+#define PARTITION_START 2048
+#define RESERVED_SECTORS 32
+#define FATS 2
+// Any fewer clusters and it's FAT16, whatever the boot sector says
+#define MIN_CLUSTERS 65525UL
+#define ROOT_CLUSTER 2
+#define FIRST_FILE_CLUSTER 3
+#define END_OF_CHAIN 0x0FFFFFFFUL
+
+static void put16(uint8_t *p, unsigned int n) {
+    p[0] = n;
+    p[1] = n >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t n) {
+    put16(p, n & 0xFFFF);
+    put16(p + 2, n >> 16);
+}
+
+static bool write_sector(FILE *out, uint32_t sector, const uint8_t *buf) {
+    return fseek(out, (long)sector * SECTOR_SIZE, SEEK_SET) == 0 && fwrite(buf, SECTOR_SIZE, 1, out) == 1;
+}
+
+/*
+ * The cluster the file's cluster `n` goes in: the pieces go one after the
+ * other, a free cluster apart.
+ */
+static uint32_t file_cluster(const struct fatgen *g, uint32_t n) {
+    return FIRST_FILE_CLUSTER + n + (g->fragment ? n / g->fragment : 0);
+}
+
+uint32_t fatgen_sector(const struct fatgen *g, uint32_t block) {
+    uint32_t cluster = file_cluster(g, block / g->cluster_sectors);
+    return g->data_start + (cluster - 2) * g->cluster_sectors + block % g->cluster_sectors;
+}
+
+/*
+ * Short name checksum, which a long name entry carries to show it goes
+ * with the entry after it.
+ */
+static uint8_t lfn_checksum(const uint8_t *name) {
+    uint8_t sum = 0;
+    int i;
+    for (i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    }
+    return sum;
+}
+
+/*
+ * The root directory: a volume label, a deleted file, then `name` with a
+ * lower case long name in front of it, so fat.c has something to skip.
+ */
+static void root_directory(uint8_t *dir, const char *name, uint32_t cluster, uint32_t size) {
+    // Where a long name entry keeps its 13 UTF-16 characters
+    static const uint8_t lfn_chars[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    uint8_t short_name[11];
+    uint8_t *entry = dir;
+    unsigned int i, n = 0;
+    const char *p;
+
+    memset(dir, 0, SECTOR_SIZE);
+    memcpy(entry, "BADAPPLE   ", 11);
+    entry[11] = 0x08;
+    entry += 32;
+
+    memcpy(entry, "\xE5OLDVID BIN", 11);
+    entry += 32;
+
+    memset(short_name, ' ', 11);
+    for (p = name; *p && *p != '.' && n < 8; p++) {
+        short_name[n++] = *p;
+    }
+    p = strchr(name, '.');
+    for (i = 8, p = p ? p + 1 : ""; *p && i < 11; p++) {
+        short_name[i++] = *p;
+    }
+
+    entry[0] = 0x41; // last (and only) long name entry
+    entry[11] = 0x0F;
+    entry[13] = lfn_checksum(short_name);
+    for (i = 0, p = name; i < 13; i++) {
+        uint16_t c = *p ? (*p >= 'A' && *p <= 'Z' ? *p - 'A' + 'a' : *p) : (i == strlen(name) ? 0 : 0xFFFF);
+        put16(entry + lfn_chars[i], c);
+        if (*p) {
+            p++;
+        }
+    }
+    entry += 32;
+
+    memcpy(entry, short_name, 11);
+    entry[11] = 0x20; // archive
+    put16(entry + 20, cluster >> 16);
+    put16(entry + 26, cluster & 0xFFFF);
+    put32(entry + 28, size);
+}
+
+bool fatgen_write(struct fatgen *g, FILE *out, const char *name, const uint8_t *data, size_t size) {
+    uint8_t buf[SECTOR_SIZE];
+    uint32_t volume = g->partitioned ? PARTITION_START : 0;
+    uint32_t blocks = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t file_clusters = (blocks + g->cluster_sectors - 1) / g->cluster_sectors;
+    uint32_t last = file_clusters ? file_cluster(g, file_clusters - 1) : ROOT_CLUSTER;
+    uint32_t clusters = last + 16 > MIN_CLUSTERS + 16 ? last + 16 : MIN_CLUSTERS + 16;
+    uint32_t fat_size = ((clusters + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t sectors = RESERVED_SECTORS + FATS * fat_size + clusters * g->cluster_sectors;
+    uint32_t fat_start = volume + RESERVED_SECTORS;
+    uint32_t n, s, f, entry;
+
+    g->data_start = fat_start + FATS * fat_size;
+    g->pieces = !file_clusters ? 0 : g->fragment ? (file_clusters + g->fragment - 1) / g->fragment : 1;
+
+    if (g->partitioned) {
+        memset(buf, 0, sizeof(buf));
+        buf[446 + 1] = 0xFE; // CHS addresses out of range: use the LBA ones
+        buf[446 + 2] = 0xFF;
+        buf[446 + 3] = 0xFF;
+        buf[446 + 4] = 0x0C; // FAT32, LBA
+        buf[446 + 5] = 0xFE;
+        buf[446 + 6] = 0xFF;
+        buf[446 + 7] = 0xFF;
+        put32(buf + 446 + 8, volume);
+        put32(buf + 446 + 12, sectors);
+        buf[510] = 0x55;
+        buf[511] = 0xAA;
+        if (!write_sector(out, 0, buf)) {
+            return false;
+        }
+    }
+
+    // Boot sector, and its backup
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "\xEB\x58\x90MSWIN4.1", 11);
+    put16(buf + 11, SECTOR_SIZE);
+    buf[13] = g->cluster_sectors;
+    put16(buf + 14, RESERVED_SECTORS);
+    buf[16] = FATS;
+    buf[21] = 0xF8; // fixed disk
+    put16(buf + 24, 63);
+    put16(buf + 26, 255);
+    put32(buf + 28, volume);
+    put32(buf + 32, sectors);
+    put32(buf + 36, fat_size);
+    put32(buf + 44, ROOT_CLUSTER);
+    put16(buf + 48, 1); // FSInfo
+    put16(buf + 50, 6); // backup boot sector
+    buf[64] = 0x80;
+    buf[66] = 0x29;
+    put32(buf + 67, 0x0BADA991);
+    memcpy(buf + 71, "BADAPPLE   FAT32   ", 19);
+    buf[510] = 0x55;
+    buf[511] = 0xAA;
+    if (!write_sector(out, volume, buf) || !write_sector(out, volume + 6, buf)) {
+        return false;
+    }
+
+    // FSInfo: free space unknown
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "RRaA", 4);
+    memcpy(buf + 484, "rrAa", 4);
+    put32(buf + 488, 0xFFFFFFFF);
+    put32(buf + 492, 0xFFFFFFFF);
+    put32(buf + 508, 0xAA550000);
+    if (!write_sector(out, volume + 1, buf)) {
+        return false;
+    }
+
+    // Both FATs: the two reserved entries, the root directory, then the
+    // file's chain.  Clusters come in order, so each FAT sector is done
+    // once.
+    for (f = 0; f < FATS; f++) {
+        memset(buf, 0, sizeof(buf));
+        put32(buf, 0x0FFFFFF8);
+        put32(buf + 4, END_OF_CHAIN);
+        put32(buf + ROOT_CLUSTER * 4, END_OF_CHAIN);
+        s = 0;
+        for (n = 0; n < file_clusters; n++) {
+            uint32_t cluster = file_cluster(g, n);
+            if (cluster / (SECTOR_SIZE / 4) != s) {
+                if (!write_sector(out, fat_start + f * fat_size + s, buf)) {
+                    return false;
+                }
+                memset(buf, 0, sizeof(buf));
+                s = cluster / (SECTOR_SIZE / 4);
+            }
+            entry = n + 1 < file_clusters ? file_cluster(g, n + 1) : END_OF_CHAIN;
+            put32(buf + cluster % (SECTOR_SIZE / 4) * 4, entry);
+        }
+        if (!write_sector(out, fat_start + f * fat_size + s, buf)) {
+            return false;
+        }
+    }
+
+    root_directory(buf, name, file_clusters ? FIRST_FILE_CLUSTER : 0, size);
+    if (!write_sector(out, g->data_start, buf)) {
+        return false;
+    }
+
+    for (n = 0; n < blocks; n++) {
+        size_t left = size - (size_t)n * SECTOR_SIZE;
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, data + (size_t)n * SECTOR_SIZE, left < SECTOR_SIZE ? left : SECTOR_SIZE);
+        if (!write_sector(out, fatgen_sector(g, n), buf)) {
+            return false;
+        }
+    }
+
+    // The rest is empty, but the card's the size the partition says
+    memset(buf, 0, sizeof(buf));
+    return write_sector(out, volume + sectors - 1, buf) && fflush(out) == 0;
+}
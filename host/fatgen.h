@@ -0,0 +1,47 @@
+/*
+ * fatgen.h
+ *
+ *  Write a FAT32 card image with one file on it, to try fat.c out on
+ *  without formatting a real card.  The volume is as small as FAT32 can
+ *  be (FAT32 is decided by the cluster count alone), written sparse.  The
+ *  file can be broken up into pieces with a free cluster between each,
+ *  the way a card that's had files deleted off it ends up.
+ */
+
+#ifndef HOST_FATGEN_H_
+#define HOST_FATGEN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fatgen {
+    unsigned int cluster_sectors;   // sectors per cluster
+    unsigned int fragment;          // clusters per piece of the file (0 = all in one)
+    bool partitioned;               // an MBR in front of the volume, like a card from the shop
+    // Filled in by fatgen_write()
+    uint32_t data_start;            // sector of cluster 2
+    uint32_t pieces;                // runs of consecutive sectors the file's in
+};
+
+/**
+ * Write a card image to `out` holding `size` bytes of `data` as the file
+ * `name` (8.3, upper case) in the root directory.  False if `out` can't
+ * be written.
+ */
+bool fatgen_write(struct fatgen *g, FILE *out, const char *name, const uint8_t *data, size_t size);
+
+/**
+ * Where sector `block` of the file went on the card.
+ */
+uint32_t fatgen_sector(const struct fatgen *g, uint32_t block);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_FATGEN_H_ */
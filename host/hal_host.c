@@ -0,0 +1,661 @@
+/*
+ * hal_host.c
+ *
+ *  Linux backend for hal.h.  SPI bytes are routed to the emulated SD
+ *  card or TFT depending on which bus they're sent on and which chip
+ *  select is low (the TFT's on UCB0 with the card, as the board's wired,
+ *  or with host_options.split_spi on UCA0 of its own), and the frame timer
+ *  never makes us wait.  DMAs move their data as soon as they're started;
+ *  a receive DMA's ISR is held back until the firmware waits for it
+ *  (hal_dma_wait), which is the earliest the real one could be noticed.
+ *
+ *  Alongside that we keep per-frame accounting so the player loop can be
+ *  benchmarked: host CPU time spent reading and decoding, bytes moved on
+ *  the bus per device, and what those bytes would cost on the real bus
+ *  at the current prescaler.
+ *
+ *  We also keep a virtual clock of what the board would be doing: the
+ *  CPU, each bus and DMA2 (which every SPI DMA sends with) have a "busy
+ *  until" time.  Polled bytes occupy the CPU and their bus, a DMA only
+ *  occupies its bus and DMA2 from whenever both can start, waiting for a
+ *  DMA moves the CPU up to the end of it, and every decoded line
+ *  costs the CPU host_options.line_ns.  The audio DMA goes round its ring
+ *  at the board's sample rate on the same clock, and what it plays is
+ *  read out of the ring whenever the firmware next calls in.  host_trace (if set) is told about
+ *  every bus transfer and decoded line as it's modelled, and with
+ *  host_options.profile every hal_mark() is written out on the virtual
+ *  clock in the stage profiler's format (profile.h).  With
+ *  host_options.trace, what the player does on the buses and every
+ *  hal_mark() is written out untimed (trace.h), for timemodel to put its
+ *  own clock to.  host_options.buttons presses the seek buttons, as if in
+ *  between frames.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "hal.h"
+#include "Timing.h"
+#include "lcd.h"
+#include "host.h"
+#include "sd_emu.h"
+#include "tft_emu.h"
+#include "profile.h"
+#include "trace.h"
+#include "dac.h"
+#include "jitter.h"
+#include "spi.h"
+#include "sdcard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+volatile bool dmaDone = 1; // nothing in flight
+
+struct host_options host_options = { 0 };
+struct host_counters host_counters = { 0 };
+void (*host_frame_done)(unsigned long frame, const struct host_frame *stats) = NULL;
+void (*host_trace)(host_lane_t lane, uint64_t start_ns, uint64_t end_ns) = NULL;
+
+// Pin state
+static bool sd_cs = false, tft_cs = false, tft_data = true;
+
+hal_spi_t hal_spi_tft = HAL_SPI_UCB0;
+
+// eUSCI state
+static uint16_t prescaler[HAL_SPI_BUSES];
+static const uint8_t *tx_buf = NULL;
+static size_t tx_size = 0;
+static bool rx_pending = false;    // receive DMA whose ISR hasn't run yet
+static uint64_t rx_start_ns, rx_byte_ns; // when it got the bus, and its pace
+
+// Virtual clock
+static uint64_t cpu_ns = 0, dma_ns = 0, bus_ns[HAL_SPI_BUSES];
+static uint64_t frame_vstart = 0;
+// Timer periods, as set by hal_set_rates()
+static uint64_t frame_ns = HOST_FRAME_NS, sample_ns = HOST_SAMPLE_NS;
+
+// Audio DMA
+static const uint8_t *audio_ring = NULL;
+static size_t audio_size = 0;
+static uint64_t audio_vstart = 0;
+
+// Running totals
+static uint64_t audio_samples = 0;  // played so far
+static FILE *audio_out = NULL;
+static FILE *profile_out = NULL;
+static struct profile_header profile_header;
+static FILE *trace_out = NULL;
+static struct trace_event trace_last;    // not written yet, in case more polled bytes follow
+static bool trace_held = false;
+
+// Per-frame accounting
+static unsigned long frames = 0;
+static uint64_t read_start, decode_start;
+static uint64_t frame_sd_bytes, frame_bus_ns;
+static uint32_t frame_sd_streams, frame_sd_block_reads;
+static uint64_t decode_ns, decode_tft_bytes;
+// FNV-1a of what's been sent to the TFT this frame
+static uint32_t tft_stream;
+static unsigned long waits;
+static uint16_t frame_stalls;
+static int32_t av_error;
+static bool drawn;
+static uint64_t total_read_ns = 0, total_decode_ns = 0, total_bus_ns = 0, total_busy_ns = 0;
+static uint64_t max_read_ns = 0, max_decode_ns = 0, max_bus_ns = 0, max_busy_ns = 0;
+
+uint64_t host_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report() {
+    fflush(stdout);
+    if (frames == 0) {
+        fprintf(stderr, "no frames played\n");
+        return;
+    }
+    fprintf(stderr, "%lu frames, %llu audio samples\n", frames, (unsigned long long)audio_samples);
+    fprintf(stderr, "read:   avg %8.1f us  max %8.1f us (host)\n",
+            total_read_ns / 1e3 / frames, max_read_ns / 1e3);
+    fprintf(stderr, "decode: avg %8.1f us  max %8.1f us (host)\n",
+            total_decode_ns / 1e3 / frames, max_decode_ns / 1e3);
+    fprintf(stderr, "spi:    avg %8.1f us  max %8.1f us (on the wire)\n",
+            total_bus_ns / 1e3 / frames, max_bus_ns / 1e3);
+    fprintf(stderr, "frame:  avg %8.1f us  max %8.1f us (modelled, of %.1f us)\n",
+            total_busy_ns / 1e3 / frames, max_busy_ns / 1e3, frame_ns / 1e3);
+    fprintf(stderr, "bytes:  sd %.1f  tft %.1f per frame, card at %.1f MHz\n",
+            (double)host_counters.sd_bytes / frames, (double)host_counters.tft_bytes / frames,
+            HOST_SMCLK_HZ / 1e6 / spi_clock(SPI_DEVICE_SD));
+    fprintf(stderr, "audio:  %u underruns, %u overruns, closest %.1f us ahead of the DAC\n",
+            dac_underruns, dac_overruns, dac_min_lead * (sample_ns / 1e3));
+    fprintf(stderr, "ring:   %u frames, %u stalls, %u retries, fewest %u frames ahead once full\n",
+            jitter_depth, jitter_stalls, jitter_retries, jitter_min_ahead);
+    if (sd_crcCheck) {
+        fprintf(stderr, "crc:    %u sectors came in wrong and were read again\n", sd_crcErrors);
+    }
+}
+
+/*
+ * Any button presses due now `frame` is done, from host_options.buttons.
+ */
+static void press_buttons(unsigned long frame) {
+    const char *p = host_options.buttons;
+    char *end;
+
+    while (p && *p) {
+        unsigned long at = strtoul(p, &end, 0);
+        unsigned long button;
+        if (*end != ':') {
+            break;
+        }
+        button = strtoul(end + 1, &end, 0);
+        if (at == frame) {
+            player_button(button);
+        }
+        p = *end == ',' ? end + 1 : NULL;
+    }
+}
+
+uint64_t host_vtime_ns() {
+    return cpu_ns;
+}
+
+/*
+ * Samples the audio DMA has moved by now, on the virtual clock.
+ */
+static uint64_t audio_position() {
+    return audio_ring ? (cpu_ns - audio_vstart) / sample_ns : 0;
+}
+
+/*
+ * Play whatever the DMA has got through since we last looked, out of the
+ * ring as it is now.
+ */
+static void audio_catch_up() {
+    uint64_t now = audio_position();
+    if (!audio_out) {
+        audio_samples = now;
+        return;
+    }
+    for (; audio_samples < now; audio_samples++) {
+        fputc(audio_ring[audio_samples % audio_size], audio_out);
+    }
+}
+
+static void trace_flush() {
+    if (trace_held) {
+        fwrite(&trace_last, sizeof(trace_last), 1, trace_out);
+    }
+    trace_held = false;
+}
+
+/*
+ * Write an event to the trace.  Polled bytes carrying on from the last
+ * event on the same bus are counted into it.
+ */
+static void trace_write(uint8_t type, hal_spi_t bus, host_lane_t lane, uint16_t a, uint16_t b) {
+    if (!trace_out) {
+        return;
+    }
+    if (type == TRACE_POLLED && trace_held && trace_last.type == TRACE_POLLED && trace_last.bus == bus
+            && trace_last.lane == lane && trace_last.a < 0xFFFF) {
+        trace_last.a++;
+        return;
+    }
+    trace_flush();
+    memset(&trace_last, 0, sizeof(trace_last));
+    trace_last.type = type;
+    trace_last.bus = bus;
+    trace_last.lane = lane;
+    trace_last.a = a;
+    trace_last.b = b;
+    trace_held = true;
+}
+
+static uint64_t byte_ns(hal_spi_t bus) {
+    // UCBRW = 0 behaves like a divider of 1
+    return 8ULL * (prescaler[bus] ? prescaler[bus] : 1) * 1000000000ULL / HOST_SMCLK_HZ;
+}
+
+static void trace(host_lane_t lane, uint64_t start, uint64_t end) {
+    if (host_trace) {
+        host_trace(lane, start, end);
+    }
+}
+
+/*
+ * Who's listening on `bus`: HOST_LANE_SD, HOST_LANE_TFT, or HOST_LANE_IDLE
+ * for nobody.
+ */
+static host_lane_t listener(hal_spi_t bus) {
+    bool sd = bus == HAL_SPI_SD && sd_cs, tft = bus == hal_spi_tft && tft_cs;
+
+    if (sd && tft) {
+        fprintf(stderr, "bus contention: SD and TFT both selected\n");
+        abort();
+    }
+    return sd ? HOST_LANE_SD : tft ? HOST_LANE_TFT : HOST_LANE_IDLE;
+}
+
+/*
+ * Put `size` bytes on `bus`, starting as soon as both it and the CPU (for
+ * polled bytes) or DMA2 (for a DMA) are free.  Returns when they'd be done.
+ */
+static uint64_t bus_occupy(hal_spi_t bus, size_t size, bool polled) {
+    uint64_t start = MAX(polled ? cpu_ns : MAX(cpu_ns, dma_ns), bus_ns[bus]);
+    host_lane_t lane = listener(bus);
+
+    bus_ns[bus] = start + size * byte_ns(bus);
+    if (polled) {
+        cpu_ns = bus_ns[bus];
+    } else {
+        dma_ns = bus_ns[bus];
+    }
+    if (lane != HOST_LANE_IDLE) {
+        trace(lane, start, bus_ns[bus]);
+    }
+    return bus_ns[bus];
+}
+
+static uint8_t xfer(hal_spi_t bus, uint8_t byte) {
+    host_lane_t lane = listener(bus);
+    uint8_t rx = 0xFF;
+
+    host_counters.bus_ns += byte_ns(bus);
+    if (lane == HOST_LANE_SD) {
+        host_counters.sd_bytes++;
+        rx = sd_emu_xfer(byte);
+        if (host_options.sd_max_hz && 1000000000ULL / byte_ns(bus) * 8 > host_options.sd_max_hz) {
+            // Too fast for it: every bit comes in a clock late
+            rx = rx >> 1 | 0x80;
+        }
+    } else if (lane == HOST_LANE_TFT) {
+        host_counters.tft_bytes++;
+        tft_emu_write(byte, tft_data);
+        // Commands hash differently from the same byte as data
+        tft_stream = (tft_stream ^ (byte | (tft_data ? 0 : 0x100))) * 16777619u;
+    }
+    return rx;
+}
+
+void hal_init() {
+    cpu_ns = dma_ns = frame_vstart = 0;
+    memset(bus_ns, 0, sizeof(bus_ns));
+    hal_spi_tft = host_options.split_spi ? HAL_SPI_UCA0 : HAL_SPI_UCB0;
+    rx_pending = false;
+    audio_ring = NULL;
+    if (!host_options.line_ns) {
+        host_options.line_ns = HOST_LINE_NS;
+    }
+    if (!host_options.audio_ns) {
+        host_options.audio_ns = HOST_AUDIO_NS;
+    }
+    frame_ns = host_options.frame_ns ? host_options.frame_ns : HOST_FRAME_NS;
+    sample_ns = HOST_SAMPLE_NS;
+    tft_emu_reset();
+    if (!sd_emu_open(host_options.image)) {
+        perror(host_options.image);
+        exit(2);
+    }
+    sd_emu_latency(&host_options.sd_latency);
+    sd_emu_faults(&host_options.sd_faults);
+    if (host_options.audio) {
+        audio_out = fopen(host_options.audio, "wb");
+        if (!audio_out) {
+            perror(host_options.audio);
+            exit(2);
+        }
+    }
+    if (host_options.trace) {
+        struct trace_header h = { TRACE_MAGIC, TRACE_VERSION };
+        trace_out = fopen(host_options.trace, "wb");
+        if (!trace_out) {
+            perror(host_options.trace);
+            exit(2);
+        }
+        fwrite(&h, sizeof(h), 1, trace_out);
+        trace_held = false;
+    }
+    if (host_options.profile) {
+        profile_out = fopen(host_options.profile, "wb");
+        if (!profile_out) {
+            perror(host_options.profile);
+            exit(2);
+        }
+        // Not a ring: every event goes in, and the header is filled in at the end
+        memset(&profile_header, 0, sizeof(profile_header));
+        profile_header.magic = PROFILE_MAGIC;
+        fwrite(&profile_header, sizeof(profile_header), 1, profile_out);
+    }
+}
+
+void hal_halt(uint16_t code) {
+    audio_catch_up();
+    report();
+    if (host_options.pgm) {
+        FILE *f = fopen(host_options.pgm, "wb");
+        if (f) {
+            tft_emu_write_pgm(f);
+            fclose(f);
+        }
+    }
+    if (audio_out) {
+        fclose(audio_out);
+    }
+    if (trace_out) {
+        trace_flush();
+        fclose(trace_out);
+    }
+    if (profile_out) {
+        rewind(profile_out);
+        fwrite(&profile_header, sizeof(profile_header), 1, profile_out);
+        fclose(profile_out);
+    }
+    if (code != 0 && !sd_emu_eof()) {
+        fprintf(stderr, "halted with error %u\n", code);
+        exit(1);
+    }
+    exit(0);
+}
+
+void hal_sd_select(bool selected) {
+    if (selected && tft_cs && hal_spi_tft == HAL_SPI_SD) {
+        // Everything the card's sent would go to the display as well
+        fprintf(stderr, "SD selected with the TFT still selected on its bus\n");
+        abort();
+    }
+    sd_cs = selected;
+    sd_emu_select(selected);
+}
+
+void hal_tft_select(bool selected) {
+    tft_cs = selected;
+}
+
+void hal_tft_dc(bool data) {
+    tft_data = data;
+}
+
+void hal_spi_init(hal_spi_t bus, uint16_t p) {
+    prescaler[bus] = p;
+    trace_write(TRACE_PRESCALER, bus, HOST_LANE_IDLE, p, 0);
+}
+
+void hal_spi_set_prescaler(hal_spi_t bus, uint16_t p) {
+    // Waits for UCBUSY: the last byte out has to finish first
+    cpu_ns = MAX(cpu_ns, bus_ns[bus]);
+    prescaler[bus] = p;
+    trace_write(TRACE_PRESCALER, bus, HOST_LANE_IDLE, p, 0);
+}
+
+uint8_t hal_spi_xfer(hal_spi_t bus, uint8_t byte) {
+    if (rx_pending && bus == HAL_SPI_SD) {
+        // Polling the bus under a running DMA: on the board this would
+        // have to wait for it anyway.
+        hal_dma_wait();
+    }
+    trace_write(TRACE_POLLED, bus, listener(bus), 1, 0);
+    bus_occupy(bus, 1, true);
+    return xfer(bus, byte);
+}
+
+/*
+ * A DMA started before the last one's been waited for would take DMA2
+ * off it halfway through on the board.
+ */
+static void dma_check() {
+    if (rx_pending || cpu_ns < dma_ns) {
+        fprintf(stderr, "DMA2 started again while still busy\n");
+        abort();
+    }
+}
+
+void hal_dma_rx_start(hal_spi_t bus, uint8_t *buf, const uint8_t *fill, size_t size) {
+    size_t i;
+    dma_check();
+    trace_write(TRACE_DMA_RX, bus, listener(bus), size, 0);
+    rx_byte_ns = byte_ns(bus);
+    rx_start_ns = bus_occupy(bus, size, false) - size * rx_byte_ns;
+    for (i = 0; i < size; i++) {
+        buf[i] = xfer(bus, *fill);
+    }
+    host_counters.dma_rx_bytes += size;
+    rx_pending = true;
+}
+
+void hal_dma_tx_setup(hal_spi_t bus, const uint8_t *buf, size_t size) {
+    tx_buf = buf;
+    tx_size = size;
+}
+
+void hal_dma_tx_start(hal_spi_t bus, const uint8_t *buf) {
+    size_t i;
+    dma_check();
+    trace_write(TRACE_DMA_TX, bus, listener(bus), tx_size, 0);
+    tx_buf = buf;
+    bus_occupy(bus, tx_size, false);
+    for (i = 0; i < tx_size; i++) {
+        xfer(bus, tx_buf[i]);
+    }
+    dmaDone = 1;
+}
+
+void hal_dma_stop() {
+    tx_buf = NULL;
+}
+
+void hal_dma_wait() {
+    trace_write(TRACE_DMA_WAIT, 0, HOST_LANE_IDLE, 0, 0);
+    cpu_ns = MAX(cpu_ns, dma_ns);
+    if (rx_pending) {
+        // Now's when the DMA ISR runs
+        rx_pending = false;
+        dmaDone = 1;
+        sd_async_dma_done();
+    }
+}
+
+size_t hal_dma_rx_count(size_t size) {
+    if (!rx_pending || cpu_ns <= rx_start_ns) {
+        return 0;
+    }
+    return MIN((cpu_ns - rx_start_ns) / rx_byte_ns, size);
+}
+
+/*
+ * The CRC16 module, in software: CRC16-CCITT, most significant bit first,
+ * which is what CRCDIRB in and CRCINIRES out make it on the board.
+ */
+static uint16_t crc;
+
+void hal_crc_reset() {
+    crc = 0;
+}
+
+void hal_crc_feed(const uint8_t *buf, size_t size) {
+    uint64_t cost = size * HOST_CRC_BYTE_NS;
+    int bit;
+
+    trace(HOST_LANE_CPU, cpu_ns, cpu_ns + cost);
+    cpu_ns += cost;
+    while (size--) {
+        crc ^= (uint16_t)*buf++ << 8;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+}
+
+uint16_t hal_crc_result() {
+    return crc;
+}
+
+void hal_audio_start(const uint8_t *ring, size_t size) {
+    audio_ring = ring;
+    audio_size = size;
+    audio_vstart = cpu_ns;
+    audio_samples = 0;
+}
+
+uint32_t hal_audio_position() {
+    audio_catch_up();
+    return audio_position();
+}
+
+void hal_set_rates(uint16_t sample_cycles, uint16_t frame_ticks) {
+    trace_write(TRACE_RATES, 0, HOST_LANE_IDLE, sample_cycles, frame_ticks);
+    sample_ns = sample_cycles * 1000000000ULL / HOST_SMCLK_HZ;
+    // Unless we've been told to run the frame timer at something else
+    if (!host_options.frame_ns) {
+        frame_ns = frame_ticks * 1000000000ULL / HAL_FRAME_TICK_HZ;
+    }
+}
+
+void hal_wait_frame() {
+    // Run flat out: the frame timer has always already fired.  The virtual
+    // clock does wait, for the next tick of the frame timer - unless one
+    // came while we were still busy with the last frame, which leaves
+    // nextFrame set and the board goes straight on.
+    uint64_t last_tick = cpu_ns / frame_ns * frame_ns;
+    uint64_t start = last_tick > frame_vstart ? cpu_ns : last_tick + frame_ns;
+
+    trace_write(TRACE_WAIT_FRAME, 0, HOST_LANE_IDLE, 0, 0);
+
+    if (start > cpu_ns) {
+        trace(HOST_LANE_IDLE, cpu_ns, start);
+    }
+    cpu_ns = frame_vstart = start;
+    waits++;
+}
+
+bool hal_frame_due() {
+    return cpu_ns / frame_ns * frame_ns > frame_vstart;
+}
+
+uint32_t hal_micros() {
+    return (uint32_t)(cpu_ns / 1000);
+}
+
+static void profile(hal_mark_t mark) {
+    struct profile_event e;
+
+    e.time = (uint16_t)(cpu_ns / 1000);
+    e.mark = mark;
+    fwrite(&e, sizeof(e), 1, profile_out);
+    profile_header.count++;
+}
+
+void hal_mark(hal_mark_t mark) {
+    uint64_t now = host_now_ns();
+    struct host_frame f;
+
+    audio_catch_up();
+    // Decoding is modelled as taking place just before its mark
+    if (mark == HAL_MARK_LINE_DECODED || mark == HAL_MARK_AUDIO_DECODED) {
+        uint64_t cost = mark == HAL_MARK_LINE_DECODED ? host_options.line_ns : host_options.audio_ns;
+        trace(HOST_LANE_CPU, cpu_ns, cpu_ns + cost);
+        cpu_ns += cost;
+    }
+    if (profile_out) {
+        profile(mark);
+    }
+    trace_write(TRACE_MARK, 0, HOST_LANE_IDLE, mark, 0);
+
+    switch (mark) {
+    case HAL_MARK_IDLE_BEGIN:
+        waits = 0;
+        break;
+    case HAL_MARK_FRAME_BEGIN:
+        av_error = dac_sync_error(frames);
+        decode_ns = decode_tft_bytes = 0;
+        tft_stream = 2166136261u;
+        frame_stalls = jitter_stalls;
+        drawn = false;
+        break;
+    case HAL_MARK_READ_BEGIN:
+        read_start = now;
+        frame_sd_bytes = host_counters.sd_bytes;
+        frame_sd_streams = sd_emu_commands(18);
+        frame_sd_block_reads = sd_emu_commands(17);
+        frame_bus_ns = host_counters.bus_ns;
+        break;
+    case HAL_MARK_DECODE_BEGIN:
+        decode_start = now;
+        decode_tft_bytes = host_counters.tft_bytes;
+        drawn = true;
+        break;
+    case HAL_MARK_DECODE_END:
+        decode_ns = now - decode_start;
+        decode_tft_bytes = host_counters.tft_bytes - decode_tft_bytes;
+        break;
+    case HAL_MARK_READ_END:
+        // The read of the next frame (and decoding its audio) finishes
+        // last, so this closes the frame
+        f.read_ns = now - read_start - decode_ns;
+        f.decode_ns = decode_ns;
+        f.bus_ns = host_counters.bus_ns - frame_bus_ns;
+        f.busy_ns = cpu_ns - frame_vstart;
+        f.sd_bytes = host_counters.sd_bytes - frame_sd_bytes;
+        f.sd_streams = sd_emu_commands(18) - frame_sd_streams;
+        f.sd_block_reads = sd_emu_commands(17) - frame_sd_block_reads;
+        f.tft_bytes = decode_tft_bytes;
+        f.hash = tft_emu_hash();
+        f.stream_hash = tft_stream;
+        f.audio_lead = dac_lead;
+        f.start_ns = frame_vstart;
+        f.av_error = av_error;
+        f.repeats = waits > 1 ? waits - 1 : 0;
+        f.jitter_ahead = jitter_ahead;
+        f.stalled = jitter_stalls != frame_stalls;
+        f.skipped = !drawn;
+
+        total_read_ns += f.read_ns;
+        total_decode_ns += f.decode_ns;
+        total_bus_ns += f.bus_ns;
+        total_busy_ns += f.busy_ns;
+        max_read_ns = MAX(max_read_ns, f.read_ns);
+        max_decode_ns = MAX(max_decode_ns, f.decode_ns);
+        max_bus_ns = MAX(max_bus_ns, f.bus_ns);
+        max_busy_ns = MAX(max_busy_ns, f.busy_ns);
+        if (host_options.verbose) {
+            printf("%lu read_us=%.1f decode_us=%.1f spi_us=%.1f frame_us=%.1f sd_bytes=%llu tft_bytes=%llu hash=%08x stream=%08x audio_lead=%ld av_error=%ld ahead=%u%s%s\n",
+                   frames, f.read_ns / 1e3, f.decode_ns / 1e3, f.bus_ns / 1e3, f.busy_ns / 1e3,
+                   (unsigned long long)f.sd_bytes, (unsigned long long)f.tft_bytes, f.hash, f.stream_hash, (long)f.audio_lead, (long)f.av_error, f.jitter_ahead, f.stalled ? " stalled" : "", f.skipped ? " skipped" : "");
+        }
+        if (host_frame_done) {
+            host_frame_done(frames, &f);
+        }
+        press_buttons(frames);
+        frames++;
+        if (host_options.frames && frames >= host_options.frames) {
+            hal_halt(0);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*****
+ * Timing.h / lcd.h stand-ins
+ *****/
+
+millis_t millis() {
+    // The board's clock, so timeouts run out after as many bytes polled
+    // off the card as they would there
+    return cpu_ns / 1000000;
+}
+
+void delay(millis_t ms) {
+    // Nothing on the host needs time to settle
+    (void)ms;
+}
+
+int lcd_init() {
+    return 0;
+}
+
+void displayNum(unsigned int num) {
+    (void)num;
+}
@@ -0,0 +1,131 @@
+/*
+ * host.h
+ *
+ *  Shared state for the Linux build of the player.
+ */
+
+#ifndef HOST_HOST_H_
+#define HOST_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sd_emu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SMCLK on the board, used to turn SPI prescalers into bus time
+#define HOST_SMCLK_HZ 16000000UL
+// Frame timer period (TA0CCR0 + 1 = 33259 1us ticks, one frame of DAC
+// samples), and DAC sample period (TB0CCR0 = 361: 362 SMCLK cycles), until
+// the player sets them from the image's header
+#define HOST_FRAME_NS 33259000ULL
+#define HOST_SAMPLE_NS 22625ULL
+// Default modelled CPU time to expand one display line from RAM
+// (128 pixels at roughly 10 cycles each)
+#define HOST_LINE_NS 80000UL
+// Default modelled CPU time to decode a frame's ADPCM audio
+// (1470 samples at roughly 35 cycles each)
+#define HOST_AUDIO_NS 3200000UL
+// Modelled CPU time to run one byte through the CRC16 module (a MOV.B to
+// CRCDIRB, unrolled: roughly 5.5 cycles)
+#define HOST_CRC_BYTE_NS 350UL
+
+struct host_options {
+    const char *image;      // SD card image
+    unsigned long frames;   // stop after this many frames (0 = whole image)
+    bool verbose;           // one report line per frame
+    const char *pgm;        // dump the last frame here at exit
+    const char *audio;      // write every sample the DAC plays here
+    unsigned long line_ns;  // modelled CPU time per decoded line (0 = HOST_LINE_NS)
+    unsigned long audio_ns; // modelled CPU time per frame of audio (0 = HOST_AUDIO_NS)
+    const char *profile;    // write every hal_mark() here, as profile.h events
+    uint64_t frame_ns;      // frame timer period (0 = whatever the player sets)
+    const char *buttons;    // "frame:button,...": press a seek button once each of those frames is done
+    bool split_spi;         // TFT on a bus of its own (UCA0), rather than the SD card's
+    const char *trace;      // write what the player does here, untimed, for timemodel (trace.h)
+    struct sd_emu_latency sd_latency; // how long the card takes over each sector (modelled time)
+    struct sd_emu_faults sd_faults; // what the card gets wrong
+    unsigned long sd_max_hz; // fastest clock the card's bytes come back right at (0 = any)
+};
+
+extern struct host_options host_options;
+
+// Running totals kept by the backend, for benchmarks to sample
+struct host_counters {
+    uint64_t sd_bytes;      // bytes clocked with the SD card selected
+    uint64_t tft_bytes;     // bytes clocked with the TFT selected
+    uint64_t dma_rx_bytes;  // bytes written to memory by the receive DMA
+    uint64_t bus_ns;        // time those bytes take on the real bus
+};
+
+extern struct host_counters host_counters;
+
+// What one frame cost, as printed by -v
+struct host_frame {
+    uint64_t read_ns;       // host time spent reading (outside of decode)
+    uint64_t decode_ns;     // host time spent in decode_and_write_frame
+    uint64_t bus_ns;        // SPI time on the real bus
+    uint64_t start_ns;      // modelled time the frame started (its tick, or later if the last one overran)
+    uint64_t busy_ns;       // modelled time from the frame starting to done
+    uint64_t sd_bytes;
+    uint64_t tft_bytes;
+    uint32_t sd_streams;    // CMD18s: reads that couldn't carry on from where the card was
+    uint32_t sd_block_reads; // CMD17s: single sectors read outside of a stream
+    uint32_t hash;          // TFT framebuffer contents afterwards
+    uint32_t stream_hash;   // every byte sent to the TFT drawing it, commands and data (FNV-1a)
+    int32_t audio_lead;     // samples the next frame's audio was queued ahead of the DAC
+    int32_t av_error;       // samples the picture was ahead of the sound at the start (dac_sync_error())
+    uint32_t repeats;       // extra ticks the frame before was left up for, to let the sound catch up
+    uint32_t jitter_ahead;  // frames read ahead of it as it came up (jitter.h)
+    bool stalled;           // had to wait for the card for the next one
+    bool skipped;           // read but not drawn, to catch up with the sound
+};
+
+/**
+ * If set, called with every frame's numbers once it's been played.
+ */
+extern void (*host_frame_done)(unsigned long frame, const struct host_frame *stats);
+
+// What the virtual clock is accounting a stretch of time to
+typedef enum {
+    HOST_LANE_SD,       // SD card's bus busy with it
+    HOST_LANE_TFT,      // TFT's bus busy with it
+    HOST_LANE_CPU,      // CPU decoding a line
+    HOST_LANE_IDLE,     // CPU waiting for the frame timer
+} host_lane_t;
+
+/**
+ * If set, called for every stretch of virtual time the backend models.
+ */
+extern void (*host_trace)(host_lane_t lane, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Nanoseconds on the virtual clock: where the board's CPU would be.
+ */
+uint64_t host_vtime_ns();
+
+/**
+ * Nanoseconds on the host's monotonic clock.
+ */
+uint64_t host_now_ns();
+
+/**
+ * Entry point of the player in main.c (renamed by the host Makefile).
+ */
+int player_main(void);
+
+/**
+ * Play `frames` frames of the image at `path` in a child process (the
+ * player exits when it's done), collecting every frame's numbers into
+ * `results`.  `setup`, if set, runs in the child first.  Exits if the
+ * player stops early.  (play.c)
+ */
+void host_play(const char *path, unsigned long frames, struct host_frame *results, void (*setup)(void));
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_HOST_H_ */
@@ -0,0 +1,78 @@
+/*
+ * mkfat.c
+ *
+ *  Put a video on a FAT32 card image, the way it'd be copied onto a real
+ *  card, for trying the player's FAT32 reader out:
+ *
+ *      mkfat [-s sectors] [-f clusters] [-r] [-n name] video.bin card.img
+ *
+ *  -s sets the sectors per cluster (8), -f breaks the file into pieces of
+ *  that many clusters with a free cluster between each, -r leaves out the
+ *  partition table, and -n names the file something other than
+ *  BADAPPLE.BIN.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "fatgen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-s sectors] [-f clusters] [-r] [-n name] video.bin card.img\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct fatgen g = { 8, 0, true, 0, 0 };
+    const char *name = "BADAPPLE.BIN";
+    uint8_t *data;
+    long size;
+    FILE *in, *out;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:f:rn:")) != -1) {
+        switch (opt) {
+        case 's':
+            g.cluster_sectors = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            g.fragment = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            g.partitioned = false;
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2 || !g.cluster_sectors || g.cluster_sectors > 128) {
+        usage(argv[0]);
+    }
+
+    in = fopen(argv[optind], "rb");
+    if (!in || fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0) {
+        perror(argv[optind]);
+        return 2;
+    }
+    rewind(in);
+    data = malloc(size ? size : 1);
+    if (!data || fread(data, 1, size, in) != (size_t)size) {
+        perror(argv[optind]);
+        return 2;
+    }
+    fclose(in);
+
+    out = fopen(argv[optind + 1], "wb");
+    if (!out || !fatgen_write(&g, out, name, data, size)) {
+        perror(argv[optind + 1]);
+        return 2;
+    }
+    fclose(out);
+    free(data);
+    printf("%s: %ld bytes in %u piece(s) of %u-sector clusters\n", name, size, g.pieces, g.cluster_sectors);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * mkimage.c
+ *
+ *  Write an SD card image of synthetic content, for trying the host
+ *  player out without converting a video:
+ *
+ *      mkimage [-f] [-l] [-d] [-c frames] [-r rate:samples] frames image.bin
+ *
+ *  -f leaves out the clean-line maps (every frame is drawn in full), -l
+ *  codes every line as a literal, -d shows every picture twice like a
+ *  15 fps source, -c starts a new chapter every so many frames (for the
+ *  seek buttons), -r sets the audio sample rate and samples per frame in
+ *  the header, and with them the frame rate (the default is 44100:1470,
+ *  30 fps).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "encode.h"
+#include "synth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-f] [-l] [-d] [-c frames] [-r rate:samples] frames image.bin\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static struct encoder e;
+    uint8_t video[SYNTH_VIDEO_SIZE], audio[SYNTH_AUDIO_SIZE];
+    unsigned int flags = 0;
+    unsigned long frames, chapter = 0, rate = CONTAINER_DEFAULT_SAMPLE_RATE, samples = AUDIO_FRAME_SIZE, n;
+    char *end;
+    FILE *f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "fldc:r:")) != -1) {
+        switch (opt) {
+        case 'f':
+            flags |= ENCODE_NO_CLEAN;
+            break;
+        case 'l':
+            flags |= ENCODE_LITERAL;
+            break;
+        case 'd':
+            flags |= ENCODE_DUPLICATE;
+            break;
+        case 'c':
+            chapter = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, &end, 0);
+            samples = *end == ':' ? strtoul(end + 1, NULL, 0) : 0;
+            if (!rate || rate > UINT16_MAX || !samples || samples > AUDIO_FRAME_SIZE || samples % 2) {
+                fprintf(stderr, "%s: -r wants rate:samples, up to %u even samples\n", argv[0], AUDIO_FRAME_SIZE);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+    }
+    frames = strtoul(argv[optind], NULL, 0);
+    f = fopen(argv[optind + 1], "wb");
+    if (!f) {
+        perror(argv[optind + 1]);
+        return 2;
+    }
+
+    encode_open(&e, f, flags);
+    encode_set_audio(&e, rate, samples);
+    for (n = 0; n < frames; n++) {
+        if (n == 0 || (chapter && n % chapter == 0)) {
+            encode_chapter(&e);
+        }
+        synth_video((flags & ENCODE_DUPLICATE) ? n / 2 : n, video);
+        synth_audio(n, audio);
+        encode_frame(&e, video, audio);
+    }
+    encode_close(&e);
+    fclose(f);
+    printf("%lu frames in %u chapter(s), %.1f bytes / %.2f sectors per frame\n", e.frames, e.chapters,
+           (double)e.bytes / e.frames, (double)e.sectors / e.frames);
+    return 0;
+}
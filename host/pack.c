@@ -0,0 +1,258 @@
+/*
+ * pack.c
+ *
+ *  convert.py's threshold, resize and packbits, see pack.h.
+ *
+ *  pack_frame() only ever looks at the source pixels the resize takes
+ *  from, and does the vertical half of the resize and the packing eight
+ *  resized columns at a time with GCC vector extensions.
+ */
+
+#include "pack.h"
+#include "defines.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// OpenCV's INTER_RESIZE_COEF_BITS: each tap's weight out of 2048
+#define COEF_SCALE 2048
+
+typedef int32_t v8si __attribute__((vector_size(32)));
+#define LANES 8
+#define VECTORS (PACK_WIDTH / LANES)
+
+/*
+ * What cv2.threshold() makes of a pixel, after decoding to BGR and
+ * cv2.cvtColor() back to grey, which for a pixel with no colour is just
+ * the luma stretched to 0-255.
+ */
+static uint8_t threshold(unsigned int luma, bool full_range) {
+    long grey = full_range ? (long)luma : lrint((luma - 16.0) * 255 / 219);
+    return grey > 127 ? 255 : 0;
+}
+
+static int16_t coef(float f) {
+    return lrintf(f * COEF_SCALE);
+}
+
+/*
+ * Where OpenCV's bilinear resize takes resized pixel `d` from: the source
+ * pixel at or before it, and how far on towards the next, in float like
+ * it does it.
+ */
+static void tap(unsigned int d, double scale, int *s, float *f) {
+    *f = (float)((d + 0.5) * scale - 0.5);
+    *s = (int)floorf(*f);
+    *f -= *s;
+}
+
+static double scale(unsigned int from, unsigned int to) {
+    return 1. / ((double)to / from);
+}
+
+/*
+ * cv2.resize() to exactly half size averages each 2x2 square instead.
+ */
+static bool half_size(double scale_x, double scale_y) {
+    return fabs(scale_x - 2) < DBL_EPSILON && fabs(scale_y - 2) < DBL_EPSILON;
+}
+
+static int clip(int n, int max) {
+    return n < 0 ? 0 : n > max ? max : n;
+}
+
+void pack_plan_init(struct pack_plan *plan, unsigned int width, unsigned int height, bool full_range) {
+    double scale_x = scale(width, PACK_WIDTH), scale_y = scale(height, PACK_HEIGHT);
+    bool half = half_size(scale_x, scale_y);
+    unsigned int i;
+    float f;
+    int s;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->width = width;
+    plan->height = height;
+    for (i = 0; i < 256; i++) {
+        plan->white[i] = threshold(i, full_range);
+    }
+
+    for (i = 0; i < PACK_WIDTH; i++) {
+        if (half) {
+            // Half of each pixel's sum: the same pixels come out above 0
+            plan->xofs[0][i] = 2 * i;
+            plan->xofs[1][i] = 2 * i + 1;
+            plan->alpha[0][i] = plan->alpha[1][i] = COEF_SCALE / 2;
+            continue;
+        }
+        tap(i, scale_x, &s, &f);
+        if (s < 0) {
+            s = 0;
+            f = 0;
+        }
+        if (s + 1 >= (int)width) {
+            // Past the last pair of columns OpenCV takes the last column whole
+            plan->xofs[0][i] = plan->xofs[1][i] = width - 1;
+            plan->alpha[0][i] = COEF_SCALE;
+            plan->alpha[1][i] = 0;
+        } else {
+            plan->xofs[0][i] = s;
+            plan->xofs[1][i] = s + 1;
+            plan->alpha[0][i] = coef(1.f - f);
+            plan->alpha[1][i] = coef(f);
+        }
+    }
+
+    for (i = 0; i < PACK_HEIGHT; i++) {
+        if (half) {
+            plan->yofs[0][i] = 2 * i;
+            plan->yofs[1][i] = 2 * i + 1;
+            plan->beta[0][i] = plan->beta[1][i] = COEF_SCALE / 2;
+            continue;
+        }
+        // Rows are clipped to the picture, but keep their weights
+        tap(i, scale_y, &s, &f);
+        plan->yofs[0][i] = clip(s, height - 1);
+        plan->yofs[1][i] = clip(s + 1, height - 1);
+        plan->beta[0][i] = coef(1.f - f);
+        plan->beta[1][i] = coef(f);
+    }
+}
+
+/*
+ * The horizontal half of the resize for one source row: each resized
+ * column's two taps, thresholded and weighted.
+ */
+static void resize_row(const struct pack_plan *plan, const uint8_t *row, v8si *out) {
+    int32_t left[PACK_WIDTH] __attribute__((aligned(32))), right[PACK_WIDTH] __attribute__((aligned(32)));
+    const v8si *a0 = (const v8si *)plan->alpha[0], *a1 = (const v8si *)plan->alpha[1];
+    unsigned int i;
+
+    for (i = 0; i < PACK_WIDTH; i++) {
+        left[i] = plan->white[row[plan->xofs[0][i]]];
+        right[i] = plan->white[row[plan->xofs[1][i]]];
+    }
+    for (i = 0; i < VECTORS; i++) {
+        out[i] = ((const v8si *)left)[i] * a0[i] + ((const v8si *)right)[i] * a1[i];
+    }
+}
+
+/*
+ * Source row `r` through resize_row(), from whichever of the two rows
+ * kept in `rows` has it, or else into the one not holding row `keep`.
+ */
+static const v8si *source_row(const struct pack_plan *plan, const uint8_t *luma, size_t stride, int r, int keep,
+                              v8si rows[2][VECTORS], int kept[2]) {
+    int slot = kept[0] == r ? 0 : kept[1] == r ? 1 : kept[0] == keep ? 1 : 0;
+
+    if (kept[slot] != r) {
+        resize_row(plan, luma + r * stride, rows[slot]);
+        kept[slot] = r;
+    }
+    return rows[slot];
+}
+
+void pack_frame(const struct pack_plan *plan, const uint8_t *luma, size_t stride, uint8_t *video) {
+    v8si rows[2][VECTORS], bits[VECTORS] = { { 0 } };
+    int kept[2] = { -1, -1 };
+    unsigned int y, i;
+
+    for (y = 0; y < PACK_HEIGHT; y++) {
+        int r0 = plan->yofs[0][y], r1 = plan->yofs[1][y];
+        const v8si *top = source_row(plan, luma, stride, r0, r1, rows, kept);
+        const v8si *bottom = source_row(plan, luma, stride, r1, r0, rows, kept);
+        int32_t b0 = plan->beta[0][y], b1 = plan->beta[1][y];
+
+        // OpenCV's vector path: a 16-bit multiply-high of each tap, added
+        // up and rounded off by two bits, so anything from 2 up is white
+        for (i = 0; i < VECTORS; i++) {
+            v8si sum = (((top[i] >> 4) * b0) >> 16) + (((bottom[i] >> 4) * b1) >> 16);
+            bits[i] = (bits[i] << 1) - (sum >= 2);
+        }
+        if (y % 8 == 7) {
+            for (i = 0; i < PACK_WIDTH; i++) {
+                video[i * VIDEO_LINE_BYTES + y / 8] = bits[i / LANES][i % LANES];
+            }
+            memset(bits, 0, sizeof(bits));
+        }
+    }
+}
+
+void pack_frame_reference(unsigned int width, unsigned int height, bool full_range, const uint8_t *luma,
+                          size_t stride, uint8_t *video) {
+    uint8_t *t = malloc(width * height), resized[PACK_HEIGHT][PACK_WIDTH];
+    double scale_x = scale(width, PACK_WIDTH), scale_y = scale(height, PACK_HEIGHT);
+    int xofs[PACK_WIDTH], alpha[PACK_WIDTH][2], xmax = PACK_WIDTH;
+    unsigned int x, y;
+    float f;
+    int s;
+
+    if (!t) {
+        abort();
+    }
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            t[y * width + x] = threshold(luma[y * stride + x], full_range);
+        }
+    }
+
+    if (half_size(scale_x, scale_y)) {
+        for (y = 0; y < PACK_HEIGHT; y++) {
+            for (x = 0; x < PACK_WIDTH; x++) {
+                const uint8_t *p = t + 2 * y * width + 2 * x;
+                resized[y][x] = (p[0] + p[1] + p[width] + p[width + 1] + 2) >> 2;
+            }
+        }
+    } else {
+        // resizeGeneric_'s column table, with xmax where it runs out of pairs
+        for (x = 0; x < PACK_WIDTH; x++) {
+            tap(x, scale_x, &s, &f);
+            if (s < 0) {
+                s = 0;
+                f = 0;
+            }
+            if (s + 1 >= (int)width) {
+                xmax = MIN(xmax, (int)x);
+                if (s >= (int)width - 1) {
+                    s = width - 1;
+                    f = 0;
+                }
+            }
+            xofs[x] = s;
+            alpha[x][0] = coef(1.f - f);
+            alpha[x][1] = coef(f);
+        }
+        for (y = 0; y < PACK_HEIGHT; y++) {
+            const uint8_t *r0, *r1;
+            int beta0, beta1;
+
+            tap(y, scale_y, &s, &f);
+            r0 = t + clip(s, height - 1) * width;
+            r1 = t + clip(s + 1, height - 1) * width;
+            beta0 = coef(1.f - f);
+            beta1 = coef(f);
+            for (x = 0; x < PACK_WIDTH; x++) {
+                int d0, d1, v;
+                if ((int)x < xmax) {
+                    d0 = r0[xofs[x]] * alpha[x][0] + r0[xofs[x] + 1] * alpha[x][1];
+                    d1 = r1[xofs[x]] * alpha[x][0] + r1[xofs[x] + 1] * alpha[x][1];
+                } else {
+                    d0 = r0[xofs[x]] * COEF_SCALE;
+                    d1 = r1[xofs[x]] * COEF_SCALE;
+                }
+                v = ((((d0 >> 4) * beta0) >> 16) + (((d1 >> 4) * beta1) >> 16) + 2) >> 2;
+                resized[y][x] = v > 255 ? 255 : v;
+            }
+        }
+    }
+    free(t);
+
+    // np.packbits(resized.T, axis=1)
+    memset(video, 0, ENCODE_VIDEO_SIZE);
+    for (x = 0; x < PACK_WIDTH; x++) {
+        for (y = 0; y < PACK_HEIGHT; y++) {
+            if (resized[y][x]) {
+                video[x * VIDEO_LINE_BYTES + y / 8] |= 0x80 >> (y % 8);
+            }
+        }
+    }
+}
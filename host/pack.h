@@ -0,0 +1,70 @@
+/*
+ * pack.h
+ *
+ *  Turns a decoded video frame into the player's packed lines the way
+ *  convert.py does: grey, threshold at 127, cv2.resize() down to 160x128
+ *  with its default bilinear filter, and np.packbits() of the transpose, so
+ *  each display line is a column of the picture and any pixel the resize
+ *  left above 0 is white.
+ *
+ *  The resize follows OpenCV's own fixed-point code for 8-bit pictures
+ *  (imgproc's resizeGeneric_, and the 2x2 average it swaps in for an exact
+ *  half size), including the rounding of its vector path, which is the one
+ *  x86 builds take.  Frames come in as luma (a Y4M's Y plane) and go
+ *  through the same conversion to grey that decoding to BGR and
+ *  cv2.cvtColor() would give a black and white video.
+ */
+
+#ifndef HOST_PACK_H_
+#define HOST_PACK_H_
+
+#include "encode.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// convert.py's OUTPUT_SIZE: a column of the resized picture per display line
+#define PACK_WIDTH VIDEO_LINES
+#define PACK_HEIGHT VIDEO_LINE_PIXELS
+
+/**
+ * What pack_frame() needs to know about a source size, worked out once.
+ * For each resized column, the two source columns it's made from and how
+ * much of each (out of 2048, like OpenCV), and the same for each resized
+ * row.
+ */
+struct pack_plan {
+    unsigned int width, height;
+    uint8_t white[256];                 // luma to cv2.threshold()'s 0 or 255
+    int32_t xofs[2][PACK_WIDTH];
+    int32_t alpha[2][PACK_WIDTH] __attribute__((aligned(32)));
+    int32_t yofs[2][PACK_HEIGHT];
+    int32_t beta[2][PACK_HEIGHT];
+};
+
+/**
+ * Plan for `width` x `height` frames.  `full_range` says the luma goes
+ * 0-255 rather than video's usual 16-235.
+ */
+void pack_plan_init(struct pack_plan *plan, unsigned int width, unsigned int height, bool full_range);
+
+/**
+ * Pack one frame's luma, `stride` bytes a row, into ENCODE_VIDEO_SIZE bytes
+ * of `video`.
+ */
+void pack_frame(const struct pack_plan *plan, const uint8_t *luma, size_t stride, uint8_t *video);
+
+/**
+ * The same, done the slow way: a whole thresholded picture, resized pixel
+ * by pixel, then packed.  For checking pack_frame() against.
+ */
+void pack_frame_reference(unsigned int width, unsigned int height, bool full_range, const uint8_t *luma,
+                          size_t stride, uint8_t *video);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_PACK_H_ */
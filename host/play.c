@@ -0,0 +1,65 @@
+/*
+ * play.c
+ *
+ *  Running the player to completion from inside a benchmark.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static int result_fd = -1;
+
+static void send_frame(unsigned long frame, const struct host_frame *stats) {
+    (void)frame;
+    if (write(result_fd, stats, sizeof(*stats)) != sizeof(*stats)) {
+        _exit(2);
+    }
+}
+
+void host_play(const char *path, unsigned long frames, struct host_frame *results, void (*setup)(void)) {
+    int fds[2];
+    unsigned long n = 0;
+    int status;
+    pid_t pid;
+
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(2);
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(2);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        result_fd = fds[1];
+        host_options.image = path;
+        host_options.frames = frames;
+        host_frame_done = send_frame;
+        // Keep the player's own report out of the way
+        if (!freopen("/dev/null", "w", stderr)) {
+            _exit(2);
+        }
+        if (setup) {
+            setup();
+        }
+        player_main();
+        _exit(1);
+    }
+    close(fds[1]);
+    while (n < frames && read(fds[0], &results[n], sizeof(*results)) == sizeof(*results)) {
+        n++;
+    }
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (n != frames || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: player stopped after %lu of %lu frames\n", path, n, frames);
+        exit(1);
+    }
+}
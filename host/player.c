@@ -0,0 +1,104 @@
+/*
+ * player.c
+ *
+ *  Command line front end for the host build of the player:
+ *
+ *      badapple [-n frames] [-v] [-p last.pgm] [-a audio.u8] [-P profile.bin]
+ *               [-b frame:button,...] [-s] [-T trace.bin] [-S sectors:ms]
+ *               [-L first:next[:tail[:one_in:ms]]] [-E response:token:hang[:corrupt]]
+ *               [-C khz] [-k] image.bin
+ *
+ *  Runs the unmodified player loop from main.c against an SD card image
+ *  as fast as the host can go, then prints per-stage costs.  -b presses
+ *  the seek buttons (0 back, 1 forward) after the frames given.  -s puts
+ *  the TFT on an SPI bus of its own, like a HAL_SPLIT_SPI build.
+ *  -T writes what the player did for timemodel to replay.  -S 200:150
+ *  has the card stop for 150ms (modelled) before every 200th sector.
+ *  -L 800:30:20:500:100 has it take 800us to get going after every read
+ *  command, 30us between the sectors of a stream, another 20us on average
+ *  on every sector, and 50 to 100ms for one sector in 500, at random.
+ *  -E 0:200:1000 has it send an error token in place of one sector in 200
+ *  and never send one in 1000 at all (and lose one command in however
+ *  many the first number says), at random; a fourth number has a bit of
+ *  one sector in so many flip on the way, under its CRC.  -C 4000 has
+ *  every byte it sends come back wrong with the bus any faster than
+ *  4 MHz, so the player has to slow down to read it.  -k checks every
+ *  sector's CRC, the way an SD_CRC build does.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "sdcard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-n frames] [-v] [-p last.pgm] [-a audio.u8] [-P profile.bin] [-b frame:button,...] [-s] [-T trace.bin] [-S sectors:ms] [-L first:next[:tail[:one_in:ms]]] [-E response:token:hang[:corrupt]] [-C khz] [-k] image.bin\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    char *end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:vp:a:P:b:sT:S:L:E:C:k")) != -1) {
+        switch (opt) {
+        case 'n':
+            host_options.frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            host_options.verbose = true;
+            break;
+        case 'p':
+            host_options.pgm = optarg;
+            break;
+        case 'a':
+            host_options.audio = optarg;
+            break;
+        case 'P':
+            host_options.profile = optarg;
+            break;
+        case 'b':
+            host_options.buttons = optarg;
+            break;
+        case 's':
+            host_options.split_spi = true;
+            break;
+        case 'T':
+            host_options.trace = optarg;
+            break;
+        case 'S':
+            host_options.sd_latency.stall_every = strtoul(optarg, &end, 0);
+            if (*end != ':') {
+                usage(argv[0]);
+            }
+            host_options.sd_latency.stall_ns = strtod(end + 1, NULL) * 1e6;
+            break;
+        case 'L':
+            if (!sd_emu_parse_latency(optarg, &host_options.sd_latency)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'C':
+            host_options.sd_max_hz = strtoul(optarg, NULL, 0) * 1000;
+            break;
+        case 'E':
+            if (!sd_emu_parse_faults(optarg, &host_options.sd_faults)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            sd_crcCheck = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    host_options.image = argv[optind];
+
+    return player_main();
+}
@@ -0,0 +1,309 @@
+/*
+ * profview.c
+ *
+ *  Makes sense of a stage profile (profile.h): a dump of profile_ring off
+ *  the board, or what badapple -P wrote.  Pairs up each stage's begin and
+ *  end marks, then prints how long every stage takes (with a histogram of
+ *  each), and the worst frames broken down by stage, saying whether it was
+ *  drawing or reading that made the late ones late.
+ *
+ *      profview [-w frames] [-d deadline us] profile.bin
+ *
+ *  Timestamps are 16 bits of microseconds, so anything longer than 65ms
+ *  between two marks (which would be a badly stuck player) comes out short.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "hal.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Histogram buckets: under 1us, then powers of two up to 65ms
+#define BUCKETS 18
+#define BAR_WIDTH 40
+
+struct stage {
+    const char *name;
+    hal_mark_t begin, end;
+};
+
+enum {
+    STAGE_FRAME, STAGE_IDLE, STAGE_READ, STAGE_DRAW, STAGE_LINE, STAGE_DMA_WAIT,
+    STAGE_SD_COMMAND, STAGE_SD_TOKEN, STAGE_SD_DMA, STAGE_AUDIO, STAGES
+};
+
+static const struct stage stages[STAGES] = {
+    [STAGE_FRAME] = { "frame", HAL_MARK_FRAME_BEGIN, HAL_MARK_IDLE_BEGIN },
+    [STAGE_IDLE] = { "idle", HAL_MARK_IDLE_BEGIN, HAL_MARK_FRAME_BEGIN },
+    [STAGE_READ] = { "read", HAL_MARK_READ_BEGIN, HAL_MARK_READ_END },
+    [STAGE_DRAW] = { "draw", HAL_MARK_DECODE_BEGIN, HAL_MARK_DECODE_END },
+    [STAGE_LINE] = { "line", HAL_MARK_LINE_BEGIN, HAL_MARK_LINE_DECODED },
+    [STAGE_DMA_WAIT] = { "dma wait", HAL_MARK_DMA_WAIT_BEGIN, HAL_MARK_DMA_WAIT_END },
+    [STAGE_SD_COMMAND] = { "sd cmd", HAL_MARK_SD_COMMAND_BEGIN, HAL_MARK_SD_COMMAND_END },
+    [STAGE_SD_TOKEN] = { "sd token", HAL_MARK_SD_TOKEN_BEGIN, HAL_MARK_SD_TOKEN_END },
+    [STAGE_SD_DMA] = { "sd dma", HAL_MARK_SD_DMA_BEGIN, HAL_MARK_SD_DMA_END },
+    [STAGE_AUDIO] = { "audio", HAL_MARK_AUDIO_BEGIN, HAL_MARK_AUDIO_DECODED },
+};
+
+struct stage_stats {
+    unsigned long count;
+    uint64_t total, min, max;
+    unsigned long buckets[BUCKETS];
+};
+
+struct frame {
+    unsigned long n;
+    uint64_t start, busy;
+    bool complete;              // got as far as going back to sleep
+    uint64_t time[STAGES];      // total time in each stage
+    unsigned long count[STAGES];
+};
+
+static struct stage_stats stats[STAGES];
+static struct frame *frames = NULL;
+static size_t frame_count = 0, frame_space = 0;
+
+static unsigned int bucket(uint64_t us) {
+    unsigned int b = 0;
+    while (us && b < BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static struct frame *new_frame(uint64_t start) {
+    struct frame *f;
+    if (frame_count == frame_space) {
+        frame_space = frame_space ? frame_space * 2 : 256;
+        frames = realloc(frames, frame_space * sizeof(*frames));
+        if (!frames) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    f = &frames[frame_count];
+    memset(f, 0, sizeof(*f));
+    f->n = frame_count++;
+    f->start = start;
+    return f;
+}
+
+/*
+ * Walk the events in order, timing every stage.  Events before the first
+ * frame starts (startup, or a ring that begins mid-frame) only count
+ * towards the stage totals.
+ */
+static void analyze(const struct profile_event *events, uint32_t count, uint32_t first, uint32_t slots) {
+    uint64_t open[STAGES];
+    bool is_open[STAGES] = { false };
+    uint64_t now = 0;
+    uint16_t last = 0;
+    struct frame *f = NULL;
+    uint32_t i;
+    int s;
+
+    for (s = 0; s < STAGES; s++) {
+        stats[s].min = UINT64_MAX;
+    }
+    for (i = 0; i < count; i++) {
+        const struct profile_event *e = &events[(first + i) % slots];
+
+        if (i > 0) {
+            now += (uint16_t)(e->time - last);
+        }
+        last = e->time;
+
+        // Ends first: the mark that starts a frame ends the idle before it
+        for (s = 0; s < STAGES; s++) {
+            if (e->mark == stages[s].end && is_open[s]) {
+                uint64_t d = now - open[s];
+                is_open[s] = false;
+                stats[s].count++;
+                stats[s].total += d;
+                stats[s].min = d < stats[s].min ? d : stats[s].min;
+                stats[s].max = d > stats[s].max ? d : stats[s].max;
+                stats[s].buckets[bucket(d)]++;
+                if (f) {
+                    f->time[s] += d;
+                    f->count[s]++;
+                }
+            }
+        }
+        for (s = 0; s < STAGES; s++) {
+            if (e->mark == stages[s].begin) {
+                // A begin with no end (an error path) is just forgotten
+                is_open[s] = true;
+                open[s] = now;
+            }
+        }
+
+        if (e->mark == HAL_MARK_FRAME_BEGIN) {
+            f = new_frame(now);
+        } else if (e->mark == HAL_MARK_IDLE_BEGIN && f) {
+            f->busy = now - f->start;
+            f->complete = true;
+        }
+    }
+    // The player can stop mid-frame
+    if (f && !f->complete) {
+        f->busy = now - f->start;
+    }
+}
+
+static void print_stages(void) {
+    unsigned int s, b;
+
+    printf("%-9s %8s %10s %10s %10s %10s\n", "stage", "count", "min us", "avg us", "max us", "us/frame");
+    for (s = 0; s < STAGES; s++) {
+        if (!stats[s].count) {
+            continue;
+        }
+        printf("%-9s %8lu %10llu %10.1f %10llu %10.1f\n", stages[s].name, stats[s].count,
+               (unsigned long long)stats[s].min, (double)stats[s].total / stats[s].count,
+               (unsigned long long)stats[s].max, frame_count ? (double)stats[s].total / frame_count : 0.0);
+    }
+
+    for (s = 0; s < STAGES; s++) {
+        unsigned long most = 0;
+        if (!stats[s].count) {
+            continue;
+        }
+        for (b = 0; b < BUCKETS; b++) {
+            most = stats[s].buckets[b] > most ? stats[s].buckets[b] : most;
+        }
+        printf("\n%s:\n", stages[s].name);
+        for (b = 0; b < BUCKETS; b++) {
+            unsigned long n = stats[s].buckets[b];
+            unsigned int width = (n * BAR_WIDTH + most - 1) / most;
+            if (!n) {
+                continue;
+            }
+            printf("  < %6lu us %8lu |%.*s\n", 1UL << b, n, width,
+                   "########################################");
+        }
+    }
+}
+
+static int by_busy(const void *a, const void *b) {
+    const struct frame *fa = a, *fb = b;
+    return fa->busy < fb->busy ? 1 : fa->busy > fb->busy ? -1 : 0;
+}
+
+/*
+ * Reading that didn't happen in between display lines: the part of the
+ * read that the frame had to sit and wait for.
+ */
+static uint64_t read_outside_draw(const struct frame *f) {
+    return f->time[STAGE_READ] > f->time[STAGE_DRAW] ? f->time[STAGE_READ] - f->time[STAGE_DRAW] : 0;
+}
+
+static void print_worst(unsigned long worst, unsigned long deadline) {
+    struct frame *sorted;
+    unsigned long i, late = 0;
+
+    for (i = 0; i < frame_count; i++) {
+        late += frames[i].busy > deadline;
+    }
+    printf("\n%zu frames, %lu over %lu us\n", frame_count, late, deadline);
+    if (!frame_count) {
+        return;
+    }
+
+    sorted = malloc(frame_count * sizeof(*sorted));
+    if (!sorted) {
+        perror("malloc");
+        exit(2);
+    }
+    memcpy(sorted, frames, frame_count * sizeof(*sorted));
+    qsort(sorted, frame_count, sizeof(*sorted), by_busy);
+
+    printf("worst frames (us):\n");
+    printf("%-6s %8s %8s %8s %8s %6s %8s %8s %8s %8s %8s %8s\n", "frame", "busy", "draw", "read", "rd wait",
+           "lines", "line", "dma wait", "sd cmd", "sd token", "sd dma", "audio");
+    for (i = 0; i < frame_count && i < worst; i++) {
+        const struct frame *f = &sorted[i];
+        uint64_t wait = read_outside_draw(f);
+        printf("%-6lu %8llu %8llu %8llu %8llu %6lu %8llu %8llu %8llu %8llu %8llu %8llu%s",
+               f->n, (unsigned long long)f->busy, (unsigned long long)f->time[STAGE_DRAW],
+               (unsigned long long)f->time[STAGE_READ], (unsigned long long)wait, f->count[STAGE_LINE],
+               (unsigned long long)f->time[STAGE_LINE], (unsigned long long)f->time[STAGE_DMA_WAIT],
+               (unsigned long long)f->time[STAGE_SD_COMMAND], (unsigned long long)f->time[STAGE_SD_TOKEN],
+               (unsigned long long)f->time[STAGE_SD_DMA], (unsigned long long)f->time[STAGE_AUDIO],
+               f->complete ? "" : " (cut off)");
+        if (f->busy > deadline) {
+            // Whichever took the bigger share of the frame gets the blame
+            printf("  LATE: %s", f->time[STAGE_DRAW] >= wait + f->time[STAGE_AUDIO]
+                   ? "decode_and_write_frame()" : "reading (jitter_next())");
+        }
+        printf("\n");
+    }
+    free(sorted);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-w frames] [-d deadline us] profile.bin\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    unsigned long worst = 5, deadline = 33333;
+    struct profile_header header;
+    struct profile_event *events;
+    uint32_t slots, count, first;
+    long size;
+    FILE *f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:d:")) != -1) {
+        switch (opt) {
+        case 'w':
+            worst = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            deadline = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 2;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != PROFILE_MAGIC) {
+        fprintf(stderr, "%s: not a profile\n", argv[optind]);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, sizeof(header), SEEK_SET);
+    slots = (size - sizeof(header)) / sizeof(*events);
+    events = slots ? malloc(slots * sizeof(*events)) : NULL;
+    if (!events || fread(events, sizeof(*events), slots, f) != slots) {
+        fprintf(stderr, "%s: short read\n", argv[optind]);
+        return 2;
+    }
+    fclose(f);
+
+    // A ring that's gone round starts with its oldest event
+    count = header.count < slots ? header.count : slots;
+    first = header.count > slots ? header.count % slots : 0;
+    printf("%u events%s%s\n", count, header.count > slots ? " (ring wrapped)" : "",
+           (header.flags & PROFILE_STOPPED) ? ", stopped after a late frame" : "");
+
+    analyze(events, count, first, slots);
+    print_stages();
+    print_worst(worst, deadline);
+    free(events);
+    free(frames);
+    return 0;
+}
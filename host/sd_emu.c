@@ -0,0 +1,421 @@
+/*
+ * sd_emu.c
+ *
+ *  Just enough of the SD SPI protocol to get sdcard.c through init and
+ *  reading: CMD0, CMD8, CMD55/ACMD41, CMD58, CMD17 and CMD18/CMD12.
+ *  Every response is preceded by one 0xFF (N_CR) byte and every data
+ *  block by one 0xFF (N_AC) byte before the start token.  On top of that
+ *  it can be slow (struct sd_emu_latency) and get things wrong (struct
+ *  sd_emu_faults), the way real cards do.
+ */
+
+#define _XOPEN_SOURCE 700
+#include "sd_emu.h"
+#include "host.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SECTOR_SIZE 512
+#define OUT_SIZE 1024
+
+#define R1_READY 0x00
+#define R1_IDLE 0x01
+#define R1_ILLEGAL_COMMAND 0x04
+#define R1_PARAMETER_ERROR 0x40
+#define DATA_START_TOKEN 0xFE
+#define DATA_ERROR_CARD_ECC 0x04
+#define DATA_ERROR_OUT_OF_RANGE 0x08
+
+static int fd = -1;
+static uint32_t sectors = 0;
+static bool eof = false;
+static uint32_t commands[64];
+
+// Card state
+static bool idle = true;
+static bool app_cmd = false;
+// CMD18 in progress, and the sector it sends next
+static bool streaming = false;
+static uint32_t stream_sector = 0;
+// A sector's on its way (the CMD17's, or the stream's next), and when
+// it's ready to send
+static bool block_due = false;
+static uint32_t block_sector;
+static uint64_t ready_ns = 0;
+static struct sd_emu_latency latency;
+static uint64_t random_state = 1;
+static struct sd_emu_faults faults;
+static uint64_t fault_state = 1;
+// faults.mangle_sector's been sent mangled already
+static bool mangled = false;
+static uint32_t injected = 0;
+// Faults start with the first read, once sd_init()'s done
+static bool reading = false;
+
+// Command currently being clocked in
+static uint8_t cmd_buf[6];
+static unsigned int cmd_len = 0;
+
+// Bytes queued up to be clocked out on MISO
+static uint8_t out[OUT_SIZE];
+static unsigned int out_head = 0, out_tail = 0;
+
+static void out_push(uint8_t b) {
+    out[out_tail] = b;
+    out_tail = (out_tail + 1) % OUT_SIZE;
+}
+
+static bool out_empty() {
+    return out_head == out_tail;
+}
+
+static uint8_t out_pop() {
+    uint8_t b = out[out_head];
+    out_head = (out_head + 1) % OUT_SIZE;
+    return b;
+}
+
+/*
+ * CRC16-CCITT (XMODEM), the CRC the card appends to every data block.
+ */
+static uint16_t crc16(const uint8_t *buf, size_t size) {
+    uint16_t crc = 0;
+    size_t i;
+    int j;
+    for (i = 0; i < size; i++) {
+        crc ^= (uint16_t)buf[i] << 8;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void read_sector(uint32_t sector, uint8_t *buf) {
+    ssize_t n;
+    memset(buf, 0, SECTOR_SIZE);
+    n = pread(fd, buf, SECTOR_SIZE, (off_t)sector * SECTOR_SIZE);
+    (void)n; // a short read of the final sector leaves it zero padded
+}
+
+/*
+ * xorshift64*, in [0, 1)
+ */
+static double random_unit(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * 2685821657736338717ULL >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Whether to get this one wrong, one time in `one_in`.
+ */
+static bool inject(uint32_t one_in) {
+    if (!one_in || random_unit(&fault_state) * one_in >= 1.0) {
+        return false;
+    }
+    injected++;
+    return true;
+}
+
+static void queue_block(uint32_t sector, bool corrupt) {
+    uint8_t buf[SECTOR_SIZE];
+    uint16_t crc;
+    int i;
+
+    read_sector(sector, buf);
+    crc = crc16(buf, SECTOR_SIZE);
+    if (corrupt) {
+        // Noise on MISO: the card sends the right CRC, we hear one bit wrong
+        i = (int)(random_unit(&fault_state) * SECTOR_SIZE * 8);
+        buf[i / 8] ^= 1 << (i % 8);
+    }
+    if (faults.mangle_sector && sector == faults.mangle_sector && !mangled) {
+        buf[0] ^= 0xFF;
+        mangled = true;
+        injected++;
+    }
+    out_push(0xFF); // N_AC
+    out_push(DATA_START_TOKEN);
+    for (i = 0; i < SECTOR_SIZE; i++) {
+        out_push(buf[i]);
+    }
+    out_push(crc >> 8);
+    out_push(crc & 0xFF);
+}
+
+/*
+ * The sector that's been on its way is ready: send it (the CMD17's, or
+ * the stream's next), or an error token if we've run off the end of the
+ * image, or something's gone wrong with it.
+ */
+static void block_ready() {
+    if (streaming && stream_sector >= sectors) {
+        eof = true;
+        streaming = false;
+        out_push(0xFF);
+        out_push(DATA_ERROR_OUT_OF_RANGE);
+        return;
+    }
+    if (inject(faults.hang_one_in)) {
+        return; // nothing more until the next command
+    }
+    if (inject(faults.token_one_in)) {
+        // A stream goes on to try this sector again, like the command had
+        // only just come in
+        out_push(0xFF);
+        out_push(DATA_ERROR_CARD_ECC);
+        return;
+    }
+    queue_block(streaming ? stream_sector++ : block_sector, inject(faults.corrupt_one_in));
+}
+
+/*
+ * Start getting `sector` ready: the first of a read command's, or the
+ * next of a stream.
+ */
+static void block_wait(uint32_t sector, bool first) {
+    uint64_t ns = first ? latency.first_ns : latency.next_ns;
+
+    if (latency.tail_ns) {
+        ns += (uint64_t)(-log(1.0 - random_unit(&random_state)) * latency.tail_ns);
+    }
+    if (latency.spike_one_in && random_unit(&random_state) * latency.spike_one_in < 1.0) {
+        ns += latency.spike_ns / 2 + (uint64_t)(random_unit(&random_state) * (latency.spike_ns / 2));
+    }
+    if (!first && latency.stall_every && sector % latency.stall_every == 0) {
+        ns += latency.stall_ns;
+    }
+    block_due = true;
+    block_sector = sector;
+    ready_ns = host_vtime_ns() + ns;
+}
+
+static void respond(uint8_t r1) {
+    out_push(0xFF); // N_CR
+    out_push(r1);
+}
+
+static void handle_command() {
+    uint8_t cmd = cmd_buf[0] & 0x3F;
+    uint32_t arg = ((uint32_t)cmd_buf[1] << 24) | ((uint32_t)cmd_buf[2] << 16)
+                 | ((uint32_t)cmd_buf[3] << 8) | cmd_buf[4];
+    uint8_t status = idle ? R1_IDLE : R1_READY;
+    bool acmd = app_cmd;
+
+    // A new command aborts whatever we were in the middle of sending
+    out_head = out_tail = 0;
+    app_cmd = false;
+    commands[cmd]++;
+
+    if (cmd == 17 || cmd == 18) {
+        reading = true;
+    }
+    if (reading && inject(faults.response_one_in)) {
+        // Lost on the way in: no answer, and nothing done about it
+        return;
+    }
+    if (streaming && cmd != 12) {
+        // Only STOP_TRANSMISSION is legal in the middle of a stream
+        respond(status | R1_ILLEGAL_COMMAND);
+        return;
+    }
+    block_due = false;
+
+    if (acmd && cmd == 41) {
+        // ACMD41: SD_SEND_OP_COND.  We're always done initializing.
+        idle = false;
+        respond(R1_READY);
+        return;
+    }
+
+    switch (cmd) {
+    case 0: // GO_IDLE_STATE
+        idle = true;
+        respond(R1_IDLE);
+        break;
+    case 8: // SEND_IF_COND: echo back the voltage range and check pattern
+        respond(status);
+        out_push(0x00);
+        out_push(0x00);
+        out_push((arg >> 8) & 0x0F);
+        out_push(arg & 0xFF);
+        break;
+    case 55: // APP_CMD
+        app_cmd = true;
+        respond(status);
+        break;
+    case 58: // READ_OCR: powered up, CCS set (SDHC), 2.7-3.6V
+        respond(status);
+        out_push(0xC0);
+        out_push(0xFF);
+        out_push(0x80);
+        out_push(0x00);
+        break;
+    case 17: // READ_SINGLE_BLOCK
+        if (idle) {
+            respond(status | R1_ILLEGAL_COMMAND);
+        } else if (arg >= sectors) {
+            eof = true;
+            respond(R1_PARAMETER_ERROR);
+        } else {
+            respond(R1_READY);
+            block_wait(arg, true);
+        }
+        break;
+    case 18: // READ_MULTIPLE_BLOCK
+        if (idle) {
+            respond(status | R1_ILLEGAL_COMMAND);
+        } else if (arg >= sectors) {
+            eof = true;
+            respond(R1_PARAMETER_ERROR);
+        } else {
+            respond(R1_READY);
+            streaming = true;
+            stream_sector = arg;
+            block_wait(arg, true);
+        }
+        break;
+    case 12: // STOP_TRANSMISSION: R1, then a couple of busy bytes
+        if (!streaming) {
+            respond(status | R1_ILLEGAL_COMMAND);
+            break;
+        }
+        streaming = false;
+        respond(status);
+        out_push(0x00);
+        out_push(0x00);
+        break;
+    default:
+        respond(status | R1_ILLEGAL_COMMAND);
+        break;
+    }
+}
+
+bool sd_emu_open(const char *path) {
+    struct stat st;
+
+    sd_emu_close();
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0) {
+        sd_emu_close();
+        return false;
+    }
+    sectors = (st.st_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    return true;
+}
+
+void sd_emu_close() {
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = -1;
+    sectors = 0;
+    eof = false;
+    memset(commands, 0, sizeof(commands));
+    injected = 0;
+    reading = false;
+    idle = true;
+    app_cmd = false;
+    streaming = false;
+    block_due = false;
+    cmd_len = 0;
+    out_head = out_tail = 0;
+}
+
+void sd_emu_select(bool selected) {
+    if (!selected) {
+        cmd_len = 0;
+    }
+}
+
+uint8_t sd_emu_xfer(uint8_t tx) {
+    uint8_t rx = 0xFF;
+
+    if (out_empty() && block_due && host_vtime_ns() >= ready_ns) {
+        block_due = false;
+        block_ready();
+    }
+    if (!out_empty()) {
+        rx = out_pop();
+        // The card starts on the next sector as soon as the last one's out
+        if (out_empty() && streaming && !block_due) {
+            block_wait(stream_sector, false);
+        }
+    }
+
+    // Commands start with a 01 bit pattern; anything else while we're not
+    // mid-command is just the host clocking us for our response.
+    if (cmd_len > 0 || (tx & 0xC0) == 0x40) {
+        cmd_buf[cmd_len++] = tx;
+        if (cmd_len == sizeof(cmd_buf)) {
+            cmd_len = 0;
+            handle_command();
+        }
+    }
+    return rx;
+}
+
+void sd_emu_latency(const struct sd_emu_latency *l) {
+    latency = *l;
+    random_state = 0x9E3779B97F4A7C15ULL;
+}
+
+void sd_emu_faults(const struct sd_emu_faults *f) {
+    faults = *f;
+    fault_state = 0xD1B54A32D192ED03ULL;
+    mangled = false;
+}
+
+bool sd_emu_parse_faults(const char *spec, struct sd_emu_faults *f) {
+    unsigned long response, token, hang, corrupt = 0;
+    int n = sscanf(spec, "%lu:%lu:%lu:%lu", &response, &token, &hang, &corrupt);
+
+    if (n != 3 && n != 4) {
+        return false;
+    }
+    f->response_one_in = response;
+    f->token_one_in = token;
+    f->hang_one_in = hang;
+    f->corrupt_one_in = corrupt;
+    return true;
+}
+
+bool sd_emu_parse_latency(const char *spec, struct sd_emu_latency *l) {
+    unsigned long first, next, tail = 0, one_in = 0, spike = 0;
+    int n = sscanf(spec, "%lu:%lu:%lu:%lu:%lu", &first, &next, &tail, &one_in, &spike);
+
+    if (n != 2 && n != 3 && n != 5) {
+        return false;
+    }
+    l->first_ns = first * 1000ULL;
+    l->next_ns = next * 1000ULL;
+    l->tail_ns = tail * 1000ULL;
+    l->spike_one_in = one_in;
+    l->spike_ns = spike * 1000000ULL;
+    return true;
+}
+
+uint32_t sd_emu_sectors() {
+    return sectors;
+}
+
+bool sd_emu_eof() {
+    return eof;
+}
+
+uint32_t sd_emu_commands(uint8_t cmd) {
+    return commands[cmd & 0x3F];
+}
+
+uint32_t sd_emu_injected() {
+    return injected;
+}
@@ -0,0 +1,117 @@
+/*
+ * sd_emu.h
+ *
+ *  Byte-level emulation of an SDHC card in SPI mode, backed by an image
+ *  file.  It sits below hal_spi_xfer() in the host build so that
+ *  sdcard.c runs unmodified against it.
+ */
+
+#ifndef HOST_SD_EMU_H_
+#define HOST_SD_EMU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open `path` as the card image.  Returns false if it can't be read.
+ */
+bool sd_emu_open(const char *path);
+
+/**
+ * How long the card takes to get each sector ready, in modelled time
+ * (host_vtime_ns()), holding its start token back until it is.  All zero
+ * (the default) is a card that always has the next sector ready.
+ */
+struct sd_emu_latency {
+    uint64_t first_ns;      // from a read command to its first sector
+    uint64_t next_ns;       // from one sector of a stream being sent to the next
+    uint64_t tail_ns;       // mean of an exponentially distributed extra on every sector
+    uint32_t spike_one_in;  // one sector in this many, at random, waits for housekeeping too (0 = never)
+    uint64_t spike_ns;      // for between half this and this
+    uint32_t stall_every;   // every this many'th sector streamed waits for housekeeping, like clockwork (0 = never)
+    uint64_t stall_ns;      // for this long
+};
+
+/**
+ * Inject `latency` from the next command on.  The random parts come from
+ * a fixed seed, so every run's the same.
+ */
+void sd_emu_latency(const struct sd_emu_latency *latency);
+
+/**
+ * Parse "first:next[:tail[:one_in:spike]]", the first three in
+ * microseconds and the spike in milliseconds (badapple -L), into the
+ * random parts of `latency`.  Returns false if it doesn't make sense.
+ */
+bool sd_emu_parse_latency(const char *spec, struct sd_emu_latency *latency);
+
+/**
+ * Things the card gets wrong, each one time in so many at random (0 =
+ * never, the default).  They only start with the first read command, so
+ * sd_init() always gets through.
+ */
+struct sd_emu_faults {
+    uint32_t response_one_in;   // a command's lost: no R1, and it isn't carried out
+    uint32_t token_one_in;      // a sector comes back as an error token (card ECC failed)
+    uint32_t hang_one_in;       // a sector never comes, until the next command
+    uint32_t corrupt_one_in;    // a bit of a sector flips on the way, under its CRC
+    uint32_t mangle_sector;     // the first time this sector's sent, its first byte comes in inverted (0 = never)
+};
+
+/**
+ * Inject `faults` from the next command on, from a fixed seed of their
+ * own, so every run's the same and they don't change the latencies.
+ */
+void sd_emu_faults(const struct sd_emu_faults *faults);
+
+/**
+ * Parse "response:token:hang[:corrupt]" (badapple -E) into `faults`.  Returns false
+ * if it doesn't make sense.
+ */
+bool sd_emu_parse_faults(const char *spec, struct sd_emu_faults *faults);
+
+/**
+ * Close the image and reset the card to its power-on state.
+ */
+void sd_emu_close();
+
+/**
+ * Chip select edge.  Deselecting the card drops any half-received command.
+ */
+void sd_emu_select(bool selected);
+
+/**
+ * Clock one byte through the card while it's selected: `tx` is what
+ * the host drove on MOSI, the return value is what the card drove on MISO.
+ */
+uint8_t sd_emu_xfer(uint8_t tx);
+
+/**
+ * Number of 512 byte sectors in the image (the last one zero padded).
+ */
+uint32_t sd_emu_sectors();
+
+/**
+ * True once the player has asked for a sector past the end of the image.
+ */
+bool sd_emu_eof();
+
+/**
+ * How many times the card's been sent command `cmd` since it was opened.
+ */
+uint32_t sd_emu_commands(uint8_t cmd);
+
+/**
+ * How many faults have been injected since the image was opened.
+ */
+uint32_t sd_emu_injected();
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_SD_EMU_H_ */
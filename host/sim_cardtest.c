@@ -0,0 +1,150 @@
+/*
+ * sim_cardtest.c
+ *
+ *  Does the card tester (cardtest.h) measure what's there?  Runs it
+ *  against the emulated card with a few kinds of latency injected (sd_emu.h)
+ *  and checks each comes out in the histograms and the slowest sectors
+ *  where it should:
+ *
+ *      steady      a card that always has the next sector ready
+ *      access      800us to get going after every command, 30us between
+ *                  the sectors of a stream
+ *      tail        300us and 20us, plus an exponential 50us on average
+ *      spikes      50 to 100ms for one sector in 200, at random
+ *      stalls      40ms before every 100th sector of the stream
+ *
+ *      sim_cardtest [sectors]
+ *
+ *  Exits 1 if any of them doesn't.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "cardtest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct card {
+    const char *name;
+    struct sd_emu_latency latency;
+};
+
+static const struct card cards[] = {
+    { "steady", { 0 } },
+    { "access", { .first_ns = 800000, .next_ns = 30000 } },
+    { "tail", { .first_ns = 300000, .next_ns = 20000, .tail_ns = 50000 } },
+    { "spikes", { .spike_one_in = 200, .spike_ns = 100000000 } },
+    { "stalls", { .stall_every = 100, .stall_ns = 40000000 } },
+};
+
+#define CARDS (sizeof(cards) / sizeof(cards[0]))
+
+static const struct cardtest_sweep *stream = &cardtest_results.sweeps[CARDTEST_SWEEP_SEQUENTIAL];
+static const struct cardtest_sweep *single = &cardtest_results.sweeps[CARDTEST_SWEEP_RANDOM];
+
+/*
+ * How many sectors of a sweep took at least `us` to start, to a bin.
+ */
+static uint32_t at_least(const struct cardtest_histogram *h, uint32_t us) {
+    uint32_t n = 0;
+    unsigned int b;
+
+    for (b = cardtest_bin(us); b < CARDTEST_BINS; b++) {
+        n += h->bins[b];
+    }
+    return n;
+}
+
+/*
+ * Whether the slowest sectors of the stream are the stalled ones, every
+ * `every`th, and nothing else held it up as long.
+ */
+static bool stalls_found(uint32_t every, uint32_t us) {
+    uint32_t found = 0;
+    unsigned int i;
+
+    for (i = 0; i < CARDTEST_WORST; i++) {
+        if (stream->worst[i].token_us >= us) {
+            if (stream->worst[i].sector % every) {
+                return false;
+            }
+            found++;
+        }
+    }
+    // The first sector's asked for by the CMD18, so isn't a stall
+    return found == MIN((stream->count - 1) / every, CARDTEST_WORST);
+}
+
+static bool check(unsigned int c) {
+    const struct cardtest_histogram *st = &stream->token, *rt = &single->token;
+    uint32_t expected;
+
+    if (stream->errors || single->errors || !(cardtest_results.flags & CARDTEST_DONE)) {
+        return false;
+    }
+    // Sending a sector takes its 514 bytes on the bus whatever the card's like
+    if (stream->transfer.max_us != stream->transfer.min_us) {
+        return false;
+    }
+    switch (c) {
+    case 0:
+        return st->max_us < 20 && rt->max_us < 20;
+    case 1:
+        // The command itself is a few bytes on top
+        return rt->min_us >= 800 && rt->max_us < 820 && st->min_us >= 30 && at_least(st, 50) <= 1;
+    case 2:
+        // Exponential, so about 1 in e^2 of them more than twice the mean over
+        expected = single->count * 0.135;
+        return rt->min_us >= 300 && rt->max_us < 2000 && st->min_us >= 20
+                && at_least(rt, 300 + 100) > expected / 2 && at_least(rt, 300 + 100) < expected * 2;
+    case 3:
+        expected = stream->count / 200;
+        return at_least(st, 50000) >= expected / 3 && at_least(st, 50000) <= expected * 3
+                && st->max_us < 101000;
+    case 4:
+        return stalls_found(100, 40000) && at_least(st, 40000) == (stream->count - 1) / 100
+                && rt->max_us < 20;
+    default:
+        return false;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long sectors = argc > 1 ? strtoul(argv[1], NULL, 0) : 2048;
+    char path[] = "/tmp/sim_cardtestXXXXXX";
+    bool ok = true, passed;
+    unsigned int c;
+    int fd = mkstemp(path);
+
+    if (fd < 0 || ftruncate(fd, sectors * 512) != 0) {
+        perror(path);
+        return 2;
+    }
+    close(fd);
+
+    printf("%lu sectors, %lu random reads\n", sectors, CARDTEST_RANDOM);
+    printf("%-8s %29s %29s\n", "", "sequential token us", "random token us");
+    printf("%-8s %9s %9s %9s %9s %9s %9s\n", "card", "min", "mean", "max", "min", "mean", "max");
+    for (c = 0; c < CARDS; c++) {
+        host_options.image = path;
+        host_options.sd_latency = cards[c].latency;
+        hal_init();
+        spi_init();
+        if (!sd_init()) {
+            fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+            return 2;
+        }
+        cardtest_run(MIN(CARDTEST_SPAN, sd_emu_sectors()));
+        passed = check(c);
+        ok = ok && passed;
+        printf("%-8s %9u %9.1f %9u %9u %9.1f %9u%s\n", cards[c].name, stream->token.min_us,
+               (double)stream->token.total_us / stream->count, stream->token.max_us, single->token.min_us,
+               (double)single->token.total_us / single->count, single->token.max_us, passed ? "" : "  FAIL");
+    }
+    unlink(path);
+    return ok ? 0 : 1;
+}
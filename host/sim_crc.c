@@ -0,0 +1,253 @@
+/*
+ * sim_crc.c
+ *
+ *  Does checking the card's data CRCs (sd_crcCheck, SD_CRC builds) catch
+ *  sectors that come in wrong, and what does it cost?
+ *
+ *  First the host's model of the CRC16 module (hal_crc_feed()) against the
+ *  SD spec's own example and the usual CRC16-CCITT check value, so it's
+ *  the CRC the board's CRCDIRB / CRCINIRES work out.  Then reads off an
+ *  emulated card that flips a bit of one sector in CORRUPT_ONE_IN on the
+ *  way (sd_emu.h), streamed, one sector at a time and asynchronously, with
+ *  the check off and on, each tried again up to SD_READ_RETRIES times:
+ *
+ *      wrong   reads that came back true with the wrong data
+ *      caught  sectors the check turned down (sd_crcErrors)
+ *      lost    reads that failed every time
+ *
+ *  Then the player, on a good card with the check off and on, and on the
+ *  bad one with it on, with the card on its own bus and sharing the TFT's:
+ *  the modelled frame time, on average and at worst, and whether every
+ *  frame drew the same as with the check off.
+ *
+ *      sim_crc [reads]
+ *
+ *  Exits 1 if a CRC comes out wrong, a bad sector got past the check, a
+ *  read was lost, or the player drew anything different or late with it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTORS 4096
+// Sectors in a stream or an asynchronous run
+#define RUN 8
+#define CORRUPT_ONE_IN 50
+
+static uint8_t buf[RUN * 512];
+static uint32_t random_state = 0x2545F491;
+
+static uint32_t random_sector() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % (SECTORS - RUN);
+}
+
+static void fill(uint32_t sector, uint8_t *p) {
+    unsigned int i;
+    for (i = 0; i < 512; i++) {
+        p[i] = (uint8_t)(sector * 7 + i + (sector >> 8));
+    }
+}
+
+static bool make_image(const char *path) {
+    uint8_t sector[512];
+    uint32_t n;
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        return false;
+    }
+    for (n = 0; n < SECTORS; n++) {
+        fill(n, sector);
+        fwrite(sector, sizeof(sector), 1, f);
+    }
+    return fclose(f) == 0;
+}
+
+static uint16_t crc(const uint8_t *p, size_t size) {
+    hal_crc_reset();
+    hal_crc_feed(p, size);
+    return hal_crc_result();
+}
+
+/*
+ * The model against known CRCs, fed whole and a byte or two at a time
+ * the way sd_async_bus_wait() does.
+ */
+static bool vectors() {
+    static const uint8_t digits[] = "123456789";
+    uint8_t ones[512], sector[512];
+    uint16_t whole, pieces, check, spec;
+    size_t i;
+
+    memset(ones, 0xFF, sizeof(ones));
+    fill(1234, sector);
+    whole = crc(sector, sizeof(sector));
+    hal_crc_reset();
+    for (i = 0; i < sizeof(sector); i += 1 + i % 3) {
+        hal_crc_feed(sector + i, MIN(1 + i % 3, sizeof(sector) - i));
+    }
+    pieces = hal_crc_result();
+    check = crc(digits, 9);
+    spec = crc(ones, sizeof(ones));
+    printf("crc16 \"123456789\" %04X, 512 x FF %04X, in pieces %s\n", check, spec,
+           pieces == whole ? "the same" : "DIFFERENT");
+    // 0x31C3 is CRC16/XMODEM's check value; the SD spec gives 0x7FA1
+    return check == 0x31C3 && spec == 0x7FA1 && pieces == whole;
+}
+
+struct totals {
+    unsigned long wrong, lost;
+};
+
+static bool try_read(unsigned int kind, uint32_t sector, uint32_t count) {
+    bool ok = true;
+    uint32_t n;
+
+    switch (kind) {
+    case 0:
+        for (n = 0; n < count && ok; n++) {
+            ok = sd_stream_read(sector + n, buf + n * 512);
+        }
+        return ok;
+    case 1:
+        return sd_read_block(sector, buf);
+    default:
+        return sd_async_start(sector, buf, count) && sd_async_wait();
+    }
+}
+
+static void read_checked(unsigned int kind, uint32_t sector, struct totals *t) {
+    uint32_t count = kind == 1 ? 1 : RUN, n;
+    uint8_t want[512], i;
+
+    for (i = 0; !try_read(kind, sector, count); i++) {
+        if (i == SD_READ_RETRIES) {
+            t->lost++;
+            return;
+        }
+    }
+    for (n = 0; n < count; n++) {
+        fill(sector + n, want);
+        if (memcmp(want, buf + n * 512, sizeof(want)) != 0) {
+            t->wrong++;
+            return;
+        }
+    }
+}
+
+struct run {
+    const char *name;
+    bool check;
+    uint32_t corrupt_one_in;
+};
+
+static const struct run runs[] = {
+    { "off", false, 0 },
+    { "on", true, 0 },
+    { "on, bad", true, 100 },
+};
+
+#define RUNS (sizeof(runs) / sizeof(runs[0]))
+
+// The play the child's being set up for
+static const struct run *run;
+static bool shared;
+
+static void setup() {
+    sd_crcCheck = run->check;
+    host_options.sd_faults.corrupt_one_in = run->corrupt_one_in;
+    host_options.split_spi = !shared;
+}
+
+int main(int argc, char **argv) {
+    unsigned long reads = argc > 1 ? strtoul(argv[1], NULL, 0) : 300, n, frames = 300;
+    char path[] = "/tmp/sim_crcXXXXXX", video[] = "/tmp/sim_crcXXXXXX";
+    struct host_frame *results = calloc(frames, sizeof(*results)), *clean = calloc(frames, sizeof(*clean));
+    struct totals t;
+    bool ok, passed;
+    unsigned int c, kind, s;
+    int fd = mkstemp(path);
+
+    if (fd < 0 || !results || !clean) {
+        perror(path);
+        return 2;
+    }
+    close(fd);
+    if (!make_image(path)) {
+        perror(path);
+        return 2;
+    }
+
+    ok = vectors();
+
+    printf("\n%lu reads of each kind, one sector in %u with a bit flipped\n", reads, CORRUPT_ONE_IN);
+    printf("%-6s %7s %7s %7s %7s\n", "check", "flipped", "wrong", "caught", "lost");
+    for (c = 0; c < 2; c++) {
+        memset(&t, 0, sizeof(t));
+        host_options.image = path;
+        host_options.sd_faults.corrupt_one_in = CORRUPT_ONE_IN;
+        hal_init();
+        spi_init();
+        if (!sd_init()) {
+            fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+            return 2;
+        }
+        sd_crcCheck = c;
+        sd_crcErrors = 0;
+        for (n = 0; n < reads; n++) {
+            for (kind = 0; kind < 3; kind++) {
+                read_checked(kind, random_sector(), &t);
+            }
+        }
+        // Without the check the flipped bits have to show, or this proves
+        // nothing.  (Not every flipped one's caught: a stream's stopped with
+        // the sector after the last one read on its way.)
+        passed = c ? !t.wrong && !t.lost && sd_crcErrors : t.wrong > 0;
+        ok = ok && passed;
+        printf("%-6s %7u %7lu %7u %7lu%s\n", c ? "on" : "off", sd_emu_injected(), t.wrong, sd_crcErrors,
+               t.lost, passed ? "" : "  FAIL");
+    }
+    host_options.sd_faults.corrupt_one_in = 0;
+    sd_crcCheck = false;
+    unlink(path);
+
+    encode_synth_image(video, frames, ENCODE_DUPLICATE);
+    printf("\n%lu frames played\n", frames);
+    printf("%-7s %-8s %9s %9s %7s %7s\n", "bus", "check", "avg us", "max us", "late", "same");
+    for (s = 0; s < 2; s++) {
+        shared = s;
+        for (c = 0; c < RUNS; c++) {
+            uint64_t total = 0, max = 0;
+            unsigned long late = 0, same = 0;
+
+            run = &runs[c];
+            host_play(video, frames, c ? results : clean, setup);
+            for (n = 0; n < frames; n++) {
+                const struct host_frame *f = c ? &results[n] : &clean[n];
+                total += f->busy_ns;
+                max = f->busy_ns > max ? f->busy_ns : max;
+                late += f->busy_ns > HOST_FRAME_NS;
+                same += f->hash == clean[n].hash;
+            }
+            passed = !c || (!late && same == frames);
+            ok = ok && passed;
+            printf("%-7s %-8s %9.1f %9.1f %7lu %7lu%s\n", shared ? "shared" : "own", run->name,
+                   total / 1e3 / frames, max / 1e3, late, same, passed ? "" : "  FAIL");
+        }
+    }
+    unlink(video);
+    free(results);
+    free(clean);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+/*
+ * sim_fat.c
+ *
+ *  Does the video play the same off a FAT32 card as written raw, without
+ *  the FAT costing anything per frame?  Puts a synthetic video on FAT32
+ *  card images a few different ways (fatgen.h): in one piece, in dozens of
+ *  pieces that frames straddle, and with no partition table.  Plays each,
+ *  pressing the seek buttons along the way, and checks every frame against
+ *  the raw card.  Counts the reads that had to start a new CMD18 stream and
+ *  the single sector reads (CMD17, which is all fat.c reads with) while
+ *  playing: the FAT card should need no single sector reads at all, and
+ *  only a new stream where a frame's sectors jump to the next piece.
+ *
+ *  Then, without the player, checks that fat_sector() puts every sector
+ *  of the file where the image has it, that streaming past its end fails
+ *  without a command to the card, and that a file in too many pieces,
+ *  a missing file and a raw card are each told apart.
+ *
+ *      sim_fat
+ *
+ *  Exits 1 if any of that isn't so.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "synth.h"
+#include "fatgen.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "fat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IMAGE_FRAMES 240
+#define CHAPTER_FRAMES 80
+#define RUN_FRAMES 200
+#define BUTTONS "50:1,100:0,150:0"
+#define FILE_NAME "BADAPPLE.BIN"
+
+struct layout {
+    const char *name;
+    struct fatgen g;
+};
+
+static struct layout layouts[] = {
+    { "one piece", { 8, 0, true } },
+    { "fragmented", { 1, 16, true } },
+    { "no MBR", { 4, 3, false } },
+};
+
+static uint8_t *video;
+static size_t video_size;
+
+static void press_buttons() {
+    host_options.buttons = BUTTONS;
+}
+
+static void write_video(char *path) {
+    uint8_t pic[SYNTH_VIDEO_SIZE], audio[SYNTH_AUDIO_SIZE];
+    static struct encoder e;
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w+b");
+    unsigned long n;
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    encode_open(&e, f, 0);
+    for (n = 0; n < IMAGE_FRAMES; n++) {
+        if (n % CHAPTER_FRAMES == 0) {
+            encode_chapter(&e);
+        }
+        synth_video(n, pic);
+        synth_audio(n, audio);
+        encode_frame(&e, pic, audio);
+    }
+    encode_close(&e);
+    video_size = ftell(f);
+    video = malloc(video_size);
+    rewind(f);
+    if (!video || fread(video, 1, video_size, f) != video_size) {
+        perror(path);
+        exit(2);
+    }
+    fclose(f);
+}
+
+static void write_card(char *path, struct fatgen *g, const char *name) {
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+
+    if (!f || !fatgen_write(g, f, name, video, video_size)) {
+        perror(path);
+        exit(2);
+    }
+    fclose(f);
+}
+
+static void count(const struct host_frame *results, unsigned long *streams, unsigned long *block_reads) {
+    unsigned long n;
+
+    *streams = *block_reads = 0;
+    for (n = 0; n < RUN_FRAMES; n++) {
+        *streams += results[n].sd_streams;
+        *block_reads += results[n].sd_block_reads;
+    }
+}
+
+/*
+ * Play the card at `path` against the raw one.
+ */
+static bool play(const char *path, const struct fatgen *g, const char *name, const struct host_frame *raw) {
+    static struct host_frame results[RUN_FRAMES];
+    unsigned long raw_streams, raw_reads, streams, reads, n, wrong = 0;
+    bool ok;
+
+    host_play(path, RUN_FRAMES, results, press_buttons);
+    for (n = 0; n < RUN_FRAMES; n++) {
+        wrong += results[n].hash != raw[n].hash;
+    }
+    count(raw, &raw_streams, &raw_reads);
+    count(results, &streams, &reads);
+    // Every seek can start over from the first piece, and the video's
+    // played over about three times along BUTTONS
+    ok = !wrong && !reads && streams <= raw_streams + 4 * g->pieces;
+    printf("%-12s %8u %8u %10lu %10lu %10lu %s\n", name, g->cluster_sectors, g->pieces, wrong, streams,
+           reads, ok ? "" : "FAIL");
+    return ok;
+}
+
+static void open_card(const char *path) {
+    host_options.image = path;
+    hal_init();
+    spi_init();
+    if (!sd_init()) {
+        fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+        exit(1);
+    }
+    fat_errorCode = FAT_ERROR_NONE;
+}
+
+/*
+ * Open the file on `path` without the player, and see that fat_sector()
+ * agrees with where fatgen put each sector.
+ */
+static bool check_map(const char *path, const struct layout *l) {
+    uint8_t buf[512];
+    uint32_t blocks = (video_size + 511) / 512, b, bad = 0, streams;
+    uint8_t extents;
+
+    open_card(path);
+    if (!fat_mount(buf) || !fat_open(FILE_NAME, buf)) {
+        printf("%s: can't open, error %x\n", l->name, fat_errorCode);
+        return false;
+    }
+    fat_extents(&extents);
+    for (b = 0; b < blocks; b++) {
+        bad += fat_sector(b) != fatgen_sector(&l->g, b);
+    }
+    // Backwards, like a seek
+    bad += fat_sector(0) != fatgen_sector(&l->g, 0);
+    bad += fat_sector(blocks) != FAT_NO_SECTOR;
+    // Streaming on past the end has to fail, without asking the card for
+    // anything
+    sd_map = fat_sector;
+    bad += !sd_stream_read(blocks - 1, buf);
+    streams = sd_emu_commands(18);
+    bad += sd_stream_read(blocks, buf) || sd_emu_commands(18) != streams;
+    sd_map = NULL;
+    printf("%s: %u extents, %u of %u sectors in the wrong place\n", l->name, extents, bad, blocks);
+    return extents == l->g.pieces && !bad;
+}
+
+/*
+ * Whether opening `name` on `path` fails the way it should.
+ */
+static bool check_error(const char *what, const char *path, const char *name, uint16_t expected) {
+    uint8_t buf[512];
+    bool ok;
+
+    open_card(path);
+    ok = !(fat_mount(buf) && fat_open(name, buf)) && fat_errorCode == expected;
+    printf("%s: error %x, %s\n", what, fat_errorCode, ok ? "as it should" : "FAIL");
+    return ok;
+}
+
+int main() {
+    char raw_path[] = "/tmp/sim_fat_rawXXXXXX";
+    char paths[sizeof(layouts) / sizeof(layouts[0])][32];
+    char bad_path[] = "/tmp/sim_fat_badXXXXXX";
+    static struct host_frame raw[RUN_FRAMES];
+    struct fatgen shredded = { 1, 4, true };
+    unsigned long streams, reads;
+    bool ok = true;
+    unsigned int i;
+
+    write_video(raw_path);
+    host_play(raw_path, RUN_FRAMES, raw, press_buttons);
+    count(raw, &streams, &reads);
+
+    printf("%lu frames, buttons %s\n", (unsigned long)RUN_FRAMES, BUTTONS);
+    printf("%-12s %8s %8s %10s %10s %10s\n", "card", "cluster", "pieces", "wrong", "streams", "CMD17s");
+    printf("%-12s %8s %8s %10s %10lu %10lu\n", "raw", "-", "-", "-", streams, reads);
+    for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        strcpy(paths[i], "/tmp/sim_fatXXXXXX");
+        write_card(paths[i], &layouts[i].g, FILE_NAME);
+        ok &= play(paths[i], &layouts[i].g, layouts[i].name, raw);
+    }
+    printf("\n");
+
+    // The rest runs the card in this process, so after all the forks
+    for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        ok &= check_map(paths[i], &layouts[i]);
+        unlink(paths[i]);
+    }
+    write_card(bad_path, &shredded, FILE_NAME);
+    ok &= check_error("too many pieces", bad_path, FILE_NAME, FAT_ERROR_FRAGMENTED);
+    ok &= check_error("wrong name", bad_path, "LAGTRAIN.BIN", FAT_ERROR_NOT_FOUND);
+    ok &= check_error("raw card", raw_path, FILE_NAME, FAT_ERROR_NO_VOLUME);
+    unlink(bad_path);
+    unlink(raw_path);
+    free(video);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/*
+ * sim_jitter.c
+ *
+ *  Does the jitter buffer keep the picture going when the card stops for
+ *  a while?  Plays a synthetic video on the modelled clock off cards that
+ *  go quiet now and then for their own housekeeping, the way cheap ones
+ *  do, both with the ring cut down to two slots (the frame being drawn
+ *  and the next one, the double buffering the player used to have) and
+ *  with all of jitter.h's JITTER_SLOTS.  For each it counts:
+ *
+ *      stalls  frames the player had to wait on the card for the next one
+ *              (with two slots, any frame drawn quicker than the next is
+ *              read, which only matters if it's made late)
+ *      late    frames that ran past the next tick because of it
+ *      skipped frames read but not drawn, to catch back up with the sound
+ *      ahead   the fewest frames there were read ahead of the one going up
+ *
+ *      sim_jitter [frames]
+ *
+ *  Exits 1 if a card the full ring is meant to ride out made a frame late.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "jitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct card {
+    const char *name;
+    unsigned long every;        // sectors between stalls
+    unsigned long ms;           // how long each one is
+};
+
+static const struct card cards[] = {
+    { "steady", 0, 0 },
+    { "50ms/500", 500, 50 },
+    { "100ms/300", 300, 100 },
+    { "250ms/1000", 1000, 250 },
+};
+
+#define CARDS (sizeof(cards) / sizeof(cards[0]))
+
+struct totals {
+    unsigned long stalls, late, skipped;
+    uint32_t min_ahead;
+};
+
+// The run the child's being set up for
+static const struct card *card;
+static uint8_t depth;
+
+static void setup() {
+    jitter_depth = depth;
+    host_options.sd_latency.stall_every = card->every;
+    host_options.sd_latency.stall_ns = card->ms * 1000000ULL;
+}
+
+static struct totals count(const struct host_frame *results, unsigned long frames) {
+    struct totals t = { 0, 0, 0, UINT32_MAX };
+    unsigned long n;
+
+    for (n = 0; n < frames; n++) {
+        t.stalls += results[n].stalled;
+        t.late += results[n].busy_ns > HOST_FRAME_NS;
+        t.skipped += results[n].skipped;
+        // The first frame comes up before anything's been read ahead
+        if (n > 0 && results[n].jitter_ahead < t.min_ahead) {
+            t.min_ahead = results[n].jitter_ahead;
+        }
+    }
+    return t;
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 900;
+    static const uint8_t depths[] = { 2, JITTER_SLOTS };
+    char path[] = "/tmp/sim_jitterXXXXXX";
+    struct host_frame *results = calloc(frames, sizeof(*results));
+    struct totals t;
+    bool ok = true;
+    unsigned int c, d;
+
+    if (!results || frames < 2) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    // Enough frames after the last one played that the ring never runs
+    // down for the end of the video
+    encode_synth_image(path, frames + JITTER_SLOTS, ENCODE_DUPLICATE);
+
+    printf("%lu frames\n", frames);
+    printf("%-11s %5s %7s %7s %7s %7s\n", "card", "slots", "stalls", "late", "skipped", "ahead");
+    for (c = 0; c < CARDS; c++) {
+        for (d = 0; d < sizeof(depths); d++) {
+            card = &cards[c];
+            depth = depths[d];
+            host_play(path, frames, results, setup);
+            t = count(results, frames);
+            printf("%-11s %5u %7lu %7lu %7lu %7u\n", card->name, depth, t.stalls, t.late, t.skipped,
+                   t.min_ahead);
+            if (depth == JITTER_SLOTS && (t.late || t.skipped)) {
+                ok = false;
+            }
+        }
+    }
+    unlink(path);
+    free(results);
+    return ok ? 0 : 1;
+}
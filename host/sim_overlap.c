@@ -0,0 +1,201 @@
+/*
+ * sim_overlap.c
+ *
+ *  Does reading the next frame actually happen while this one is being
+ *  drawn?  Plays a synthetic image through the unmodified player loop on
+ *  the host backend's virtual clock, records what the bus and CPU are
+ *  doing, then prints a timeline of one frame and, for every frame, how
+ *  much of the SD traffic landed in between the TFT's lines, and how much
+ *  of it was on the wire at the same time as the TFT's.
+ *
+ *      sim_overlap [-s] [frames] [frame to draw]
+ *
+ *  The TFT's on the SD card's bus, as the board's wired, so nothing can be
+ *  on the two at once.  -s puts it on a bus of its own (a HAL_SPLIT_SPI
+ *  build), and the card's commands and start tokens go back and forth
+ *  while a line's being sent (the sector itself still waits for the line:
+ *  both DMAs need DMA2).
+ *
+ *  Exits 1 if no SD traffic overlapped a frame's drawing at all, or if the
+ *  two ever went at once on a shared bus, or never did on separate ones.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "defines.h"
+#include "jitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GANTT_WIDTH 100
+
+struct event {
+    host_lane_t lane;
+    uint64_t start, end;
+};
+
+static struct event *events = NULL;
+static size_t event_count = 0, event_space = 0;
+static unsigned long frames, draw_frame;
+static char image_path[] = "/tmp/sim_overlapXXXXXX";
+
+static void record(host_lane_t lane, uint64_t start, uint64_t end) {
+    struct event *last = event_count ? &events[event_count - 1] : NULL;
+
+    // Polled bytes come in one at a time; keep runs as one event
+    if (last && last->lane == lane && last->end == start) {
+        last->end = end;
+        return;
+    }
+    if (event_count == event_space) {
+        event_space = event_space ? event_space * 2 : 4096;
+        events = realloc(events, event_space * sizeof(*events));
+        if (!events) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    events[event_count].lane = lane;
+    events[event_count].start = start;
+    events[event_count].end = end;
+    event_count++;
+}
+
+/*
+ * Time `lane` spends inside [from, to).
+ */
+static uint64_t lane_time(host_lane_t lane, uint64_t from, uint64_t to) {
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < event_count; i++) {
+        uint64_t s = MAX(events[i].start, from), e = MIN(events[i].end, to);
+        if (events[i].lane == lane && e > s) {
+            total += e - s;
+        }
+    }
+    return total;
+}
+
+/*
+ * Time `lane` spends on the wire at the same time as `other`, inside
+ * [from, to).
+ */
+static uint64_t lane_concurrent(host_lane_t lane, host_lane_t other, uint64_t from, uint64_t to) {
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < event_count; i++) {
+        uint64_t s = MAX(events[i].start, from), e = MIN(events[i].end, to);
+        if (events[i].lane == lane && e > s) {
+            total += lane_time(other, s, e);
+        }
+    }
+    return total;
+}
+
+/*
+ * First and last moments of `lane` inside [from, to).
+ */
+static bool lane_span(host_lane_t lane, uint64_t from, uint64_t to, uint64_t *first, uint64_t *last) {
+    bool found = false;
+    size_t i;
+    for (i = 0; i < event_count; i++) {
+        if (events[i].lane != lane || events[i].start < from || events[i].start >= to) {
+            continue;
+        }
+        if (!found) {
+            *first = events[i].start;
+        }
+        *last = events[i].end;
+        found = true;
+    }
+    return found;
+}
+
+static void gantt(uint64_t from, uint64_t to) {
+    static const char *names[] = { "sd", "tft", "cpu" };
+    static const char marks[] = { 'S', 'T', 'c' };
+    uint64_t step = (to - from + GANTT_WIDTH - 1) / GANTT_WIDTH;
+    int lane, col;
+
+    printf("frame %lu, %.1f us per column:\n", draw_frame, step / 1e3);
+    for (lane = HOST_LANE_SD; lane <= HOST_LANE_CPU; lane++) {
+        printf("%-4s|", names[lane]);
+        for (col = 0; col < GANTT_WIDTH; col++) {
+            uint64_t s = from + col * step;
+            putchar(lane_time(lane, s, s + step) ? marks[lane] : ' ');
+        }
+        printf("|\n");
+    }
+}
+
+static void analyze() {
+    unsigned long n, overlapped = 0, concurrent = 0;
+    uint64_t first, last;
+
+    unlink(image_path);
+    printf("%s bus\n", host_options.split_spi ? "separate" : "shared");
+    printf("%-6s %10s %10s %10s %10s %10s %10s\n", "frame", "tft us", "sd us", "sd hidden", "sd with tft",
+           "cpu us", "busy us");
+    // Frame 0 is read before the loop starts, so it has nothing to overlap with
+    for (n = 1; n < frames; n++) {
+        uint64_t from = n * HOST_FRAME_NS, to = from + HOST_FRAME_NS;
+        uint64_t hidden = 0, both, busy_end = from;
+        size_t i;
+
+        if (!lane_span(HOST_LANE_TFT, from, to, &first, &last)) {
+            continue;
+        }
+        hidden = lane_time(HOST_LANE_SD, first, last);
+        both = lane_concurrent(HOST_LANE_SD, HOST_LANE_TFT, from, to);
+        for (i = 0; i < event_count; i++) {
+            if (events[i].lane != HOST_LANE_IDLE && events[i].start >= from && events[i].start < to) {
+                busy_end = MAX(busy_end, events[i].end);
+            }
+        }
+        if (hidden) {
+            overlapped++;
+        }
+        if (both) {
+            concurrent++;
+        }
+        printf("%-6lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", n,
+               lane_time(HOST_LANE_TFT, from, to) / 1e3, lane_time(HOST_LANE_SD, from, to) / 1e3,
+               hidden / 1e3, both / 1e3, lane_time(HOST_LANE_CPU, from, to) / 1e3, (busy_end - from) / 1e3);
+        if (n == draw_frame) {
+            gantt(from, busy_end);
+        }
+    }
+    printf("%lu of %lu frames read the next frame in between display lines\n", overlapped, frames - 1);
+    printf("%lu of %lu frames had the SD card and the TFT on the wire at once\n", concurrent, frames - 1);
+    free(events);
+    if (frames > 1 && (overlapped == 0 || (host_options.split_spi ? concurrent == 0 : concurrent != 0))) {
+        _exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        if (opt != 's') {
+            fprintf(stderr, "usage: %s [-s] [frames] [frame to draw]\n", argv[0]);
+            return 2;
+        }
+        host_options.split_spi = true;
+    }
+    frames = optind < argc ? strtoul(argv[optind], NULL, 0) : 10;
+    draw_frame = optind + 1 < argc ? strtoul(argv[optind + 1], NULL, 0) : 2;
+
+    // Enough extra frames on the card that the jitter buffer's still reading
+    // ahead at the end.  No clean-line maps, so every frame draws every line.
+    encode_synth_image(image_path, frames + JITTER_SLOTS, ENCODE_NO_CLEAN);
+    host_options.image = image_path;
+    host_options.frames = frames;
+    host_trace = record;
+    // The player exits through hal_halt() once it's played `frames`
+    atexit(analyze);
+    return player_main();
+}
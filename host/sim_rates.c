@@ -0,0 +1,195 @@
+/*
+ * sim_rates.c
+ *
+ *  Does the player take its timing from the image's header?  Writes a
+ *  synthetic image at a few audio rates and samples per frame (mkimage -r),
+ *  plays each on the modelled clock, and checks the frames come one tick
+ *  of the frame timer apart, the tick being one frame of DAC samples at
+ *  the header's rate, and that the picture stays with the sound.  Then
+ *  checks the formats the player has to turn down are turned down, and
+ *  that of two images without a header, one with the frames the player
+ *  reads is taken for version 0 and one of the original raw ones isn't.
+ *
+ *      sim_rates
+ *
+ *  Exits 1 if a format plays at the wrong frame rate, underruns, or gets
+ *  more than a frame and a half from the sound, or if one it can't play
+ *  is let through.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "synth.h"
+#include "container.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define IMAGE_FRAMES 300
+
+struct format {
+    const char *name;
+    unsigned int sample_rate;
+    unsigned int frame_samples;
+};
+
+static const struct format playable[] = {
+    { "30 fps, 44.1 kHz", 44100, 1470 },
+    { "25 fps, 22.05 kHz", 22050, 882 },
+    { "20 fps, 16 kHz", 16000, 800 },
+    { "30 fps, 22.05 kHz", 22050, 736 },
+};
+
+// Too many samples a frame, odd, or a frame longer than the 16-bit timer
+static const struct format unplayable[] = {
+    { "24 fps, 48 kHz", 48000, 2000 },
+    { "odd samples", 22050, 735 },
+    { "15 fps, 22.05 kHz", 22050, 1470 },
+};
+
+static void write_image(char *path, const struct format *fmt) {
+    uint8_t video[SYNTH_VIDEO_SIZE], audio[SYNTH_AUDIO_SIZE];
+    static struct encoder e;
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+    unsigned long n;
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    encode_open(&e, f, 0);
+    encode_set_audio(&e, fmt->sample_rate, fmt->frame_samples);
+    encode_chapter(&e);
+    for (n = 0; n < IMAGE_FRAMES; n++) {
+        synth_video(n, video);
+        synth_audio(n, audio);
+        encode_frame(&e, video, audio);
+    }
+    encode_close(&e);
+    fclose(f);
+}
+
+static bool run(const struct format *fmt) {
+    char path[] = "/tmp/sim_ratesXXXXXX";
+    static struct host_frame results[IMAGE_FRAMES];
+    // What main.c sets the timers to
+    unsigned long cycles = HOST_SMCLK_HZ / fmt->sample_rate;
+    unsigned long ticks = (fmt->frame_samples * cycles + 8) / 16;
+    double sample_ms = cycles * 1e3 / HOST_SMCLK_HZ;
+    double period_us, worst = 0;
+    unsigned long underruns = 0, n;
+    bool ok;
+
+    write_image(path, fmt);
+    host_play(path, IMAGE_FRAMES, results, NULL);
+    unlink(path);
+
+    // Frame 0's drawn in full from whenever startup's done, so can run
+    // over into frame 1's tick: the period's from frame 2 on
+    period_us = (results[IMAGE_FRAMES - 1].start_ns - results[2].start_ns) / 1e3 / (IMAGE_FRAMES - 3);
+    for (n = 0; n < IMAGE_FRAMES; n++) {
+        int32_t error = results[n].av_error < 0 ? -results[n].av_error : results[n].av_error;
+        worst = error > worst ? error : worst;
+        // The last frame played has no next frame's audio to queue
+        if (n + 1 < IMAGE_FRAMES && results[n].audio_lead < 0) {
+            underruns++;
+        }
+    }
+    ok = period_us > ticks - 1 && period_us < ticks + 1 && !underruns && worst <= 1.5 * fmt->frame_samples;
+    printf("%-20s %6u %6u %10lu %10.1f %10.1f %10lu %s\n", fmt->name, fmt->sample_rate, fmt->frame_samples,
+           ticks, period_us, worst * sample_ms, underruns, ok ? "" : "FAIL");
+    return ok;
+}
+
+/*
+ * What container_playable() says to a version 1 header in this format.
+ */
+static bool accepted(const struct format *fmt) {
+    container.version = CONTAINER_VERSION;
+    container.lines = VIDEO_LINES;
+    container.line_pixels = VIDEO_LINE_PIXELS;
+    container.sample_rate = fmt->sample_rate;
+    container.frame_samples = fmt->frame_samples;
+    return container_playable();
+}
+
+/*
+ * What container_load() makes of an image without a header: an encoded
+ * one with its header sector cut off, or raw frames (packed pixels, then
+ * 6-bit samples) one after the other, as they were first written.
+ */
+static uint16_t headerless_version(bool raw) {
+    char path[] = "/tmp/sim_ratesXXXXXX";
+    uint8_t frame[SYNTH_VIDEO_SIZE + SYNTH_AUDIO_SIZE];
+    FILE *in, *out;
+    unsigned long n;
+    unsigned int i;
+    size_t size;
+
+    encode_synth_image(path, IMAGE_FRAMES, 0);
+    in = fopen(path, "rb");
+    unlink(path);
+    out = in ? fopen(path, "wb") : NULL;
+    if (!out) {
+        perror(path);
+        exit(2);
+    }
+    if (raw) {
+        for (n = 0; n < IMAGE_FRAMES; n++) {
+            synth_video(n, frame);
+            synth_audio(n, frame + SYNTH_VIDEO_SIZE);
+            for (i = 0; i < SYNTH_AUDIO_SIZE; i++) {
+                frame[SYNTH_VIDEO_SIZE + i] >>= 2;
+            }
+            fwrite(frame, sizeof(frame), 1, out);
+        }
+    } else {
+        fseek(in, CONTAINER_SIZE, SEEK_SET);
+        while ((size = fread(frame, 1, sizeof(frame), in)) > 0) {
+            fwrite(frame, 1, size, out);
+        }
+    }
+    fclose(in);
+    fclose(out);
+
+    host_options.image = path;
+    hal_init();
+    spi_init();
+    if (!sd_init() || !container_load()) {
+        fprintf(stderr, "%s: can't read the card: %u\n", path, sd_errorCode);
+        exit(2);
+    }
+    unlink(path);
+    return container.version;
+}
+
+int main() {
+    bool ok = true;
+    unsigned int i;
+
+    printf("%-20s %6s %6s %10s %10s %10s %10s\n", "format", "Hz", "samps", "tick us", "frame us",
+           "worst ms", "underruns");
+    for (i = 0; i < sizeof(playable) / sizeof(playable[0]); i++) {
+        ok &= run(&playable[i]);
+    }
+    for (i = 0; i < sizeof(unplayable) / sizeof(unplayable[0]); i++) {
+        bool bad = accepted(&unplayable[i]);
+        printf("%-20s %6u %6u turned down: %s\n", unplayable[i].name, unplayable[i].sample_rate,
+               unplayable[i].frame_samples, bad ? "no, FAIL" : "yes");
+        ok &= !bad;
+    }
+    for (i = 0; i < 2; i++) {
+        uint16_t version = headerless_version(i);
+        bool right = version == (i ? CONTAINER_VERSION_RAW : 0) && container_playable() == !i;
+
+        printf("no header, %-9s version %u, %s%s\n", i ? "raw" : "aligned", version,
+               container_playable() ? "played" : "turned down", right ? "" : ", FAIL");
+        ok &= right;
+    }
+    return ok ? 0 : 1;
+}
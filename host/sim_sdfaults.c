@@ -0,0 +1,261 @@
+/*
+ * sim_sdfaults.c
+ *
+ *  Does sdcard.c get over a card that gets things wrong?  Reads an image
+ *  whose every sector says where it is off the emulated card, the three
+ *  ways the player does (streams, single sectors and asynchronous runs),
+ *  with each kind of fault sd_emu.h can inject, trying every read again
+ *  up to SD_READ_RETRIES times the way the player's callers do.  For each
+ *  it counts:
+ *
+ *      faults  how many the card made
+ *      failed  reads that came back false, to be tried again
+ *      lost    reads that failed every time
+ *      wrong   reads that came back true with the wrong sector
+ *      worst   the longest any one call took (modelled time)
+ *
+ *  and then, with the card behaving again, whether a read of each kind
+ *  works first time.  Then it plays a synthetic video through each, and
+ *  through one that mangles the sector count at the start of one frame,
+ *  once, which the player has to read again and draw the same.
+ *
+ *      sim_sdfaults [reads]
+ *
+ *  Exits 1 if a read was lost or wrong, a call took longer than one
+ *  SD_READ_TIMEOUT should let it, the card didn't come back, or the
+ *  player didn't make it to the end with every frame on time (and drawn
+ *  right, with the mangled frame).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "hal.h"
+#include "spi.h"
+#include "sdcard.h"
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTORS 4096
+// Sectors in a stream or an asynchronous run
+#define RUN 8
+// SD_READ_TIMEOUT (SdInfo.h), and a little for the commands around it
+#define WORST_MS 320
+
+struct card {
+    const char *name;
+    struct sd_emu_faults faults;
+};
+
+static const struct card cards[] = {
+    { "none", { 0, 0, 0 } },
+    { "commands", { 20, 0, 0 } },
+    { "tokens", { 0, 100, 0 } },
+    { "hangs", { 0, 0, 200 } },
+    { "all", { 50, 100, 400 } },
+};
+
+#define CARDS (sizeof(cards) / sizeof(cards[0]))
+
+struct totals {
+    unsigned long failed, lost, wrong;
+    uint64_t worst_ns;
+};
+
+static uint8_t buf[RUN * 512];
+static uint32_t random_state = 0x2545F491;
+
+static uint32_t random_sector() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % (SECTORS - RUN);
+}
+
+static void fill(uint32_t sector, uint8_t *p) {
+    unsigned int i;
+    for (i = 0; i < 512; i++) {
+        p[i] = (uint8_t)(sector * 7 + i + (sector >> 8));
+    }
+}
+
+static bool right(uint32_t sector, const uint8_t *p) {
+    uint8_t want[512];
+    fill(sector, want);
+    return memcmp(want, p, sizeof(want)) == 0;
+}
+
+static bool make_image(const char *path) {
+    uint8_t sector[512];
+    uint32_t n;
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        return false;
+    }
+    for (n = 0; n < SECTORS; n++) {
+        fill(n, sector);
+        fwrite(sector, sizeof(sector), 1, f);
+    }
+    return fclose(f) == 0;
+}
+
+/*
+ * One try at reading `count` sectors from `sector` into buf, the way `kind`
+ * says: streamed (one call each), one sector with CMD17, or asynchronously.
+ */
+static bool try_read(unsigned int kind, uint32_t sector, uint32_t count, struct totals *t) {
+    uint64_t start = host_vtime_ns();
+    bool ok = true;
+    uint32_t n;
+
+    switch (kind) {
+    case 0:
+        for (n = 0; n < count && ok; n++) {
+            ok = sd_stream_read(sector + n, buf + n * 512);
+        }
+        break;
+    case 1:
+        ok = sd_read_block(sector, buf);
+        break;
+    default:
+        ok = sd_async_start(sector, buf, count) && sd_async_wait();
+        break;
+    }
+    if (host_vtime_ns() - start > t->worst_ns) {
+        t->worst_ns = host_vtime_ns() - start;
+    }
+    return ok;
+}
+
+static bool read_checked(unsigned int kind, uint32_t sector, struct totals *t) {
+    uint32_t count = kind == 1 ? 1 : RUN, n;
+    uint8_t i;
+
+    for (i = 0; !try_read(kind, sector, count, t); i++) {
+        t->failed++;
+        if (i == SD_READ_RETRIES) {
+            t->lost++;
+            return false;
+        }
+    }
+    for (n = 0; n < count; n++) {
+        if (!right(sector + n, buf + n * 512)) {
+            t->wrong++;
+            return false;
+        }
+    }
+    return true;
+}
+
+static const struct card *card;
+
+/*
+ * Where frame `n` of the image at `path` starts on the card.
+ */
+static uint32_t frame_block(const char *path, unsigned long n) {
+    uint8_t sectors = 0;
+    uint32_t block = CONTAINER_BLOCK + 1;
+    FILE *f = fopen(path, "rb");
+
+    for (; f && n; n--) {
+        fseek(f, block * 512L, SEEK_SET);
+        if (fread(&sectors, 1, 1, f) != 1 || !sectors) {
+            break;
+        }
+        block += sectors;
+    }
+    if (!f || n) {
+        fprintf(stderr, "%s: no frame %lu\n", path, n);
+        exit(2);
+    }
+    fclose(f);
+    return block;
+}
+
+static void setup() {
+    host_options.sd_faults = card->faults;
+}
+
+int main(int argc, char **argv) {
+    unsigned long reads = argc > 1 ? strtoul(argv[1], NULL, 0) : 600, n, frames = 300;
+    static const struct sd_emu_faults none = { 0, 0, 0 };
+    char path[] = "/tmp/sim_sdfaultsXXXXXX", video[] = "/tmp/sim_sdfaultsXXXXXX";
+    struct host_frame *results = calloc(frames, sizeof(*results)), *clean = calloc(frames, sizeof(*clean));
+    struct card mangled = { "mangled", { 0, 0, 0 } };
+    struct totals t;
+    bool ok = true, passed, recovered;
+    unsigned int c, kind;
+    unsigned long late;
+    int fd = mkstemp(path);
+
+    if (fd < 0 || !results || !clean) {
+        perror(path);
+        return 2;
+    }
+    close(fd);
+    if (!make_image(path)) {
+        perror(path);
+        return 2;
+    }
+
+    printf("%lu reads of each kind, each tried up to %u times\n", reads, SD_READ_RETRIES + 1);
+    printf("%-9s %7s %7s %7s %7s %9s %9s\n", "card", "faults", "failed", "lost", "wrong", "worst ms", "recovers");
+    for (c = 0; c < CARDS; c++) {
+        memset(&t, 0, sizeof(t));
+        host_options.image = path;
+        host_options.sd_faults = cards[c].faults;
+        hal_init();
+        spi_init();
+        if (!sd_init()) {
+            fprintf(stderr, "sd_init failed: %u\n", sd_errorCode);
+            return 2;
+        }
+        for (n = 0; n < reads; n++) {
+            for (kind = 0; kind < 3; kind++) {
+                read_checked(kind, random_sector(), &t);
+            }
+        }
+        // Whatever state that left the card in, it has to come back from
+        sd_emu_faults(&none);
+        recovered = true;
+        for (kind = 0; kind < 3; kind++) {
+            recovered = recovered && try_read(kind, random_sector(), kind == 1 ? 1 : RUN, &t);
+        }
+        passed = !t.lost && !t.wrong && t.worst_ns <= WORST_MS * 1000000ULL && recovered;
+        ok = ok && passed;
+        printf("%-9s %7u %7lu %7lu %7lu %9.1f %9s%s\n", cards[c].name, sd_emu_injected(), t.failed, t.lost,
+               t.wrong, t.worst_ns / 1e6, recovered ? "yes" : "no", passed ? "" : "  FAIL");
+    }
+    unlink(path);
+
+    // The whole player, which retries with jitter.h's JITTER_RETRIES: it
+    // has to get to the end (host_play() exits if it doesn't), and the
+    // ring has room to ride out a read timing out
+    encode_synth_image(video, frames, ENCODE_DUPLICATE);
+    printf("\n%lu frames played\n", frames);
+    printf("%-9s %7s %7s %7s\n", "card", "stalls", "late", "skipped");
+    mangled.faults.mangle_sector = frame_block(video, frames / 3);
+    for (c = 0; c <= CARDS; c++) {
+        unsigned long stalls = 0, skipped = 0, wrong = 0;
+
+        card = c < CARDS ? &cards[c] : &mangled;
+        host_play(video, frames, c ? results : clean, setup);
+        late = 0;
+        for (n = 0; n < frames; n++) {
+            const struct host_frame *f = c ? &results[n] : &clean[n];
+            stalls += f->stalled;
+            late += f->busy_ns > HOST_FRAME_NS;
+            skipped += f->skipped;
+            wrong += c == CARDS && f->hash != clean[n].hash;
+        }
+        printf("%-9s %7lu %7lu %7lu%s\n", card->name, stalls, late, skipped, late || wrong ? "  FAIL" : "");
+        ok = ok && !late && !wrong;
+    }
+    unlink(video);
+    free(results);
+    free(clean);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/*
+ * sim_seek.c
+ *
+ *  Do the seek buttons land where they should, straight away, without
+ *  upsetting the sound?  Plays a synthetic image straight through, then
+ *  again with the buttons pressed in between frames (host_options.buttons),
+ *  and checks every frame drawn against the straight run: the frame after
+ *  a press has to be the one the button points at.  Done twice, on an
+ *  image with three chapters (buttons go back to the start of the chapter,
+ *  or the one before, and on to the next) and on one with just the one
+ *  (buttons step 10 seconds, to the index entry at or before).
+ *
+ *  Prints each seek with how long the frame it happened in took, and the
+ *  furthest the picture got from the sound.
+ *
+ *      sim_seek
+ *
+ *  Exits 1 if a frame comes out wrong, a seek frame runs past its tick,
+ *  the audio underruns, or the picture gets more than a frame and a half
+ *  from the sound.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "synth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHAPTER_FRAMES 200
+#define IMAGE_FRAMES 600
+#define MAX_PRESSES 8
+
+// A button pressed once frame `at` of the run is done, and the frame of
+// the video it should take us to (-1 if nowhere)
+struct press {
+    unsigned long at;
+    unsigned int button;
+    long target;
+};
+
+struct scenario {
+    const char *name;
+    unsigned long chapter;      // frames per chapter, 0 for one
+    struct press presses[MAX_PRESSES];
+};
+
+static const struct scenario scenarios[] = {
+    { "chapters", CHAPTER_FRAMES, {
+        { 100, 1, 200 },    // on to chapter 1
+        { 130, 0, 0 },      // 30 frames into it: back to chapter 0
+        { 300, 0, 0 },      // well into chapter 0: its start again
+        { 400, 1, 200 },
+        { 450, 1, 400 },
+        { 500, 1, -1 },     // no chapter after the last one
+    } },
+    { "one", 0, {
+        { 100, 1, 390 },    // 101 + 300, to the entry before (a second apart)
+        { 200, 0, 180 },    // 490 - 300
+        { 220, 0, 0 },      // not 10 seconds in: the start
+    } },
+};
+
+static char buttons[256];
+
+static void press_buttons() {
+    host_options.buttons = buttons;
+}
+
+static void write_image(char *path, unsigned long chapter) {
+    uint8_t video[SYNTH_VIDEO_SIZE], audio[SYNTH_AUDIO_SIZE];
+    static struct encoder e;
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+    unsigned long n;
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    encode_open(&e, f, 0);
+    for (n = 0; n < IMAGE_FRAMES; n++) {
+        if (n == 0 || (chapter && n % chapter == 0)) {
+            encode_chapter(&e);
+        }
+        synth_video(n, video);
+        synth_audio(n, audio);
+        encode_frame(&e, video, audio);
+    }
+    encode_close(&e);
+    fclose(f);
+}
+
+/*
+ * Which frame of the video every frame of the run should show, given the
+ * presses; returns how many frames the run is.
+ */
+static unsigned long expect(const struct scenario *s, long *shown) {
+    unsigned long n = 0;
+    unsigned int i;
+
+    shown[0] = 0;
+    while (shown[n] + 1 < IMAGE_FRAMES) {
+        shown[n + 1] = shown[n] + 1;
+        for (i = 0; i < MAX_PRESSES && s->presses[i].at; i++) {
+            if (s->presses[i].at == n && s->presses[i].target >= 0) {
+                shown[n + 1] = s->presses[i].target;
+            }
+        }
+        n++;
+    }
+    return n + 1;
+}
+
+static bool run(const struct scenario *s) {
+    char path[] = "/tmp/sim_seekXXXXXX";
+    struct host_frame *straight = calloc(IMAGE_FRAMES, sizeof(*straight));
+    long *shown = calloc(IMAGE_FRAMES * MAX_PRESSES, sizeof(*shown));
+    struct host_frame *seeking;
+    unsigned long frames, n;
+    double worst_ms = 0;
+    bool ok = true;
+    unsigned int i;
+    size_t len = 0;
+
+    if (!straight || !shown) {
+        perror("calloc");
+        exit(2);
+    }
+    frames = expect(s, shown);
+    seeking = calloc(frames, sizeof(*seeking));
+    if (!seeking) {
+        perror("calloc");
+        exit(2);
+    }
+    buttons[0] = '\0';
+    for (i = 0; i < MAX_PRESSES && s->presses[i].at; i++) {
+        len += snprintf(buttons + len, sizeof(buttons) - len, "%s%lu:%u", i ? "," : "",
+                        s->presses[i].at, s->presses[i].button);
+    }
+
+    write_image(path, s->chapter);
+    host_play(path, IMAGE_FRAMES, straight, NULL);
+    host_play(path, frames, seeking, press_buttons);
+    unlink(path);
+
+    printf("%s: %lu frames, buttons %s\n", s->name, frames, buttons);
+    for (n = 0; n < frames; n++) {
+        double ms = seeking[n].av_error * (HOST_SAMPLE_NS / 1e6);
+        if (seeking[n].hash != straight[shown[n]].hash) {
+            printf("  frame %lu should show %ld, doesn't\n", n, shown[n]);
+            ok = false;
+        }
+        if (n && shown[n] != shown[n - 1] + 1) {
+            printf("  frame %lu: seek to %ld, %.1f us of %.1f\n", n, shown[n],
+                   seeking[n].busy_ns / 1e3, HOST_FRAME_NS / 1e3);
+            ok &= seeking[n].busy_ns <= HOST_FRAME_NS;
+        }
+        // The last frame played has no next frame's audio to queue
+        if (n + 1 < frames && seeking[n].audio_lead < 0) {
+            printf("  frame %lu: audio underran\n", n);
+            ok = false;
+        }
+        worst_ms = ms > worst_ms ? ms : -ms > worst_ms ? -ms : worst_ms;
+    }
+    printf("  furthest from the sound: %.1f ms\n", worst_ms);
+    free(straight);
+    free(shown);
+    free(seeking);
+    return ok && worst_ms <= 1.5 * AUDIO_FRAME_SIZE * (HOST_SAMPLE_NS / 1e6);
+}
+
+int main() {
+    bool ok = true;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        ok &= run(&scenarios[i]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/*
+ * sim_sync.c
+ *
+ *  Do the picture and the sound stay together over a whole video?  Plays
+ *  a synthetic video as long as the real one three ways on the modelled
+ *  clock:
+ *
+ *      free    the old frame timer (TA0CCR0 = 33333) and nothing keeping
+ *              the frames with the sound: the DAC's 362-cycle samples
+ *              run ahead, and the audio ring has to underrun to let the
+ *              pictures catch up
+ *      synced  the same frame timer, with frames held or skipped against
+ *              the samples DMA0 has played (av_sync in main.c)
+ *      locked  the frame timer at one frame of samples, and synced: how
+ *              the board runs now
+ *
+ *  and prints the furthest the picture got from the sound
+ *  (dac_sync_error(), positive when the picture's ahead) in every 30
+ *  seconds of video, then the worst of it overall, the underruns, and the
+ *  frames repeated and skipped.
+ *
+ *      sim_sync [frames]
+ *
+ *  Exits 1 if the locked run underran or got more than a frame and a half
+ *  away from the sound.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "host.h"
+#include "encode.h"
+#include "dac.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The frame timer before it was locked to the DAC (TA0CCR0 = 33333)
+#define FREE_FRAME_NS 33334000ULL
+// Every 30 seconds of video
+#define REPORT_EVERY 900
+// Frames in the main video on the card
+#define VIDEO_FRAMES 6572
+
+// The player's side of things, from main.c
+extern bool av_sync;
+
+enum { RUN_FREE, RUN_SYNCED, RUN_LOCKED, RUNS };
+
+static const char *names[RUNS] = { "free", "synced", "locked" };
+
+struct totals {
+    double final_ms, worst_ms;
+    unsigned long underruns, repeats, skips;
+};
+
+static void free_running() {
+    av_sync = false;
+    host_options.frame_ns = FREE_FRAME_NS;
+}
+
+static void synced() {
+    host_options.frame_ns = FREE_FRAME_NS;
+}
+
+static double error_ms(const struct host_frame *f) {
+    return f->av_error * (HOST_SAMPLE_NS / 1e6);
+}
+
+/*
+ * The error furthest from zero among frames [from, to).
+ */
+static double furthest_ms(const struct host_frame *results, unsigned long from, unsigned long to) {
+    double furthest = 0;
+    unsigned long n;
+    for (n = from; n < to; n++) {
+        double ms = error_ms(&results[n]);
+        if ((ms < 0 ? -ms : ms) > (furthest < 0 ? -furthest : furthest)) {
+            furthest = ms;
+        }
+    }
+    return furthest;
+}
+
+static struct totals count(const struct host_frame *results, unsigned long frames) {
+    struct totals t = { 0 };
+    unsigned long n;
+
+    for (n = 0; n < frames; n++) {
+        double ms = error_ms(&results[n]);
+        if (ms > t.worst_ms || -ms > t.worst_ms) {
+            t.worst_ms = ms < 0 ? -ms : ms;
+        }
+        // The last frame played has no next frame's audio to queue
+        if (n + 1 < frames && results[n].audio_lead < 0) {
+            t.underruns++;
+        }
+        t.repeats += results[n].repeats;
+        t.skips += results[n].skipped;
+    }
+    t.final_ms = error_ms(&results[frames - 1]);
+    return t;
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 0) : VIDEO_FRAMES;
+    static void (*const setup[RUNS])(void) = { free_running, synced, NULL };
+    char path[] = "/tmp/sim_syncXXXXXX";
+    struct host_frame *results[RUNS];
+    struct totals t[RUNS];
+    unsigned long n;
+    int r;
+
+    if (frames < 2) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    // Duplicated frames like convert.py makes of the 15 fps source
+    encode_synth_image(path, frames + 1, ENCODE_DUPLICATE);
+    for (r = 0; r < RUNS; r++) {
+        results[r] = calloc(frames, sizeof(*results[r]));
+        if (!results[r]) {
+            perror("calloc");
+            return 2;
+        }
+        host_play(path, frames, results[r], setup[r]);
+        t[r] = count(results[r], frames);
+    }
+    unlink(path);
+
+    printf("picture ahead of sound, furthest in every 30s, ms:\n");
+    printf("%-8s %10s %10s %10s\n", "video s", names[RUN_FREE], names[RUN_SYNCED], names[RUN_LOCKED]);
+    for (n = 0; n < frames; n += REPORT_EVERY) {
+        unsigned long end = n + REPORT_EVERY < frames ? n + REPORT_EVERY : frames;
+        printf("%-8lu", n / 30);
+        for (r = 0; r < RUNS; r++) {
+            printf(" %10.1f", furthest_ms(results[r], n, end));
+        }
+        printf("\n");
+    }
+    printf("\n%-8s %10s %10s %10s %10s %10s\n", "run", "final ms", "worst ms", "underruns", "repeats", "skips");
+    for (r = 0; r < RUNS; r++) {
+        printf("%-8s %10.1f %10.1f %10lu %10lu %10lu\n", names[r], t[r].final_ms, t[r].worst_ms,
+               t[r].underruns, t[r].repeats, t[r].skips);
+        free(results[r]);
+    }
+    return t[RUN_LOCKED].underruns || t[RUN_LOCKED].worst_ms > 1.5 * AUDIO_FRAME_SIZE * (HOST_SAMPLE_NS / 1e6) ? 1 : 0;
+}
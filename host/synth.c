@@ -0,0 +1,39 @@
+/*
+ * synth.c
+ */
+
+#include "synth.h"
+#include <math.h>
+#include <string.h>
+
+void synth_video(unsigned long n, uint8_t *video) {
+    double t = n / 30.0;
+    double ax = 64 + 44 * sin(t * 1.3), ay = 70 + 50 * cos(t * 0.7);
+    double bx = 64 + 30 * cos(t * 2.1), by = 100 + 30 * sin(t * 1.1);
+    double ar = 18 + 8 * sin(t * 3.0), br = 12 + 6 * cos(t * 2.5);
+    unsigned int horizon = 130 + (unsigned int)(10 * sin(t * 0.5));
+    unsigned int row, col;
+
+    memset(video, 0, SYNTH_VIDEO_SIZE);
+    for (row = 0; row < SYNTH_LINES; row++) {
+        for (col = 0; col < SYNTH_LINE_BYTES * 8; col++) {
+            double dax = col - ax, day = row - ay;
+            double dbx = col - bx, dby = row - by;
+            int lit = row >= horizon
+                || dax * dax + day * day < ar * ar
+                || dbx * dbx + dby * dby < br * br;
+            if (lit) {
+                video[row * SYNTH_LINE_BYTES + col / 8] |= 0x80 >> (col % 8);
+            }
+        }
+    }
+}
+
+void synth_audio(unsigned long n, uint8_t *audio) {
+    unsigned int i;
+    for (i = 0; i < SYNTH_AUDIO_SIZE; i++) {
+        double s = (n * SYNTH_AUDIO_SIZE + i) / 44100.0;
+        double v = sin(2 * M_PI * 440 * s) * (0.6 + 0.4 * sin(2 * M_PI * 0.5 * s));
+        audio[i] = (uint8_t)(128 + 124 * v);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * synth.h
+ *
+ *  Deterministic synthetic Bad Apple-ish content for the host benchmarks,
+ *  so they can run without the real video: a couple of bouncing blobs
+ *  over a horizon, and a wobbling tone.
+ */
+
+#ifndef HOST_SYNTH_H_
+#define HOST_SYNTH_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same geometry as convert.py's output
+#define SYNTH_LINES 160
+#define SYNTH_LINE_BYTES 16
+#define SYNTH_VIDEO_SIZE (SYNTH_LINES * SYNTH_LINE_BYTES)
+#define SYNTH_AUDIO_SIZE 1470
+
+/**
+ * Render frame `n` as packed 1bpp lines, MSB first, like np.packbits.
+ */
+void synth_video(unsigned long n, uint8_t *video);
+
+/**
+ * Frame `n`'s worth of 8-bit unsigned audio samples, like the WAV
+ * convert.py reads.
+ */
+void synth_audio(unsigned long n, uint8_t *audio);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_SYNTH_H_ */
@@ -0,0 +1,180 @@
+/*
+ * tft_emu.c
+ *
+ *  Only the commands the player sends do anything: CASET, RASET, RAMWR,
+ *  MADCTL and COLMOD.  Everything else is parsed and ignored.  Pixels are
+ *  kept as RGB565 whatever format they were written in, so the same
+ *  picture hashes the same at 12 and 16 bits per pixel.
+ */
+
+#include "tft_emu.h"
+#include "tft.h"
+#include "defines.h"
+#include <string.h>
+
+#define MADCTL_MY 0x80
+#define MADCTL_MX 0x40
+#define MADCTL_MV 0x20
+
+#define COLMOD_12BIT 0x03
+
+static uint16_t fb[TFT_EMU_HEIGHT * TFT_EMU_WIDTH];
+
+static uint8_t cmd = TFT_NOP;
+static unsigned int argn = 0;
+static uint8_t args[4];
+
+static uint8_t madctl = 0;
+static uint8_t colmod = 0x05;
+// Address window and write cursor, in MADCTL-relative coordinates
+static unsigned int xs = 0, xe = TFT_EMU_WIDTH - 1;
+static unsigned int ys = 0, ye = TFT_EMU_HEIGHT - 1;
+static unsigned int cx = 0, cy = 0;
+// Partially assembled pixel(s): two bytes at 16 bpp, three (two pixels) at 12
+static uint8_t pixel_bytes[3];
+static unsigned int pixel_count = 0;
+
+static unsigned int logical_width() {
+    return (madctl & MADCTL_MV) ? TFT_EMU_HEIGHT : TFT_EMU_WIDTH;
+}
+
+static unsigned int logical_height() {
+    return (madctl & MADCTL_MV) ? TFT_EMU_WIDTH : TFT_EMU_HEIGHT;
+}
+
+static void put_pixel(uint16_t color) {
+    unsigned int col = cx, row = cy;
+    // The window is clamped to the panel at write time, so that a CASET sent
+    // before a MADCTL rotation still lands on the panel.
+    unsigned int right = MIN(xe, logical_width() - 1);
+    unsigned int bottom = MIN(ye, logical_height() - 1);
+
+    if (cx > right || cy > bottom) {
+        return; // window starts off the panel
+    }
+    if (madctl & MADCTL_MV) {
+        unsigned int t = col;
+        col = row;
+        row = t;
+    }
+    if (madctl & MADCTL_MX) {
+        col = TFT_EMU_WIDTH - 1 - col;
+    }
+    if (madctl & MADCTL_MY) {
+        row = TFT_EMU_HEIGHT - 1 - row;
+    }
+    fb[row * TFT_EMU_WIDTH + col] = color;
+
+    // Advance the cursor through the window, wrapping back to the top
+    if (++cx > right) {
+        cx = xs;
+        if (++cy > bottom) {
+            cy = ys;
+        }
+    }
+}
+
+/*
+ * RGB444 to RGB565, stretching each channel over its full range.
+ */
+static uint16_t rgb444(uint16_t c) {
+    uint16_t r = (c >> 8) & 0xF, g = (c >> 4) & 0xF, b = c & 0xF;
+    return (r << 1 | r >> 3) << 11 | (g << 2 | g >> 2) << 5 | (b << 1 | b >> 3);
+}
+
+static void ram_write(uint8_t byte) {
+    pixel_bytes[pixel_count++] = byte;
+    if (colmod == COLMOD_12BIT) {
+        if (pixel_count == 3) {
+            put_pixel(rgb444(pixel_bytes[0] << 4 | pixel_bytes[1] >> 4));
+            put_pixel(rgb444((pixel_bytes[1] & 0x0F) << 8 | pixel_bytes[2]));
+            pixel_count = 0;
+        }
+    } else if (pixel_count == 2) {
+        put_pixel(pixel_bytes[0] << 8 | pixel_bytes[1]);
+        pixel_count = 0;
+    }
+}
+
+static void command_arg(uint8_t byte) {
+    if (argn < sizeof(args)) {
+        args[argn] = byte;
+    }
+    argn++;
+
+    switch (cmd) {
+    case TFT_CASET:
+        if (argn == 4) {
+            xs = (args[0] << 8) | args[1];
+            xe = (args[2] << 8) | args[3];
+        }
+        break;
+    case TFT_RASET:
+        if (argn == 4) {
+            ys = (args[0] << 8) | args[1];
+            ye = (args[2] << 8) | args[3];
+        }
+        break;
+    case TFT_MADCTL:
+        madctl = byte;
+        break;
+    case TFT_COLMOD:
+        colmod = byte & 0x07;
+        break;
+    case TFT_RAMWR:
+        ram_write(byte);
+        break;
+    default:
+        break;
+    }
+}
+
+void tft_emu_reset() {
+    memset(fb, 0, sizeof(fb));
+    cmd = TFT_NOP;
+    argn = 0;
+    madctl = 0;
+    colmod = 0x05;
+    xs = ys = cx = cy = 0;
+    xe = TFT_EMU_WIDTH - 1;
+    ye = TFT_EMU_HEIGHT - 1;
+    pixel_count = 0;
+}
+
+void tft_emu_write(uint8_t byte, bool data) {
+    if (!data) {
+        cmd = byte;
+        argn = 0;
+        if (cmd == TFT_RAMWR) {
+            cx = xs;
+            cy = ys;
+            pixel_count = 0;
+        } else if (cmd == TFT_SWRESET) {
+            tft_emu_reset();
+        }
+        return;
+    }
+    command_arg(byte);
+}
+
+const uint16_t *tft_emu_framebuffer() {
+    return fb;
+}
+
+uint32_t tft_emu_hash() {
+    uint32_t h = 2166136261u;
+    size_t i;
+    const uint8_t *p = (const uint8_t *)fb;
+    for (i = 0; i < sizeof(fb); i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+void tft_emu_write_pgm(FILE *f) {
+    int i;
+    fprintf(f, "P5\n%d %d\n255\n", TFT_EMU_WIDTH, TFT_EMU_HEIGHT);
+    for (i = 0; i < TFT_EMU_WIDTH * TFT_EMU_HEIGHT; i++) {
+        fputc(fb[i] ? 255 : 0, f);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * tft_emu.h
+ *
+ *  Emulation of the ST7735's command parser and frame memory for the
+ *  host build.  Pixels written with RAMWR land in an in-memory
+ *  framebuffer that can be inspected or dumped.
+ */
+
+#ifndef HOST_TFT_EMU_H_
+#define HOST_TFT_EMU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Panel geometry in its native (MADCTL = 0) orientation
+#define TFT_EMU_WIDTH 128
+#define TFT_EMU_HEIGHT 160
+
+/**
+ * Reset the panel: framebuffer black, window full screen, 16 bpp.
+ */
+void tft_emu_reset();
+
+/**
+ * Clock one byte into the panel.  `data` is the level of the D/C line.
+ */
+void tft_emu_write(uint8_t byte, bool data);
+
+/**
+ * The panel's frame memory as RGB565, TFT_EMU_HEIGHT rows of TFT_EMU_WIDTH.
+ */
+const uint16_t *tft_emu_framebuffer();
+
+/**
+ * FNV-1a hash of the current frame memory.
+ */
+uint32_t tft_emu_hash();
+
+/**
+ * Write the frame memory to `f` as a binary PGM (any lit pixel is white).
+ */
+void tft_emu_write_pgm(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_TFT_EMU_H_ */
@@ -0,0 +1,480 @@
+/*
+ * timemodel.c
+ *
+ *  Will it fit in a frame?  Replays what the host build of the player did
+ *  (badapple -T, see trace.h) through a timing model of the board, and
+ *  predicts how long every frame would take on it:
+ *   - SPI bytes at SMCLK / UCxxBRW, as the trace set them;
+ *   - polled bytes costing the CPU some cycles each on top, running the
+ *     SPI code from FRAM;
+ *   - FRAM at NWAITS_1: a wait state on the share of accesses that miss
+ *     its cache, for code run from it and for reading the frame buffers;
+ *   - every DMA transfer holding the CPU for a couple of cycles, the
+ *     audio's included;
+ *   - the SD card taking a while to send a sector's start token after a
+ *     read command, and after each sector of a stream.
+ *  Then prints the model, a summary, the worst frames broken down, and a
+ *  timeline of the worst (or a chosen) frame.
+ *
+ *      timemodel [-b sd:tft] [-w waits] [-t first:next] [-l cycles]
+ *                [-c target us] [-n worst] [-g frame] trace.bin
+ *
+ *  -b overrides the prescalers the trace set, -w the FRAM wait states,
+ *  -t the card's token latency in us, and -l the cycles it takes to
+ *  decode a line.  -c finds the line cost that makes the frames drawn in
+ *  full take `target` us on average, and models with that.  -n is how many
+ *  of the worst frames to list and -g the frame to draw.
+ *
+ *  DEFAULT_LINE_CYCLES came from -c 24000 (the board's figure for a whole
+ *  frame, from the README) over a trace of `mkimage -f` frames.
+ *
+ *  A token that's late stalls the CPU where the trace has it turn up.
+ *  The player would hand the bus back to the display and look again a
+ *  line later, so frames made late by the card come out a bit worse here
+ *  than they'd be.
+ *
+ *  Exits 1 if any frame would overrun.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "hal.h"
+#include "host.h"
+#include "trace.h"
+#include "video.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MCLK_HZ 16000000ULL
+#define GANTT_WIDTH 100
+
+// Cycles to decode a line, from SRAM (see above)
+#define DEFAULT_LINE_CYCLES 1539
+// FRAM reads a line makes of its frame buffer: a frame is 1-2KB coded
+#define LINE_FRAM_READS 10
+// Cycles to decode a sample of ADPCM, from SRAM, and its FRAM reads
+#define SAMPLE_CYCLES 35
+#define SAMPLE_FRAM_READS 0.5
+// A polled byte: the calls down to hal_spi_xfer() and the loop round it
+#define POLL_CYCLES 20
+// Programming the DMA channels to start a transfer
+#define DMA_SETUP_CYCLES 60
+// The CPU's held for 2 MCLK cycles for each DMA transfer
+#define DMA_CYCLES 2
+// Share of FRAM accesses that miss its cache and wait
+#define FRAM_MISS 0.5
+// Frame 0 is read before the loop starts, along with everything else the
+// player does at startup, so it's left out of the numbers
+#define FIRST_FRAME 1
+
+struct model {
+    uint16_t prescaler[HAL_SPI_BUSES];
+    bool fixed_prescaler;           // -b: ignore the trace's
+    unsigned int fram_waits;
+    unsigned int line_cycles;
+    double token_first_us, token_next_us;
+};
+
+struct frame {
+    uint64_t busy_ns;       // frame timer tick to done
+    uint64_t draw_ns;       // in decode_and_write_frame()
+    uint64_t token_ns;      // CPU held up waiting for the card's start tokens
+    uint64_t dma_wait_ns;   // CPU spinning on a DMA
+    unsigned int lines;
+};
+
+struct span {
+    host_lane_t lane;
+    uint64_t start, end;
+};
+
+// The card's lane in the timeline, when it's holding the CPU up
+#define LANE_TOKEN HOST_LANE_IDLE
+
+static struct trace_event *events;
+static size_t event_count;
+static struct frame *frames;
+static size_t frame_count, frame_space;
+static uint64_t frame_period_ns;
+
+// The frame being drawn, and what happened in it
+static long gantt_frame = -1;
+static struct span *spans;
+static size_t span_count, span_space;
+
+static void *grow(void *p, size_t *space, size_t size) {
+    *space = *space ? *space * 2 : 1024;
+    p = realloc(p, *space * size);
+    if (!p) {
+        perror("realloc");
+        exit(2);
+    }
+    return p;
+}
+
+static void span(host_lane_t lane, uint64_t start, uint64_t end) {
+    if ((long)frame_count != gantt_frame || end <= start) {
+        return;
+    }
+    if (span_count == span_space) {
+        spans = grow(spans, &span_space, sizeof(*spans));
+    }
+    spans[span_count].lane = lane;
+    spans[span_count].start = start;
+    spans[span_count].end = end;
+    span_count++;
+}
+
+static uint64_t byte_ns(const uint16_t *prescaler, uint8_t bus) {
+    // UCBRW = 0 behaves like a divider of 1
+    return 8ULL * (prescaler[bus] ? prescaler[bus] : 1) * 1000000000ULL / HOST_SMCLK_HZ;
+}
+
+/*
+ * What a CPU cycle comes to, once the audio DMA's taken its cycles out of
+ * every `sample_cycles`.
+ */
+static double cycle_ns(double sample_cycles) {
+    return 1e9 / MCLK_HZ / (1 - DMA_CYCLES / sample_cycles);
+}
+
+/*
+ * Replay the trace through `m`, filling in frames[].
+ */
+static void replay(const struct model *m) {
+    uint64_t cpu = 0, dma = 0, bus[HAL_SPI_BUSES] = { 0 }, sd_ready = 0, vstart = 0;
+    uint64_t draw_start = 0, t;
+    uint16_t prescaler[HAL_SPI_BUSES] = { 0 };
+    double sample_cycles = HOST_SAMPLE_NS * (HAL_SMCLK_HZ / 1e9);
+    double cycle = cycle_ns(sample_cycles), fram_ns = cycle * m->fram_waits * FRAM_MISS;
+    double samples = HOST_FRAME_NS / (double)HOST_SAMPLE_NS;
+    struct frame f;
+    size_t i;
+
+    frame_count = 0;
+    span_count = 0;
+    frame_period_ns = HOST_FRAME_NS;
+    memset(&f, 0, sizeof(f));
+    if (m->fixed_prescaler) {
+        memcpy(prescaler, m->prescaler, sizeof(prescaler));
+    }
+
+    for (i = 0; i < event_count; i++) {
+        const struct trace_event *e = &events[i];
+        uint64_t start, end;
+
+        switch (e->type) {
+        case TRACE_POLLED:
+            // Each byte goes out once the CPU's got to it, then the CPU
+            // spins until it's back, and loops round for the next
+            start = MAX(cpu, bus[e->bus]);
+            end = start + e->a * (byte_ns(prescaler, e->bus) + (uint64_t)(POLL_CYCLES * (cycle + fram_ns)));
+            span(e->lane, start, end);
+            bus[e->bus] = cpu = end;
+            break;
+        case TRACE_DMA_RX:
+        case TRACE_DMA_TX:
+            cpu += DMA_SETUP_CYCLES * cycle;
+            if (e->type == TRACE_DMA_RX && e->lane == HOST_LANE_SD && sd_ready > cpu) {
+                // The CPU saw the start token before starting this
+                span(LANE_TOKEN, cpu, sd_ready);
+                f.token_ns += sd_ready - cpu;
+                cpu = sd_ready;
+            }
+            start = MAX(MAX(cpu, dma), bus[e->bus]);
+            end = start + e->a * byte_ns(prescaler, e->bus);
+            span(e->lane, start, end);
+            bus[e->bus] = dma = end;
+            // The CPU runs on alongside, less the cycles the DMA takes
+            // (two channels for a receive: DMA2 sends the fill)
+            cpu += e->a * DMA_CYCLES * (e->type == TRACE_DMA_RX ? 2 : 1) * cycle;
+            if (e->type == TRACE_DMA_RX && e->lane == HOST_LANE_SD) {
+                sd_ready = end + m->token_next_us * 1000;
+            }
+            break;
+        case TRACE_DMA_WAIT:
+            if (dma > cpu) {
+                f.dma_wait_ns += dma - cpu;
+                cpu = dma;
+            }
+            break;
+        case TRACE_PRESCALER:
+            if (!m->fixed_prescaler) {
+                prescaler[e->bus] = e->a;
+            }
+            break;
+        case TRACE_RATES:
+            frame_period_ns = e->b * 1000000000ULL / HAL_FRAME_TICK_HZ;
+            samples = (double)e->b * (HAL_SMCLK_HZ / HAL_FRAME_TICK_HZ) / e->a;
+            sample_cycles = e->a;
+            cycle = cycle_ns(sample_cycles);
+            fram_ns = cycle * m->fram_waits * FRAM_MISS;
+            break;
+        case TRACE_WAIT_FRAME:
+            // As the host backend does it: the next tick, unless one went
+            // by while we were busy
+            t = cpu / frame_period_ns * frame_period_ns;
+            cpu = vstart = t > vstart ? cpu : t + frame_period_ns;
+            break;
+        case TRACE_MARK:
+            switch (e->a) {
+            case HAL_MARK_LINE_DECODED:
+                end = cpu + (uint64_t)(m->line_cycles * cycle + LINE_FRAM_READS * fram_ns);
+                span(HOST_LANE_CPU, cpu, end);
+                cpu = end;
+                f.lines++;
+                break;
+            case HAL_MARK_AUDIO_DECODED:
+                end = cpu + (uint64_t)(samples * (SAMPLE_CYCLES * cycle + SAMPLE_FRAM_READS * fram_ns));
+                span(HOST_LANE_CPU, cpu, end);
+                cpu = end;
+                break;
+            case HAL_MARK_SD_COMMAND_END:
+                sd_ready = cpu + m->token_first_us * 1000;
+                break;
+            case HAL_MARK_DECODE_BEGIN:
+                draw_start = cpu;
+                break;
+            case HAL_MARK_DECODE_END:
+                f.draw_ns += cpu - draw_start;
+                break;
+            case HAL_MARK_READ_END:
+                // Reading the next frame finishes last, as in the host backend
+                f.busy_ns = cpu - vstart;
+                if (frame_count == frame_space) {
+                    frames = grow(frames, &frame_space, sizeof(*frames));
+                }
+                frames[frame_count++] = f;
+                memset(&f, 0, sizeof(f));
+                break;
+            default:
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * The average of the frames that drew every line, and how many there are.
+ */
+static double full_average(size_t *count) {
+    double total = 0;
+    size_t i;
+
+    *count = 0;
+    for (i = FIRST_FRAME; i < frame_count; i++) {
+        if (frames[i].lines == VIDEO_LINES) {
+            total += frames[i].busy_ns;
+            (*count)++;
+        }
+    }
+    return *count ? total / *count : 0;
+}
+
+/*
+ * The line cost that makes a frame drawn in full take `target_ns`.
+ * Frames only get longer as lines do, so halve the range till it's found.
+ */
+static unsigned int calibrate(struct model *m, double target_ns) {
+    unsigned int lo = 0, hi = 65535;
+    size_t count;
+
+    while (lo < hi) {
+        m->line_cycles = (lo + hi) / 2;
+        replay(m);
+        if (full_average(&count) < target_ns) {
+            lo = m->line_cycles + 1;
+        } else {
+            hi = m->line_cycles;
+        }
+    }
+    if (!count) {
+        fprintf(stderr, "no frames drawn in full to calibrate against (mkimage -f makes some)\n");
+        exit(2);
+    }
+    return lo;
+}
+
+static uint64_t lane_time(host_lane_t lane, uint64_t from, uint64_t to) {
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < span_count; i++) {
+        uint64_t s = MAX(spans[i].start, from), e = MIN(spans[i].end, to);
+        if (spans[i].lane == lane && e > s) {
+            total += e - s;
+        }
+    }
+    return total;
+}
+
+static void gantt() {
+    static const char *names[] = { "sd", "tft", "cpu", "card" };
+    static const char marks[] = { 'S', 'T', 'c', 'w' };
+    uint64_t from = spans[0].start, to = from, step;
+    int lane, col;
+    size_t i;
+
+    for (i = 0; i < span_count; i++) {
+        from = MIN(from, spans[i].start);
+        to = MAX(to, spans[i].end);
+    }
+    step = (to - from + GANTT_WIDTH - 1) / GANTT_WIDTH;
+    printf("\nframe %ld, %.1f us per column (w: CPU waiting for the card's start token):\n", gantt_frame, step / 1e3);
+    for (lane = HOST_LANE_SD; lane <= LANE_TOKEN; lane++) {
+        printf("%-4s|", names[lane]);
+        for (col = 0; col < GANTT_WIDTH; col++) {
+            uint64_t s = from + col * step;
+            putchar(lane_time(lane, s, s + step) ? marks[lane] : ' ');
+        }
+        printf("|\n");
+    }
+}
+
+static int by_busy(const void *a, const void *b) {
+    const struct frame *fa = &frames[*(const size_t *)a], *fb = &frames[*(const size_t *)b];
+    return fa->busy_ns < fb->busy_ns ? 1 : fa->busy_ns > fb->busy_ns ? -1 : 0;
+}
+
+static void load(const char *path) {
+    struct trace_header h;
+    size_t space = 0;
+    FILE *f = fopen(path, "rb");
+
+    if (!f || fread(&h, sizeof(h), 1, f) != 1) {
+        perror(path);
+        exit(2);
+    }
+    if (h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %u trace\n", path, TRACE_VERSION);
+        exit(2);
+    }
+    for (;;) {
+        if (event_count == space) {
+            events = grow(events, &space, sizeof(*events));
+        }
+        if (fread(&events[event_count], sizeof(*events), 1, f) != 1) {
+            break;
+        }
+        event_count++;
+    }
+    fclose(f);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-b sd:tft] [-w waits] [-t first:next] [-l cycles] [-c target us] [-n worst] [-g frame] trace.bin\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct model m = { { 0, 0 }, false, 1, DEFAULT_LINE_CYCLES, 200, 20 };
+    double target_us = 0, total = 0, full;
+    unsigned long worst = 5, over = 0;
+    size_t *order, count, i;
+    uint64_t longest = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:t:l:c:n:g:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (sscanf(optarg, "%hu:%hu", &m.prescaler[HAL_SPI_UCB0], &m.prescaler[HAL_SPI_UCA0]) != 2) {
+                usage(argv[0]);
+            }
+            m.fixed_prescaler = true;
+            break;
+        case 'w':
+            m.fram_waits = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            if (sscanf(optarg, "%lf:%lf", &m.token_first_us, &m.token_next_us) != 2) {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            m.line_cycles = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            target_us = strtod(optarg, NULL);
+            break;
+        case 'n':
+            worst = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            gantt_frame = strtol(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    load(argv[optind]);
+
+    if (target_us) {
+        m.line_cycles = calibrate(&m, target_us * 1000);
+        printf("calibrated: %u cycles a line for %.0f us a full frame\n", m.line_cycles, target_us);
+    }
+    replay(&m);
+    if (frame_count <= FIRST_FRAME) {
+        fprintf(stderr, "%s: no frames past the first\n", argv[optind]);
+        return 2;
+    }
+
+    printf("model: SMCLK %llu MHz, ", MCLK_HZ / 1000000);
+    if (m.fixed_prescaler) {
+        printf("SPI /%u (UCB0) /%u (UCA0), ", MAX(m.prescaler[HAL_SPI_UCB0], 1), MAX(m.prescaler[HAL_SPI_UCA0], 1));
+    } else {
+        printf("SPI as the trace set it, ");
+    }
+    printf("FRAM %u wait%s on %.0f%% of accesses,\n"
+           "       DMA %u cycles a transfer, SD token %.0f us after a command and %.0f us a sector,\n"
+           "       %u cycles a line\n",
+           m.fram_waits, m.fram_waits == 1 ? "" : "s", FRAM_MISS * 100, DMA_CYCLES, m.token_first_us, m.token_next_us,
+           m.line_cycles);
+
+    count = frame_count - FIRST_FRAME;
+    order = malloc(count * sizeof(*order));
+    if (!order) {
+        perror("malloc");
+        return 2;
+    }
+    for (i = FIRST_FRAME; i < frame_count; i++) {
+        order[i - FIRST_FRAME] = i;
+        total += frames[i].busy_ns;
+        longest = MAX(longest, frames[i].busy_ns);
+        over += frames[i].busy_ns > frame_period_ns;
+    }
+    printf("%zu frames of %.1f us: avg %.1f us, worst %.1f us, %lu over\n", count,
+           frame_period_ns / 1e3, total / count / 1e3, longest / 1e3, over);
+    full = full_average(&count);
+    if (count) {
+        printf("%zu drawn in full: avg %.1f us\n", count, full / 1e3);
+    }
+    count = frame_count - FIRST_FRAME;
+
+    qsort(order, count, sizeof(*order), by_busy);
+    printf("\n%-6s %10s %10s %6s %10s %10s\n", "frame", "busy us", "draw us", "lines", "token us", "dma wait us");
+    for (i = 0; i < worst && i < count; i++) {
+        const struct frame *f = &frames[order[i]];
+        printf("%-6zu %10.1f %10.1f %6u %10.1f %10.1f%s\n", order[i], f->busy_ns / 1e3, f->draw_ns / 1e3, f->lines,
+               f->token_ns / 1e3, f->dma_wait_ns / 1e3, f->busy_ns > frame_period_ns ? " late" : "");
+    }
+
+    // Once more, keeping the timeline of the frame to draw
+    if (gantt_frame < FIRST_FRAME || (size_t)gantt_frame >= frame_count) {
+        gantt_frame = order[0];
+    }
+    replay(&m);
+    if (span_count) {
+        gantt();
+    }
+    free(order);
+    free(frames);
+    free(events);
+    free(spans);
+    return over ? 1 : 0;
+}
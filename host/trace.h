@@ -0,0 +1,51 @@
+/*
+ * trace.h
+ *
+ *  Event trace written by the host backend (badapple -T) for timemodel
+ *  to replay.  It says what the player did, in order, and nothing about
+ *  how long any of it took: bytes polled and DMA'd on each bus, waits for
+ *  DMAs and for the frame timer, prescaler and timer settings, and every
+ *  hal_mark().  The timing is timemodel's job, so the same trace can be
+ *  run through different assumptions about the board.
+ */
+
+#ifndef HOST_TRACE_H_
+#define HOST_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAGIC 0x5254   // "TR"
+#define TRACE_VERSION 1
+
+struct trace_header {
+    uint16_t magic;
+    uint16_t version;
+};
+
+enum {
+    TRACE_MARK,         // a = hal_mark_t
+    TRACE_POLLED,       // a bytes sent and received one at a time by the CPU
+    TRACE_DMA_RX,       // a bytes received by DMA (DMA1, with DMA2 sending the fill)
+    TRACE_DMA_TX,       // a bytes sent by DMA2
+    TRACE_DMA_WAIT,     // CPU waiting for the SPI DMA in flight
+    TRACE_PRESCALER,    // a = the bus's new UCxxBRW
+    TRACE_RATES,        // a = DAC sample period in SMCLK cycles, b = frame timer period in 1us ticks
+    TRACE_WAIT_FRAME,   // CPU asleep until the frame timer's next tick
+};
+
+struct trace_event {
+    uint8_t type;       // TRACE_*
+    uint8_t bus;        // hal_spi_t for SPI events
+    uint8_t lane;       // host_lane_t listening on the bus for SPI events
+    uint8_t reserved;
+    uint16_t a, b;
+};
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HOST_TRACE_H_ */
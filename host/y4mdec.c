@@ -0,0 +1,409 @@
+/*
+ * y4mdec.c
+ *
+ *  decode.py without the window or the waiting: goes through a card image
+ *  as fast as it can be read, checks it hangs together, and can write the
+ *  pictures out as Y4M and the sound as a WAV.
+ *
+ *      y4mdec [-q] [-v video.y4m] [-a sound.wav] image.bin
+ *
+ *  Prints each frame's sectors and an FNV-1a hash of its decoded picture
+ *  and sound (-q only prints the totals), so two images can be diffed
+ *  frame by frame.  Checked along the way:
+ *
+ *   - every frame's sector counts: the next frame's matches what the one
+ *     before said, and they stay inside the image
+ *   - every line's codes cover exactly the line, inside the frame
+ *   - every line marked clean is the same as in the frame before
+ *   - the header's frame count, seek index and chapters point at frames
+ *
+ *  The pictures are 160x128, one column per display line as convert.py
+ *  had them, at the header's frame rate.  The sound is what the DAC would
+ *  play, its 6 bits stretched to 8.  "-" writes either to stdout.
+ *
+ *  Exits 1 if anything didn't check out.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "video.h"
+#include "audio.h"
+#include "container.h"
+#include "seek.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 512
+#define VIDEO_SIZE (VIDEO_LINES * VIDEO_LINE_BYTES)
+#define FNV_BASIS 2166136261u
+
+struct image {
+    const uint8_t *data;
+    uint64_t size;
+    bool has_header;
+    unsigned int sample_rate, frame_samples;
+    uint32_t first_block;
+    // Where every frame started, for checking the index against
+    uint32_t *blocks;
+    unsigned long frames;
+};
+
+static unsigned long errors;
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-q] [-v video.y4m] [-a sound.wav] image.bin\n", argv0);
+    exit(2);
+}
+
+static void fail(unsigned long frame, const char *what) {
+    fprintf(stderr, "frame %lu: %s\n", frame, what);
+    errors++;
+}
+
+static uint32_t fnv(uint32_t h, const uint8_t *p, size_t size) {
+    size_t i;
+    for (i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static void put16(uint8_t *p, unsigned int n) {
+    p[0] = n;
+    p[1] = n >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t n) {
+    put16(p, n & 0xFFFF);
+    put16(p + 2, n >> 16);
+}
+
+static FILE *open_out(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    return f;
+}
+
+/*
+ * What the header says about the frames, or what the player assumes of an
+ * image without one.
+ */
+static bool read_header(struct image *im) {
+    const uint8_t *h = im->data;
+
+    im->sample_rate = CONTAINER_DEFAULT_SAMPLE_RATE;
+    im->frame_samples = AUDIO_FRAME_SIZE;
+    im->first_block = CONTAINER_BLOCK;
+    if (im->size < CONTAINER_SIZE || memcmp(h, CONTAINER_MAGIC, 4) != 0) {
+        return true;
+    }
+    im->has_header = true;
+    im->first_block = CONTAINER_BLOCK + 1;
+    im->sample_rate = get16(h + CONTAINER_SAMPLE_RATE_OFFSET);
+    im->frame_samples = get16(h + CONTAINER_FRAME_SAMPLES_OFFSET);
+    if (get16(h + CONTAINER_VERSION_OFFSET) != CONTAINER_VERSION || get16(h + CONTAINER_LINES_OFFSET) != VIDEO_LINES
+            || get16(h + CONTAINER_LINE_PIXELS_OFFSET) != VIDEO_LINE_PIXELS) {
+        fprintf(stderr, "header: version %u, %ux%u, not a format this decodes\n", get16(h + CONTAINER_VERSION_OFFSET),
+                get16(h + CONTAINER_LINES_OFFSET), get16(h + CONTAINER_LINE_PIXELS_OFFSET));
+        return false;
+    }
+    if (!im->sample_rate || !im->frame_samples || im->frame_samples % 2 || im->frame_samples > AUDIO_FRAME_SIZE) {
+        fprintf(stderr, "header: %u Hz, %u samples a frame, not a format this decodes\n", im->sample_rate,
+                im->frame_samples);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Length of the run-length coded line at `src`, or 0 if its codes don't
+ * cover exactly one line before `end`.  The player's decoder copes with
+ * a damaged line, but could read well past it.
+ */
+static size_t check_line(const uint8_t *src, const uint8_t *end) {
+    const uint8_t *p = src;
+    unsigned int pixels = 0, n;
+
+    while (pixels < VIDEO_LINE_PIXELS) {
+        if (p >= end) {
+            return 0;
+        }
+        if (*p & VIDEO_RLE_RUN) {
+            n = (*p & (VIDEO_RLE_WHITE - 1)) + 1;
+            p++;
+        } else {
+            n = (*p + 1) * 8;
+            p += 1 + *p + 1;
+        }
+        pixels += n;
+    }
+    return pixels == VIDEO_LINE_PIXELS && p <= end ? (size_t)(p - src) : 0;
+}
+
+/*
+ * Decode frame `n`, at `frame`, `size` bytes of it, into `video` and
+ * `samples`, checking its lines against `prev` as it goes.
+ */
+static void decode_frame(const struct image *im, unsigned long n, const uint8_t *frame, size_t size,
+                         const uint8_t *prev, uint8_t *video, uint8_t *samples) {
+    size_t video_offset = FRAME_AUDIO_OFFSET + AUDIO_BLOCK_BYTES(im->frame_samples);
+    const uint8_t *src = frame + video_offset, *end = frame + size;
+    unsigned int i, changed = 0;
+    size_t length;
+
+    memset(video, 0, VIDEO_SIZE);
+    memset(samples, 0x20, im->frame_samples);
+    if (size < video_offset) {
+        fail(n, "too short for its sound");
+        return;
+    }
+    audio_decode(frame + FRAME_AUDIO_OFFSET, samples, im->frame_samples);
+    for (i = 0; i < VIDEO_LINES; i++) {
+        uint8_t *line = video + i * VIDEO_LINE_BYTES;
+        bool clean = frame[FRAME_CLEAN_OFFSET + i / 8] & (0x80 >> (i % 8));
+
+        length = check_line(src, end);
+        if (!length) {
+            fail(n, "line runs off the end of its codes");
+            return;
+        }
+        video_decode_packed(src, line);
+        src += length;
+        changed += clean && (!prev || memcmp(line, prev + i * VIDEO_LINE_BYTES, VIDEO_LINE_BYTES) != 0);
+    }
+    if (changed) {
+        fail(n, "lines marked clean have changed");
+    }
+}
+
+/*
+ * Every frame in order, following the sector counts.
+ */
+static void walk(struct image *im, FILE *y4m, FILE *wav, FILE *report, bool quiet) {
+    uint8_t video[2][VIDEO_SIZE], samples[AUDIO_FRAME_SIZE], picture[VIDEO_LINES * VIDEO_LINE_PIXELS];
+    uint64_t block = im->first_block;
+    unsigned int expected = 0, x, y;
+    uint32_t video_hash = FNV_BASIS, audio_hash = FNV_BASIS;
+    unsigned long n;
+
+    for (n = 0; block * SECTOR_SIZE < im->size; n++) {
+        const uint8_t *frame = im->data + block * SECTOR_SIZE;
+        unsigned int sectors = frame[FRAME_SECTORS_OFFSET], next = frame[FRAME_NEXT_SECTORS_OFFSET];
+        uint8_t *cur = video[n % 2], *prev = n ? video[(n + 1) % 2] : NULL;
+        size_t size = (size_t)sectors * SECTOR_SIZE;
+        unsigned int i;
+
+        if (!sectors || (uint64_t)(block + sectors) * SECTOR_SIZE > im->size) {
+            fail(n, "sector count runs off the end of the image");
+            break;
+        }
+        if (n && sectors != expected) {
+            fail(n, "sector count isn't what the frame before said");
+        }
+        if (n % 1024 == 0) {
+            im->blocks = realloc(im->blocks, (n + 1024) * sizeof(*im->blocks));
+            if (!im->blocks) {
+                perror("realloc");
+                exit(2);
+            }
+        }
+        im->blocks[n] = block;
+        decode_frame(im, n, frame, size, prev, cur, samples);
+
+        if (!quiet) {
+            fprintf(report, "%lu %u %08x %08x\n", n, sectors, fnv(FNV_BASIS, cur, VIDEO_SIZE),
+                   fnv(FNV_BASIS, samples, im->frame_samples));
+        }
+        video_hash = fnv(video_hash, cur, VIDEO_SIZE);
+        audio_hash = fnv(audio_hash, samples, im->frame_samples);
+        if (y4m) {
+            // Line x is column x
+            for (x = 0; x < VIDEO_LINES; x++) {
+                for (y = 0; y < VIDEO_LINE_PIXELS; y++) {
+                    bool white = cur[x * VIDEO_LINE_BYTES + y / 8] & (0x80 >> (y % 8));
+                    picture[y * VIDEO_LINES + x] = white ? 255 : 0;
+                }
+            }
+            fputs("FRAME\n", y4m);
+            fwrite(picture, 1, sizeof(picture), y4m);
+        }
+        if (wav) {
+            for (i = 0; i < im->frame_samples; i++) {
+                samples[i] = samples[i] << 2 | samples[i] >> 4;
+            }
+            fwrite(samples, 1, im->frame_samples, wav);
+        }
+
+        block += sectors;
+        expected = next;
+        if (!next) {
+            n++;
+            break;
+        }
+    }
+    if (expected) {
+        fail(n, "image ends before the frame the last one said was next");
+    }
+    im->frames = n;
+    fprintf(report, "%lu frames, video %08x, audio %08x\n", n, video_hash, audio_hash);
+}
+
+/*
+ * Whether the header's frame count, chapters and index entries agree with
+ * where the frames really are.
+ */
+static void check_index(const struct image *im) {
+    const uint8_t *h = im->data;
+    uint32_t frames = get32(h + SEEK_FRAMES_OFFSET), frame, b;
+    unsigned int interval = get16(h + SEEK_INTERVAL_OFFSET), entries = get16(h + SEEK_ENTRIES_OFFSET);
+    unsigned int chapters = h[SEEK_CHAPTERS_OFFSET], i;
+
+    if (frames != im->frames) {
+        fprintf(stderr, "header: says %u frames, there are %lu\n", frames, im->frames);
+        errors++;
+    }
+    if (chapters > SEEK_MAX_CHAPTERS || entries > SEEK_MAX_ENTRIES || (entries && !interval)) {
+        fprintf(stderr, "header: %u chapters, %u index entries every %u frames\n", chapters, entries, interval);
+        errors++;
+        return;
+    }
+    for (i = 0; i < chapters; i++) {
+        frame = get32(h + SEEK_CHAPTER_TABLE_OFFSET + i * 8);
+        b = get32(h + SEEK_CHAPTER_TABLE_OFFSET + i * 8 + 4);
+        if (frame >= im->frames || im->blocks[frame] != b) {
+            fprintf(stderr, "header: chapter %u doesn't start at a frame\n", i);
+            errors++;
+        }
+    }
+    for (i = 0; i < entries; i++) {
+        frame = i * interval;
+        if (frame >= im->frames || im->blocks[frame] != get32(h + SEEK_ENTRY_TABLE_OFFSET + i * 4)) {
+            fprintf(stderr, "header: index entry %u isn't frame %u\n", i, frame);
+            errors++;
+        }
+    }
+}
+
+/*
+ * A WAV header for `samples` 8-bit mono samples.  Written up front as
+ * long as it can be, then again at the end if the file can be rewound.
+ */
+static void wav_header(FILE *f, unsigned int rate, uint32_t samples) {
+    uint8_t h[44] = { 0 };
+
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + samples);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1);       // PCM
+    put16(h + 22, 1);       // mono
+    put32(h + 24, rate);
+    put32(h + 28, rate);
+    put16(h + 32, 1);
+    put16(h + 34, 8);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, samples);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    struct image im = { 0 };
+    const char *y4m_path = NULL, *wav_path = NULL;
+    FILE *y4m = NULL, *wav = NULL;
+    bool quiet = false;
+    struct stat st;
+    double start;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "qv:a:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quiet = true;
+            break;
+        case 'v':
+            y4m_path = optarg;
+            break;
+        case 'a':
+            wav_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return 2;
+    }
+    im.size = st.st_size;
+    im.data = im.size ? mmap(NULL, im.size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    if (im.data == MAP_FAILED || !im.data) {
+        fprintf(stderr, "%s: can't map it\n", argv[optind]);
+        return 2;
+    }
+    posix_madvise((void *)im.data, im.size, POSIX_MADV_SEQUENTIAL);
+    if (!read_header(&im)) {
+        return 1;
+    }
+
+    if (y4m_path) {
+        y4m = open_out(y4m_path);
+        fprintf(y4m, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 Cmono XCOLORRANGE=FULL\n", VIDEO_LINES, VIDEO_LINE_PIXELS,
+                im.sample_rate, im.frame_samples);
+    }
+    if (wav_path) {
+        wav = open_out(wav_path);
+        wav_header(wav, im.sample_rate, UINT32_MAX - 36);
+    }
+
+    start = now();
+    // Out of the way of a Y4M or WAV on stdout
+    walk(&im, y4m, wav, y4m == stdout || wav == stdout ? stderr : stdout, quiet);
+    if (im.has_header) {
+        check_index(&im);
+    }
+    fprintf(stderr, "%.1f MB/s, %lu errors\n", im.size / 1e6 / (now() - start), errors);
+
+    if (y4m && y4m != stdout) {
+        fclose(y4m);
+    }
+    if (wav) {
+        if (fseek(wav, 0, SEEK_SET) == 0) {
+            wav_header(wav, im.sample_rate, im.frames * im.frame_samples);
+        }
+        if (wav != stdout) {
+            fclose(wav);
+        }
+    }
+    munmap((void *)im.data, im.size);
+    close(fd);
+    free(im.blocks);
+    return errors ? 1 : 0;
+}
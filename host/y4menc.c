@@ -0,0 +1,295 @@
+/*
+ * y4menc.c
+ *
+ *  convert.py without Python or OpenCV: encodes Y4M
+ *  video and 8-bit mono WAV sound into a card image, each pair of files
+ *  a chapter, the same as convert.py would have from the same pictures
+ *  (see pack.h for how close that is).
+ *
+ *      y4menc [-j threads] [-r repeats] image.bin video.y4m sound.wav [video.y4m sound.wav ...]
+ *
+ *  -j sets how many threads pack and code the pictures (none by default:
+ *  the thread reading does it; bench_y4menc shows whether more help), and
+ *  -r how many times each picture is written (2, since convert.py's source
+ *  is 15 fps: every second frame just moves the sound on).  A video of
+ *  "-" is read from stdin, so ffmpeg can decode straight into it:
+ *
+ *      ffmpeg -i lagtrain.mp4 -f yuv4mpegpipe -pix_fmt gray - | y4menc image.bin - lagtrain-encoded.wav
+ *
+ *  Only the luma is used, so a picture with colour in it comes out a
+ *  little different from convert.py's BGR to grey.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "encode.h"
+#include "encpool.h"
+#include "pack.h"
+#include "defines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct y4m {
+    FILE *f;
+    const char *path;
+    unsigned int width, height;
+    size_t chroma;                      // bytes of colour after each frame's luma
+    bool full_range;
+    uint8_t *skip;
+    char *line;                         // the last FRAME header
+    size_t line_size;
+};
+
+struct wav {
+    FILE *f;
+    uint32_t left;                      // samples still to come
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-j threads] [-r repeats] image.bin video.y4m sound.wav [video.y4m sound.wav ...]\n",
+            argv0);
+    exit(2);
+}
+
+/*
+ * Bytes of chroma a frame of `y` has for colour space `c`, or 0 with
+ * `ok` false for one that isn't 8 bits.
+ */
+static size_t chroma_size(const struct y4m *y, const char *c, bool *ok) {
+    size_t w = y->width, h = y->height;
+    const char *p = strchr(c, 'p');
+
+    *ok = !(p && p[1] >= '0' && p[1] <= '9');
+    if (strcmp(c, "mono") == 0) {
+        return 0;
+    } else if (strncmp(c, "420", 3) == 0) {
+        return 2 * ((w + 1) / 2) * ((h + 1) / 2);
+    } else if (strncmp(c, "411", 3) == 0) {
+        return 2 * ((w + 3) / 4) * h;
+    } else if (strncmp(c, "422", 3) == 0) {
+        return 2 * ((w + 1) / 2) * h;
+    } else if (strcmp(c, "444alpha") == 0) {
+        return 3 * w * h;
+    } else if (strncmp(c, "444", 3) == 0) {
+        return 2 * w * h;
+    }
+    *ok = false;
+    return 0;
+}
+
+static bool y4m_open(struct y4m *y, const char *path) {
+    char *line = NULL, *tag, *save;
+    size_t cap = 0;
+    bool ok = true;
+
+    memset(y, 0, sizeof(*y));
+    y->path = path;
+    y->f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!y->f) {
+        perror(path);
+        return false;
+    }
+    if (getline(&line, &cap, y->f) <= 0 || strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+        fprintf(stderr, "%s: not a Y4M file\n", path);
+        goto fail;
+    }
+    y->chroma = SIZE_MAX;
+    for (tag = strtok_r(line + 10, " \n", &save); tag; tag = strtok_r(NULL, " \n", &save)) {
+        if (tag[0] == 'W') {
+            y->width = strtoul(tag + 1, NULL, 10);
+        } else if (tag[0] == 'H') {
+            y->height = strtoul(tag + 1, NULL, 10);
+        } else if (tag[0] == 'C') {
+            y->chroma = chroma_size(y, tag + 1, &ok);
+            if (!ok) {
+                fprintf(stderr, "%s: can't read colour space %s, only 8 bits\n", path, tag + 1);
+                goto fail;
+            }
+        } else if (strcmp(tag, "XCOLORRANGE=FULL") == 0) {
+            y->full_range = true;
+        }
+    }
+    if (!y->width || !y->height) {
+        fprintf(stderr, "%s: no picture size\n", path);
+        goto fail;
+    }
+    if (y->chroma == SIZE_MAX) {
+        // No C tag is 4:2:0
+        y->chroma = chroma_size(y, "420jpeg", &ok);
+    }
+    y->skip = malloc(y->chroma ? y->chroma : 1);
+    if (!y->skip) {
+        perror("malloc");
+        goto fail;
+    }
+    free(line);
+    return true;
+
+fail:
+    free(line);
+    if (y->f != stdin) {
+        fclose(y->f);
+    }
+    return false;
+}
+
+/*
+ * The next frame's luma, or false at the end.
+ */
+static bool y4m_frame(struct y4m *y, uint8_t *luma) {
+    size_t size = (size_t)y->width * y->height;
+
+    if (getline(&y->line, &y->line_size, y->f) <= 0) {
+        return false;
+    }
+    if (strncmp(y->line, "FRAME", 5) != 0) {
+        fprintf(stderr, "%s: lost track of the frames\n", y->path);
+        return false;
+    }
+    if (fread(luma, 1, size, y->f) != size || fread(y->skip, 1, y->chroma, y->f) != y->chroma) {
+        fprintf(stderr, "%s: last frame cut short\n", y->path);
+        return false;
+    }
+    return true;
+}
+
+static void y4m_close(struct y4m *y) {
+    if (y->f != stdin) {
+        fclose(y->f);
+    }
+    free(y->skip);
+    free(y->line);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Open a WAV the way convert.py reads it, up to the start of its samples:
+ * 8-bit mono PCM at 44.1 kHz.
+ */
+static bool wav_open(struct wav *w, const char *path) {
+    uint8_t header[12], chunk[8], fmt[16];
+    bool have_fmt = false;
+    uint32_t size;
+
+    w->f = fopen(path, "rb");
+    if (!w->f) {
+        perror(path);
+        return false;
+    }
+    if (fread(header, 1, 12, w->f) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        goto fail;
+    }
+    while (fread(chunk, 1, 8, w->f) == 8) {
+        size = le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(fmt)) {
+            if (fread(fmt, 1, sizeof(fmt), w->f) != sizeof(fmt)) {
+                break;
+            }
+            // PCM, 1 channel, 8 bits per sample
+            if (fmt[0] != 1 || fmt[2] != 1 || fmt[14] != 8 || le32(fmt + 4) != CONTAINER_DEFAULT_SAMPLE_RATE) {
+                fprintf(stderr, "%s: need 8-bit mono PCM at %u Hz\n", path, CONTAINER_DEFAULT_SAMPLE_RATE);
+                goto fail;
+            }
+            have_fmt = true;
+            size -= sizeof(fmt);
+        } else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+            w->left = size;
+            return true;
+        }
+        fseek(w->f, size + (size & 1), SEEK_CUR);
+    }
+    fprintf(stderr, "%s: no sound in it\n", path);
+
+fail:
+    fclose(w->f);
+    return false;
+}
+
+/*
+ * The next `count` samples, padded with silence once the song runs out.
+ */
+static void wav_read(struct wav *w, uint8_t *samples, unsigned int count) {
+    size_t n = fread(samples, 1, MIN(w->left, count), w->f);
+
+    w->left -= n;
+    if (n < count) {
+        w->left = 0;
+        memset(samples + n, 0x80, count - n);
+    }
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    static struct encoder e;
+    static struct pack_plan plan;
+    struct encpool pool;
+    struct y4m y;
+    struct wav w;
+    long threads = 0;
+    unsigned long repeats = 2, frames = 0;
+    uint8_t *luma, *audio;
+    double start;
+    FILE *f;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "j:r:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = strtol(optarg, NULL, 0);
+            break;
+        case 'r':
+            repeats = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind < 3 || (argc - optind - 1) % 2 || threads < 0 || !repeats) {
+        usage(argv[0]);
+    }
+    f = fopen(argv[optind], "wb");
+    if (!f) {
+        perror(argv[optind]);
+        return 2;
+    }
+
+    start = now();
+    encode_open(&e, f, 0);
+    for (i = optind + 1; i < argc; i += 2) {
+        if (!y4m_open(&y, argv[i]) || !wav_open(&w, argv[i + 1])) {
+            return 2;
+        }
+        pack_plan_init(&plan, y.width, y.height, y.full_range);
+        encpool_start(&pool, &e, &plan, repeats, threads);
+        encpool_chapter(&pool);
+        for (;;) {
+            encpool_next(&pool, &luma, &audio);
+            if (!y4m_frame(&y, luma)) {
+                break;
+            }
+            wav_read(&w, audio, repeats * e.frame_samples);
+            encpool_submit(&pool);
+            frames++;
+        }
+        encpool_finish(&pool);
+        y4m_close(&y);
+        fclose(w.f);
+    }
+    encode_close(&e);
+    fclose(f);
+    printf("%lu pictures, %lu frames in %u chapter(s), %.1f bytes / %.2f sectors per frame, %.0f pictures/s\n",
+           frames, e.frames, e.chapters, e.frames ? (double)e.bytes / e.frames : 0.0,
+           e.frames ? (double)e.sectors / e.frames : 0.0, frames / (now() - start));
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * jitter.c
+ *
+ *  Jitter buffer, see jitter.h.
+ */
+
+#include "hal.h"
+#include "sdcard.h"
+#include "jitter.h"
+
+// Nowhere near enough room for these in the lower FRAM: they get the
+// top of FRAM2 to themselves (the .jitter section in the linker command
+// file, which the MPU leaves writeable), and aren't cleared at startup.
+#pragma DATA_SECTION(jitter_slots, ".jitter")
+uint8_t jitter_slots[JITTER_SLOTS][JITTER_SLOT_SIZE];
+
+uint8_t jitter_depth = JITTER_SLOTS;
+uint32_t jitter_block = 0;
+uint8_t jitter_ahead = 0;
+uint8_t jitter_min_ahead = JITTER_SLOTS;
+uint16_t jitter_stalls = 0;
+uint16_t jitter_retries = 0;
+
+// The slot of the frame being drawn, and how many frames there are in
+// the ring counting that one
+static uint8_t head = 0, count = 0;
+// A read into the slot after them is on its way: where the frame starts,
+// how long it is, and how many times it's been started
+static bool reading = false;
+static uint32_t reading_block;
+static uint8_t reading_sectors, tries;
+// The ring's been full since jitter_start(), so is meant to stay that way
+// (until the last frame's been read)
+static bool full = false;
+
+static uint8_t *slot(uint8_t n) {
+    n += head;
+    return jitter_slots[n >= jitter_depth ? n - jitter_depth : n];
+}
+
+uint8_t *jitter_frame(uint8_t n) {
+    return slot(n);
+}
+
+/*
+ * Count the frame in flight in once it's in, or start it again if its
+ * read failed or it isn't as long as the frame before said.  Returns false
+ * once it's failed JITTER_RETRIES times over.
+ */
+static bool collect() {
+    bool mangled = false;
+
+    if (!reading) {
+        return true;
+    }
+    switch (sd_async_state()) {
+    case SD_ASYNC_IDLE:
+        if (slot(count)[FRAME_SECTORS_OFFSET] == reading_sectors) {
+            reading = false;
+            if (++count == jitter_depth) {
+                full = true;
+            }
+            return true;
+        }
+        // A byte got mangled on the way in (or in the frame before): don't
+        // trust where the card's stream has got to either
+        mangled = true;
+        sd_stream_stop();
+        // fall through
+    case SD_ASYNC_ERROR:
+        if (tries > JITTER_RETRIES) {
+            if (mangled) {
+                hal_halt(JITTER_ERROR_BAD_FRAME);
+            }
+            return false;
+        }
+        jitter_retries++;
+        tries++;
+        sd_async_start(reading_block, slot(count), reading_sectors);
+        return true;
+    default:
+        return true;
+    }
+}
+
+/*
+ * The blocking read of jitter_start(): the first sector says how many
+ * more there are.
+ */
+static bool read_first(uint32_t block) {
+    uint8_t *buf = slot(0);
+    uint8_t sectors;
+
+    if (!sd_stream_read(block, buf)) {
+        return false;
+    }
+    sectors = buf[FRAME_SECTORS_OFFSET];
+    if (sectors == 0 || sectors > JITTER_SLOT_SECTORS) {
+        hal_halt(JITTER_ERROR_BAD_FRAME);
+    }
+    sd_async_start(block + 1, buf + JITTER_SECTOR_SIZE, sectors - 1);
+    jitter_block = block + sectors;
+    return sd_async_wait();
+}
+
+bool jitter_start(uint32_t block) {
+    uint8_t i;
+
+    // Whatever was on its way is for frames we're not going to draw
+    sd_async_cancel();
+    reading = false;
+    count = 0;
+    full = false;
+    for (i = 0; !read_first(block); i++) {
+        if (i == JITTER_RETRIES) {
+            return false;
+        }
+        jitter_retries++;
+    }
+    count = 1;
+    jitter_ahead = 0;
+    return true;
+}
+
+bool jitter_fill() {
+    uint8_t sectors;
+
+    if (!collect()) {
+        return false;
+    }
+    if (reading || count == jitter_depth) {
+        return true;
+    }
+    // The last frame in says how long the one after it is
+    sectors = slot(count - 1)[FRAME_NEXT_SECTORS_OFFSET];
+    if (sectors == 0) {
+        full = false; // that was the last one: the ring runs down from here
+        return true;
+    }
+    if (sectors > JITTER_SLOT_SECTORS) {
+        hal_halt(JITTER_ERROR_BAD_FRAME);
+    }
+    reading = true;
+    reading_block = jitter_block;
+    reading_sectors = sectors;
+    tries = 1;
+    sd_async_start(jitter_block, slot(count), sectors);
+    jitter_block += sectors;
+    return true;
+}
+
+bool jitter_prefill() {
+    for (;;) {
+        if (!jitter_fill()) {
+            return false;
+        }
+        if (!reading) {
+            jitter_ahead = count - 1;
+            return true;
+        }
+        sd_async_wait(); // a failure's picked up by the next jitter_fill()
+    }
+}
+
+bool jitter_read_ahead() {
+    if (!collect()) {
+        return false;
+    }
+    // The slot the last frame leaves is read into between the next one's
+    // display lines, like always: only catching up is worth staying awake for
+    if (!reading && count + 1 >= jitter_depth) {
+        return false;
+    }
+    if (!jitter_fill() || !reading) {
+        return false;
+    }
+    sd_async_poll();
+    return true;
+}
+
+bool jitter_next() {
+    if (!jitter_fill()) {
+        return false;
+    }
+    if (count > 1 || !reading) {
+        return true;
+    }
+    jitter_stalls++;
+    while (count == 1) {
+        sd_async_wait();
+        if (!collect()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void jitter_advance() {
+    head = head + 1 == jitter_depth ? 0 : head + 1;
+    count--;
+    // Anything that came in while the last frame was finishing counts
+    collect();
+    jitter_ahead = count - 1;
+    if (full && jitter_ahead < jitter_min_ahead) {
+        jitter_min_ahead = jitter_ahead;
+    }
+}
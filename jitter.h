@@ -0,0 +1,111 @@
+/*
+ * jitter.h
+ *
+ *  Jitter buffer: a ring of frame slots in FRAM2 that the player reads
+ *  ahead into, so the card can go quiet for a while (SD cards stop to do
+ *  their own housekeeping, for 100ms and more on cheap ones) without a
+ *  frame coming late.
+ *
+ *  Frames come in in order, one at a time, through sdcard.c's
+ *  asynchronous reads.  The next one's started at the start of each
+ *  frame, and moves along in between display lines, so with the ring full
+ *  the slot the last frame left is read into while the next one's drawn,
+ *  just like double buffering.  After the card's been slow, the ring's
+ *  topped up while the player would otherwise be asleep waiting for the
+ *  frame timer (jitter_read_ahead()) too, so it fills right back up.
+ *  Only when the player needs a frame that isn't in yet does it wait for
+ *  the card (a stall).  A read that
+ *  fails, or brings in a frame that isn't as long as the one before said,
+ *  is started again from its first sector, a few times, before giving up.
+ *
+ *  The frame being drawn is slot 0 (jitter_frame()), the one after it 1,
+ *  and so on.
+ */
+
+#ifndef JITTER_H_
+#define JITTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "video.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames in the ring, counting the one being drawn: about half a second
+#define JITTER_SLOTS 16
+#define JITTER_SECTOR_SIZE 512
+// Room in a slot for the biggest frame there can be
+#define JITTER_SLOT_SECTORS ((FRAME_MAX_SIZE + JITTER_SECTOR_SIZE - 1) / JITTER_SECTOR_SIZE)
+#define JITTER_SLOT_SIZE (JITTER_SLOT_SECTORS * JITTER_SECTOR_SIZE)
+// Times a frame's read is started over before the player gives up
+#define JITTER_RETRIES 3
+
+// Halt code for a frame header that makes no sense, or still doesn't
+// match once the frame's been read again JITTER_RETRIES times
+#define JITTER_ERROR_BAD_FRAME 0xBAD
+
+extern uint8_t jitter_slots[JITTER_SLOTS][JITTER_SLOT_SIZE];
+
+// How many of the slots to use, from 2 (the frame being drawn and the
+// next one, double buffering) to JITTER_SLOTS.  Set before jitter_start().
+extern uint8_t jitter_depth;
+
+// Where the next frame to be read starts on the card
+extern uint32_t jitter_block;
+
+// How it's going, for the debugger (and the host backend's report).
+// Frames read ahead of the one being drawn as it started, and the fewest
+// there have been since the ring was last full; frames the player had
+// to wait for; and reads that failed and were started again.
+extern uint8_t jitter_ahead;
+extern uint8_t jitter_min_ahead;
+extern uint16_t jitter_stalls;
+extern uint16_t jitter_retries;
+
+/**
+ * Empty the ring and read the frame at `block` into slot 0, blocking.
+ * Returns false if the read failed (sd_errorCode says why).
+ */
+bool jitter_start(uint32_t block);
+
+/**
+ * Read ahead until the ring's full or the video ends, blocking.
+ */
+bool jitter_prefill();
+
+/**
+ * Frame `n` after the one being drawn (0 for that one).  It has to have
+ * been read: jitter_next() makes sure of frame 1.
+ */
+uint8_t *jitter_frame(uint8_t n);
+
+/**
+ * Start reading the next frame if there's a slot for it and the card
+ * isn't already busy with one.  The display path moves it along.
+ */
+bool jitter_fill();
+
+/**
+ * One bus turn's worth of reading ahead, for while there's nothing else
+ * to do.  Returns false when there's nothing to catch up on: the ring's
+ * full but for the slot the next frame's display lines will read into.
+ */
+bool jitter_read_ahead();
+
+/**
+ * Wait for the frame after the one being drawn to come in, unless that
+ * was the last one.  Returns false if its read failed for good.
+ */
+bool jitter_next();
+
+/**
+ * Done with the frame being drawn: the next one takes its place.
+ */
+void jitter_advance();
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* JITTER_H_ */
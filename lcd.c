@@ -6,6 +6,7 @@ GEORGE MASON UNIVERSITY
 Date:   Fall 2022
 Author: Jens-Peter Kaps
 --------------------------------------------------------*/
+#include <msp430.h>
 #include <lcd.h>
 
 // LCD memory map for numeric digits
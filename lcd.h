@@ -8,7 +8,6 @@ Author: Jens-Peter Kaps
 #ifndef LCD_H_
 #define LCD_H_
 
-#include "msp430.h"
 #include "stdint.h"
 
 #ifdef __cplusplus
@@ -161,6 +161,10 @@ SECTIONS
     .const            : {} >> FRAM | FRAM2  /* Constant data                     */
 #endif
 
+    /* jitter.c's frame slots: the top of FRAM2, on a 1K boundary so the  */
+    /* MPU can leave them writeable and everything below them not.        */
+    .jitter           : type = NOINIT {} ALIGN(0x0400), RUN_START(fram_jitter_start) > FRAM2 (HIGH)
+
     .text:_isr        : {}  > FRAM          /* Code ISRs                         */
 #ifndef __LARGE_CODE_MODEL__
     .text             : {} > FRAM           /* Code                              */
@@ -318,9 +322,12 @@ SECTIONS
          mpu_segment_border2 = fram_rx_start >> 4;
          mpu_sam_value = 0x1573; // Info R, Seg3 RX, Seg2 RWX, Seg1 RW
       #else
+         //seg1 = any read + write persistent variables
+         //seg2 = code, read + execute only
+         //seg3 = jitter buffer, read + write
          mpu_segment_border1 = fram_rx_start >> 4;
-         mpu_segment_border2 = fram_rx_start >> 4;
-         mpu_sam_value = 0x1513; // Info R, Seg3 RX, Seg2 R, Seg1 RW
+         mpu_segment_border2 = fram_jitter_start >> 4;
+         mpu_sam_value = 0x1353; // Info R, Seg3 RW, Seg2 RX, Seg1 RW
       #endif
    #endif
    #ifdef _MPU_LOCK
@@ -7,174 +7,324 @@
  * 1. Initialize clocks, SPI
  * 2. Setup audio player: Timer A1 runs as fast as possible to emulate a PWM DAC.
  *        TA1's period is fixed by TA1CCR0, duty cycle controlled by TA1CCR1.
- *    Timer B1 drives DMA0 to transfer data from AUDIO_BUF_A to TA1CCR1.
- *        DMA0's source will be changed / reset by main loop.
- * 3. Initialize the SD card.
+ *    Timer B1 drives DMA0 to transfer samples from a ring of decoded audio to TA1CCR1.
+ *        DMA0 goes round the ring by itself (see dac.h); the main loop just keeps it topped up.
+ * 3. Initialize the SD card.  A build with CARDTEST defined times the card instead of playing
+ *    anything (see cardtest.h).
  * 4. Initialize the SPI display.
  *
  *
  * Main loop:
- * 1. Read one frame and write it to FRAM buffer A. (May overrun a little bit - make sure to keep hold of it)
- * 2. Reconfigure DMA0 to point to our newly acquired audio buffer - this will start playing the current frame's worth of audio.
- * 3. Simultaneously decode and write out the newly acquired framebuffer to the display via SPI.
- * 4. Switch buffers, and repeat.
+ * 1. Frames are read ahead into a ring of FRAM2 frame buffers (see jitter.h), DMA'd straight in from
+ *    the card (frames are padded to whole sectors on the card, and each one says how many sectors the
+ *    next one takes up).  The card gets the bus in between display lines, and when the ring's short
+ *    after the card's stopped for a while, while we're waiting for the next frame tick too.
+ * 2. The card stores audio as ADPCM (see audio.h), so each frame's samples are decoded into the
+ *    DAC's ring as soon as the frame before it's been drawn, while DMA0 is still playing that one's.
+ *    A late frame just eats into the ring's slack instead of stopping the sound.
+ * 3. Simultaneously decode (run-length, see video.h) and write out the oldest frame in the ring to
+ *    the display via SPI, skipping the lines the encoder marked as unchanged since the previous frame.
+ * 4. Move on to the next frame in the ring, and repeat.
+ *
+ * Frames are paced by the audio: the frame timer runs at one frame's worth of samples, and the
+ * player compares each frame against how many samples DMA0 has actually played, holding a frame
+ * for another tick or skipping one if the picture gets more than about a frame away from the sound.
+ *
+ * The video is the file BADAPPLE.BIN on a FAT32 card (see fat.h), or written raw from the first sector.
+ * It starts with a header (see container.h) saying what format the frames are in,
+ * how fast the sound plays, and where frames start for seeking (see seek.h).  The seek buttons
+ * just leave a note for the main loop, which reads the frame they point at in place of the one it
+ * was about to draw.
  */
 
-#include <msp430.h>
 #include <sdcard.h>
 #include <Timing.h>
 #include <stddef.h>
+#include "hal.h"
 #include "spi.h"
 #include "defines.h"
 #include "lcd.h"
 #include "tft.h"
+#include "video.h"
+#include "audio.h"
+#include "dac.h"
+#include "container.h"
+#include "seek.h"
+#include "fat.h"
+#include "jitter.h"
+#include "cardtest.h"
 
-// These numbers are output by the encoding script, and determine how much data
-// to read each frame.
-// AUDIO_FRAME_SIZE can be calculated by `AUDIO_SAMPLE_RATE * AUDIO_SAMPLE_WIDTH / FRAME_RATE`,
-// and VIDEO_FRAME_SIZE is just `width * height / 8`.
-#define AUDIO_FRAME_SIZE 1470
-#define VIDEO_FRAME_SIZE 2560
-#define FRAME_SIZE (AUDIO_FRAME_SIZE + VIDEO_FRAME_SIZE)
-
-// These buffers are marked ((persistent)) so that they're stored in FRAM,
-// since we don't have enough space to fit them in SRAM.  This does mean that
-// they're slightly slower to write to, however.
-uint8_t  __attribute__((persistent)) framebuffer_a[FRAME_SIZE] = { 0 };
-uint8_t __attribute__((persistent)) framebuffer_b[FRAME_SIZE] = { 0 };
-uint8_t __attribute__((persistent)) block_buffer[512] = { 0 };
+// The frame layout itself is described in video.h.  The encoder pads every
+// frame out to a whole number of sectors, so that each frame starts on a
+// sector boundary and can be DMA'd straight into its frame buffer (one of
+// jitter.h's slots).
 
-// SRAM globals
-uint16_t frame_number = 0;
-uint32_t current_block = 0;
-uint16_t current_block_offset = 0;
-volatile bool nextFrame = 0;
+// Halt code for a card in a format this build can't play (container.h)
+#define PLAYER_ERROR_FORMAT 0xF0
+// ... and for one of the original raw images, which no build plays now
+#define PLAYER_ERROR_RAW 0xF1
+// The video, on a FAT32 card
+#define PLAYER_FILE "BADAPPLE.BIN"
 
-// Functions
-bool read_frame(uint8_t *frame_buffer);
-void decode_and_write_frame(uint8_t *current_buffer);
+// Button 0 this soon into a chapter goes back to the one before, rather
+// than to the start of this one again
+#define SEEK_RESTART_FRAMES 60
+// On a card with only the one chapter, how far the buttons step instead
+#define SEEK_STEP_FRAMES 300
+#define BUTTON_NONE 0xFF
 
-/**
- * MSP init: initialize misc. peripherals and pins
- */
-void msp_init() {
-    WDTCTL = WDTPW | WDTHOLD;   // stop watchdog timer
-    PM5CTL0 &= ~LOCKLPM5;         // Unlock ports from power manager
-    // make the ULP advisor shut up
-    PADIR = PBDIR = PCDIR = PDDIR = PEDIR = 0;
-    PAOUT = PBOUT = PCOUT = PDOUT = PEOUT = 0;
-
-    aclk_init();
-    smclk_init();
-    delay_init();
-    lcd_init();
-    spi_init();
+// How far the picture may get from the sound (dac_sync_error()) before a
+// frame is held up for another tick, or read without being drawn, given
+// the samples in a frame
+#define SYNC_AHEAD_MAX(samples) ((samples) / 2)
+#define SYNC_BEHIND_MAX(samples) (samples)
 
-    // Pins:
-    __disable_interrupt();
-    BIC(P2DIR, BIT1 | BIT2); // button P2.1 and P2.2 for seeking
-    BIS(P2IE, BIT1 | BIT2);
-    BIS(P2IES, BIT1 | BIT2);
-    BIS(P2REN, BIT1 | BIT2);
-    BIC(P2IFG, BIT1 | BIT2);
-    __enable_interrupt();
-
-    // P2.6, P2.7, P3.6, P3.7 are all LED pins and also our CS/DC lines
-    BIS(P2DIR, BIT2 | BIT6 | BIT7);
-    BIS(P2OUT, BIT2 | BIT6 | BIT7);
-    BIS(P3DIR, BIT6 | BIT7);
-    BIS(P3OUT, BIT6 | BIT7);
-
-    // Timer A1: PWM DAC
-    // Blisteringly fast 16MHz count, 6-bit PWM for a frequency of ~250kHz
-    BIS(P4DIR, BIT7); // P4.7 is TA1.2 output
-    BIS(P4SEL0, BIT7);
-    BIS(P4SEL1, BIT7);
-    TA1EX0 = TAIDEX_0; // divide by 1
-    TA1CTL = TASSEL__SMCLK | MC__UP | TACLR + ID__1; // SMCLK, up mode, clear timer, divide by 1
-    TA1CCR0 = 0x3F; // 6-bit PWM
-    TA1CCR2 = 0x2F; // 0% duty cycle
-    TA1CCTL2 = OUTMOD_3;
-    
-    // Timer A0: count when it's time for the next frame
-    TA0EX0 = TAIDEX_1; // divide by 2
-    TA0CTL = TASSEL__SMCLK | MC__UP | TACLR | ID__8; // 1us timer ticks
-    TA0CCR0 = 33333; // 30 Hz / FPS
-    TA0CCTL0 = CCIE;
-
-    // Timer B1: DMA0 trigger
-    // We need a frequency of 44100 Hz (~22.6 uS per sample)
-    // At 16MHz, this is 363.6 cycles per sample (we'll round up to 364)
-    TB0EX0 = TBIDEX_0; // divide by 1
-    TB0CTL = TBSSEL__SMCLK | MC__UP | TBCLR | ID__1; // SMCLK, up mode, clear timer, divide by 1
-    TB0CCR0 = 361; // *should* be 364 cycles per sample, but trial and error says 361 sounds best
-    
-    // DMA0: Audio buffer to TA0CCR1
-    DMACTL0 |= DMA0TSEL__TB0CCR0;
-    DMA0CTL = DMADT_0 + DMADSTINCR_0 + DMASRCINCR_3 + DMASRCBYTE + DMADSTBYTE + DMALEVEL;
-    __data20_write_long((uint32_t)&DMA0DA, (uint32_t)&TA1CCR2);
-    DMA0SZ = AUDIO_FRAME_SIZE;
-    // DMDA0SA is unset - main loop will set it and enable the transfer
-}
+// SRAM globals
+// Pixel format for the display.  Pixels are only ever black or white, so
+// 12 bits per pixel loses nothing and makes a line 192 bytes instead of 256.
+uint8_t display_colmod = TFT_COLMOD_12BIT;
+// Whether frames follow the sound, or just the frame timer
+bool av_sync = true;
+// Frames held up for another tick, and read without being drawn, to keep
+// with the sound
+uint16_t sync_repeats = 0, sync_skips = 0;
+uint32_t frame_number = 0;
+// Where the frame being drawn is in the video, counting from the start of
+// the card
+uint32_t video_frame = 0;
+// Set by the button ISR, for the main loop to pick up
+volatile uint8_t button_pressed = BUTTON_NONE;
+uint16_t seeks = 0;
+
+// Functions
+static void wait_frame();
+static bool button_target(uint8_t button, uint32_t frame, struct seek_target *target);
+void decode_and_write_frame(uint8_t *current_buffer, bool full);
 
 /**
  * Main loop!
  */
-void main(void) {
-	msp_init();
-
-//	displayNum(asmfunc("test 4"));
-//	for(;;);
+int main(void) {
+    hal_init();
+    spi_init();
 
 	// Setup SD card
 	if (!sd_init()) {
         displayNum(sd_errorCode);
-        for (;;);
+        hal_halt(sd_errorCode);
 	}
+    // As fast as this card, in this socket, can go.  Nothing's in the
+    // jitter buffer yet to get in the way.
+    if (!sd_probe_clock(jitter_frame(0))) {
+        hal_halt(sd_errorCode);
+    }
+#ifdef CARDTEST
+    // A card tester build (cardtest.h): time the card instead of playing
+    cardtest_run(CARDTEST_SPAN);
+    hal_halt(cardtest_results.error);
+#endif
 
 	// Setup TFT
-    tft_init();
+    tft_init(display_colmod);
     
-    uint8_t *current_buffer = framebuffer_a;
-    uint8_t *alternate_buffer = framebuffer_b;
+    uint8_t *current_buffer = jitter_frame(0);
     uint16_t start = 0;
-    
+    bool ok, skip = false;
+    // Whether the frame being drawn, and the one after it, don't follow on
+    // from the one before (the first one, after a seek, or after one that
+    // wasn't drawn), so have to be drawn in full rather than just their
+    // changed lines.
+    bool current_full = true, next_full;
+    struct seek_target target;
+    uint16_t sample_cycles;
+    int32_t ahead_max, behind_max;
+
+    // The video's either a file on a FAT32 card, or written straight to
+    // the card from sector 0.  A file has its extents mapped out once, here,
+    // and from then on the reads below come out of it without going near
+    // the FAT.  The frame buffer's free to use as scratch until the first
+    // frame's read.
+    if (fat_mount(current_buffer)) {
+        if (!fat_open(PLAYER_FILE, current_buffer)) {
+            hal_halt(fat_errorCode);
+        }
+        sd_map = fat_sector;
+    } else if (fat_errorCode != FAT_ERROR_NO_VOLUME) {
+        hal_halt(fat_errorCode);
+    }
+
+    // The header comes first in the video, then the frames.  It says how
+    // fast the sound goes and how many samples make a frame, and the
+    // frame timer follows from those.
+    if (!container_load()) {
+        hal_halt(sd_errorCode);
+    }
+    if (!container_playable()) {
+        hal_halt(container.version == CONTAINER_VERSION_RAW ? PLAYER_ERROR_RAW : PLAYER_ERROR_FORMAT);
+    }
+    sample_cycles = HAL_SMCLK_HZ / container.sample_rate;
+    hal_set_rates(sample_cycles, ((uint32_t)container.frame_samples * sample_cycles
+            + HAL_SMCLK_HZ / HAL_FRAME_TICK_HZ / 2) / (HAL_SMCLK_HZ / HAL_FRAME_TICK_HZ));
+    ahead_max = SYNC_AHEAD_MAX(container.frame_samples);
+    behind_max = SYNC_BEHIND_MAX(container.frame_samples);
+    seek_init();
+    seek_frame(0, &target);
+    // Fill the ring up front.  After that, frames are read in the
+    // background, as slots come free.
+    if (!jitter_start(target.block) || !jitter_prefill()) {
+        hal_halt(sd_errorCode);
+    }
+    current_buffer = jitter_frame(0);
+    dac_init(container.frame_samples);
+    dac_queue(current_buffer + FRAME_AUDIO_OFFSET);
+
     for (frame_number = 0; ; frame_number++) {
-        // Read frame
-        BIS(P2OUT, BIT6);
-        if (!read_frame(alternate_buffer)) {
-            for (;;);
+        // Delay until our next frame flag is set.  A frame that was
+        // skipped didn't use up its tick, so the next one goes straight on.
+        hal_mark(HAL_MARK_IDLE_BEGIN);
+        if (!skip) {
+            wait_frame();
+        }
+        if (frame_number == DAC_LATENCY_FRAMES) {
+            // From here on DMA0 keeps going by itself, a little behind
+            dac_start();
+        }
+        // The samples DMA0 has played are the clock: the frame timer only
+        // says when to look.  If the picture's ahead, leave the last frame
+        // up for another tick; if it's behind, catch up by reading this
+        // frame (for its sound, and so the next one has something to
+        // follow on from) without drawing it.
+        while (av_sync && dac_sync_error(frame_number) > ahead_max) {
+            sync_repeats++;
+            wait_frame();
+        }
+        skip = av_sync && dac_sync_error(frame_number) < -behind_max;
+        hal_mark(HAL_MARK_FRAME_BEGIN);
+        start = millis();
+
+        // Keep reading ahead.  The decoder lends the card the bus in
+        // between display lines.
+        hal_mark(HAL_MARK_READ_BEGIN);
+        if (button_pressed != BUTTON_NONE) {
+            if (button_target(button_pressed, video_frame, &target)) {
+                // A seek.  Everything read ahead goes, and the frame it
+                // lands on goes straight in place of the one we were about
+                // to draw, and its sound in place of that one's, unless
+                // that's already playing.  The ring carries on from there
+                // like after any other frame, so the sound stays in step.
+                seeks++;
+                if (!jitter_start(target.block)) {
+                    hal_halt(sd_errorCode);
+                }
+                current_buffer = jitter_frame(0);
+                video_frame = target.frame;
+                current_full = true;
+                dac_requeue(current_buffer + FRAME_AUDIO_OFFSET);
+            }
+            button_pressed = BUTTON_NONE;
+        }
+        if (!jitter_fill()) {
+            hal_halt(sd_errorCode);
+        }
+        next_full = false;
+
+        if (skip) {
+            // The next frame's unchanged lines are from one we never drew
+            sync_skips++;
+            next_full = true;
+        } else {
+            // Set the display width; decode_and_write_frame picks the rows.
+            hal_mark(HAL_MARK_DECODE_BEGIN);
+            tft_command(TFT_CASET, 4, 0, 0, 0, 128);
+            // See TFT datasheet for full details, but we set the bit that flips the
+            // image about the Y axis
+            tft_command(TFT_MADCTL, 1, 0x40);
+            decode_and_write_frame(current_buffer, current_full);
+            hal_mark(HAL_MARK_DECODE_END);
+        }
+
+        // The next frame, if it's not in already (the card's had every
+        // chance, so it's a stall)
+        ok = jitter_next();
+        if (ok && current_buffer[FRAME_NEXT_SECTORS_OFFSET] != 0) {
+            // The next frame's samples have to be in the ring by the time
+            // DMA0 gets to the end of this frame's
+            hal_mark(HAL_MARK_AUDIO_BEGIN);
+            dac_queue(jitter_frame(1) + FRAME_AUDIO_OFFSET);
+            hal_mark(HAL_MARK_AUDIO_DECODED);
+        }
+        hal_mark(HAL_MARK_READ_END);
+        if (!ok) {
+            hal_halt(sd_errorCode);
+        }
+        if (current_buffer[FRAME_NEXT_SECTORS_OFFSET] == 0) {
+            // That was the last frame: let its audio play out
+            hal_wait_frame();
+            hal_halt(0);
         }
-        BIC(P2OUT, BIT6);
 
         // Display the time it took for this frame to be read, decoded, and displayed
         uint16_t x = millis() - start;
         displayNum(x);
-        // Delay until our next frame flag is set
-        while (!nextFrame) __low_power_mode_1();
-        nextFrame = 0;
-        start = millis();
 
+        // On to the next frame
+        jitter_advance();
+        current_buffer = jitter_frame(0);
+        current_full = next_full;
+        video_frame++;
+    }
+}
 
-        // Swap buffers
-        uint8_t *tmp = current_buffer;
-        current_buffer = alternate_buffer;
-        alternate_buffer = tmp;
-
-        // Reconfigure DMA0 to point at our new frame's audio buffer.
-        BIS(DMA0CTL, DMAABORT);
-        DMA0SA = (current_buffer + VIDEO_FRAME_SIZE);
-        BIC(DMA0CTL, DMAABORT);
-        DMA0CTL |= DMAEN;
-        
-        // Reset our TFT's write position to the beginning and set the display size
-        tft_command(TFT_CASET, 4, 0, 0, 0, 128);
-        tft_command(TFT_RASET, 4, 0, 0, 0, 160);
-        // See TFT datasheet for full details, but we set the bit that flips the
-        // image about the Y axis
-        tft_command(TFT_MADCTL, 1, 0x40);
-        decode_and_write_frame(current_buffer);
+/**
+ * Sleep until the frame timer's next tick, giving the card the bus to
+ * read ahead with until then, for as long as there's room in the ring.
+ */
+static void wait_frame() {
+    while (!hal_frame_due() && jitter_read_ahead()) {
     }
+    hal_wait_frame();
+}
+
+/**
+ * Decode line `n` of the frame into `line`, in the display's pixel format.
+ * Lines are only ever decoded in order, so `*src` (where line `*at` starts)
+ * just walks forwards, stepping over the lines in between, and never past
+ * `end`, where the frame's bytes do.
+ */
+#pragma CODE_SECTION (decode_line, ".TI.ramfunc")
+static inline void decode_line(const uint8_t **src, const uint8_t *end, unsigned int *at, unsigned int n, uint16_t *line, bool twelve) {
+    uint8_t packed[VIDEO_LINE_BYTES];
+
+    hal_mark(HAL_MARK_LINE_BEGIN);
+    for (; *at < n; (*at)++) {
+        *src = video_skip_line(*src, end);
+    }
+    if (twelve) {
+        // Runs and literals can start on any pixel, which at 12 bits can
+        // be half way through a byte: go through packed bits first, so the
+        // expansion is always whole words.
+        *src = video_decode_packed(*src, packed);
+        video_expand12(packed, line, VIDEO_LINE_BYTES);
+    } else {
+        *src = video_decode_line(*src, line);
+    }
+    *src = MIN(*src, end);
+    (*at)++;
+    hal_mark(HAL_MARK_LINE_DECODED);
+}
+
+/**
+ * First line at or after `i` that has to be sent to the display.
+ */
+static inline unsigned int next_dirty_line(const uint8_t *clean, unsigned int i, bool full) {
+    static const unsigned int lsize = 160;
+    if (full) {
+        return i;
+    }
+    while (i < lsize && (clean[i >> 3] & (0x80 >> (i & 7)))) {
+        i++;
+    }
+    return i;
 }
 
 /**
@@ -183,136 +333,143 @@ void main(void) {
  * wait-state for every FRAM access which theoretically slows down
  * code.  By copying the most critical functions into RAM, we're able
  * to go from ~21ms to 18ms execution time on this function.
+ *
+ * Lines go out by DMA from two line buffers: while one is on the bus the
+ * next is decoded into the other.  In between lines the SD card gets a
+ * turn on the bus (sd_async_yield) to move a sector of the next frame,
+ * and we decode ahead while that sector's DMA runs.  When the card has a
+ * bus of its own its turn starts before the line before has finished
+ * going out, and the TFT stays selected for the whole frame.
+ *
+ * Lines go out in whichever pixel format display_colmod says the TFT
+ * was set up for.
+ *
+ * Unless `full` is set, lines the encoder marked as unchanged are skipped
+ * entirely: each run of changed lines is written as its own band, with
+ * RASET moving the TFT's write position to the top of the band.
  */
 #pragma CODE_SECTION (decode_and_write_frame, ".TI.ramfunc")
-void decode_and_write_frame(uint8_t *current_buffer) {
-    unsigned int i, j, k;
+void decode_and_write_frame(uint8_t *current_buffer, bool full) {
+    unsigned int i, n;
     static const unsigned int lsize = 160;
     static const unsigned int csize = 128;
-    static const uint16_t lookup[2] = {0x0000, 0xFFFF};
-    uint8_t *f = current_buffer;
+    const uint8_t *clean = current_buffer + FRAME_CLEAN_OFFSET;
+    const uint8_t *src = current_buffer + container.video_offset;
+    const uint8_t *end = current_buffer + current_buffer[FRAME_SECTORS_OFFSET] * JITTER_SECTOR_SIZE;
+    unsigned int at = 0;    // line `src` points at
     uint16_t line_a[csize];
     uint16_t line_b[csize];
-    uint16_t *line = line_a;
-
-    // Signal the start of our write to frame memory
-    tft_command(TFT_RAMWR, 0);
-
-    for (i = 0; i < lsize; i++) {
-        // Swap line buffers so that we're not messing with our background DMA transfer
-        line = (line == line_a) ? line_b : line_a;
-        for (j = 0; j < csize / 8; j++) {
-            uint8_t packed = *f++;
-            // Each encoded bit corresponds to one 16-bit black or white pixel.
-            for (k = 0; k < 8; k++) {
-                line[j * 8 + 7 - k] = lookup[(packed & 1)];
-                packed >>= 1;
+    uint16_t *line = line_a;    // next line to go out
+    uint16_t *next = line_b;    // the one after that
+    uint16_t *tmp;
+    bool decoded, setup, sd_turn, band = true;
+    bool twelve = display_colmod == TFT_COLMOD_12BIT;
+    unsigned int line_bytes = twelve ? VIDEO_LINE_BYTES_12BIT : VIDEO_LINE_BYTES_16BIT;
+
+    i = next_dirty_line(clean, 0, full);
+    if (i < lsize) {
+        decode_line(&src, end, &at, i, line, twelve);
+    }
+    dmaDone = 1; // nothing in flight yet
+
+    while (i < lsize) {
+        n = next_dirty_line(clean, i + 1, full);
+        decoded = false;
+        setup = false;
+        // On its own bus, the card can look for its next sector while the
+        // previous line's still going out (the sector waits for the line)
+        sd_turn = !SPI_SHARED && sd_async_yield();
+        if (!sd_turn) {
+            // wait for the previous line's DMA to finish; `next` is free after this
+            hal_mark(HAL_MARK_DMA_WAIT_BEGIN);
+            hal_dma_wait();
+            hal_mark(HAL_MARK_DMA_WAIT_END);
+            sd_turn = SPI_SHARED && sd_async_yield();
+        }
+
+        if (sd_turn) {
+            // The card has DMA2 for a sector: get ahead on decoding
+            if (n < lsize) {
+                decode_line(&src, end, &at, n, next, twelve);
+                decoded = true;
             }
+            sd_async_bus_wait();
+            if (SPI_SHARED) {
+                tft_select();
+            }
+            setup = true;
         }
-        if (i != 0) {
-            // wait for DMA to finish.
-            // Spaghetti: the ISR that sets this flag lives in spi.c
-            while (!dmaDone);
-        } else {
+
+        if (band) {
+            // Start of a run of changed lines: move the write position there
+            // and signal the start of our write to frame memory
+            hal_dma_stop();
+            tft_command(TFT_RASET, 4, 0, i, 0, lsize - 1);
+            tft_command(TFT_RAMWR, 0);
+            setup = true;
+        }
+        if (setup) {
             // Setup the DMAs to transfer lines in the background
-            dma_tx_setup((uint8_t *)line, csize * 2);
+            dma_tx_setup(SPI_TFT, (uint8_t *)line, line_bytes);
         }
+
         dmaDone = 0;
-        __data20_write_long((unsigned long)&DMA2SA, (unsigned long)line);
-        DMA2CTL |= DMAEN + DMAIE;
-        UCB0IFG &= ~(UCTXIFG | UCRXIFG);
-        UCB0IFG |= UCTXIFG | UCRXIFG;
+        hal_dma_tx_start(SPI_TFT, (uint8_t *)line);
+
+        if (n < lsize && !decoded) {
+            decode_line(&src, end, &at, n, next, twelve);
+        }
+        band = n != i + 1;
+        i = n;
+        tmp = line;
+        line = next;
+        next = tmp;
     }
 
     // wait for the last line's DMA to finish
-    while (!dmaDone);
-    DMA2CTL = 0; // disarm
+    hal_mark(HAL_MARK_DMA_WAIT_BEGIN);
+    hal_dma_wait();
+    hal_mark(HAL_MARK_DMA_WAIT_END);
+    hal_dma_stop(); // disarm
     tft_unselect();
 }
 
 
 /**
- *  Read in a single frame of audio + video data from the SD card.
- *  Assumes that the current block is already loaded into 
- *  block_buffer (this is covered by previous invocation of this function).
- *  
- *  @param frame_buffer The buffer to read the frame into.
+ * Where a seek button takes us from `frame`.  Button 0 goes back to the
+ * start of the chapter, or to the one before if we've only just started
+ * this one; button 1 goes on to the next chapter.  With only the one
+ * chapter they step SEEK_STEP_FRAMES back or forward instead.
  */
-bool read_frame(uint8_t *frame_buffer) {
-    uint16_t bytes_remaining = FRAME_SIZE;
-    // We can assume that block_buffer is already populated with the current block, from the previous read.
-    do {
-        // Copy the remaining bytes from the current block into the frame buffer.
-        uint16_t bytes_to_copy = MIN(bytes_remaining, 512 - current_block_offset);
-        memcpy(frame_buffer, block_buffer + current_block_offset, bytes_to_copy);
-        bytes_remaining -= bytes_to_copy;
-        frame_buffer += bytes_to_copy;
-        current_block_offset += bytes_to_copy;
-
-        // If we've reached the end of the block, read the next one.
-        if (current_block_offset == 512) {
-            current_block_offset = 0;
-            current_block++;
-            if (!sd_read_block(current_block, block_buffer)) {
-                return false;
-            }
-        }
-    } while (bytes_remaining > 0);
-    return true;
-}
+static bool button_target(uint8_t button, uint32_t frame, struct seek_target *target) {
+    uint8_t chapter = seek_chapter_of(frame);
+    bool chapters = seek_chapter(1, target);
 
-/**
- * TODO: this is broken :(
- * Should be much faster than the built-in memcpy() once it works, though
- */
-void memcpy_dma(void *dst, void *src, size_t size) {
-    DMA1CTL = 0;
-    __data20_write_long(&DMA1SA, src);
-    __data20_write_long(&DMA1DA, dst);
-    DMA1SZ = size / 2;
-    DMACTL0 |= DMA1TSEL__DMAREQ;
-    DMA1CTL = DMADT_1 + DMAEN + DMALEVEL + DMAREQ + DMAIE;
-    // DMA in block transfer mode is blocking, so it's done by now.
-    // Just in case though, wait for the interrupt to set the flag.
-    // (Spaghetti: the ISR lives in spi.c)
-    while (!dmaDone);
-    DMA1CTL = 0; // Disarm it
-    if (size & 1) { // Deal w/ odd numbers of bytes
-        ((uint8_t*)dst)[size - 1] = ((uint8_t*)src)[size - 1];
+    switch (button) {
+    case 0:
+        if (!chapters) {
+            return seek_frame(frame > SEEK_STEP_FRAMES ? frame - SEEK_STEP_FRAMES : 0, target);
+        }
+        seek_chapter(chapter, target);
+        if (chapter > 0 && frame - target->frame < SEEK_RESTART_FRAMES) {
+            seek_chapter(chapter - 1, target);
+        }
+        return true;
+    case 1:
+        if (!chapters) {
+            // The index may not have anything between here and there
+            return seek_frame(frame + SEEK_STEP_FRAMES, target) && target->frame > frame;
+        }
+        return seek_chapter(chapter + 1, target);
+    default:
+        return false;
     }
 }
 
-
-// Called once every 33ms when it's time for a new frame.
-#pragma vector=TIMER0_A0_VECTOR
-interrupt void frameInterrupt() {
-    nextFrame = true;
-    TA0IV = 0;
-    __low_power_mode_off_on_exit();
-}
-
 /**
- * TODO: fix this!
- * This is supposed to be a hack to allow seeking to particular parts of the video, but right
- * now having the interrupt enabled just fixes the playback on a single frame and breaks everything.
+ * Seek buttons, called from the button ISR.  The seek itself waits for
+ * the main loop to get to the next frame.
  */
-#pragma vector=PORT2_VECTOR
-interrupt void buttonInterrupt() {
-    P2IV = 0;
-    return;
-    switch (P2IV) {
-    case P2IV_P2IFG1:
-        // Beginning of video
-        current_block = 0;
-        current_block_offset = 0;
-        break;
-    case P2IV_P2IFG2:
-        // Beginning of second, bonus video
-        current_block = 51728;
-        current_block_offset = 424;
-        break;
-    default:
-        break;
-    }
-    P2IV = 0;  // Acknowledge interrupt
+void player_button(uint8_t button) {
+    button_pressed = button;
 }
@@ -0,0 +1,14 @@
+/*
+ * profile.c
+ */
+
+#include "profile.h"
+#include <string.h>
+
+// Far too big for SRAM
+struct profile_ring __attribute__((persistent)) profile_ring = { 0 };
+
+void profile_reset() {
+    memset(&profile_ring.header, 0, sizeof(profile_ring.header));
+    profile_ring.header.magic = PROFILE_MAGIC;
+}
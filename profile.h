@@ -0,0 +1,87 @@
+/*
+ * profile.h
+ *
+ *  Stage profiler.  Built with HAL_PROFILE defined, every hal_mark() is
+ *  logged with a 1us timestamp (TA2, free running) into a ring in FRAM
+ *  (profile_ring), for the debugger to dump once the player halts or is
+ *  paused.  host/profview turns a dump into per-stage histograms and the
+ *  worst frames broken down by stage.
+ *
+ *  If a frame overruns its 33ms, the ring keeps going for another half of
+ *  itself and then stops, so the frame that was late ends up in the
+ *  middle of it with what led up to it.
+ *
+ *  The host backend writes the same format from its virtual clock
+ *  (badapple -P), just with every event rather than a ring's worth.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events in the ring, a power of two.  A fully drawn frame is about 700.
+#ifndef PROFILE_RING_SIZE
+#define PROFILE_RING_SIZE 8192
+#endif
+
+#define PROFILE_MAGIC 0x5046
+#define PROFILE_STOPPED 0x0001
+
+struct profile_event {
+    uint16_t time;          // microseconds, wrapping
+    uint16_t mark;          // hal_mark_t
+};
+
+struct profile_header {
+    uint16_t magic;         // PROFILE_MAGIC once reset
+    uint16_t flags;
+    uint32_t count;         // events ever recorded; event n is in slot n % slots
+    uint16_t stop_after;    // once triggered, events to go before stopping
+    uint16_t reserved;
+};
+
+struct profile_ring {
+    struct profile_header header;
+    struct profile_event events[PROFILE_RING_SIZE];
+};
+
+extern struct profile_ring profile_ring;
+
+/**
+ * Empty the ring and start recording.
+ */
+void profile_reset();
+
+static inline void profile_record(uint16_t mark, uint16_t time) {
+    struct profile_event *e;
+
+    if (profile_ring.header.flags & PROFILE_STOPPED) {
+        return;
+    }
+    e = &profile_ring.events[profile_ring.header.count & (PROFILE_RING_SIZE - 1)];
+    e->time = time;
+    e->mark = mark;
+    profile_ring.header.count++;
+    if (profile_ring.header.stop_after && --profile_ring.header.stop_after == 0) {
+        profile_ring.header.flags |= PROFILE_STOPPED;
+    }
+}
+
+/**
+ * Something worth looking at just happened: stop half a ring from now.
+ */
+static inline void profile_trigger() {
+    if (!profile_ring.header.stop_after && !(profile_ring.header.flags & PROFILE_STOPPED)) {
+        profile_ring.header.stop_after = PROFILE_RING_SIZE / 2;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PROFILE_H_ */
@@ -8,13 +8,14 @@
  *      Author: dylan
  */
 
-#include <msp430.h>
 #include "sdcard.h"
 #include "spi.h"
+#include "hal.h"
 #include "defines.h"
 #include "Timing.h"
 #include "lcd.h"
 #include "SdInfo.h"
+#include <string.h>
 
 // Globals (these are emulating SdFat's class member variables)
 // Error code from last error
@@ -23,13 +24,35 @@ uint16_t sd_errorCode = SD_CARD_ERROR_INIT_NOT_CALLED;
 uint16_t sd_status = 0;
 // SD card type
 uint8_t sd_cardType = 0;
+#ifdef SD_CRC
+bool sd_crcCheck = true;
+#else
+bool sd_crcCheck = false;
+#endif
+uint16_t sd_crcErrors = 0;
+
+// Multi-block read state: is CMD18 active, and which sector comes next
+static bool sd_streaming = false;
+static uint32_t sd_streamNext = 0;
+// The card might be streaming, but from who knows where: a command that
+// should have stopped it, or started something else, didn't get an answer
+// that made sense.  Nothing carries on from it, whatever sd_streamNext is.
+static bool sd_streamLost = false;
+uint32_t (*sd_map)(uint32_t sector) = NULL;
+
+#ifdef CARDTEST
+struct sd_timing sd_timing;
+#define SD_TIME(when) (sd_timing.when = hal_micros())
+#else
+#define SD_TIME(when)
+#endif
 
 static inline void sd_select() {
-    BIC(P3OUT, BIT7);
+    spi_select(SPI_DEVICE_SD, true);
 }
 
 static inline void sd_unselect() {
-    BIS(P3OUT, BIT7);
+    spi_select(SPI_DEVICE_SD, false);
 }
 
 uint8_t sd_command(uint8_t cmd, uint32_t arg) {
@@ -46,19 +69,21 @@ uint8_t sd_command(uint8_t cmd, uint32_t arg) {
     tx_buf[5] = cmd == CMD0 ? 0x95 : 0x87;
 
     // Perform the SPI transaction
+    hal_mark(HAL_MARK_SD_COMMAND_BEGIN);
     sd_select(); // Make sure CS is low!
-    spi_send(tx_buf, 6);
+    spi_send(SPI_SD, tx_buf, 6);
 
     // "Discard first byte to avoid MISO pull-up problems" - ???
-    spi_receive_byte();
+    spi_receive_byte(SPI_SD);
 
     // Wait for the first response byte.
     // All responses have the uppermost bit unset, so we can
     // just poll for that.
     i = 0;
     do {
-        sd_status = spi_receive_byte();
+        sd_status = spi_receive_byte(SPI_SD);
     } while (sd_status & 0x80 && ++i < 15);
+    hal_mark(HAL_MARK_SD_COMMAND_END);
     return sd_status;
 }
 
@@ -87,7 +112,7 @@ bool sd_init() {
     delay(5);
 
     sd_unselect();
-    spi_send(buf, 16);
+    spi_send(SPI_SD, buf, 16);
 
     // Select the SD card
     sd_select();
@@ -104,7 +129,7 @@ bool sd_init() {
         }
         // Force any active transfer to end for an already initialized card.
         for (j = 0; j < 0xF; j++) {
-          spi_receive(buf, 0xFF, 16);
+          spi_receive(SPI_SD, buf, 0xFF, 16);
         }
     }
 
@@ -113,11 +138,12 @@ bool sd_init() {
         // Supports CMD8!  Check that we got our 0xAA byte echoed back.
         sd_cardType = SD_CARD_TYPE_SD2;
         for (i = 4; i > 0; i--) {
-            sd_status = spi_receive_byte();
+            sd_status = spi_receive_byte(SPI_SD);
         }
         // Check that we got the correct response echoed back
         if (sd_status != 0xAA) {
             sd_errorCode = SD_CARD_ERROR_CMD8;
+            goto fail;
         }
     } else {
         // Doesn't support CMD8
@@ -142,19 +168,20 @@ bool sd_init() {
             sd_errorCode = SD_CARD_ERROR_CMD58;
             goto fail;
         }
-        if (spi_receive_byte() & 0xC0) {
+        if (spi_receive_byte(SPI_SD) & 0xC0) {
             // SDHC bits are set - this is a SDHC card
             sd_cardType = SD_CARD_TYPE_SDHC;
         }
         // Discard the rest of the response (it's just voltage bits)
-//        spi_receive(buf, 0xFF, 3);
-        spi_receive_byte();
-        spi_receive_byte();
-        spi_receive_byte();
+//        spi_receive(SPI_SD, buf, 0xFF, 3);
+        spi_receive_byte(SPI_SD);
+        spi_receive_byte(SPI_SD);
+        spi_receive_byte(SPI_SD);
     }
 
-    // TODO: increase SPI clock speed here in an idiomatic way
-    UCB0BRW = 0; // until then: direct register tweaking
+    // Full speed (SMCLK) from here on, unless sd_probe_clock() finds the
+    // card can't keep up
+    spi_set_clock(SPI_DEVICE_SD, 0);
     // init successful!
 
     sd_unselect();
@@ -166,18 +193,53 @@ fail:
 }
 
 
+bool sd_probe_clock(uint8_t *scratch) {
+    uint8_t *check = scratch + 512;
+    uint16_t prescaler;
+    uint8_t i;
+
+    // What the sector really says, read at the clock the card came up at
+    spi_set_clock(SPI_DEVICE_SD, SPI_INIT_PRESCALER);
+    for (i = 0; !sd_read_block(SD_PROBE_SECTOR, scratch); i++) {
+        if (i == SD_READ_RETRIES) {
+            return false;
+        }
+    }
+
+    // The fastest clock it comes back the same at, every time
+    for (prescaler = 1; prescaler <= SD_PROBE_SLOWEST; prescaler <<= 1) {
+        spi_set_clock(SPI_DEVICE_SD, prescaler);
+        for (i = 0; i < SD_PROBE_READS; i++) {
+            if (!sd_read_block(SD_PROBE_SECTOR, check) || memcmp(scratch, check, 512) != 0) {
+                break;
+            }
+        }
+        if (i == SD_PROBE_READS) {
+            return true;
+        }
+    }
+    // Something's wrong with more than the clock
+    spi_set_clock(SPI_DEVICE_SD, SPI_INIT_PRESCALER);
+    sd_errorCode = SD_CARD_ERROR_PROBE;
+    return false;
+}
+
 /**
  * Wait for a start block token, then read `size` bytes into `buf`.
  */
 bool sd_read_data(uint8_t *buf, size_t size) {
     uint16_t start = millis();
+    uint16_t crc;
     // Wait for data start token
-    while ((sd_status = spi_receive_byte()) == 0xFF) {
+    hal_mark(HAL_MARK_SD_TOKEN_BEGIN);
+    while ((sd_status = spi_receive_byte(SPI_SD)) == 0xFF) {
         if (millis() - start > SD_READ_TIMEOUT) {
             sd_errorCode = SD_CARD_ERROR_READ_TIMEOUT;
             goto fail;
         }
     }
+    hal_mark(HAL_MARK_SD_TOKEN_END);
+    SD_TIME(token);
 
     // Confirm it was in fact the start token
     if (sd_status != DATA_START_SECTOR) {
@@ -186,12 +248,23 @@ bool sd_read_data(uint8_t *buf, size_t size) {
     }
 
     // Receive the full block
-    spi_receive_dma(buf, 0xFF, size);
-
-    // Discard CRC
-    spi_receive_byte();
-    spi_receive_byte();
-
+    hal_mark(HAL_MARK_SD_DMA_BEGIN);
+    spi_receive_dma(SPI_SD, buf, 0xFF, size);
+    hal_mark(HAL_MARK_SD_DMA_END);
+
+    crc = spi_receive_byte(SPI_SD) << 8;
+    crc |= spi_receive_byte(SPI_SD);
+    SD_TIME(done);
+
+    if (sd_crcCheck) {
+        hal_crc_reset();
+        hal_crc_feed(buf, size);
+        if (hal_crc_result() != crc) {
+            sd_crcErrors++;
+            sd_errorCode = SD_CARD_ERROR_READ_CRC;
+            goto fail;
+        }
+    }
     return true;
 
 fail:
@@ -199,26 +272,400 @@ fail:
     return false;
 }
 
+/**
+ * A command came back wrong.  If that's because the card's still in a
+ * stream it was meant to have stopped (say its CMD12 got lost, or an R1 was
+ * read out of the middle of a sector), it'll turn down everything else
+ * until it's stopped, so make sure the next read sends a CMD12 first.
+ */
+static void sd_stream_lost() {
+    sd_streaming = true;
+    sd_streamLost = true;
+}
+
 bool sd_read_block(uint32_t sector, uint8_t *buf) {
+    // The card won't take a new read command in the middle of a stream.
+    if (!sd_stream_stop()) {
+        return false;
+    }
+
     // Non-SDHCs are indexed by bytes, not sectors.
     if (sd_cardType != SD_CARD_TYPE_SDHC) {
         sector <<= 9;
     }
 
     // CMD17 is the single read block command.
+    SD_TIME(asked);
     if (sd_command(CMD17, sector)) {
         sd_errorCode = SD_CARD_ERROR_CMD17;
+        sd_stream_lost();
+        goto fail;
+    }
+
+    if (!sd_read_data(buf, 512)) {
         goto fail;
     }
 
+    sd_unselect();
+    return true;
+
+fail:
+    sd_unselect();
+    return false;
+}
+
+/**
+ * Select the card with a CMD18 stream positioned at `sector` (before
+ * sd_map), starting a new stream if there isn't one or it's somewhere else
+ * (a seek, or the next piece of the file).
+ */
+static bool sd_stream_open(uint32_t sector) {
+    uint32_t arg;
+
+    if (sd_map) {
+        sector = sd_map(sector);
+        if (sector == SD_NO_SECTOR) {
+            // Past the end of the file: there's nothing there to read
+            sd_errorCode = SD_CARD_ERROR_NO_SECTOR;
+            return false;
+        }
+    }
+    arg = sector;
+    if (sd_streaming && !sd_streamLost && sector == sd_streamNext) {
+        // Card is already sending us this sector - just go get it.
+#ifdef CARDTEST
+        // It's been getting it ready since the last one went out
+        sd_timing.asked = sd_timing.done;
+#endif
+        sd_select();
+        return true;
+    }
+
+    if (!sd_stream_stop()) {
+        return false;
+    }
+    // Non-SDHCs are indexed by bytes, not sectors.
+    if (sd_cardType != SD_CARD_TYPE_SDHC) {
+        arg <<= 9;
+    }
+    // CMD18 is the multiple block read command.
+    SD_TIME(asked);
+    if (sd_command(CMD18, arg)) {
+        sd_errorCode = SD_CARD_ERROR_CMD18;
+        sd_stream_lost();
+        sd_unselect();
+        return false;
+    }
+    sd_streaming = true;
+    sd_streamNext = sector;
+    return true;
+}
+
+/**
+ * Something went wrong mid-stream: try to leave the card in a state
+ * where the next command works, keeping the original error code.
+ */
+static void sd_stream_abort() {
+    uint16_t errorCode = sd_errorCode;
+    if (sd_streaming) {
+        sd_stream_stop();
+    }
+    sd_errorCode = errorCode;
+    sd_unselect();
+}
+
+bool sd_stream_read(uint32_t sector, uint8_t *buf) {
+    if (!sd_stream_open(sector)) {
+        goto fail;
+    }
     if (!sd_read_data(buf, 512)) {
         goto fail;
     }
+    sd_streamNext++;
+
+    sd_unselect();
+    return true;
+
+fail:
+    sd_stream_abort();
+    return false;
+}
+
+bool sd_stream_stop() {
+    uint16_t start;
+
+    if (!sd_streaming) {
+        return true;
+    }
+
+    // CMD12's R1 comes after a stuff byte (which sd_command already
+    // discards), and then the card holds MISO low while it's busy.  A card
+    // that had stopped already (the last CMD12 got through, but not its
+    // answer) calls it an illegal command, which is just as good.
+    if (sd_command(CMD12, 0) & ~R1_ILLEGAL_COMMAND) {
+        sd_errorCode = SD_CARD_ERROR_CMD12;
+        goto fail;
+    }
+    start = millis();
+    while (spi_receive_byte(SPI_SD) != 0xFF) {
+        if (millis() - start > SD_CMD_TIMEOUT) {
+            sd_errorCode = SD_CARD_ERROR_STOP_TRAN;
+            goto fail;
+        }
+    }
+
+    sd_streaming = sd_streamLost = false;
+    sd_unselect();
+    return true;
 
+fail:
+    // Still streaming, as far as we know: the next read tries again
+    sd_stream_lost();
     sd_unselect();
+    return false;
+}
+
+
+/*****
+ * Asynchronous reads
+ *
+ * A read of N sectors is broken into bus turns.  Each turn (sd_async_step)
+ * selects the card, waits a bounded number of bytes for the start token
+ * and, if it shows up, starts the sector's receive DMA and returns with
+ * the bus still owned by the card.  The DMA ISR finishes the sector in
+ * sd_async_dma_done(): clock out the CRC, deselect, move on to the next.
+ * With sd_crcCheck the sector is run through the CRC16 module while
+ * sd_async_bus_wait() waits for it, and it's only moved on from once the
+ * rest of it has been (SD_ASYNC_CHECK).
+ *
+ * Turns are only taken when the display path hands one over
+ * (sd_async_yield) or when someone waits for the read to finish
+ * (sd_async_wait).  When the card shares its bus with the TFT the display
+ * is deselected for the turn; on a bus of its own the turn can start while
+ * a display line is still going out, and only the sector's DMA has to
+ * wait for it (DMA2 sends both).
+ *****/
+
+static volatile uint8_t sd_asyncState = SD_ASYNC_IDLE;
+static uint8_t *sd_asyncBuf;
+static uint32_t sd_asyncSector;
+static volatile uint8_t sd_asyncRemaining = 0;
+static const uint8_t sd_asyncFill = 0xFF;
+// Since when turns have been looking for the sector in flight's start
+// token: SD_READ_TIMEOUT runs across them, not from each one, or a card
+// that's gone quiet would only ever be given up on by sd_async_wait
+static bool sd_asyncLooking = false;
+static uint16_t sd_asyncSince;
+// The sector in flight's CRC check (sd_crcCheck): where it is, how much
+// of it has been through the CRC16 module, and the CRC the card sent
+static uint8_t *sd_crcBuf;
+static uint16_t sd_crcFed;
+static uint16_t sd_crcSent;
+
+/**
+ * One bus turn.  `polls` is how many bytes to wait for the start token
+ * before giving the bus back (0 to wait up to SD_READ_TIMEOUT).
+ * Returns true if a sector DMA is now running.
+ */
+static bool sd_async_step(uint16_t polls) {
+    uint16_t i = 0;
+
+    if (!sd_stream_open(sd_asyncSector)) {
+        goto fail;
+    }
+    if (!sd_asyncLooking) {
+        sd_asyncLooking = true;
+        sd_asyncSince = millis();
+    }
+
+    hal_mark(HAL_MARK_SD_TOKEN_BEGIN);
+    while ((sd_status = spi_receive_byte(SPI_SD)) == 0xFF) {
+        if (millis() - sd_asyncSince > SD_READ_TIMEOUT) {
+            sd_errorCode = SD_CARD_ERROR_READ_TIMEOUT;
+            goto fail;
+        }
+        if (polls && ++i >= polls) {
+            // Card isn't ready yet - give the bus back and try next turn.
+            hal_mark(HAL_MARK_SD_TOKEN_END);
+            sd_unselect();
+            return false;
+        }
+    }
+    hal_mark(HAL_MARK_SD_TOKEN_END);
+    sd_asyncLooking = false;
+    if (sd_status != DATA_START_SECTOR) {
+        sd_errorCode = SD_CARD_ERROR_READ_TOKEN;
+        goto fail;
+    }
+
+    // DMA2 may still be sending a display line on the TFT's bus
+    hal_dma_wait();
+
+    // The rest of the sector happens in the background.  Set the state
+    // first: the ISR can fire before hal_dma_rx_start returns.
+    sd_asyncState = SD_ASYNC_TRANSFER;
+    dmaDone = 0;
+    if (sd_crcCheck) {
+        sd_crcBuf = sd_asyncBuf;
+        sd_crcFed = 0;
+        hal_crc_reset();
+    }
+    hal_mark(HAL_MARK_SD_DMA_BEGIN);
+    hal_dma_rx_start(SPI_SD, sd_asyncBuf, &sd_asyncFill, 512);
     return true;
 
 fail:
+    sd_asyncState = SD_ASYNC_ERROR;
+    sd_asyncLooking = false;
+    sd_stream_abort();
+    return false;
+}
+
+void sd_async_dma_done() {
+    if (sd_asyncState != SD_ASYNC_TRANSFER) {
+        return; // a blocking transfer, not ours
+    }
+    hal_mark(HAL_MARK_SD_DMA_END);
+    hal_dma_stop();
+
+    sd_crcSent = spi_receive_byte(SPI_SD) << 8;
+    sd_crcSent |= spi_receive_byte(SPI_SD);
     sd_unselect();
+
+    sd_streamNext++;
+    sd_asyncSector++;
+    sd_asyncBuf += 512;
+    sd_asyncRemaining--;
+    if (sd_crcCheck) {
+        // Too long for the ISR: whoever's waiting on the read finishes it
+        sd_asyncState = SD_ASYNC_CHECK;
+        return;
+    }
+    sd_asyncState = sd_asyncRemaining ? SD_ASYNC_PENDING : SD_ASYNC_IDLE;
+}
+
+/**
+ * Run the sector in flight through the CRC16 module, up to `size` bytes
+ * of it.  Returns false if there was nothing new to.
+ */
+static bool sd_crc_catch_up(uint16_t size) {
+    if (size <= sd_crcFed) {
+        return false;
+    }
+    hal_crc_feed(sd_crcBuf + sd_crcFed, size - sd_crcFed);
+    sd_crcFed = size;
+    return true;
+}
+
+/**
+ * Finish checking the sector that's just come in, and move on from it.
+ * The card carries on streaming either way: a bad sector's just read
+ * again, like one that failed any other way.
+ */
+static void sd_async_check() {
+    sd_crc_catch_up(512);
+    if (hal_crc_result() != sd_crcSent) {
+        sd_crcErrors++;
+        sd_errorCode = SD_CARD_ERROR_READ_CRC;
+        sd_asyncState = SD_ASYNC_ERROR;
+        return;
+    }
+    sd_asyncState = sd_asyncRemaining ? SD_ASYNC_PENDING : SD_ASYNC_IDLE;
+}
+
+bool sd_async_start(uint32_t sector, uint8_t *buf, uint8_t count) {
+    if (sd_asyncState == SD_ASYNC_PENDING || sd_asyncState == SD_ASYNC_TRANSFER
+            || sd_asyncState == SD_ASYNC_CHECK) {
+        return false;
+    }
+    sd_asyncSector = sector;
+    sd_asyncBuf = buf;
+    sd_asyncLooking = false;
+    sd_asyncRemaining = count;
+    sd_asyncState = count ? SD_ASYNC_PENDING : SD_ASYNC_IDLE;
+    return true;
+}
+
+uint8_t sd_async_state() {
+    return sd_asyncState;
+}
+
+bool sd_async_yield() {
+    if (sd_asyncState == SD_ASYNC_CHECK) {
+        sd_async_check();
+    }
+    if (sd_asyncState != SD_ASYNC_PENDING) {
+        return false;
+    }
+    if (!SPI_SHARED) {
+        return sd_async_step(SD_ASYNC_TOKEN_POLLS);
+    }
+    // Take the bus from the display for this turn
+    spi_select(SPI_DEVICE_TFT, false);
+    if (sd_async_step(SD_ASYNC_TOKEN_POLLS)) {
+        return true;
+    }
+    spi_select(SPI_DEVICE_TFT, true);
     return false;
 }
+
+void sd_async_bus_wait() {
+    if (sd_asyncState != SD_ASYNC_TRANSFER && sd_asyncState != SD_ASYNC_CHECK) {
+        return;
+    }
+    hal_mark(HAL_MARK_DMA_WAIT_BEGIN);
+    while (sd_asyncState == SD_ASYNC_TRANSFER) {
+        // Rather than spin, check what's in of the sector so far
+        if (!sd_crcCheck || !sd_crc_catch_up(hal_dma_rx_count(512))) {
+            hal_dma_wait();
+        }
+    }
+    if (sd_asyncState == SD_ASYNC_CHECK) {
+        sd_async_check();
+    }
+    hal_mark(HAL_MARK_DMA_WAIT_END);
+}
+
+bool sd_async_wait() {
+    // The bus is ours until we're done
+    if (SPI_SHARED) {
+        spi_select(SPI_DEVICE_TFT, false);
+    }
+    for (;;) {
+        switch (sd_asyncState) {
+        case SD_ASYNC_IDLE:
+            return true;
+        case SD_ASYNC_ERROR:
+            return false;
+        case SD_ASYNC_PENDING:
+            sd_async_step(0);
+            break;
+        default:
+            sd_async_bus_wait(); // the ISR will move us along
+            break;
+        }
+    }
+}
+
+bool sd_async_poll() {
+    if (sd_asyncState == SD_ASYNC_CHECK) {
+        sd_async_check();
+    }
+    if (sd_asyncState != SD_ASYNC_PENDING) {
+        return false;
+    }
+    if (SPI_SHARED) {
+        spi_select(SPI_DEVICE_TFT, false);
+    }
+    if (!sd_async_step(SD_ASYNC_TOKEN_POLLS)) {
+        return false;
+    }
+    sd_async_bus_wait();
+    return true;
+}
+
+void sd_async_cancel() {
+    sd_async_bus_wait();
+    sd_asyncRemaining = 0;
+    sd_asyncState = SD_ASYNC_IDLE;
+}
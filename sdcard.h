@@ -36,6 +36,18 @@ uint8_t sd_command(uint8_t cmd, uint32_t arg);
  */
 uint8_t sd_acmd(uint8_t acmd, uint32_t arg);
 
+// Whether to check the CRC16 the card sends after each data block, and
+// fail the read (SD_CARD_ERROR_READ_CRC) if it's wrong: on in SD_CRC
+// builds.  Asynchronous reads check a sector as it comes in, while
+// sd_async_bus_wait() would only be spinning; sd_crcErrors counts the bad ones.
+extern bool sd_crcCheck;
+extern uint16_t sd_crcErrors;
+
+// How many more times a read that fails is worth trying before giving up
+// on it: cards get the odd sector wrong, or lose a command, and get it
+// right the next time.  sdcard.c doesn't try again by itself.
+#define SD_READ_RETRIES 3
+
 /**
  * Read a single 512 byte block into `buf`, at the index
  * `sector`.
@@ -43,10 +55,141 @@ uint8_t sd_acmd(uint8_t acmd, uint32_t arg);
 bool sd_read_block(uint32_t sector, uint8_t *buf);
 
 /**
- * Initialize the SD card, returning true if the initialization failed.
+ * If set, where the sectors asked of sd_stream_read() and sd_async_start()
+ * really are on the card: the player streams one file (fat.h), and counts
+ * its blocks from the start of it.  Sectors the card streams one after
+ * the other don't have to be consecutive in the file; a jump just costs a
+ * new CMD18.  A sector it returns SD_NO_SECTOR for (past the end of the
+ * file) fails the read with SD_CARD_ERROR_NO_SECTOR.  sd_read_block()
+ * always reads the card's own sectors.
+ */
+extern uint32_t (*sd_map)(uint32_t sector);
+#define SD_NO_SECTOR 0xFFFFFFFFUL
+
+/**
+ * Streaming version of sd_read_block, for reading sequential sectors.
+ * The first call issues CMD18 (READ_MULTIPLE_BLOCK) and leaves the card in
+ * continuous-read mode; every following call for the next sector in line
+ * just waits for the next data token, with no command round trip.  Asking
+ * for any other sector (a seek) stops the stream and starts a new one.
+ *
+ * The card is deselected between calls so the bus can be shared with the
+ * TFT (SPI_SHARED).
+ */
+bool sd_stream_read(uint32_t sector, uint8_t *buf);
+
+/**
+ * End a stream started by sd_stream_read with CMD12 (STOP_TRANSMISSION).
+ * Does nothing if no stream is open.
+ */
+bool sd_stream_stop();
+
+/*
+ * Asynchronous reads.  sd_async_start() queues up a read of `count`
+ * sequential sectors (using the same CMD18 stream as sd_stream_read) and
+ * returns straight away.  The read then progresses one sector DMA at a
+ * time, whenever it gets a turn on the bus:
+ *  - sd_async_yield(), called by the display path in between its own
+ *    transfers, lends the card the bus for one sector if it's ready;
+ *  - sd_async_wait() takes the bus until the whole read is done.
+ * The DMA ISR finishes each sector (sd_async_dma_done) and hands the bus back.
+ */
+enum {
+    SD_ASYNC_IDLE,      // nothing queued, or the last read finished
+    SD_ASYNC_PENDING,   // sectors left to read, bus is free
+    SD_ASYNC_TRANSFER,  // a sector DMA is running and owns the bus
+    SD_ASYNC_CHECK,     // a sector's in, but its CRC hasn't been checked yet
+    SD_ASYNC_ERROR,     // the read failed, see sd_errorCode
+};
+
+// How many bytes sd_async_yield waits for a start token before giving
+// the bus back to the display (each one is 0.5us at full speed).
+#define SD_ASYNC_TOKEN_POLLS 16
+
+/**
+ * Queue an asynchronous read of `count` sectors starting at `sector`.
+ * Returns false if a read is already in progress.
+ */
+bool sd_async_start(uint32_t sector, uint8_t *buf, uint8_t count);
+
+/**
+ * Current SD_ASYNC_* state.
+ */
+uint8_t sd_async_state();
+
+/**
+ * Offer the card one bus turn.  Call with the TFT selected.  If the two
+ * share a bus (SPI_SHARED) it has to be idle, and the TFT is deselected
+ * for the turn; otherwise a display line's DMA can still be running.
+ * Returns true if a sector DMA was started (after any display line's
+ * finished): DMA2 then belongs to the card until sd_async_state() leaves
+ * SD_ASYNC_TRANSFER, and has to be set up for the TFT again before it's
+ * used, along with selecting the TFT again on a shared bus.
+ */
+bool sd_async_yield();
+
+/**
+ * Wait for the sector DMA started by sd_async_yield (if any) to finish,
+ * checking its CRC (sd_crcCheck) as it comes in.
+ */
+void sd_async_bus_wait();
+
+/**
+ * Finish the queued read, blocking.  Returns false if it failed.
+ */
+bool sd_async_wait();
+
+/**
+ * Offer the card a bus turn while nothing else wants the bus (the TFT
+ * is deselected for it on a shared bus), and if it had a sector ready,
+ * wait for it to come in.
+ * Returns false if there was nothing to read or the card wasn't ready.
+ */
+bool sd_async_poll();
+
+/**
+ * Drop what's left of the queued read, once any sector DMA in flight has
+ * finished.  The card carries on streaming from where it got to.
+ */
+void sd_async_cancel();
+
+#ifdef CARDTEST
+/**
+ * For the card tester (cardtest.h): when the last sector sd_read_block()
+ * or sd_stream_read() read was asked of the card (its command went out,
+ * or for the next sector of a stream, the one before it was in), when its
+ * start token came, and when the whole sector was in, in hal_micros().
+ */
+struct sd_timing {
+    uint32_t asked;
+    uint32_t token;
+    uint32_t done;
+};
+
+extern struct sd_timing sd_timing;
+#endif
+
+/**
+ * Initialize the SD card at SPI_INIT_PRESCALER, leaving it at full speed.
+ * Returns false if the initialization failed.
  */
 bool sd_init();
 
+// sd_probe_clock() reads this sector (there's always one) this many
+// times at each clock, down to SMCLK / SD_PROBE_SLOWEST (1 MHz)
+#define SD_PROBE_SECTOR 0
+#define SD_PROBE_READS 4
+#define SD_PROBE_SLOWEST 16
+
+/**
+ * Find the fastest clock the card reads back reliably at (with its wiring:
+ * long wires or a cheap socket can't take 16 MHz), and leave it at that:
+ * SD_PROBE_SECTOR is read at SPI_INIT_PRESCALER, then again at SMCLK,
+ * SMCLK / 2 and so on until it reads back the same every time.  `scratch`
+ * is 1024 bytes to read into.  Returns false if it doesn't at any of them
+ * (SD_CARD_ERROR_PROBE), or the first read failed.
+ */
+bool sd_probe_clock(uint8_t *scratch);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,65 @@
+/*
+ * seek.c
+ *
+ *  Seek index, see seek.h.
+ */
+
+#include "seek.h"
+
+static uint32_t frames = 0;
+static uint16_t interval = 0, entries = 0;
+static uint8_t chapters = 0;
+
+void seek_init() {
+    frames = interval = entries = chapters = 0;
+    if (container.version == 0) {
+        return;
+    }
+    interval = container_get16(SEEK_INTERVAL_OFFSET);
+    entries = container_get16(SEEK_ENTRIES_OFFSET);
+    chapters = container_header[SEEK_CHAPTERS_OFFSET];
+    if (interval == 0 || entries == 0 || entries > SEEK_MAX_ENTRIES || chapters > SEEK_MAX_CHAPTERS) {
+        interval = entries = chapters = 0;
+        return;
+    }
+    frames = container_get32(SEEK_FRAMES_OFFSET);
+}
+
+bool seek_frame(uint32_t frame, struct seek_target *target) {
+    uint16_t entry;
+
+    if (entries == 0) {
+        // No index.  The first frame is all we know where to find.
+        target->frame = 0;
+        target->block = container.first_block;
+        return frame == 0;
+    }
+    if (frame >= frames) {
+        return false;
+    }
+    entry = frame / interval;
+    if (entry >= entries) {
+        entry = entries - 1;
+    }
+    target->frame = (uint32_t)entry * interval;
+    target->block = container_get32(SEEK_ENTRY_TABLE_OFFSET + entry * 4);
+    return true;
+}
+
+bool seek_chapter(uint8_t chapter, struct seek_target *target) {
+    if (chapter >= chapters) {
+        return false;
+    }
+    target->frame = container_get32(SEEK_CHAPTER_TABLE_OFFSET + chapter * 8);
+    target->block = container_get32(SEEK_CHAPTER_TABLE_OFFSET + chapter * 8 + 4);
+    return true;
+}
+
+uint8_t seek_chapter_of(uint32_t frame) {
+    uint8_t chapter = 0;
+    // There are only a handful
+    while (chapter + 1 < chapters && container_get32(SEEK_CHAPTER_TABLE_OFFSET + (chapter + 1) * 8) <= frame) {
+        chapter++;
+    }
+    return chapter;
+}
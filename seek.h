@@ -0,0 +1,79 @@
+/*
+ * seek.h
+ *
+ *  Seek index.  The header sector at the front of the card (container.h)
+ *  ends with a table of where frames start, so the player can jump to a
+ *  chapter or a time without reading through everything in between.
+ *  convert.py (and host/encode.c) write it, the player picks it out of the
+ *  header once at startup (seek_init()).
+ *
+ *  Frames are sector aligned, so a block number is all it takes to find
+ *  one.  Every frame carries the ADPCM state its audio starts from and can
+ *  be drawn in full regardless of its clean-line map, so playback can pick
+ *  up from any of them.
+ */
+
+#ifndef SEEK_H_
+#define SEEK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "container.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The index, from CONTAINER_INDEX_OFFSET in the header sector, numbers
+ * little endian:
+ *   [0]     frames in the image (32 bits)
+ *   [4]     frames between index entries (16 bits)
+ *   [6]     index entries (16 bits)
+ *   [8]     chapters (8 bits), then 7 zero bytes
+ *   [16]    SEEK_MAX_CHAPTERS chapters: first frame, then its block (32 bits each)
+ *   [80]    index entries: block of frame n * interval (32 bits each)
+ * The encoder picks the interval, a whole number of seconds, to make the
+ * entries fit.
+ */
+#define SEEK_FRAMES_OFFSET (CONTAINER_INDEX_OFFSET + 0)
+#define SEEK_INTERVAL_OFFSET (CONTAINER_INDEX_OFFSET + 4)
+#define SEEK_ENTRIES_OFFSET (CONTAINER_INDEX_OFFSET + 6)
+#define SEEK_CHAPTERS_OFFSET (CONTAINER_INDEX_OFFSET + 8)
+#define SEEK_CHAPTER_TABLE_OFFSET (CONTAINER_INDEX_OFFSET + 16)
+#define SEEK_MAX_CHAPTERS 8
+#define SEEK_ENTRY_TABLE_OFFSET (SEEK_CHAPTER_TABLE_OFFSET + SEEK_MAX_CHAPTERS * 8)
+#define SEEK_MAX_ENTRIES ((CONTAINER_SIZE - SEEK_ENTRY_TABLE_OFFSET) / 4)
+
+// Where to pick playback up from
+struct seek_target {
+    uint32_t frame;
+    uint32_t block;
+};
+
+/**
+ * Pick the index out of the header sector, once container_load() has
+ * read it.  An image from before there was a header can't be seeked in.
+ */
+void seek_init();
+
+/**
+ * The nearest frame at or before `frame` that the index can find.  False
+ * if `frame` is past the end.  Without an index only frame 0 can be found.
+ */
+bool seek_frame(uint32_t frame, struct seek_target *target);
+
+/**
+ * The start of chapter `chapter`.  False if there's no such chapter.
+ */
+bool seek_chapter(uint8_t chapter, struct seek_target *target);
+
+/**
+ * The chapter `frame` is in.
+ */
+uint8_t seek_chapter_of(uint32_t frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SEEK_H_ */
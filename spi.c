@@ -5,125 +5,117 @@
  *      Author: dylan
  */
 #include "spi.h"
+#include "hal.h"
 #include "defines.h"
 #include <stdbool.h>
 #include <stdint.h>
-#include <msp430.h>
 
 
+// Each device's clock, and the one its bus is running at
+static uint16_t spi_prescaler[SPI_DEVICES];
+static uint16_t spi_busPrescaler[HAL_SPI_BUSES];
+
+static inline spi_bus_t spi_bus(spi_device_t device) {
+    return device == SPI_DEVICE_SD ? SPI_SD : SPI_TFT;
+}
+
+/*
+ * Put `device`'s bus on its clock, if it isn't already.
+ */
+static void spi_switch(spi_device_t device) {
+    spi_bus_t bus = spi_bus(device);
+
+    if (spi_busPrescaler[bus] != spi_prescaler[device]) {
+        spi_busPrescaler[bus] = spi_prescaler[device];
+        hal_spi_set_prescaler(bus, spi_prescaler[device]);
+    }
+}
+
 void spi_init() {
-    BIS(UCB0CTLW0, UCSWRST); // hold UCB0 logic in reset state while we're configuring stuff
-
-    BIS(P1SEL0, BIT4);
-    BIC(P1SEL1, BIT4); // Configure P1.4 as SPI CLK
-    BIS(P1SEL0, BIT6);
-    BIC(P1SEL1, BIT6); // Configure P1.6 as SIMO
-    BIS(P1SEL0, BIT7);
-    BIC(P1SEL1, BIT7); // Configure P1.7 as SOMI
-
-    // Configure UCB0 as SPI.
-    // Don't set UCCPKH/UCCPKL - we're in SPI mode 0 for the SD card.
-    // UCMSB: SD cards transmit MSB first
-    // UCMST: we're an SPI master.
-    // UCSYNC: SPI requires this
-    // UCSSEL__SMCLK: clock source is SMCLK
-    // UCSWRST: keep us held in reset until everything's ready
-    UCB0CTLW0 = UCMSB + UCMST + UCSYNC + UCSSEL__SMCLK + UCSWRST;
-    UCB0BRW = 160; // prescaler of 160, for 100 kHz w/ 16 MHz SMCLK
-
-    BIC(UCB0CTLW0, UCSWRST); // enable SPI - writes to UCB0TXBUF will start a transfer
+    spi_prescaler[SPI_DEVICE_SD] = spi_prescaler[SPI_DEVICE_TFT] = SPI_INIT_PRESCALER;
+    spi_busPrescaler[SPI_SD] = spi_busPrescaler[SPI_TFT] = SPI_INIT_PRESCALER;
+    hal_spi_init(SPI_SD, SPI_INIT_PRESCALER);
+    if (!SPI_SHARED) {
+        hal_spi_init(SPI_TFT, SPI_INIT_PRESCALER);
+    }
+}
+
+void spi_set_clock(spi_device_t device, uint16_t prescaler) {
+    // UCBRW = 0 runs at SMCLK just like 1 does: don't switch between them
+    spi_prescaler[device] = prescaler ? prescaler : 1;
+    spi_switch(device);
 }
 
-static void dma_rx_setup(uint8_t *buf, size_t size) {
-    // Setup DMA1 to receive
-    DMACTL0 |= DMA1TSEL__UCB0RXIFG0;
-    DMA1CTL = DMADT_0 + DMADSTINCR_3 + DMASRCINCR_0 + DMASRCBYTE + DMADSTBYTE;
-    __data20_write_long((unsigned long)&DMA1SA, (unsigned long)&UCB0RXBUF);
-    DMA1SZ = size;
-    __data20_write_long((unsigned long)&DMA1DA, (unsigned long)buf);
+uint16_t spi_clock(spi_device_t device) {
+    return spi_prescaler[device];
 }
 
-void dma_tx_setup(const uint8_t *buf, size_t size) {
-    // Setup DMA2 to transmit
-    DMACTL1 |= DMA2TSEL__UCB0TXIFG0;
-    DMA2CTL = DMADT_0 + DMADSTINCR_0 + DMASRCINCR_3 + DMASRCBYTE + DMADSTBYTE;
-    __data20_write_long((unsigned long)&DMA2SA, (unsigned long)buf);
-    DMA2SZ = size;
-    __data20_write_long((unsigned long)&DMA2DA, (unsigned long)&UCB0TXBUF);
+void spi_select(spi_device_t device, bool selected) {
+    if (selected) {
+        spi_switch(device);
+    }
+    if (device == SPI_DEVICE_SD) {
+        hal_sd_select(selected);
+    } else {
+        hal_tft_select(selected);
+    }
+}
+
+void dma_tx_setup(spi_bus_t bus, const uint8_t *buf, size_t size) {
+    hal_dma_tx_setup(bus, buf, size);
 }
 
 
-void spi_transaction(const uint8_t *output, uint8_t *input, size_t size) {
+void spi_transaction(spi_bus_t bus, const uint8_t *output, uint8_t *input, size_t size) {
     unsigned int i;
     // TODO: use DMA instead
     for (i = 0; i < size; i++) {
-        input[i] = spi_send_byte(output[i]);
+        input[i] = spi_send_byte(bus, output[i]);
     }
 }
 
-void spi_send(const uint8_t *output, size_t size) {
+void spi_send(spi_bus_t bus, const uint8_t *output, size_t size) {
     unsigned int i;
     // TODO: use DMA instead
     for (i = 0; i < size; i++) {
-        spi_send_byte(output[i]);
+        spi_send_byte(bus, output[i]);
     }
     return;
 }
 
-void spi_send_dma(const uint8_t *output, size_t size) {
-    dma_tx_setup(output, size);
+void spi_send_dma(spi_bus_t bus, const uint8_t *output, size_t size) {
+    hal_dma_tx_setup(bus, output, size);
     // start 'em up
     dmaDone = 0;
-    DMA2CTL |= DMAEN + DMAIE;
-    UCB0IFG &= ~(UCTXIFG | UCRXIFG);
-    UCB0IFG |= UCTXIFG | UCRXIFG;
+    hal_dma_tx_start(bus, output);
     // wait for DMAs to finish
-    while(!dmaDone);
+    hal_dma_wait();
     // disable DMAs
-    BIC(DMA2CTL, DMAEN + DMAIE);
+    hal_dma_stop();
 }
 
-void spi_receive(uint8_t *input, uint8_t fillByte, size_t size) {
+void spi_receive(spi_bus_t bus, uint8_t *input, uint8_t fillByte, size_t size) {
     size_t i;
     for (i = 0; i < size; i++) {
-        input[i] = spi_send_byte(fillByte);
+        input[i] = spi_send_byte(bus, fillByte);
     }
     return;
 }
 
-void spi_receive_dma(uint8_t *input, uint8_t fillByte, size_t size) {
-    // TODO: Clean this up and make it easier to use in other functions!
-     dma_rx_setup(input, size);
-     dma_tx_setup(&fillByte, size - 1);
-     // switch it around so it just repeats fillByte instead
-     DMA2CTL = DMADT_0 + DMADSTINCR_0 + DMASRCINCR_0 + DMASRCBYTE + DMADSTBYTE;
-     // start 'em up
-     dmaDone = 0;
-     DMA1CTL |= DMAEN;
-     DMA2CTL |= DMAEN + DMAIE;
-     UCB0TXBUF = 0xFF;
-     // wait for DMAs to finish
-     while(!dmaDone);
-     // disable DMAs
-     BIC(DMA1CTL, DMAEN);
-     BIC(DMA2CTL, DMAEN + DMAIE);
-}
-
-uint8_t spi_send_byte(uint8_t byte) {
-    UCB0TXBUF = byte;
-    while (UCB0STATW & UCBUSY); // wait for SPI transaction to finish
-    return UCB0RXBUF;
+void spi_receive_dma(spi_bus_t bus, uint8_t *input, uint8_t fillByte, size_t size) {
+    // start 'em up
+    dmaDone = 0;
+    hal_dma_rx_start(bus, input, &fillByte, size);
+    // wait for DMAs to finish
+    hal_dma_wait();
+    // disable DMAs
+    hal_dma_stop();
 }
 
-uint8_t spi_receive_byte() {
-    return spi_send_byte(0xFF);
+uint8_t spi_send_byte(spi_bus_t bus, uint8_t byte) {
+    return hal_spi_xfer(bus, byte);
 }
 
-
-volatile bool dmaDone = 0;
-
-#pragma vector=DMA_VECTOR
-__interrupt void dmaInterrupt() {
-    dmaDone = 1;
-    DMAIV = 0;
+uint8_t spi_receive_byte(spi_bus_t bus) {
+    return spi_send_byte(bus, 0xFF);
 }
@@ -15,59 +15,102 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 #include "defines.h"
+#include "hal.h"
+
+/*
+ * Every call takes the bus to use.  Drivers use the one their device is
+ * wired to: SPI_SD for the card, SPI_TFT for the display.  On a board
+ * where they're the same bus (SPI_SHARED), only one device can be
+ * selected at a time and they take turns; otherwise the card can be read
+ * while a line goes out to the display.
+ */
+typedef hal_spi_t spi_bus_t;
+#define SPI_SD HAL_SPI_SD
+#define SPI_TFT HAL_SPI_TFT
+#define SPI_SHARED (SPI_SD == SPI_TFT)
+
+/*
+ * The devices on the buses.  Each has a clock of its own, which its bus
+ * is switched to whenever it's selected, so on a shared bus the card and
+ * the TFT can each run as fast as they're good for.
+ */
+typedef enum {
+    SPI_DEVICE_SD,
+    SPI_DEVICE_TFT,
+    SPI_DEVICES
+} spi_device_t;
+
+// 100 kHz from the 16 MHz SMCLK, what every device starts at (cards have
+// to be brought up at 400 kHz or less)
+#define SPI_INIT_PRESCALER 160
 
 /**
- * Initialize the UCB0 SPI peripheral.
+ * Initialize the SD card's and the TFT's SPI peripherals, with every
+ * device at SPI_INIT_PRESCALER until its driver speeds it up.
  */
 void spi_init();
 
+/**
+ * Set `device`'s clock to SMCLK / prescaler (0 is taken as 1), switching
+ * its bus over now: call it with the device selected, or nothing else on
+ * the bus in the middle of anything.
+ */
+void spi_set_clock(spi_device_t device, uint16_t prescaler);
+
+/**
+ * `device`'s prescaler (never 0).
+ */
+uint16_t spi_clock(spi_device_t device);
+
+/**
+ * Chip select for `device`.  Selecting it switches its bus to its clock
+ * first, if the other device on the bus left it at another.
+ */
+void spi_select(spi_device_t device, bool selected);
+
 /**
  * One SPI transaction: shift out the bytes on *output*, while reading the results to the buffer *input*.
  * Both buffers are the same size, specified by parameter `size`.
  */
-void spi_transaction(const uint8_t *output, uint8_t *input, size_t size);
+void spi_transaction(spi_bus_t bus, const uint8_t *output, uint8_t *input, size_t size);
 
 /**
  * Send size bytes from output, ignoring any incoming received bytes.
  */
-void spi_send(const uint8_t *output, size_t size);
+void spi_send(spi_bus_t bus, const uint8_t *output, size_t size);
 
 /*
  * Blocking DMA version of spi_send.
  * TODO: merge spi_send and spi_send_dma
  */
-void spi_send_dma(const uint8_t *output, size_t size);
+void spi_send_dma(spi_bus_t bus, const uint8_t *output, size_t size);
 
 /*
  * Receive size bytes into input, repeating the same fillByte on the output.
  */
-void spi_receive(uint8_t *input, uint8_t fillByte, size_t size);
+void spi_receive(spi_bus_t bus, uint8_t *input, uint8_t fillByte, size_t size);
 
 /**
  * Blocking DMA version of spi_receive.
  * TODO: merge spi_receive and spi_receive_dma
  */
-void spi_receive_dma(uint8_t *input, uint8_t fillByte, size_t size);
+void spi_receive_dma(spi_bus_t bus, uint8_t *input, uint8_t fillByte, size_t size);
 
 /**
  * Send the single byte `byte` and return the received byte.
  */
-uint8_t spi_send_byte(uint8_t byte);
+uint8_t spi_send_byte(spi_bus_t bus, uint8_t byte);
 
 /**
  * Wrapper around spi_send_byte that sends 0xFF and returns the received byte.
  */
-uint8_t spi_receive_byte();
+uint8_t spi_receive_byte(spi_bus_t bus);
 
 /**
  * Prepare DMA2 to perform a block -> single address bytewise
- * transfer, but don't start the DMA yet.
+ * transfer to `bus`, but don't start the DMA yet.
  */
-void dma_tx_setup(const uint8_t *buf, size_t size);
-
-// Unfortunate hack: this flag is to true / 1 whenever a DMA completes
-// and triggers the DMA_VECTOR ISR.
-extern volatile bool dmaDone;
+void dma_tx_setup(spi_bus_t bus, const uint8_t *buf, size_t size);
 
 #ifdef __cplusplus
 }
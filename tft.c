@@ -7,28 +7,26 @@
 
 #include <tft.h>
 #include <stdarg.h>
-#include <msp430.h>
 #include <stdbool.h>
 #include "defines.h"
 #include "Timing.h"
+#include "hal.h"
 
 void tft_select() {
-    BIC(P2OUT, BIT6);
+    spi_select(SPI_DEVICE_TFT, true);
 }
 
 void tft_unselect() {
-    BIS(P2OUT, BIT6);
+    spi_select(SPI_DEVICE_TFT, false);
 }
 
 void tft_dc(bool dc) {
-    if (dc) {
-        BIS(P2OUT, BIT2);
-    } else {
-        BIC(P2OUT, BIT2);
-    }
+    hal_tft_dc(dc);
 }
 
-void tft_init() {
+void tft_init(uint8_t colmod) {
+    // Full speed (SMCLK), whatever the card on the same bus runs at
+    spi_set_clock(SPI_DEVICE_TFT, 0);
     // Based off ATTiny init sequence
     // (other, longer and more proper init sequences do exist - check
     //  Adafruit's ST7735 library or the git history)
@@ -36,7 +34,7 @@ void tft_init() {
     delay(150);
     tft_command(TFT_SLPOUT, 0); // Exit sleep mode
     delay(500);
-    tft_command(TFT_COLMOD, 1, 0x05); // Set pixel format to 16 bits per pixel
+    tft_command(TFT_COLMOD, 1, colmod); // Set pixel format
     delay(50);
     tft_command(TFT_MADCTL, 1, 0x68); // copied one
     delay(10);
@@ -51,10 +49,10 @@ void tft_command(uint8_t cmd, size_t argc, ...) {
     va_start(argptr, argc);
     tft_select();
     tft_dc(false);
-    spi_send_byte(cmd);
+    spi_send_byte(SPI_TFT, cmd);
     tft_dc(true);
     for (; argc > 0; argc--) {
-        spi_send_byte((uint8_t) va_arg(argptr, uint16_t));
+        spi_send_byte(SPI_TFT, (uint8_t) va_arg(argptr, unsigned int));
     }
     va_end(argptr);
 }
@@ -16,10 +16,15 @@ extern "C" {
 #endif
 
 
+// Pixel formats for tft_init()
+#define TFT_COLMOD_12BIT 0x03   // RGB444, two pixels in three bytes
+#define TFT_COLMOD_16BIT 0x05   // RGB565, one pixel in two bytes
+
 /**
- * Initialize the connected ST7735 TFT display.
+ * Initialize the connected ST7735 TFT display, taking pixels in the
+ * format `colmod`.
  */
-void tft_init();
+void tft_init(uint8_t colmod);
 
 /**
  * Send a command to the connected ST7735 TFT display.
@@ -0,0 +1,192 @@
+/*
+ * video.c
+ *
+ *  Run-length line decoder.  Everything here runs once per pixel or
+ *  code, so it lives in SRAM like decode_and_write_frame().
+ */
+
+#include "video.h"
+#include "defines.h"
+#include <string.h>
+
+static const uint16_t lookup[2] = {0x0000, 0xFFFF};
+
+// The four 16-bit pixels each nibble expands to, MSB first.  Not const, so
+// it gets copied into SRAM at startup instead of being read out of FRAM
+// (with its wait state) eight times a byte.
+#define NIBBLE_PIXEL(n, bit) (((n) & (bit)) ? 0xFFFF : 0x0000)
+#define NIBBLE(n) { NIBBLE_PIXEL(n, 8), NIBBLE_PIXEL(n, 4), NIBBLE_PIXEL(n, 2), NIBBLE_PIXEL(n, 1) }
+static uint16_t nibble_pixels[16][4] = {
+    NIBBLE(0), NIBBLE(1), NIBBLE(2), NIBBLE(3), NIBBLE(4), NIBBLE(5), NIBBLE(6), NIBBLE(7),
+    NIBBLE(8), NIBBLE(9), NIBBLE(10), NIBBLE(11), NIBBLE(12), NIBBLE(13), NIBBLE(14), NIBBLE(15)
+};
+
+/**
+ * Two table lookups and eight word copies per byte, rather than shifting
+ * out one bit (and one pixel) at a time.
+ */
+#pragma CODE_SECTION (video_expand, ".TI.ramfunc")
+void video_expand(const uint8_t *packed, uint16_t *pixels, uint16_t bytes) {
+    while (bytes--) {
+        uint8_t p = *packed++;
+        const uint16_t *hi = nibble_pixels[p >> 4];
+        const uint16_t *lo = nibble_pixels[p & 0x0F];
+
+        pixels[0] = hi[0];
+        pixels[1] = hi[1];
+        pixels[2] = hi[2];
+        pixels[3] = hi[3];
+        pixels[4] = lo[0];
+        pixels[5] = lo[1];
+        pixels[6] = lo[2];
+        pixels[7] = lo[3];
+        pixels += 8;
+    }
+}
+
+// The same for 12-bit pixels: each nibble is four pixels, so six bytes,
+// which come out as three whole words (little endian, as the MSP430 and
+// the host both are).  In bytes, white pixels AAA BBB go out as AA AB BB.
+#define PAIR_BYTE(n, hi, lo) ((((n) & (hi)) ? 0xF0 : 0x00) | (((n) & (lo)) ? 0x0F : 0x00))
+#define NIBBLE12(n) { PAIR_BYTE(n, 8, 8) | PAIR_BYTE(n, 8, 4) << 8, \
+                      PAIR_BYTE(n, 4, 4) | PAIR_BYTE(n, 2, 2) << 8, \
+                      PAIR_BYTE(n, 2, 1) | PAIR_BYTE(n, 1, 1) << 8 }
+static uint16_t nibble_pixels12[16][3] = {
+    NIBBLE12(0), NIBBLE12(1), NIBBLE12(2), NIBBLE12(3), NIBBLE12(4), NIBBLE12(5), NIBBLE12(6), NIBBLE12(7),
+    NIBBLE12(8), NIBBLE12(9), NIBBLE12(10), NIBBLE12(11), NIBBLE12(12), NIBBLE12(13), NIBBLE12(14), NIBBLE12(15)
+};
+
+/**
+ * Every byte expands to twelve, so it's whole words all the way.
+ */
+#pragma CODE_SECTION (video_expand12, ".TI.ramfunc")
+void video_expand12(const uint8_t *packed, uint16_t *words, uint16_t bytes) {
+    while (bytes--) {
+        uint8_t p = *packed++;
+        const uint16_t *hi = nibble_pixels12[p >> 4];
+        const uint16_t *lo = nibble_pixels12[p & 0x0F];
+
+        words[0] = hi[0];
+        words[1] = hi[1];
+        words[2] = hi[2];
+        words[3] = lo[0];
+        words[4] = lo[1];
+        words[5] = lo[2];
+        words += 6;
+    }
+}
+
+#pragma CODE_SECTION (video_decode_line, ".TI.ramfunc")
+const uint8_t *video_decode_line(const uint8_t *src, uint16_t *line) {
+    uint16_t *end = line + VIDEO_LINE_PIXELS;
+    uint16_t n;
+
+    while (line < end) {
+        uint8_t code = *src++;
+        if (code & VIDEO_RLE_RUN) {
+            uint16_t colour = lookup[(code & VIDEO_RLE_WHITE) != 0];
+            n = (code & (VIDEO_RLE_WHITE - 1)) + 1;
+            // A damaged frame shouldn't be able to run off the end of the line
+            n = MIN(n, end - line);
+            while (n--) {
+                *line++ = colour;
+            }
+        } else {
+            n = code + 1;
+            n = MIN(n, (end - line) / 8);
+            video_expand(src, line, n);
+            src += code + 1;
+            line += n * 8;
+            if (n == 0) {
+                break;
+            }
+        }
+    }
+    return src;
+}
+
+/*
+ * Set `n` packed pixels starting at pixel `p`.
+ */
+#pragma CODE_SECTION (set_pixels, ".TI.ramfunc")
+static inline void set_pixels(uint8_t *packed, uint16_t p, uint16_t n) {
+    for (; n && (p & 7); p++, n--) {
+        packed[p >> 3] |= 0x80 >> (p & 7);
+    }
+    for (; n >= 8; p += 8, n -= 8) {
+        packed[p >> 3] = 0xFF;
+    }
+    for (; n; p++, n--) {
+        packed[p >> 3] |= 0x80 >> (p & 7);
+    }
+}
+
+/**
+ * Literals land wherever the run before them ended, so they get shifted
+ * into place a byte at a time.
+ */
+#pragma CODE_SECTION (video_decode_packed, ".TI.ramfunc")
+const uint8_t *video_decode_packed(const uint8_t *src, uint8_t *packed) {
+    uint16_t p = 0, n, shift;
+    uint8_t *dst;
+
+    memset(packed, 0, VIDEO_LINE_BYTES);
+    while (p < VIDEO_LINE_PIXELS) {
+        uint8_t code = *src++;
+        if (code & VIDEO_RLE_RUN) {
+            n = (code & (VIDEO_RLE_WHITE - 1)) + 1;
+            // A damaged frame shouldn't be able to run off the end of the line
+            n = MIN(n, VIDEO_LINE_PIXELS - p);
+            if (code & VIDEO_RLE_WHITE) {
+                set_pixels(packed, p, n);
+            }
+            p += n;
+        } else {
+            n = code + 1;
+            n = MIN(n, (VIDEO_LINE_PIXELS - p) / 8);
+            dst = packed + (p >> 3);
+            shift = p & 7;
+            if (shift == 0) {
+                memcpy(dst, src, n);
+            } else {
+                const uint8_t *lit = src;
+                const uint8_t *end = src + n;
+                // The last byte's low bits land in dst[n], still on the line
+                for (; lit < end; lit++, dst++) {
+                    dst[0] |= *lit >> shift;
+                    dst[1] |= *lit << (8 - shift);
+                }
+            }
+            src += code + 1;
+            p += n * 8;
+            if (n == 0) {
+                break;
+            }
+        }
+    }
+    return src;
+}
+
+#pragma CODE_SECTION (video_skip_line, ".TI.ramfunc")
+const uint8_t *video_skip_line(const uint8_t *src, const uint8_t *end) {
+    uint16_t pixels = 0, n;
+
+    // Clamped the same way as the decoders, and a damaged frame can't
+    // step past its own bytes either
+    while (pixels < VIDEO_LINE_PIXELS && src < end) {
+        uint8_t code = *src++;
+        if (code & VIDEO_RLE_RUN) {
+            n = (code & (VIDEO_RLE_WHITE - 1)) + 1;
+            pixels += MIN(n, VIDEO_LINE_PIXELS - pixels);
+        } else {
+            n = code + 1;
+            n = MIN(n, (VIDEO_LINE_PIXELS - pixels) / 8);
+            src += code + 1;
+            pixels += n * 8;
+            if (n == 0) {
+                break;
+            }
+        }
+    }
+    return MIN(src, end);
+}
@@ -0,0 +1,91 @@
+/*
+ * video.h
+ *
+ *  Layout of a frame on the SD card (after the header sector,
+ *  container.h), and the run-length code its video lines are stored in.
+ *  convert.py (and host/encode.c) write this, the
+ *  player reads it.
+ */
+
+#ifndef VIDEO_H_
+#define VIDEO_H_
+
+#include <stdint.h>
+#include "audio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Display geometry: 160 lines of 128 1bpp pixels
+#define VIDEO_LINES 160
+#define VIDEO_LINE_PIXELS 128
+#define VIDEO_LINE_BYTES (VIDEO_LINE_PIXELS / 8)
+// A line as sent to the display, at 16 (RGB565) or 12 (RGB444) bits per pixel
+#define VIDEO_LINE_BYTES_16BIT (VIDEO_LINE_PIXELS * 2)
+#define VIDEO_LINE_BYTES_12BIT (VIDEO_LINE_PIXELS * 3 / 2)
+
+/*
+ * A frame, padded out to a whole number of sectors:
+ *   [0]     number of sectors in this frame
+ *   [1]     number of sectors in the next frame (0 after the last one)
+ *   [2]     clean-line map: bit set (MSB first) = line is the same as in
+ *           the previous frame and doesn't need to be drawn
+ *   [22]    audio: one ADPCM block (audio.h) of the header's samples per frame
+ *   [761]   video: all 160 lines, each run-length coded (below).  That's
+ *           with 1470 samples a frame: it's container.video_offset.
+ */
+#define FRAME_SECTORS_OFFSET 0
+#define FRAME_NEXT_SECTORS_OFFSET 1
+#define FRAME_CLEAN_OFFSET 2
+#define CLEAN_MAP_SIZE (VIDEO_LINES / 8)
+#define FRAME_AUDIO_OFFSET (FRAME_CLEAN_OFFSET + CLEAN_MAP_SIZE)
+// With AUDIO_FRAME_SIZE samples, the most there can be
+#define FRAME_VIDEO_OFFSET (FRAME_AUDIO_OFFSET + AUDIO_BLOCK_SIZE)
+
+/*
+ * Each line is a sequence of codes that together cover exactly 128 pixels:
+ *   1cnnnnnn        run of n+1 pixels of colour c (1 = white)
+ *   0nnnnnnn ...    n+1 bytes of packed pixels follow, MSB first
+ * The encoder never makes a line longer than one 16-byte literal.
+ */
+#define VIDEO_RLE_RUN 0x80
+#define VIDEO_RLE_WHITE 0x40
+#define VIDEO_RLE_MAX_RUN 64
+#define VIDEO_RLE_MAX_LINE (1 + VIDEO_LINE_BYTES)
+
+#define FRAME_MAX_SIZE (FRAME_VIDEO_OFFSET + VIDEO_LINES * VIDEO_RLE_MAX_LINE)
+
+/**
+ * Expand `bytes` bytes of packed pixels into 16-bit black or white pixels.
+ */
+void video_expand(const uint8_t *packed, uint16_t *pixels, uint16_t bytes);
+
+/**
+ * Decode one run-length coded line into 128 16-bit pixels, returning
+ * where the next line starts.
+ */
+const uint8_t *video_decode_line(const uint8_t *src, uint16_t *line);
+
+/**
+ * Expand `bytes` bytes of packed pixels into 12-bit black or white pixels,
+ * two to every three bytes, as the TFT takes them in COLMOD 0x03.
+ */
+void video_expand12(const uint8_t *packed, uint16_t *out, uint16_t bytes);
+
+/**
+ * Decode one run-length coded line back into VIDEO_LINE_BYTES packed
+ * bytes, returning where the next line starts.
+ */
+const uint8_t *video_decode_packed(const uint8_t *src, uint8_t *packed);
+
+/**
+ * Step over a run-length coded line without decoding it, going no further
+ * than `end` (the end of the frame's bytes).
+ */
+const uint8_t *video_skip_line(const uint8_t *src, const uint8_t *end);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* VIDEO_H_ */